@@ -22,14 +22,15 @@
 #pragma once
 
 #include "emtr-aggregate-timer.h"
+#include "emtr-event-sender-private.h"
 #include "emer-event-recorder-server.h"
 
 G_BEGIN_DECLS
 
-EmtrAggregateTimer *emtr_aggregate_timer_new (EmerEventRecorderServer *dbus_proxy,
-                                              uid_t                    uid,
-                                              GVariant                *event_id,
-                                              gboolean                 has_payload,
-                                              GVariant                *auxiliary_payload);
+EmtrAggregateTimer *emtr_aggregate_timer_new (EmtrEventSender *sender,
+                                              uid_t            uid,
+                                              GVariant        *event_id,
+                                              gboolean         has_payload,
+                                              GVariant        *auxiliary_payload);
 
 G_END_DECLS
@@ -20,6 +20,9 @@
  */
 
 #include "emtr-aggregate-timer-private.h"
+#include "emtr-trace-private.h"
+
+#include <string.h>
 
 
 /**
@@ -35,22 +38,107 @@ struct _EmtrAggregateTimer
 {
   GObject parent_instance;
 
+  /* The context in which all D-Bus calls are made, and in which timer_proxy
+     and stop_sent are accessed. */
+  GMainContext *context; /* (owned) */
+
   EmerAggregateTimer *timer_proxy; /* (owned) */
 
-  gboolean stopped;
+  /* Counts the timer as running until it is stopped or finalized, and the
+     round trips of its D-Bus calls */
+  EmtrStats *stats; /* (owned) */
+
+  /* Monotonic time at which StartAggregateTimer was called */
+  gint64 start_call_time;
+
+  /* For tracepoints */
+  guchar event_id[EMTR_EVENT_ID_LENGTH];
+
+  gboolean stopped; /* (atomic) */
+  gboolean stop_sent;
 };
 
+/* Arguments of the StartAggregateTimer call */
+typedef struct
+{
+  EmtrAggregateTimer *timer; /* (owned) */
+  uid_t uid;
+  GVariant *event_id; /* (owned) */
+  gboolean has_payload;
+  GVariant *auxiliary_payload; /* (owned) */
+  EmtrEventSender *sender; /* (unowned): outlives the data */
+} StartTimerData;
+
+/* Data for a StopTimer call, which may outlive the timer */
+typedef struct
+{
+  EmerAggregateTimer *timer_proxy; /* (owned) */
+  EmtrStats *stats; /* (owned) */
+  gint64 call_time; /* monotonic */
+} StopTimerData;
+
 G_DEFINE_TYPE (EmtrAggregateTimer, emtr_aggregate_timer, G_TYPE_OBJECT)
 
+static void
+on_timer_stopped_cb (GObject      *source_object,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+  StopTimerData *data = user_data;
+
+  emer_aggregate_timer_call_stop_timer_finish (EMER_AGGREGATE_TIMER (source_object),
+                                               result, NULL);
+  emtr_stats_add_latency (data->stats, EMTR_LATENCY_STOP_TIMER,
+                          (g_get_monotonic_time () - data->call_time) * 1000);
+
+  g_object_unref (data->timer_proxy);
+  emtr_stats_unref (data->stats);
+  g_free (data);
+}
+
+/* Calls StopTimer on the daemon without waiting for it to return. Must be
+   called in the context of the timer. */
+static gboolean
+call_stop_timer_cb (gpointer user_data)
+{
+  StopTimerData *data = user_data;
+
+  data->call_time = g_get_monotonic_time ();
+  emer_aggregate_timer_call_stop_timer (data->timer_proxy, NULL,
+                                        on_timer_stopped_cb, data);
+
+  return G_SOURCE_REMOVE;
+}
+
+static StopTimerData *
+stop_timer_data_new (EmtrAggregateTimer *self)
+{
+  StopTimerData *data = g_new (StopTimerData, 1);
+
+  data->timer_proxy = g_object_ref (self->timer_proxy);
+  data->stats = emtr_stats_ref (self->stats);
+
+  return data;
+}
+
 static void
 emtr_aggregate_timer_finalize (GObject *object)
 {
   EmtrAggregateTimer *self = (EmtrAggregateTimer *)object;
 
-  if (!self->stopped && self->timer_proxy)
-    emer_aggregate_timer_call_stop_timer (self->timer_proxy, NULL, NULL, NULL);
+  /* The last reference may be dropped in any thread, but the call must be
+     made in the context of the timer, so that its reply is dispatched. */
+  if (!self->stop_sent && self->timer_proxy)
+    g_main_context_invoke_full (self->context, G_PRIORITY_DEFAULT,
+                                call_stop_timer_cb, stop_timer_data_new (self),
+                                NULL);
+
+  if (!g_atomic_int_get (&self->stopped))
+    emtr_stats_timer_stopped (self->stats);
 
   g_clear_object (&self->timer_proxy);
+  g_clear_pointer (&self->context, g_main_context_unref);
+  g_clear_pointer (&self->stats, emtr_stats_unref);
 
   G_OBJECT_CLASS (emtr_aggregate_timer_parent_class)->finalize (object);
 }
@@ -68,6 +156,17 @@ emtr_aggregate_timer_init (EmtrAggregateTimer *self)
 {
 }
 
+/* Must be called in self->context. */
+static void
+send_stop_timer (EmtrAggregateTimer *self)
+{
+  if (self->stop_sent || self->timer_proxy == NULL)
+    return;
+
+  call_stop_timer_cb (stop_timer_data_new (self));
+  self->stop_sent = TRUE;
+}
+
 static void
 on_aggregate_timer_proxy_created_cb (GObject      *source_object,
                                      GAsyncResult *result,
@@ -82,8 +181,8 @@ on_aggregate_timer_proxy_created_cb (GObject      *source_object,
   if (error)
     g_warning ("Error creating aggregate timer: %s", error->message);
 
-  if (self->stopped && self->timer_proxy)
-    emer_aggregate_timer_call_stop_timer (self->timer_proxy, NULL, NULL, NULL);
+  if (g_atomic_int_get (&self->stopped))
+    send_stop_timer (self);
 }
 
 static void
@@ -103,6 +202,8 @@ on_server_aggregate_timer_started_cb (GObject      *source_object,
                                                                 &timer_object_path,
                                                                 result,
                                                                 &error);
+  emtr_stats_add_latency (self->stats, EMTR_LATENCY_START_AGGREGATE_TIMER,
+                          (g_get_monotonic_time () - self->start_call_time) * 1000);
 
   if (error)
     {
@@ -123,28 +224,93 @@ on_server_aggregate_timer_started_cb (GObject      *source_object,
                                   g_object_ref (self));
 }
 
+static void
+start_timer_data_free (StartTimerData *data)
+{
+  g_object_unref (data->timer);
+  g_variant_unref (data->event_id);
+  g_variant_unref (data->auxiliary_payload);
+  g_free (data);
+}
+
+/* Called in the context of the sender once it is connected to the daemon. */
+static void
+start_timer_cb (EmerEventRecorderServer *dbus_proxy,
+                gpointer                 user_data)
+{
+  StartTimerData *data = user_data;
+
+  /* The sender has already complained about the failed connection. */
+  if (dbus_proxy == NULL)
+    return;
+
+  /* Timers started while recording is disabled are never started on the
+     daemon, and stopping them does nothing. */
+  if (!emtr_event_sender_is_enabled (data->sender))
+    return;
+
+  data->timer->start_call_time = g_get_monotonic_time ();
+  emer_event_recorder_server_call_start_aggregate_timer (dbus_proxy,
+                                                         data->uid,
+                                                         data->event_id,
+                                                         data->has_payload,
+                                                         data->auxiliary_payload,
+                                                         NULL,
+                                                         on_server_aggregate_timer_started_cb,
+                                                         g_object_ref (data->timer));
+}
+
+static gboolean
+stop_timer_cb (gpointer user_data)
+{
+  send_stop_timer (EMTR_AGGREGATE_TIMER (user_data));
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * The D-Bus calls of the timer are made in the context of the thread of
+ * @sender, once it has connected to the daemon, so that their replies are
+ * dispatched even if the thread creating the timer does not run a main loop.
+ */
 EmtrAggregateTimer *
-emtr_aggregate_timer_new (EmerEventRecorderServer *dbus_proxy,
-                          uid_t                    uid,
-                          GVariant                *event_id,
-                          gboolean                 has_payload,
-                          GVariant                *auxiliary_payload)
+emtr_aggregate_timer_new (EmtrEventSender *sender,
+                          uid_t            uid,
+                          GVariant        *event_id,
+                          gboolean         has_payload,
+                          GVariant        *auxiliary_payload)
 {
   EmtrAggregateTimer *self;
+  StartTimerData *data;
 
   g_return_val_if_fail (auxiliary_payload != NULL, NULL);
   g_return_val_if_fail (g_variant_is_of_type (auxiliary_payload, G_VARIANT_TYPE_VARIANT), NULL);
 
   self = g_object_new (EMTR_TYPE_AGGREGATE_TIMER, NULL);
+  self->context = g_main_context_ref (emtr_event_sender_get_context (sender));
+  self->stats = emtr_stats_ref (emtr_event_sender_get_stats (sender));
+  emtr_stats_timer_started (self->stats);
 
-  emer_event_recorder_server_call_start_aggregate_timer (dbus_proxy,
-                                                         uid,
-                                                         event_id,
-                                                         has_payload,
-                                                         auxiliary_payload,
-                                                         NULL,
-                                                         on_server_aggregate_timer_started_cb,
-                                                         g_object_ref (self));
+  gsize event_id_length;
+  const guchar *event_id_bytes =
+    g_variant_get_fixed_array (event_id, &event_id_length, 1);
+  memcpy (self->event_id, event_id_bytes,
+          MIN (event_id_length, EMTR_EVENT_ID_LENGTH));
+
+  if (EMTR_TRACE_ENABLED (timer__start))
+    EMTR_TRACE (timer__start, self->event_id,
+                emtr_trace_payload_size (auxiliary_payload));
+
+  data = g_new (StartTimerData, 1);
+  data->timer = g_object_ref (self);
+  data->uid = uid;
+  data->event_id = g_variant_ref_sink (event_id);
+  data->has_payload = has_payload;
+  data->auxiliary_payload = g_variant_ref_sink (auxiliary_payload);
+  data->sender = sender;
+
+  emtr_event_sender_invoke_with_proxy (sender, start_timer_cb, data,
+                                       (GDestroyNotify) start_timer_data_free);
 
   return self;
 }
@@ -159,9 +325,15 @@ void
 emtr_aggregate_timer_stop (EmtrAggregateTimer *self)
 {
   g_return_if_fail (EMTR_IS_AGGREGATE_TIMER (self));
-  g_return_if_fail (!self->stopped);
+  g_return_if_fail (!g_atomic_int_get (&self->stopped));
+
+  g_atomic_int_set (&self->stopped, TRUE);
+  emtr_stats_timer_stopped (self->stats);
+  EMTR_TRACE (timer__stop, self->event_id);
 
-  if (self->timer_proxy)
-    emer_aggregate_timer_call_stop_timer (self->timer_proxy, NULL, NULL, NULL);
-  self->stopped = TRUE;
+  /* If the timer proxy has not been created yet, the timer is stopped as soon
+     as it is. */
+  g_main_context_invoke_full (self->context, G_PRIORITY_DEFAULT,
+                              stop_timer_cb, g_object_ref (self),
+                              g_object_unref);
 }
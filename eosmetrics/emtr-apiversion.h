@@ -45,6 +45,7 @@ macros. */
 #define EMTR_VERSION_0_2 (G_ENCODE_VERSION (0, 2))
 #define EMTR_VERSION_0_4 (G_ENCODE_VERSION (0, 4))
 #define EMTR_VERSION_0_5 (G_ENCODE_VERSION (0, 5))
+#define EMTR_VERSION_0_6 (G_ENCODE_VERSION (0, 6))
 
 #if (EMTR_MINOR_VERSION == 99)
 #define EMTR_VERSION_CUR_STABLE (G_ENCODE_VERSION (EMTR_MAJOR_VERSION + 1, 0))
@@ -133,4 +134,10 @@ macros. */
 # define EMTR_AVAILABLE_IN_0_5
 #endif
 
+#if EMTR_VERSION_MAX_ALLOWED < EMTR_VERSION_0_6
+# define EMTR_AVAILABLE_IN_0_6 EMTR_UNAVAILABLE(0, 6)
+#else
+# define EMTR_AVAILABLE_IN_0_6
+#endif
+
 #endif /* EMTR_VERSION_H */
@@ -0,0 +1,220 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "emtr-client-stats-private.h"
+
+#include "emer-event-recorder-server.h"
+#include "emtr-enums.h"
+#include "emtr-latency-histogram.h"
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib-object.h>
+
+/*
+ * Exports the com.endlessm.Metrics.ClientStats interface on the system bus
+ * connection of the default event recorder, so that eos-metrics-client-stats
+ * can tell which processes record the most events. The interface is exported
+ * from the sender thread, so that GetStats is handled there and can read the
+ * state of the sender that only that thread touches.
+ */
+
+#define CLIENT_STATS_OBJECT_PATH "/com/endlessm/Metrics/ClientStats"
+
+typedef struct
+{
+  EmtrEventRecorder *recorder; /* (owned) */
+
+  /* Owned by recorder */
+  EmtrEventSender *sender; /* (unowned) */
+
+  EmerClientStats *skeleton; /* (owned) */
+} ClientStats;
+
+/*
+ * Returns TRUE if the EOS_METRICS_CLIENT_STATS environment variable asks for
+ * the statistics of the default event recorder to be exported.
+ */
+gboolean
+emtr_client_stats_requested (void)
+{
+  const gchar *val = g_getenv ("EOS_METRICS_CLIENT_STATS");
+
+  return val != NULL && g_str_equal (val, "1");
+}
+
+static void
+add_latencies (ClientStats     *self,
+               GVariantBuilder *builder)
+{
+  GEnumClass *enum_class = g_type_class_ref (EMTR_TYPE_LATENCY_KIND);
+  GVariantBuilder latencies;
+
+  g_variant_builder_init (&latencies, G_VARIANT_TYPE ("a{s(ttttt)}"));
+
+  for (guint i = 0; i < enum_class->n_values; i++)
+    {
+      GEnumValue *kind = &enum_class->values[i];
+      EmtrLatencyHistogram *histogram =
+        emtr_event_recorder_get_latency_histogram (self->recorder,
+                                                   kind->value);
+
+      g_variant_builder_add (&latencies, "{s(ttttt)}", kind->value_nick,
+                             emtr_latency_histogram_get_count (histogram),
+                             (guint64) emtr_latency_histogram_get_p50 (histogram),
+                             (guint64) emtr_latency_histogram_get_p99 (histogram),
+                             (guint64) emtr_latency_histogram_get_p999 (histogram),
+                             (guint64) emtr_latency_histogram_get_max (histogram));
+      emtr_latency_histogram_unref (histogram);
+    }
+
+  g_type_class_unref (enum_class);
+
+  g_variant_builder_add (builder, "{sv}", "latencies",
+                         g_variant_builder_end (&latencies));
+}
+
+static gboolean
+handle_get_stats (EmerClientStats       *skeleton,
+                  GDBusMethodInvocation *invocation,
+                  ClientStats           *self)
+{
+  GVariantBuilder builder;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+  GVariant *recorder_stats = emtr_event_recorder_get_stats (self->recorder);
+  GVariantIter iter;
+  const gchar *key;
+  GVariant *value;
+
+  g_variant_iter_init (&iter, recorder_stats);
+  while (g_variant_iter_next (&iter, "{&sv}", &key, &value))
+    {
+      g_variant_builder_add (&builder, "{sv}", key, value);
+      g_variant_unref (value);
+    }
+  g_variant_unref (recorder_stats);
+
+  const gchar *program_name = g_get_prgname ();
+  if (program_name != NULL)
+    g_variant_builder_add (&builder, "{sv}", "program-name",
+                           g_variant_new_string (program_name));
+
+  emtr_event_sender_add_queue_depths (self->sender, &builder);
+  add_latencies (self, &builder);
+
+  emer_client_stats_complete_get_stats (skeleton, invocation,
+                                        g_variant_builder_end (&builder));
+  return TRUE;
+}
+
+static gboolean
+handle_get_recent_events (EmerClientStats       *skeleton,
+                          GDBusMethodInvocation *invocation,
+                          ClientStats           *self)
+{
+  GVariant *events = emtr_event_recorder_get_recent_events (self->recorder);
+
+  emer_client_stats_complete_get_recent_events (skeleton, invocation, events);
+  g_variant_unref (events);
+  return TRUE;
+}
+
+/* Doesn't go through the property, so that its notification is not emitted
+   on the sender thread. */
+static gboolean
+handle_set_profiling (EmerClientStats       *skeleton,
+                      GDBusMethodInvocation *invocation,
+                      gboolean               enabled,
+                      ClientStats           *self)
+{
+  emtr_stats_set_profiling (emtr_event_sender_get_stats (self->sender),
+                            enabled);
+
+  emer_client_stats_complete_set_profiling (skeleton, invocation);
+  return TRUE;
+}
+
+static void
+client_stats_free (ClientStats *self)
+{
+  g_clear_object (&self->recorder);
+  g_free (self);
+}
+
+static void
+export_with_proxy (EmerEventRecorderServer *dbus_proxy,
+                   ClientStats             *self)
+{
+  if (dbus_proxy == NULL)
+    {
+      g_debug ("Not exporting client statistics, because the system bus "
+               "could not be reached.");
+      client_stats_free (self);
+      return;
+    }
+
+  GDBusConnection *connection =
+    g_dbus_proxy_get_connection (G_DBUS_PROXY (dbus_proxy));
+  GError *error = NULL;
+
+  self->skeleton = emer_client_stats_skeleton_new ();
+  g_signal_connect (self->skeleton, "handle-get-stats",
+                    G_CALLBACK (handle_get_stats), self);
+  g_signal_connect (self->skeleton, "handle-get-recent-events",
+                    G_CALLBACK (handle_get_recent_events), self);
+  g_signal_connect (self->skeleton, "handle-set-profiling",
+                    G_CALLBACK (handle_set_profiling), self);
+
+  if (!g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (self->skeleton),
+                                         connection, CLIENT_STATS_OBJECT_PATH,
+                                         &error))
+    {
+      g_warning ("Unable to export client statistics: %s.", error->message);
+      g_error_free (error);
+      g_object_unref (self->skeleton);
+      client_stats_free (self);
+      return;
+    }
+
+  /* The skeleton stays exported for as long as the process runs, since the
+     default recorder is never freed. */
+}
+
+/*
+ * Exports the statistics of @recorder, which must be the default event
+ * recorder, and of its @sender on the system bus, once @sender has connected
+ * to it.
+ */
+void
+emtr_client_stats_export (EmtrEventRecorder *recorder,
+                          EmtrEventSender   *sender)
+{
+  ClientStats *self = g_new0 (ClientStats, 1);
+
+  self->recorder = g_object_ref (recorder);
+  self->sender = sender;
+
+  emtr_event_sender_invoke_with_proxy (sender,
+                                       (EmtrProxyCallback) export_with_proxy,
+                                       self, NULL);
+}
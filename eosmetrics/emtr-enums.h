@@ -30,6 +30,40 @@ G_BEGIN_DECLS
 
 /* Shared typedefs for enumerations */
 
+/**
+ * EmtrDropPolicy:
+ * @EMTR_DROP_POLICY_DROP_NEWEST: Drop events as they are recorded, until
+ *   there is room again.
+ * @EMTR_DROP_POLICY_DROP_OLDEST: Drop the oldest events that are waiting to be
+ *   sent, to make room for new ones.
+ * @EMTR_DROP_POLICY_BLOCK: Block the recording function until there is room,
+ *   for up to #EmtrEventRecorder:block-timeout milliseconds, then drop the
+ *   event.
+ *
+ * What an #EmtrEventRecorder does with asynchronously recorded events that
+ * there is no room for, because the daemon does not keep up with them. See
+ * #EmtrEventRecorder:drop-policy.
+ *
+ * Since: 0.6
+ */
+typedef enum
+{
+  EMTR_DROP_POLICY_DROP_NEWEST,
+  EMTR_DROP_POLICY_DROP_OLDEST,
+  EMTR_DROP_POLICY_BLOCK,
+} EmtrDropPolicy;
+
+typedef enum
+{
+  EMTR_LATENCY_RECORD_CALL,
+  EMTR_LATENCY_RECORD_SINGULAR_EVENT,
+  EMTR_LATENCY_RECORD_AGGREGATE_EVENT,
+  EMTR_LATENCY_RECORD_EVENT_SEQUENCE,
+  EMTR_LATENCY_RECORD_EVENTS,
+  EMTR_LATENCY_START_AGGREGATE_TIMER,
+  EMTR_LATENCY_STOP_TIMER,
+} EmtrLatencyKind;
+
 G_END_DECLS
 
 #endif /* EMTR_ENUMS_H */
@@ -0,0 +1,36 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "emtr-event-handle.h"
+#include "emtr-event-sender-private.h"
+
+G_BEGIN_DECLS
+
+struct _EmtrEventHandle
+{
+  gint ref_count; /* (atomic) */
+  guchar event_id[EMTR_EVENT_ID_LENGTH];
+};
+
+EmtrEventHandle *emtr_event_handle_new (const guchar *event_id);
+
+G_END_DECLS
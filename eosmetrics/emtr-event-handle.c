@@ -0,0 +1,87 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "emtr-event-handle-private.h"
+
+#include <string.h>
+
+/**
+ * SECTION:emtr-event-handle
+ * @title: Event handle
+ * @short_description: Event ID parsed ahead of time.
+ * @include: eosmetrics/eosmetrics.h
+ *
+ * An #EmtrEventHandle holds an event ID that has already been parsed, and is
+ * obtained with emtr_event_recorder_register_event(). Recording an event with
+ * a handle, for example with emtr_event_recorder_record_event_with_handle(),
+ * skips parsing the event ID, which matters for events that are recorded very
+ * often. Handles are immutable, so they may be shared between threads.
+ */
+
+G_DEFINE_BOXED_TYPE (EmtrEventHandle, emtr_event_handle,
+                     emtr_event_handle_ref, emtr_event_handle_unref)
+
+EmtrEventHandle *
+emtr_event_handle_new (const guchar *event_id)
+{
+  EmtrEventHandle *self = g_new (EmtrEventHandle, 1);
+
+  self->ref_count = 1;
+  memcpy (self->event_id, event_id, EMTR_EVENT_ID_LENGTH);
+
+  return self;
+}
+
+/**
+ * emtr_event_handle_ref:
+ * @self: an #EmtrEventHandle
+ *
+ * Increases the reference count of @self.
+ *
+ * Returns: (transfer full): @self
+ *
+ * Since: 0.6
+ */
+EmtrEventHandle *
+emtr_event_handle_ref (EmtrEventHandle *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+  return self;
+}
+
+/**
+ * emtr_event_handle_unref:
+ * @self: (transfer full): an #EmtrEventHandle
+ *
+ * Decreases the reference count of @self, and frees it when the count drops to
+ * zero.
+ *
+ * Since: 0.6
+ */
+void
+emtr_event_handle_unref (EmtrEventHandle *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (g_atomic_int_dec_and_test (&self->ref_count))
+    g_free (self);
+}
@@ -0,0 +1,45 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#if !(defined(_EMTR_INSIDE_EOSMETRICS_H) || defined(COMPILING_EOS_METRICS))
+#error "Please do not include this header file directly."
+#endif
+
+#include "emtr-types.h"
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define EMTR_TYPE_EVENT_HANDLE (emtr_event_handle_get_type())
+
+EMTR_AVAILABLE_IN_0_6
+GType            emtr_event_handle_get_type (void) G_GNUC_CONST;
+
+EMTR_AVAILABLE_IN_0_6
+EmtrEventHandle *emtr_event_handle_ref      (EmtrEventHandle *self);
+
+EMTR_AVAILABLE_IN_0_6
+void             emtr_event_handle_unref    (EmtrEventHandle *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EmtrEventHandle, emtr_event_handle_unref)
+
+G_END_DECLS
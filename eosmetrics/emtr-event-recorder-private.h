@@ -0,0 +1,54 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "emtr-event-recorder.h"
+
+#include <glib.h>
+#include <uuid/uuid.h>
+
+G_BEGIN_DECLS
+
+/* Helpers of the recording functions, which are not static only so that
+   tests/bench-recorder-internals.c can measure them. They are hidden, so that
+   they are not exported from the library; the benchmark is built from the
+   library sources instead of linking to it. */
+
+G_GNUC_INTERNAL
+gboolean emtr_event_recorder_parse_event_id           (const gchar     *unparsed_event_id,
+                                                       uuid_t           parsed_event_id);
+
+G_GNUC_INTERNAL
+void     emtr_event_recorder_get_uuid_builder         (uuid_t           uuid,
+                                                       GVariantBuilder *uuid_builder);
+
+G_GNUC_INTERNAL
+gboolean emtr_event_recorder_contains_maybe_variant   (GVariant        *variant);
+
+G_GNUC_INTERNAL
+GArray  *emtr_event_recorder_new_event_sequence       (void);
+
+G_GNUC_INTERNAL
+void     emtr_event_recorder_append_event_to_sequence (GArray          *event_sequence,
+                                                       gint64           relative_time,
+                                                       GVariant        *auxiliary_payload);
+
+G_END_DECLS
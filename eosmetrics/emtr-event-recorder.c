@@ -27,6 +27,12 @@
 #include "emtr-event-recorder.h"
 #include "emer-event-recorder-server.h"
 #include "eosmetrics/emtr-aggregate-timer-private.h"
+#include "eosmetrics/emtr-client-stats-private.h"
+#include "eosmetrics/emtr-event-handle-private.h"
+#include "eosmetrics/emtr-event-recorder-private.h"
+#include "eosmetrics/emtr-event-sender-private.h"
+#include "eosmetrics/emtr-sequence-table-private.h"
+#include "eosmetrics/emtr-trace-private.h"
 #include "eosmetrics/emtr-util.h"
 
 #include <string.h>
@@ -45,6 +51,7 @@
  * array of guchar.
  */
 #define UUID_LENGTH (sizeof (uuid_t) / sizeof (guchar))
+G_STATIC_ASSERT (UUID_LENGTH == EMTR_EVENT_ID_LENGTH);
 
 /**
  * SECTION:emtr-event-recorder
@@ -55,7 +62,11 @@
  * The event recorder asynchronously sends metric events to the metric system
  * daemon via D-Bus. The system daemon then delivers metrics to the server on
  * a best-effort basis. No feedback is given regarding the outcome of delivery.
- * The event recorder is thread-safe.
+ * The event recorder is thread-safe. All D-Bus traffic happens on a thread
+ * owned by the event recorder, so recording an event does not require the
+ * calling thread to run a main loop. Creating an event recorder does not block:
+ * the connection to the daemon is made in the background when the first event
+ * is recorded, and events recorded in the meantime are sent once it is ready.
  *
  * This API may be called from JavaScript as follows.
  *
@@ -84,14 +95,71 @@
  *   }););
  * ]|
  *
+ * Asynchronously recorded events are not sent individually. They are buffered
+ * and sent to the daemon together in a single D-Bus message once
+ * #EmtrEventRecorder:max-batch-size events are waiting, or once
+ * #EmtrEventRecorder:flush-interval milliseconds have passed since the first of
+ * them was recorded, whichever comes first. The synchronous variants of the
+ * recording functions send any buffered events before their own, and
+ * emtr_event_recorder_flush_sync() may be used to send buffered events from a
+ * process that is about to close.
+ *
+ * Counters that are incremented very often with
+ * emtr_event_recorder_record_events() may additionally be summed up on the
+ * client by setting #EmtrEventRecorder:aggregation-window, so that only one
+ * aggregate event per event ID and auxiliary payload is sent per window.
+ *
+ * Events recorded while the daemon is not running, or while the system bus
+ * cannot be reached, are kept in a spool in the user's cache directory, and
+ * sent once the daemon is back, possibly by another process. The spool is
+ * capped in size; once it is full, the oldest events are dropped.
+ *
  * Event submission may be disabled at runtime by setting the
- * `EOS_DISABLE_METRICS` environment variable to the empty string or `1`. This
- * is intended to be set when running unit tests in other modules, for example,
- * to avoid submitting metrics from unit test runs. It will skip submitting
- * metrics to the D-Bus daemon, but otherwise all eos-metrics functions will
- * report success.
+ * `EOS_DISABLE_METRICS` environment variable to the empty string or `1` before
+ * the #EmtrEventRecorder is created. This is intended to be set when running
+ * unit tests in other modules, for example, to avoid submitting metrics from
+ * unit test runs. It will skip submitting metrics to the D-Bus daemon, but
+ * otherwise all eos-metrics functions will report success.
+ *
+ * Likewise, while the daemon's `Enabled` property is false, because the user
+ * has opted out of metrics collection, the recording functions return
+ * immediately without doing any work, and events that were recorded but not
+ * yet sent are dropped.
+ *
+ * The memory taken up by events that have not been sent yet is bounded by
+ * #EmtrEventRecorder:max-queued-bytes and #EmtrEventRecorder:max-in-flight.
+ * When a daemon that is stalled or too slow lets them fill up, the recorder
+ * drops events according to #EmtrEventRecorder:drop-policy. The number of
+ * events dropped this way is counted per event ID and reported to the daemon
+ * periodically, as aggregate events of their own.
+ *
+ * When the `EOS_METRICS_CLIENT_STATS` environment variable is set to `1`
+ * before the default recorder is created, the counters returned by
+ * emtr_event_recorder_get_stats(), the depths of the recorder's queues and its
+ * latency histograms are exported on the system bus under the
+ * `com.endlessm.Metrics.ClientStats` interface, at
+ * `/com/endlessm/Metrics/ClientStats`. The `eos-metrics-client-stats` tool
+ * lists the processes exporting them.
+ *
+ * Each recorder also keeps a small flight recorder of the last events it took
+ * in, sent or dropped, which emtr_event_recorder_get_recent_events() returns.
+ * When the `EOS_METRICS_DUMP_SIGNAL` environment variable is set to `USR1` or
+ * `USR2` before a recorder is created, it is printed to stderr whenever the
+ * process receives that signal.
  */
 
+/* Default values of the properties controlling how events are batched */
+#define DEFAULT_MAX_BATCH_SIZE 128u
+#define DEFAULT_FLUSH_INTERVAL_MS 1000u
+#define DEFAULT_AGGREGATION_WINDOW_MS 0u
+#define DEFAULT_MEMFD_THRESHOLD (64u * 1024u)
+
+/* Default values of the properties bounding the events waiting to be sent */
+#define DEFAULT_MAX_QUEUED_BYTES (4u * 1024u * 1024u)
+#define DEFAULT_MAX_IN_FLIGHT 16u
+#define DEFAULT_DROP_POLICY EMTR_DROP_POLICY_DROP_NEWEST
+#define DEFAULT_BLOCK_TIMEOUT_MS 100u
+
 typedef struct EmtrEventRecorderPrivate
 {
   /*
@@ -102,18 +170,182 @@ typedef struct EmtrEventRecorderPrivate
    */
   GVariant *empty_auxiliary_payload;
 
-  GHashTable * volatile events_by_id_with_key;
-  GMutex events_by_id_with_key_lock;
-
-  gboolean recording_enabled;
-
-  EmerEventRecorderServer *dbus_proxy;
+  /* Event sequences that have been started but not stopped */
+  EmtrSequenceTable *sequences;
+
+  /* Delivers events to the daemon from its own thread */
+  EmtrEventSender *sender;
+
+  guint max_batch_size;
+  guint flush_interval_ms;
+  guint aggregation_window_ms;
+  gboolean wait_for_replies;
+  guint memfd_threshold;
+  guint max_queued_bytes;
+  guint max_in_flight;
+  EmtrDropPolicy drop_policy;
+  guint block_timeout_ms;
 } EmtrEventRecorderPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (EmtrEventRecorder, emtr_event_recorder, G_TYPE_OBJECT)
 
-/* Callback to make the finish call after async D-Bus calls */
-typedef gboolean (*FinishCallback) (EmerEventRecorderServer *, GAsyncResult *, GError **);
+EMTR_DEFINE_ENUM_TYPE (EmtrDropPolicy, emtr_drop_policy,
+                       EMTR_ENUM_VALUE (EMTR_DROP_POLICY_DROP_NEWEST, drop-newest)
+                       EMTR_ENUM_VALUE (EMTR_DROP_POLICY_DROP_OLDEST, drop-oldest)
+                       EMTR_ENUM_VALUE (EMTR_DROP_POLICY_BLOCK, block))
+
+enum
+{
+  PROP_0,
+  PROP_MAX_BATCH_SIZE,
+  PROP_FLUSH_INTERVAL,
+  PROP_AGGREGATION_WINDOW,
+  PROP_WAIT_FOR_REPLIES,
+  PROP_MEMFD_THRESHOLD,
+  PROP_MAX_QUEUED_BYTES,
+  PROP_MAX_IN_FLIGHT,
+  PROP_DROP_POLICY,
+  PROP_BLOCK_TIMEOUT,
+  PROP_PROFILE_PHASES,
+  NPROPS
+};
+
+static GParamSpec *emtr_event_recorder_props[NPROPS] = { NULL, };
+
+static void
+emtr_event_recorder_get_property (GObject    *object,
+                                  guint       property_id,
+                                  GValue     *value,
+                                  GParamSpec *pspec)
+{
+  EmtrEventRecorder *self = EMTR_EVENT_RECORDER (object);
+  EmtrEventRecorderPrivate *priv =
+    emtr_event_recorder_get_instance_private (self);
+
+  switch (property_id)
+    {
+    case PROP_MAX_BATCH_SIZE:
+      g_value_set_uint (value, priv->max_batch_size);
+      break;
+
+    case PROP_FLUSH_INTERVAL:
+      g_value_set_uint (value, priv->flush_interval_ms);
+      break;
+
+    case PROP_AGGREGATION_WINDOW:
+      g_value_set_uint (value, priv->aggregation_window_ms);
+      break;
+
+    case PROP_WAIT_FOR_REPLIES:
+      g_value_set_boolean (value, priv->wait_for_replies);
+      break;
+
+    case PROP_MEMFD_THRESHOLD:
+      g_value_set_uint (value, priv->memfd_threshold);
+      break;
+
+    case PROP_MAX_QUEUED_BYTES:
+      g_value_set_uint (value, priv->max_queued_bytes);
+      break;
+
+    case PROP_MAX_IN_FLIGHT:
+      g_value_set_uint (value, priv->max_in_flight);
+      break;
+
+    case PROP_DROP_POLICY:
+      g_value_set_enum (value, priv->drop_policy);
+      break;
+
+    case PROP_BLOCK_TIMEOUT:
+      g_value_set_uint (value, priv->block_timeout_ms);
+      break;
+
+    case PROP_PROFILE_PHASES:
+      {
+        EmtrStats *stats = emtr_event_sender_get_stats (priv->sender);
+        g_value_set_boolean (value, emtr_stats_is_profiling (stats));
+      }
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+static void
+emtr_event_recorder_set_property (GObject      *object,
+                                  guint         property_id,
+                                  const GValue *value,
+                                  GParamSpec   *pspec)
+{
+  EmtrEventRecorder *self = EMTR_EVENT_RECORDER (object);
+  EmtrEventRecorderPrivate *priv =
+    emtr_event_recorder_get_instance_private (self);
+
+  switch (property_id)
+    {
+    case PROP_MAX_BATCH_SIZE:
+      priv->max_batch_size = g_value_get_uint (value);
+      emtr_event_sender_set_max_batch_size (priv->sender,
+                                            priv->max_batch_size);
+      break;
+
+    case PROP_FLUSH_INTERVAL:
+      priv->flush_interval_ms = g_value_get_uint (value);
+      emtr_event_sender_set_flush_interval (priv->sender,
+                                            priv->flush_interval_ms);
+      break;
+
+    case PROP_AGGREGATION_WINDOW:
+      priv->aggregation_window_ms = g_value_get_uint (value);
+      emtr_event_sender_set_aggregation_window (priv->sender,
+                                                priv->aggregation_window_ms);
+      break;
+
+    case PROP_WAIT_FOR_REPLIES:
+      priv->wait_for_replies = g_value_get_boolean (value);
+      emtr_event_sender_set_wait_for_replies (priv->sender,
+                                              priv->wait_for_replies);
+      break;
+
+    case PROP_MEMFD_THRESHOLD:
+      priv->memfd_threshold = g_value_get_uint (value);
+      emtr_event_sender_set_memfd_threshold (priv->sender,
+                                             priv->memfd_threshold);
+      break;
+
+    case PROP_MAX_QUEUED_BYTES:
+      priv->max_queued_bytes = g_value_get_uint (value);
+      emtr_event_sender_set_max_queued_bytes (priv->sender,
+                                              priv->max_queued_bytes);
+      break;
+
+    case PROP_MAX_IN_FLIGHT:
+      priv->max_in_flight = g_value_get_uint (value);
+      emtr_event_sender_set_max_in_flight (priv->sender, priv->max_in_flight);
+      break;
+
+    case PROP_DROP_POLICY:
+      priv->drop_policy = g_value_get_enum (value);
+      emtr_event_sender_set_drop_policy (priv->sender, priv->drop_policy,
+                                         priv->block_timeout_ms);
+      break;
+
+    case PROP_BLOCK_TIMEOUT:
+      priv->block_timeout_ms = g_value_get_uint (value);
+      emtr_event_sender_set_drop_policy (priv->sender, priv->drop_policy,
+                                         priv->block_timeout_ms);
+      break;
+
+    case PROP_PROFILE_PHASES:
+      emtr_stats_set_profiling (emtr_event_sender_get_stats (priv->sender),
+                                g_value_get_boolean (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
 
 static void
 emtr_event_recorder_finalize (GObject *object)
@@ -122,44 +354,222 @@ emtr_event_recorder_finalize (GObject *object)
   EmtrEventRecorderPrivate *priv =
     emtr_event_recorder_get_instance_private (self);
 
-  g_hash_table_destroy (priv->events_by_id_with_key);
-  g_mutex_clear (&priv->events_by_id_with_key_lock);
+  /* Don't lose events that were still waiting for their batch to fill up. */
+  g_clear_pointer (&priv->sender, emtr_event_sender_free);
+
+  emtr_sequence_table_free (priv->sequences);
 
   g_variant_unref (priv->empty_auxiliary_payload);
-  g_clear_object (&priv->dbus_proxy);
 
   G_OBJECT_CLASS (emtr_event_recorder_parent_class)->finalize (object);
 }
 
 
 
-/*
- * https://developer.gnome.org/glib/2.40/glib-GVariant.html#g-variant-hash
- * does not work on container types, so we implement our own more general, hash
- * function. Note that the GVariant is trusted to be in fully-normalized form.
- * The implementation is inspired by the GLib implementations of g_str_hash and
- * g_bytes_hash.
- */
-static guint
-general_variant_hash (gconstpointer key)
-{
-  GVariant *variant = (GVariant *) key;
-  const gchar *type_string = g_variant_get_type_string (variant);
-  guint hash_value = g_str_hash (type_string);
-  GBytes *serialized_data = g_variant_get_data_as_bytes (variant);
-  if (serialized_data != NULL)
-    {
-      hash_value = (hash_value * 33) + g_bytes_hash (serialized_data);
-      g_bytes_unref (serialized_data);
-    }
-  return hash_value;
-}
-
 static void
 emtr_event_recorder_class_init (EmtrEventRecorderClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  object_class->get_property = emtr_event_recorder_get_property;
+  object_class->set_property = emtr_event_recorder_set_property;
   object_class->finalize = emtr_event_recorder_finalize;
+
+  /**
+   * EmtrEventRecorder:max-batch-size:
+   *
+   * The number of asynchronously recorded events, event sequences included,
+   * that are buffered before they are sent to the daemon in a single D-Bus
+   * message. A value of 0 or 1 sends every event as soon as it is recorded.
+   *
+   * Since: 0.6
+   */
+  emtr_event_recorder_props[PROP_MAX_BATCH_SIZE] =
+    g_param_spec_uint ("max-batch-size", "Max batch size",
+                       "Number of events to buffer before sending them",
+                       0, G_MAXUINT, DEFAULT_MAX_BATCH_SIZE,
+                       G_PARAM_READWRITE | G_PARAM_CONSTRUCT |
+                       G_PARAM_STATIC_STRINGS);
+
+  /**
+   * EmtrEventRecorder:flush-interval:
+   *
+   * The maximum time, in milliseconds, for which an asynchronously recorded
+   * event is buffered before it is sent to the daemon, even if
+   * #EmtrEventRecorder:max-batch-size has not been reached.
+   *
+   * Since: 0.6
+   */
+  emtr_event_recorder_props[PROP_FLUSH_INTERVAL] =
+    g_param_spec_uint ("flush-interval", "Flush interval",
+                       "Milliseconds after which buffered events are sent",
+                       0, G_MAXUINT, DEFAULT_FLUSH_INTERVAL_MS,
+                       G_PARAM_READWRITE | G_PARAM_CONSTRUCT |
+                       G_PARAM_STATIC_STRINGS);
+
+  /**
+   * EmtrEventRecorder:aggregation-window:
+   *
+   * The time, in milliseconds, over which asynchronously recorded aggregate
+   * events are counted before they are sent to the daemon. Events with the
+   * same event ID and auxiliary payload that are recorded during a window are
+   * sent as a single aggregate event whose count is the sum of theirs, and
+   * whose time is that of the first of them. A value of 0 disables this, and
+   * sends every aggregate event that is recorded.
+   *
+   * Recording an event synchronously, or calling
+   * emtr_event_recorder_flush_sync(), ends the current window early.
+   *
+   * Since: 0.6
+   */
+  emtr_event_recorder_props[PROP_AGGREGATION_WINDOW] =
+    g_param_spec_uint ("aggregation-window", "Aggregation window",
+                       "Milliseconds over which aggregate events are counted",
+                       0, G_MAXUINT, DEFAULT_AGGREGATION_WINDOW_MS,
+                       G_PARAM_READWRITE | G_PARAM_CONSTRUCT |
+                       G_PARAM_STATIC_STRINGS);
+
+  /**
+   * EmtrEventRecorder:wait-for-replies:
+   *
+   * Whether asynchronously recorded events are sent with D-Bus calls that
+   * wait for a reply from the daemon. By default they are sent as messages
+   * that expect no reply, which is cheaper, but means that events the daemon
+   * rejects are dropped silently. Set this to %TRUE to have a warning logged
+   * for each of them when diagnosing problems, and to have batches of events
+   * sent again when the daemon is briefly too busy to accept them.
+   *
+   * Synchronously recorded events always wait for a reply.
+   *
+   * Since: 0.6
+   */
+  emtr_event_recorder_props[PROP_WAIT_FOR_REPLIES] =
+    g_param_spec_boolean ("wait-for-replies", "Wait for replies",
+                          "Whether to wait for the daemon to reply to "
+                          "asynchronously sent events",
+                          FALSE,
+                          G_PARAM_READWRITE | G_PARAM_CONSTRUCT |
+                          G_PARAM_STATIC_STRINGS);
+
+  /**
+   * EmtrEventRecorder:memfd-threshold:
+   *
+   * The size, in bytes, from which a batch of events is handed to the daemon
+   * as a sealed memory file descriptor rather than copied into the D-Bus
+   * message. This saves copying large auxiliary payloads into the message and
+   * through the bus daemon. Smaller batches, and all batches if this is 0, are
+   * sent inline. Daemons that cannot receive file descriptors are detected,
+   * and sent everything inline.
+   *
+   * Since: 0.6
+   */
+  emtr_event_recorder_props[PROP_MEMFD_THRESHOLD] =
+    g_param_spec_uint ("memfd-threshold", "Memfd threshold",
+                       "Size in bytes from which events are passed in a file "
+                       "descriptor",
+                       0, G_MAXUINT, DEFAULT_MEMFD_THRESHOLD,
+                       G_PARAM_READWRITE | G_PARAM_CONSTRUCT |
+                       G_PARAM_STATIC_STRINGS);
+
+  /**
+   * EmtrEventRecorder:max-queued-bytes:
+   *
+   * The size, in bytes, that asynchronously recorded events waiting to be
+   * sent to the daemon may take up, for instance while
+   * #EmtrEventRecorder:max-in-flight messages are waiting for a slow daemon.
+   * Events that don't fit are dropped according to
+   * #EmtrEventRecorder:drop-policy. An event always fits if no other event is
+   * waiting. A value of 0 removes the limit.
+   *
+   * Since: 0.6
+   */
+  emtr_event_recorder_props[PROP_MAX_QUEUED_BYTES] =
+    g_param_spec_uint ("max-queued-bytes", "Max queued bytes",
+                       "Size in bytes of the events that may wait to be sent",
+                       0, G_MAXUINT, DEFAULT_MAX_QUEUED_BYTES,
+                       G_PARAM_READWRITE | G_PARAM_CONSTRUCT |
+                       G_PARAM_STATIC_STRINGS);
+
+  /**
+   * EmtrEventRecorder:max-in-flight:
+   *
+   * The number of messages carrying asynchronously recorded events that may
+   * be sent before the earlier ones have been written out to the daemon or,
+   * when #EmtrEventRecorder:wait-for-replies is set, replied to by it. Further
+   * events wait until one of them completes. A value of 0 removes the limit.
+   *
+   * Since: 0.6
+   */
+  emtr_event_recorder_props[PROP_MAX_IN_FLIGHT] =
+    g_param_spec_uint ("max-in-flight", "Max in flight",
+                       "Number of messages that may be in flight",
+                       0, G_MAXUINT, DEFAULT_MAX_IN_FLIGHT,
+                       G_PARAM_READWRITE | G_PARAM_CONSTRUCT |
+                       G_PARAM_STATIC_STRINGS);
+
+  /**
+   * EmtrEventRecorder:drop-policy:
+   *
+   * What happens to asynchronously recorded events once those waiting to be
+   * sent take up #EmtrEventRecorder:max-queued-bytes. Once dropping has
+   * started, %EMTR_DROP_POLICY_DROP_NEWEST and %EMTR_DROP_POLICY_BLOCK only
+   * let events through again when the waiting events are down to half of the
+   * limit. Synchronously recorded events are never dropped.
+   *
+   * Since: 0.6
+   */
+  emtr_event_recorder_props[PROP_DROP_POLICY] =
+    g_param_spec_enum ("drop-policy", "Drop policy",
+                       "What to do with events there is no room for",
+                       EMTR_TYPE_DROP_POLICY, DEFAULT_DROP_POLICY,
+                       G_PARAM_READWRITE | G_PARAM_CONSTRUCT |
+                       G_PARAM_STATIC_STRINGS);
+
+  /**
+   * EmtrEventRecorder:block-timeout:
+   *
+   * The maximum time, in milliseconds, for which the recording functions
+   * block waiting for room when #EmtrEventRecorder:drop-policy is
+   * %EMTR_DROP_POLICY_BLOCK, before dropping the event.
+   *
+   * Since: 0.6
+   */
+  emtr_event_recorder_props[PROP_BLOCK_TIMEOUT] =
+    g_param_spec_uint ("block-timeout", "Block timeout",
+                       "Milliseconds to wait for room before dropping an "
+                       "event",
+                       0, G_MAXUINT, DEFAULT_BLOCK_TIMEOUT_MS,
+                       G_PARAM_READWRITE | G_PARAM_CONSTRUCT |
+                       G_PARAM_STATIC_STRINGS);
+
+  /**
+   * EmtrEventRecorder:profile-phases:
+   *
+   * Whether the time spent in each step of recording events is measured, to
+   * find out which of them dominates on a real workload. The steps taken by
+   * the recording functions for singular and aggregate events, such as
+   * reading the clock, checking the payload and parsing the event ID, are
+   * timed per event ID, and those taken on the sender thread, such as putting
+   * payloads in normal form and sending messages, are timed too. The times
+   * are reported by emtr_event_recorder_get_stats().
+   *
+   * Timing uses the processor's cycle counter where there is one, and costs a
+   * few tens of nanoseconds per recording call, so this is meant to be turned
+   * on for a few minutes at a time. It defaults to %FALSE, unless the
+   * `EOS_METRICS_PROFILE` environment variable is set to `1` when the recorder
+   * is created. For the default recorder, it can also be turned on at runtime
+   * with `eos-metrics-client-stats --profile`, in which case no change
+   * notification is emitted.
+   *
+   * Since: 0.6
+   */
+  emtr_event_recorder_props[PROP_PROFILE_PHASES] =
+    g_param_spec_boolean ("profile-phases", "Profile phases",
+                          "Whether to time each step of recording events",
+                          FALSE,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (object_class, NPROPS,
+                                     emtr_event_recorder_props);
 }
 
 static void
@@ -168,40 +578,24 @@ emtr_event_recorder_init (EmtrEventRecorder *self)
   EmtrEventRecorderPrivate *priv =
     emtr_event_recorder_get_instance_private (self);
 
-  priv->events_by_id_with_key =
-    g_hash_table_new_full (general_variant_hash, g_variant_equal,
-                           (GDestroyNotify) g_variant_unref,
-                           (GDestroyNotify) g_ptr_array_unref);
-  g_mutex_init (&priv->events_by_id_with_key_lock);
+  priv->sequences = emtr_sequence_table_new ();
 
   GVariant *unboxed_variant = g_variant_new_boolean (FALSE);
   priv->empty_auxiliary_payload = g_variant_new_variant (unboxed_variant);
   g_variant_ref_sink (priv->empty_auxiliary_payload);
 
-  /* If getting the D-Bus connection fails, mark self as a no-op object. */
-  GError *error = NULL;
-  priv->dbus_proxy =
-    emer_event_recorder_server_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
-                                                       G_DBUS_PROXY_FLAGS_NONE,
-                                                       "com.endlessm.Metrics",
-                                                       "/com/endlessm/Metrics",
-                                                       NULL /* GCancellable */,
-                                                       &error);
-  if (priv->dbus_proxy == NULL)
-    {
-      g_critical ("Unable to connect to the D-Bus event recorder server: %s",
-                  error->message);
-      g_error_free (error);
-      priv->recording_enabled = FALSE;
-      return;
-    }
+  /* The connection to the daemon is made by the sender when the first event
+     is recorded, so that creating the recorder never blocks. */
+  priv->sender = emtr_event_sender_new ();
 
-  priv->recording_enabled = TRUE;
+  if (g_strcmp0 (g_getenv ("EOS_METRICS_PROFILE"), "1") == 0)
+    emtr_stats_set_profiling (emtr_event_sender_get_stats (priv->sender),
+                              TRUE);
 }
 
-static gboolean
-parse_event_id (const gchar *unparsed_event_id,
-                uuid_t       parsed_event_id)
+gboolean
+emtr_event_recorder_parse_event_id (const gchar *unparsed_event_id,
+                                    uuid_t       parsed_event_id)
 {
   gint parse_failed = uuid_parse (unparsed_event_id, parsed_event_id);
   if (parse_failed != 0)
@@ -215,42 +609,21 @@ parse_event_id (const gchar *unparsed_event_id,
   return TRUE;
 }
 
-static GVariant *
-get_normalized_form_of_variant (GVariant *variant)
-{
-  if (variant == NULL)
-    return NULL;
-
-  g_variant_ref_sink (variant);
-  GVariant *normalized_variant = g_variant_get_normal_form (variant);
-  g_variant_unref (variant);
-  return normalized_variant;
-}
-
 /*
  * Initializes the given uuid_builder and populates it with the contents of
  * uuid.
  */
-static void
-get_uuid_builder (uuid_t           uuid,
-                  GVariantBuilder *uuid_builder)
+void
+emtr_event_recorder_get_uuid_builder (uuid_t           uuid,
+                                      GVariantBuilder *uuid_builder)
 {
   g_variant_builder_init (uuid_builder, G_VARIANT_TYPE ("ay"));
   for (size_t i = 0; i < UUID_LENGTH; ++i)
     g_variant_builder_add (uuid_builder, "y", uuid[i]);
 }
 
-static GVariant *
-combine_event_id_with_key (uuid_t    event_id,
-                           GVariant *key)
-{
-  GVariantBuilder event_id_builder;
-  get_uuid_builder (event_id, &event_id_builder);
-  return g_variant_new ("(aymv)", &event_id_builder, key);
-}
-
-static gboolean
-contains_maybe_variant (GVariant *variant)
+gboolean
+emtr_event_recorder_contains_maybe_variant (GVariant *variant)
 {
   if (variant == NULL)
     return FALSE;
@@ -268,210 +641,78 @@ contains_maybe_variant (GVariant *variant)
 }
 
 static void
-append_event_to_sequence (EmtrEventRecorder *self,
-                          GPtrArray         *event_sequence,
-                          gint64             relative_time,
-                          GVariant          *auxiliary_payload)
+clear_sequence_event (EmtrSequenceEvent *event)
 {
-  EmtrEventRecorderPrivate *priv =
-    emtr_event_recorder_get_instance_private (self);
-
-  /* Variants sent to D-Bus are not allowed to be NULL or maybe types. */
-  gboolean has_payload = (auxiliary_payload != NULL);
-  GVariant *maybe_payload =
-    has_payload ? auxiliary_payload : priv->empty_auxiliary_payload;
-  GVariant *event =
-    g_variant_new ("(xbv)", relative_time, has_payload, maybe_payload);
+  g_clear_pointer (&event->payload, g_variant_unref);
+}
 
-  g_variant_ref_sink (event);
-  g_ptr_array_add (event_sequence, event);
+GArray *
+emtr_event_recorder_new_event_sequence (void)
+{
+  GArray *event_sequence =
+    g_array_sized_new (FALSE, FALSE, sizeof (EmtrSequenceEvent), 2u);
+  g_array_set_clear_func (event_sequence,
+                          (GDestroyNotify) clear_sequence_event);
+  return event_sequence;
 }
 
 /*
- * The callback for the asynchronous D-Bus calls, send_events_to_dbus and
- * send_event_sequence_to_dbus. Calls the finish method.
- * @finish_callback: the finish D-Bus method call, will be called in this
- * function.
+ * The payload is put in normal form and boxed by the sender thread when the
+ * event sequence is sent, not here.
  */
-static void
-send_events_to_dbus_finish_callback (EmerEventRecorderServer *dbus_proxy,
-                                     GAsyncResult            *res,
-                                     FinishCallback           finish_callback)
+void
+emtr_event_recorder_append_event_to_sequence (GArray   *event_sequence,
+                                              gint64    relative_time,
+                                              GVariant *auxiliary_payload)
 {
-  GError *error = NULL;
-  gboolean success = finish_callback (dbus_proxy, res, &error);
-
-  if (!success)
-    {
-      g_warning ("Failed to send event to event recorder daemon: %s.",
-                 error->message);
-      g_error_free (error);
-    }
-}
+  EmtrSequenceEvent event;
 
-/* Check the EOS_DISABLE_METRICS environment variable to see if we should
- * skip submitting any metrics. This is intended to be set when running unit
- * tests in other modules, for example, to avoid submitting metrics from unit
- * test runs. */
-static gboolean
-disable_event_submission (void)
-{
-  const gchar *val = g_getenv ("EOS_DISABLE_METRICS");
+  event.relative_time = relative_time;
+  event.payload = auxiliary_payload != NULL ?
+    g_variant_ref_sink (auxiliary_payload) : NULL;
 
-  return (val != NULL &&
-          (g_str_equal (val, "") || g_str_equal (val, "1")));
+  g_array_append_val (event_sequence, event);
 }
 
-/* Send either singular or aggregate event to D-Bus.
+/* Send either singular or aggregate event to D-Bus from the sender thread.
    num_events parameter is ignored if is_aggregate is FALSE. */
 static void
 send_events_to_dbus (EmtrEventRecorder *self,
-                     uuid_t             parsed_event_id,
+                     const guchar      *parsed_event_id,
                      GVariant          *auxiliary_payload,
                      gint64             relative_time,
                      gboolean           is_synchronous,
                      gboolean           is_aggregate,
-                     gint               num_events)
+                     gint64             num_events)
 {
   EmtrEventRecorderPrivate *priv =
     emtr_event_recorder_get_instance_private (self);
 
-  GVariantBuilder uuid_builder;
-  GVariant *event_id_variant;
-
-  /* Variants sent to D-Bus are not allowed to be NULL or maybe types. */
-  gboolean has_payload = auxiliary_payload != NULL;
-  GVariant *maybe_auxiliary_payload;
-
-  if (disable_event_submission ())
-    {
-      g_debug ("Skipping submitting %i events as submission is disabled",
-               num_events);
-      return;
-    }
-
-  get_uuid_builder (parsed_event_id, &uuid_builder);
-  event_id_variant = g_variant_builder_end (&uuid_builder);
-  maybe_auxiliary_payload = has_payload ?
-    g_variant_new_variant (auxiliary_payload) : priv->empty_auxiliary_payload;
-
-  if (is_synchronous)
-    {
-      GError *error = NULL;
-      gboolean success;
-      if (is_aggregate)
-        success =
-          emer_event_recorder_server_call_record_aggregate_event_sync (priv->dbus_proxy,
-                                                                       getuid (),
-                                                                       event_id_variant,
-                                                                       num_events,
-                                                                       relative_time,
-                                                                       has_payload,
-                                                                       maybe_auxiliary_payload,
-                                                                       NULL /* GCancellable */,
-                                                                       &error);
-      else
-        success =
-          emer_event_recorder_server_call_record_singular_event_sync (priv->dbus_proxy,
-                                                                      getuid (),
-                                                                      event_id_variant,
-                                                                      relative_time,
-                                                                      has_payload,
-                                                                      maybe_auxiliary_payload,
-                                                                      NULL /* GCancellable */,
-                                                                      &error);
-
-      if (!success)
-        {
-          g_warning ("Failed to send event to event recorder daemon: %s.",
-                     error->message);
-          g_error_free (error);
-        }
-    }
-  else
-    {
-      if (is_aggregate)
-        emer_event_recorder_server_call_record_aggregate_event (priv->dbus_proxy,
-                                                                getuid (),
-                                                                event_id_variant,
-                                                                num_events,
-                                                                relative_time,
-                                                                has_payload,
-                                                                maybe_auxiliary_payload,
-                                                                NULL /* GCancellable */,
-                                                                (GAsyncReadyCallback) send_events_to_dbus_finish_callback,
-                                                                (FinishCallback) emer_event_recorder_server_call_record_aggregate_event_finish);
-      else
-        emer_event_recorder_server_call_record_singular_event (priv->dbus_proxy,
-                                                               getuid (),
-                                                               event_id_variant,
-                                                               relative_time,
-                                                               has_payload,
-                                                               maybe_auxiliary_payload,
-                                                               NULL /* GCancellable */,
-                                                               (GAsyncReadyCallback) send_events_to_dbus_finish_callback,
-                                                               (FinishCallback) emer_event_recorder_server_call_record_singular_event_finish);
-    }
+  emtr_event_sender_send_event (priv->sender,
+                                is_aggregate ? EMTR_RECORD_AGGREGATE_EVENT :
+                                               EMTR_RECORD_SINGULAR_EVENT,
+                                parsed_event_id,
+                                relative_time,
+                                num_events,
+                                auxiliary_payload,
+                                is_synchronous);
 }
 
 /*
- * Sends the corresponding event_sequence GVariant to D-Bus.
+ * Sends the event sequence to D-Bus from the sender thread. Takes ownership of
+ * event_sequence.
  */
 static void
 send_event_sequence_to_dbus (EmtrEventRecorder *self,
-                             GVariant          *event_id,
-                             GPtrArray         *event_sequence,
+                             uuid_t             parsed_event_id,
+                             GArray            *event_sequence,
                              gboolean           is_synchronous)
 {
   EmtrEventRecorderPrivate *priv =
     emtr_event_recorder_get_instance_private (self);
 
-  GVariantBuilder event_sequence_builder;
-  GVariant *event_sequence_variant;
-
-  if (disable_event_submission ())
-    {
-      g_debug ("Skipping submitting event sequence as submission is disabled");
-      return;
-    }
-
-  g_variant_builder_init (&event_sequence_builder, G_VARIANT_TYPE ("a(xbv)"));
-  for (gint i = 0; i < event_sequence->len; i++)
-    {
-      GVariant *event = g_ptr_array_index (event_sequence, i);
-      g_variant_builder_add_value (&event_sequence_builder, event);
-    }
-
-  event_sequence_variant = g_variant_builder_end (&event_sequence_builder);
-
-  if (is_synchronous)
-    {
-      GError *error = NULL;
-      gboolean success =
-        emer_event_recorder_server_call_record_event_sequence_sync (priv->dbus_proxy,
-                                                                    getuid (),
-                                                                    event_id,
-                                                                    event_sequence_variant,
-                                                                    NULL /* GCancellable */,
-                                                                    &error);
-
-      if (!success)
-        {
-          g_warning ("Failed to send event to event recorder daemon: %s.",
-                     error->message);
-          g_error_free (error);
-        }
-    }
-  else
-    {
-      emer_event_recorder_server_call_record_event_sequence (priv->dbus_proxy,
-                                                             getuid (),
-                                                             event_id,
-                                                             event_sequence_variant,
-                                                             NULL /* GCancellable */,
-                                                             (GAsyncReadyCallback) send_events_to_dbus_finish_callback,
-                                                             (FinishCallback) emer_event_recorder_server_call_record_event_sequence_finish);
-    }
+  emtr_event_sender_send_event_sequence (priv->sender, parsed_event_id,
+                                         event_sequence, is_synchronous);
 }
 
 #ifdef DEBUG
@@ -488,26 +729,57 @@ pretty_print_variant_or_null (GVariant *variant)
 }
 #endif /* DEBUG */
 
+/*
+ * Counts the cost of a recording function to its caller, from @relative_time,
+ * the timestamp of the event that it took on CLOCK_BOOTTIME, until the event
+ * has been handed over to the sender.
+ */
 static void
-record_events (EmtrEventRecorder *self,
-               const gchar       *event_id,
-               GVariant          *auxiliary_payload,
-               gint64             relative_time,
-               gboolean           is_synchronous,
-               gboolean           is_aggregate,
-               gint64             num_events)
+count_call_latency (EmtrEventRecorder *self,
+                    gint64             relative_time)
 {
   EmtrEventRecorderPrivate *priv =
     emtr_event_recorder_get_instance_private (self);
+  gint64 now;
 
-  if (!priv->recording_enabled)
-    return;
+  if (emtr_util_get_current_time (CLOCK_BOOTTIME, &now))
+    emtr_stats_add_latency (emtr_event_sender_get_stats (priv->sender),
+                            EMTR_LATENCY_RECORD_CALL, now - relative_time);
+}
 
-  uuid_t parsed_event_id;
-  if (!parse_event_id (event_id, parsed_event_id))
-    return;
+/* The name of the recording function for tracepoints, which is the same for
+   its variants taking a handle or a raw event ID */
+static const gchar *
+get_record_function_name (gboolean is_synchronous,
+                          gboolean is_aggregate)
+{
+  if (is_aggregate)
+    return is_synchronous ? "record_events_sync" : "record_events";
+
+  return is_synchronous ? "record_event_sync" : "record_event";
+}
+
+static void
+record_events_with_parsed_id (EmtrEventRecorder *self,
+                              const guchar      *parsed_event_id,
+                              GVariant          *auxiliary_payload,
+                              gint64             relative_time,
+                              EmtrProfile       *profile,
+                              gboolean           is_synchronous,
+                              gboolean           is_aggregate,
+                              gint64             num_events)
+{
+  EmtrEventRecorderPrivate *priv =
+    emtr_event_recorder_get_instance_private (self);
+
+  if (EMTR_TRACE_ENABLED (record__entry))
+    EMTR_TRACE (record__entry,
+                get_record_function_name (is_synchronous, is_aggregate),
+                parsed_event_id, emtr_trace_payload_size (auxiliary_payload));
 
-  auxiliary_payload = get_normalized_form_of_variant (auxiliary_payload);
+  /* The payload is put in normal form by the sender thread. */
+  if (auxiliary_payload != NULL)
+    g_variant_ref_sink (auxiliary_payload);
 
   send_events_to_dbus (self,
                        parsed_event_id,
@@ -516,9 +788,143 @@ record_events (EmtrEventRecorder *self,
                        is_synchronous,
                        is_aggregate,
                        num_events);
+  emtr_profile_phase (profile, EMTR_PHASE_ENQUEUE);
+
+  count_call_latency (self, relative_time);
+  emtr_stats_profile_end (emtr_event_sender_get_stats (priv->sender), profile,
+                          parsed_event_id);
 
   if (auxiliary_payload != NULL)
     g_variant_unref (auxiliary_payload);
+
+  EMTR_TRACE (record__return,
+              get_record_function_name (is_synchronous, is_aggregate),
+              parsed_event_id);
+}
+
+static void
+record_events (EmtrEventRecorder *self,
+               const gchar       *event_id,
+               GVariant          *auxiliary_payload,
+               gint64             relative_time,
+               EmtrProfile       *profile,
+               gboolean           is_synchronous,
+               gboolean           is_aggregate,
+               gint64             num_events)
+{
+  uuid_t parsed_event_id;
+  if (!emtr_event_recorder_parse_event_id (event_id, parsed_event_id))
+    return;
+  emtr_profile_phase (profile, EMTR_PHASE_PARSE_EVENT_ID);
+
+  record_events_with_parsed_id (self,
+                                parsed_event_id,
+                                auxiliary_payload,
+                                relative_time,
+                                profile,
+                                is_synchronous,
+                                is_aggregate,
+                                num_events);
+}
+
+/* Sinks and frees @variant if it is floating, as recording it would have. */
+static void
+release_floating_variant (GVariant *variant)
+{
+  if (variant != NULL && g_variant_is_floating (variant))
+    g_variant_unref (g_variant_ref_sink (variant));
+}
+
+/*
+ * Returns FALSE if recording has been disabled, so that the recording functions
+ * can return before doing any work. In that case, the floating references to
+ * @key and @auxiliary_payload, either of which may be NULL, are released, since
+ * the caller passed them for the recording functions to consume. This is
+ * checked before validating arguments, so it returns TRUE if @self is not an
+ * event recorder and leaves reporting that to g_return_if_fail().
+ */
+static gboolean
+recording_is_enabled (EmtrEventRecorder *self,
+                      GVariant          *key,
+                      GVariant          *auxiliary_payload)
+{
+  if (!EMTR_IS_EVENT_RECORDER (self))
+    return TRUE;
+
+  EmtrEventRecorderPrivate *priv =
+    emtr_event_recorder_get_instance_private (self);
+
+  if (emtr_event_sender_is_enabled (priv->sender))
+    return TRUE;
+
+  release_floating_variant (key);
+  release_floating_variant (auxiliary_payload);
+  return FALSE;
+}
+
+/*
+ * Like recording_is_enabled(), and if recording is enabled, starts timing the
+ * phases of the recording call in @profile if profiling is on.
+ */
+static gboolean
+begin_recording (EmtrEventRecorder *self,
+                 GVariant          *auxiliary_payload,
+                 EmtrProfile       *profile)
+{
+  profile->last = 0;
+
+  if (!recording_is_enabled (self, NULL, auxiliary_payload))
+    return FALSE;
+
+  if (!EMTR_IS_EVENT_RECORDER (self))
+    return TRUE;
+
+  EmtrEventRecorderPrivate *priv =
+    emtr_event_recorder_get_instance_private (self);
+
+  emtr_stats_profile_begin (emtr_event_sender_get_stats (priv->sender),
+                            profile);
+  return TRUE;
+}
+
+/*
+ * Validates the arguments shared by the functions that record events by handle
+ * or by raw event ID, and records the events.
+ */
+static void
+record_events_by_id (EmtrEventRecorder *self,
+                     const guchar      *parsed_event_id,
+                     GVariant          *auxiliary_payload,
+                     gboolean           is_synchronous,
+                     gboolean           is_aggregate,
+                     gint64             num_events)
+{
+  EmtrProfile profile;
+  if (!begin_recording (self, auxiliary_payload, &profile))
+    return;
+
+  /* Get the time before doing anything else because it will change during
+     execution. */
+  gint64 relative_time;
+  if (!emtr_util_get_current_time (CLOCK_BOOTTIME, &relative_time))
+    {
+      g_critical ("Getting relative timestamp failed.");
+      return;
+    }
+  emtr_profile_phase (&profile, EMTR_PHASE_CLOCK);
+
+  g_return_if_fail (EMTR_IS_EVENT_RECORDER (self));
+  g_return_if_fail (parsed_event_id != NULL);
+  g_return_if_fail (auxiliary_payload == NULL ||
+                    _IS_VARIANT (auxiliary_payload));
+
+  if (emtr_event_recorder_contains_maybe_variant (auxiliary_payload))
+    return;
+  emtr_profile_phase (&profile, EMTR_PHASE_CHECK_PAYLOAD);
+
+  record_events_with_parsed_id (self, parsed_event_id, auxiliary_payload,
+                                relative_time, &profile, is_synchronous,
+                                is_aggregate, num_events);
 }
 
 static void
@@ -531,12 +937,23 @@ record_stop (EmtrEventRecorder *self,
   EmtrEventRecorderPrivate *priv =
     emtr_event_recorder_get_instance_private (self);
 
-  if (!priv->recording_enabled)
+  uuid_t parsed_event_id;
+  if (!emtr_event_recorder_parse_event_id (event_id, parsed_event_id))
     return;
 
-  /* Acquire this lock before getting the time so that event sequences are
+  if (EMTR_TRACE_ENABLED (record__entry))
+    EMTR_TRACE (record__entry,
+                is_synchronous ? "record_stop_sync" : "record_stop",
+                parsed_event_id, emtr_trace_payload_size (auxiliary_payload));
+
+  EmtrSequenceKey sequence_key;
+  if (key != NULL)
+    g_variant_ref_sink (key);
+  emtr_sequence_key_init (&sequence_key, parsed_event_id, key);
+
+  /* Lock the sequence before getting the time so that event sequences are
      guaranteed to be chronologically sorted. */
-  g_mutex_lock (&priv->events_by_id_with_key_lock);
+  emtr_sequence_table_lock (priv->sequences, &sequence_key);
 
   // Get the time as soon as possible because it will change during execution.
   gint64 relative_time;
@@ -546,24 +963,14 @@ record_stop (EmtrEventRecorder *self,
       goto finally;
     }
 
-  uuid_t parsed_event_id;
-  if (!parse_event_id (event_id, parsed_event_id))
-    goto finally;
-
-  key = get_normalized_form_of_variant (key);
-
-  GVariant *event_id_with_key = combine_event_id_with_key (parsed_event_id,
-                                                           key);
-  GPtrArray *event_sequence =
-    g_hash_table_lookup (priv->events_by_id_with_key, event_id_with_key);
+  GArray *event_sequence =
+    emtr_sequence_table_steal (priv->sequences, &sequence_key);
 
   if (event_sequence == NULL)
     {
-      g_variant_unref (event_id_with_key);
       if (key != NULL)
         {
           gchar *key_as_string = g_variant_print (key, TRUE);
-          g_variant_unref (key);
 
           g_warning ("Ignoring request to stop event of type %s with key %s "
                      "because there is no corresponding unstopped start "
@@ -580,28 +987,22 @@ record_stop (EmtrEventRecorder *self,
       goto finally;
     }
 
-  if (key != NULL)
-    g_variant_unref (key);
-
-  auxiliary_payload = get_normalized_form_of_variant (auxiliary_payload);
-
-  append_event_to_sequence (self, event_sequence, relative_time,
-                            auxiliary_payload);
+  emtr_event_recorder_append_event_to_sequence (event_sequence, relative_time,
+                                                auxiliary_payload);
 
-  if (auxiliary_payload != NULL)
-    g_variant_unref (auxiliary_payload);
-
-  GVariant *event_id_variant = g_variant_get_child_value (event_id_with_key, 0);
-  send_event_sequence_to_dbus (self, event_id_variant, event_sequence,
+  send_event_sequence_to_dbus (self, parsed_event_id, event_sequence,
                                is_synchronous);
-  g_variant_unref (event_id_variant);
-
-  g_assert (g_hash_table_remove (priv->events_by_id_with_key,
-                                 event_id_with_key));
-  g_variant_unref (event_id_with_key);
+  count_call_latency (self, relative_time);
 
 finally:
-  g_mutex_unlock (&priv->events_by_id_with_key_lock);
+  emtr_sequence_table_unlock (priv->sequences, &sequence_key);
+  emtr_sequence_key_clear (&sequence_key);
+  if (key != NULL)
+    g_variant_unref (key);
+
+  EMTR_TRACE (record__return,
+              is_synchronous ? "record_stop_sync" : "record_stop",
+              parsed_event_id);
 }
 
 /* PUBLIC API */
@@ -629,6 +1030,9 @@ emtr_event_recorder_new (void)
  * emtr_event_recorder_get_default:
  *
  * Gets the event recorder object that you should use to record all metrics.
+ * Its statistics are exported on the system bus if the
+ * `EOS_METRICS_CLIENT_STATS` environment variable is set to `1`; see
+ * #EmtrEventRecorder.
  *
  * Returns: (transfer none): the default #EmtrEventRecorder.
  * This object is owned by the metrics library; do not free it.
@@ -641,6 +1045,14 @@ emtr_event_recorder_get_default (void)
   if (g_once_init_enter (&singleton))
     {
       EmtrEventRecorder *retval = g_object_new (EMTR_TYPE_EVENT_RECORDER, NULL);
+
+      if (emtr_client_stats_requested ())
+        {
+          EmtrEventRecorderPrivate *priv =
+            emtr_event_recorder_get_instance_private (retval);
+          emtr_client_stats_export (retval, priv->sender);
+        }
+
       g_once_init_leave (&singleton, retval);
     }
 
@@ -679,6 +1091,10 @@ emtr_event_recorder_record_event (EmtrEventRecorder *self,
                                   const gchar       *event_id,
                                   GVariant          *auxiliary_payload)
 {
+  EmtrProfile profile;
+  if (!begin_recording (self, auxiliary_payload, &profile))
+    return;
+
   /* Get the time before doing anything else because it will change during
   execution. */
   gint64 relative_time;
@@ -687,14 +1103,16 @@ emtr_event_recorder_record_event (EmtrEventRecorder *self,
       g_critical ("Getting relative timestamp failed.");
       return;
     }
+  emtr_profile_phase (&profile, EMTR_PHASE_CLOCK);
 
   g_return_if_fail (EMTR_IS_EVENT_RECORDER (self));
   g_return_if_fail (event_id != NULL);
   g_return_if_fail (auxiliary_payload == NULL ||
                     _IS_VARIANT (auxiliary_payload));
 
-  if (contains_maybe_variant (auxiliary_payload))
+  if (emtr_event_recorder_contains_maybe_variant (auxiliary_payload))
     return;
+  emtr_profile_phase (&profile, EMTR_PHASE_CHECK_PAYLOAD);
 
 #ifdef DEBUG
   {
@@ -709,8 +1127,9 @@ emtr_event_recorder_record_event (EmtrEventRecorder *self,
              auxiliary_payload);
   }
 #endif /* DEBUG */
+  emtr_profile_phase (&profile, EMTR_PHASE_DEBUG_LOG);
 
-  record_events (self, event_id, auxiliary_payload, relative_time,
+  record_events (self, event_id, auxiliary_payload, relative_time, &profile,
                  FALSE /* is_synchronous */, FALSE /* is_aggregate */,
                  -1 /* num_events (ignored) */);
 }
@@ -739,6 +1158,10 @@ emtr_event_recorder_record_event_sync (EmtrEventRecorder *self,
                                        const gchar       *event_id,
                                        GVariant          *auxiliary_payload)
 {
+  EmtrProfile profile;
+  if (!begin_recording (self, auxiliary_payload, &profile))
+    return;
+
   /* Get the time before doing anything else because it will change during
    * execution.
    */
@@ -748,14 +1171,16 @@ emtr_event_recorder_record_event_sync (EmtrEventRecorder *self,
       g_critical ("Getting relative timestamp failed.");
       return;
     }
+  emtr_profile_phase (&profile, EMTR_PHASE_CLOCK);
 
   g_return_if_fail (EMTR_IS_EVENT_RECORDER (self));
   g_return_if_fail (event_id != NULL);
   g_return_if_fail (auxiliary_payload == NULL ||
                     _IS_VARIANT (auxiliary_payload));
 
-  if (contains_maybe_variant (auxiliary_payload))
+  if (emtr_event_recorder_contains_maybe_variant (auxiliary_payload))
     return;
+  emtr_profile_phase (&profile, EMTR_PHASE_CHECK_PAYLOAD);
 
 #ifdef DEBUG
   {
@@ -770,8 +1195,9 @@ emtr_event_recorder_record_event_sync (EmtrEventRecorder *self,
              auxiliary_payload);
   }
 #endif /* DEBUG */
+  emtr_profile_phase (&profile, EMTR_PHASE_DEBUG_LOG);
 
-  record_events (self, event_id, auxiliary_payload, relative_time,
+  record_events (self, event_id, auxiliary_payload, relative_time, &profile,
                  TRUE /* is_synchronous */, FALSE /* is_aggregate */,
                  -1 /* num_events (ignored) */);
 }
@@ -812,6 +1238,10 @@ emtr_event_recorder_record_events (EmtrEventRecorder *self,
                                    gint64             num_events,
                                    GVariant          *auxiliary_payload)
 {
+  EmtrProfile profile;
+  if (!begin_recording (self, auxiliary_payload, &profile))
+    return;
+
   /* Get the time before doing anything else because it will change during
   execution. */
   gint64 relative_time;
@@ -820,14 +1250,16 @@ emtr_event_recorder_record_events (EmtrEventRecorder *self,
       g_critical ("Getting relative timestamp failed.");
       return;
     }
+  emtr_profile_phase (&profile, EMTR_PHASE_CLOCK);
 
   g_return_if_fail (EMTR_IS_EVENT_RECORDER (self));
   g_return_if_fail (event_id != NULL);
   g_return_if_fail (auxiliary_payload == NULL ||
                     _IS_VARIANT (auxiliary_payload));
 
-  if (contains_maybe_variant (auxiliary_payload))
+  if (emtr_event_recorder_contains_maybe_variant (auxiliary_payload))
     return;
+  emtr_profile_phase (&profile, EMTR_PHASE_CHECK_PAYLOAD);
 
 #ifdef DEBUG
   {
@@ -842,8 +1274,9 @@ emtr_event_recorder_record_events (EmtrEventRecorder *self,
              "payload: %p", G_STRFUNC, event_id, num_events, auxiliary_payload);
   }
 #endif /* DEBUG */
+  emtr_profile_phase (&profile, EMTR_PHASE_DEBUG_LOG);
 
-  record_events (self, event_id, auxiliary_payload, relative_time,
+  record_events (self, event_id, auxiliary_payload, relative_time, &profile,
                  FALSE /* is_synchronous */, TRUE /* is_aggregate */,
                  num_events);
 }
@@ -875,6 +1308,10 @@ emtr_event_recorder_record_events_sync (EmtrEventRecorder *self,
                                         gint64             num_events,
                                         GVariant          *auxiliary_payload)
 {
+  EmtrProfile profile;
+  if (!begin_recording (self, auxiliary_payload, &profile))
+    return;
+
   /* Get the time before doing anything else because it will change during
    * execution.
    */
@@ -884,14 +1321,16 @@ emtr_event_recorder_record_events_sync (EmtrEventRecorder *self,
       g_critical ("Getting relative timestamp failed.");
       return;
     }
+  emtr_profile_phase (&profile, EMTR_PHASE_CLOCK);
 
   g_return_if_fail (EMTR_IS_EVENT_RECORDER (self));
   g_return_if_fail (event_id != NULL);
   g_return_if_fail (auxiliary_payload == NULL ||
                     _IS_VARIANT (auxiliary_payload));
 
-  if (contains_maybe_variant (auxiliary_payload))
+  if (emtr_event_recorder_contains_maybe_variant (auxiliary_payload))
     return;
+  emtr_profile_phase (&profile, EMTR_PHASE_CHECK_PAYLOAD);
 
 #ifdef DEBUG
   {
@@ -906,12 +1345,195 @@ emtr_event_recorder_record_events_sync (EmtrEventRecorder *self,
              "payload: %p", G_STRFUNC, event_id, num_events, auxiliary_payload);
   }
 #endif /* DEBUG */
+  emtr_profile_phase (&profile, EMTR_PHASE_DEBUG_LOG);
 
-  record_events (self, event_id, auxiliary_payload, relative_time,
+  record_events (self, event_id, auxiliary_payload, relative_time, &profile,
                  TRUE /* is_synchronous */, TRUE /* is_aggregate */,
                  num_events);
 }
 
+/**
+ * emtr_event_recorder_register_event:
+ * @self: (in): the event recorder
+ * @event_id: (in): an RFC 4122 UUID representing a type of event
+ *
+ * Parses @event_id once, so that events of that type can then be recorded with
+ * emtr_event_recorder_record_event_with_handle() and similar functions without
+ * parsing it again each time. This is worthwhile for events that are recorded
+ * very often.
+ *
+ * Returns: (transfer full) (nullable): a handle for @event_id, or %NULL if
+ * @event_id is not a valid UUID. Free with emtr_event_handle_unref().
+ *
+ * Since: 0.6
+ */
+EmtrEventHandle *
+emtr_event_recorder_register_event (EmtrEventRecorder *self,
+                                    const gchar       *event_id)
+{
+  uuid_t parsed_event_id;
+
+  g_return_val_if_fail (EMTR_IS_EVENT_RECORDER (self), NULL);
+  g_return_val_if_fail (event_id != NULL, NULL);
+
+  if (!emtr_event_recorder_parse_event_id (event_id, parsed_event_id))
+    return NULL;
+
+  return emtr_event_handle_new (parsed_event_id);
+}
+
+/**
+ * emtr_event_recorder_record_event_with_handle:
+ * @self: (in): the event recorder
+ * @handle: (in): a handle for the type of event that took place, as returned
+ * by emtr_event_recorder_register_event()
+ * @auxiliary_payload: (allow-none) (in): miscellaneous data to associate with
+ * the event. Must not contain maybe variants as they are not compatible with
+ * D-Bus.
+ *
+ * Behaves like emtr_event_recorder_record_event(), but takes an event ID that
+ * has already been parsed.
+ *
+ * Since: 0.6
+ */
+void
+emtr_event_recorder_record_event_with_handle (EmtrEventRecorder *self,
+                                              EmtrEventHandle   *handle,
+                                              GVariant          *auxiliary_payload)
+{
+  record_events_by_id (self, handle != NULL ? handle->event_id : NULL,
+                       auxiliary_payload, FALSE /* is_synchronous */,
+                       FALSE /* is_aggregate */,
+                       -1 /* num_events (ignored) */);
+}
+
+/**
+ * emtr_event_recorder_record_event_with_handle_sync:
+ * @self: (in): the event recorder
+ * @handle: (in): a handle for the type of event that took place, as returned
+ * by emtr_event_recorder_register_event()
+ * @auxiliary_payload: (allow-none) (in): miscellaneous data to associate with
+ * the event. Must not contain maybe variants as they are not compatible with
+ * D-Bus.
+ *
+ * Behaves like emtr_event_recorder_record_event_sync(), but takes an event ID
+ * that has already been parsed.
+ *
+ * Since: 0.6
+ */
+void
+emtr_event_recorder_record_event_with_handle_sync (EmtrEventRecorder *self,
+                                                   EmtrEventHandle   *handle,
+                                                   GVariant          *auxiliary_payload)
+{
+  record_events_by_id (self, handle != NULL ? handle->event_id : NULL,
+                       auxiliary_payload, TRUE /* is_synchronous */,
+                       FALSE /* is_aggregate */,
+                       -1 /* num_events (ignored) */);
+}
+
+/**
+ * emtr_event_recorder_record_events_with_handle:
+ * @self: (in): the event recorder
+ * @handle: (in): a handle for the type of event that took place, as returned
+ * by emtr_event_recorder_register_event()
+ * @num_events: (in): the number of times the event type took place
+ * @auxiliary_payload: (allow-none) (in): miscellaneous data to associate with
+ * the events. Must not contain maybe variants as they are not compatible with
+ * D-Bus.
+ *
+ * Behaves like emtr_event_recorder_record_events(), but takes an event ID that
+ * has already been parsed.
+ *
+ * Since: 0.6
+ */
+void
+emtr_event_recorder_record_events_with_handle (EmtrEventRecorder *self,
+                                               EmtrEventHandle   *handle,
+                                               gint64             num_events,
+                                               GVariant          *auxiliary_payload)
+{
+  record_events_by_id (self, handle != NULL ? handle->event_id : NULL,
+                       auxiliary_payload, FALSE /* is_synchronous */,
+                       TRUE /* is_aggregate */, num_events);
+}
+
+/**
+ * emtr_event_recorder_record_events_with_handle_sync:
+ * @self: (in): the event recorder
+ * @handle: (in): a handle for the type of event that took place, as returned
+ * by emtr_event_recorder_register_event()
+ * @num_events: (in): the number of times the event type took place
+ * @auxiliary_payload: (allow-none) (in): miscellaneous data to associate with
+ * the events. Must not contain maybe variants as they are not compatible with
+ * D-Bus.
+ *
+ * Behaves like emtr_event_recorder_record_events_sync(), but takes an event ID
+ * that has already been parsed.
+ *
+ * Since: 0.6
+ */
+void
+emtr_event_recorder_record_events_with_handle_sync (EmtrEventRecorder *self,
+                                                    EmtrEventHandle   *handle,
+                                                    gint64             num_events,
+                                                    GVariant          *auxiliary_payload)
+{
+  record_events_by_id (self, handle != NULL ? handle->event_id : NULL,
+                       auxiliary_payload, TRUE /* is_synchronous */,
+                       TRUE /* is_aggregate */, num_events);
+}
+
+/**
+ * emtr_event_recorder_record_event_with_id:
+ * @self: (in): the event recorder
+ * @event_id: (in) (array fixed-size=16): the 16 bytes of an RFC 4122 UUID
+ * representing the type of event that took place, in network byte order
+ * @auxiliary_payload: (allow-none) (in): miscellaneous data to associate with
+ * the event. Must not contain maybe variants as they are not compatible with
+ * D-Bus.
+ *
+ * Behaves like emtr_event_recorder_record_event(), but takes the binary form of
+ * the event ID, as produced by uuid_parse() for example.
+ *
+ * Since: 0.6
+ */
+void
+emtr_event_recorder_record_event_with_id (EmtrEventRecorder *self,
+                                          const guint8      *event_id,
+                                          GVariant          *auxiliary_payload)
+{
+  record_events_by_id (self, event_id, auxiliary_payload,
+                       FALSE /* is_synchronous */, FALSE /* is_aggregate */,
+                       -1 /* num_events (ignored) */);
+}
+
+/**
+ * emtr_event_recorder_record_events_with_id:
+ * @self: (in): the event recorder
+ * @event_id: (in) (array fixed-size=16): the 16 bytes of an RFC 4122 UUID
+ * representing the type of event that took place, in network byte order
+ * @num_events: (in): the number of times the event type took place
+ * @auxiliary_payload: (allow-none) (in): miscellaneous data to associate with
+ * the events. Must not contain maybe variants as they are not compatible with
+ * D-Bus.
+ *
+ * Behaves like emtr_event_recorder_record_events(), but takes the binary form
+ * of the event ID, as produced by uuid_parse() for example.
+ *
+ * Since: 0.6
+ */
+void
+emtr_event_recorder_record_events_with_id (EmtrEventRecorder *self,
+                                           const guint8      *event_id,
+                                           gint64             num_events,
+                                           GVariant          *auxiliary_payload)
+{
+  record_events_by_id (self, event_id, auxiliary_payload,
+                       FALSE /* is_synchronous */, TRUE /* is_aggregate */,
+                       num_events);
+}
+
 /**
  * emtr_event_recorder_record_start:
  * @self: (in): the event recorder
@@ -958,6 +1580,9 @@ emtr_event_recorder_record_start (EmtrEventRecorder *self,
                                   GVariant          *key,
                                   GVariant          *auxiliary_payload)
 {
+  if (!recording_is_enabled (self, key, auxiliary_payload))
+    return;
+
   /* Validate inputs before acquiring the lock below to avoid verbose error
      handling that releases the lock and logs a custom error message. */
   g_return_if_fail (EMTR_IS_EVENT_RECORDER (self));
@@ -966,7 +1591,7 @@ emtr_event_recorder_record_start (EmtrEventRecorder *self,
   g_return_if_fail (auxiliary_payload == NULL ||
                     _IS_VARIANT (auxiliary_payload));
 
-  if (contains_maybe_variant (auxiliary_payload))
+  if (emtr_event_recorder_contains_maybe_variant (auxiliary_payload))
     return;
 
 #ifdef DEBUG
@@ -988,12 +1613,22 @@ emtr_event_recorder_record_start (EmtrEventRecorder *self,
   EmtrEventRecorderPrivate *priv =
     emtr_event_recorder_get_instance_private (self);
 
-  if (!priv->recording_enabled)
+  uuid_t parsed_event_id;
+  if (!emtr_event_recorder_parse_event_id (event_id, parsed_event_id))
     return;
 
-  /* Acquire this lock before getting the time so that event sequences are
+  if (EMTR_TRACE_ENABLED (record__entry))
+    EMTR_TRACE (record__entry, "record_start", parsed_event_id,
+                emtr_trace_payload_size (auxiliary_payload));
+
+  EmtrSequenceKey sequence_key;
+  if (key != NULL)
+    g_variant_ref_sink (key);
+  emtr_sequence_key_init (&sequence_key, parsed_event_id, key);
+
+  /* Lock the sequence before getting the time so that event sequences are
      guaranteed to be chronologically sorted. */
-  g_mutex_lock (&priv->events_by_id_with_key_lock);
+  emtr_sequence_table_lock (priv->sequences, &sequence_key);
 
   // Get the time as soon as possible because it will change during execution.
   gint64 relative_time;
@@ -1003,30 +1638,16 @@ emtr_event_recorder_record_start (EmtrEventRecorder *self,
       goto finally;
     }
 
-  uuid_t parsed_event_id;
-  if (!parse_event_id (event_id, parsed_event_id))
-    goto finally;
-
-  key = get_normalized_form_of_variant (key);
+  GArray *event_sequence = emtr_event_recorder_new_event_sequence ();
+  emtr_event_recorder_append_event_to_sequence (event_sequence, relative_time,
+                                                auxiliary_payload);
 
-  GVariant *event_id_with_key = combine_event_id_with_key (parsed_event_id,
-                                                           key);
-
-  auxiliary_payload = get_normalized_form_of_variant (auxiliary_payload);
-  GPtrArray *event_sequence =
-    g_ptr_array_new_full (2u, (GDestroyNotify) g_variant_unref);
-  append_event_to_sequence (self, event_sequence, relative_time,
-                            auxiliary_payload);
-  if (auxiliary_payload != NULL)
-    g_variant_unref (auxiliary_payload);
-
-  if (!g_hash_table_insert (priv->events_by_id_with_key, event_id_with_key,
-                            event_sequence))
+  if (!emtr_sequence_table_insert (priv->sequences, &sequence_key,
+                                   event_sequence))
     {
       if (key != NULL)
         {
           gchar *key_as_string = g_variant_print (key, TRUE);
-          g_variant_unref (key);
 
           g_warning ("Restarted event of type %s with key %s; there was "
                      "already an unstopped start event with this "
@@ -1040,14 +1661,17 @@ emtr_event_recorder_record_start (EmtrEventRecorder *self,
                      "already an unstopped start event with this type and key.",
                      event_id);
         }
-      goto finally;
     }
 
+  count_call_latency (self, relative_time);
+
+finally:
+  emtr_sequence_table_unlock (priv->sequences, &sequence_key);
+  emtr_sequence_key_clear (&sequence_key);
   if (key != NULL)
     g_variant_unref (key);
 
-finally:
-  g_mutex_unlock (&priv->events_by_id_with_key_lock);
+  EMTR_TRACE (record__return, "record_start", parsed_event_id);
 }
 
 /**
@@ -1072,6 +1696,9 @@ emtr_event_recorder_record_progress (EmtrEventRecorder *self,
                                      GVariant          *key,
                                      GVariant          *auxiliary_payload)
 {
+  if (!recording_is_enabled (self, key, auxiliary_payload))
+    return;
+
   /* Validate inputs before acquiring the lock below to avoid verbose error
      handling that releases the lock and logs a custom error message. */
   g_return_if_fail (EMTR_IS_EVENT_RECORDER (self));
@@ -1080,7 +1707,7 @@ emtr_event_recorder_record_progress (EmtrEventRecorder *self,
   g_return_if_fail (auxiliary_payload == NULL ||
                     _IS_VARIANT (auxiliary_payload));
 
-  if (contains_maybe_variant (auxiliary_payload))
+  if (emtr_event_recorder_contains_maybe_variant (auxiliary_payload))
     return;
 
 #ifdef DEBUG
@@ -1102,12 +1729,22 @@ emtr_event_recorder_record_progress (EmtrEventRecorder *self,
   EmtrEventRecorderPrivate *priv =
     emtr_event_recorder_get_instance_private (self);
 
-  if (!priv->recording_enabled)
+  uuid_t parsed_event_id;
+  if (!emtr_event_recorder_parse_event_id (event_id, parsed_event_id))
     return;
 
-  /* Acquire this lock before getting the time so that event sequences are
+  if (EMTR_TRACE_ENABLED (record__entry))
+    EMTR_TRACE (record__entry, "record_progress", parsed_event_id,
+                emtr_trace_payload_size (auxiliary_payload));
+
+  EmtrSequenceKey sequence_key;
+  if (key != NULL)
+    g_variant_ref_sink (key);
+  emtr_sequence_key_init (&sequence_key, parsed_event_id, key);
+
+  /* Lock the sequence before getting the time so that event sequences are
      guaranteed to be chronologically sorted. */
-  g_mutex_lock (&priv->events_by_id_with_key_lock);
+  emtr_sequence_table_lock (priv->sequences, &sequence_key);
 
   // Get the time as soon as possible because it will change during execution.
   gint64 relative_time;
@@ -1117,24 +1754,14 @@ emtr_event_recorder_record_progress (EmtrEventRecorder *self,
       goto finally;
     }
 
-  uuid_t parsed_event_id;
-  if (!parse_event_id (event_id, parsed_event_id))
-    goto finally;
-
-  key = get_normalized_form_of_variant (key);
-
-  GVariant *event_id_with_key =
-    combine_event_id_with_key (parsed_event_id, key);
-  GPtrArray *event_sequence =
-    g_hash_table_lookup (priv->events_by_id_with_key, event_id_with_key);
-  g_variant_unref (event_id_with_key);
+  GArray *event_sequence =
+    emtr_sequence_table_lookup (priv->sequences, &sequence_key);
 
   if (event_sequence == NULL)
     {
       if (key != NULL)
         {
           gchar *key_as_string = g_variant_print (key, TRUE);
-          g_variant_unref (key);
 
           g_warning ("Ignoring request to record progress for event of type %s "
                      "with key %s because there is no corresponding unstopped "
@@ -1151,19 +1778,17 @@ emtr_event_recorder_record_progress (EmtrEventRecorder *self,
       goto finally;
     }
 
+  emtr_event_recorder_append_event_to_sequence (event_sequence, relative_time,
+                                                auxiliary_payload);
+  count_call_latency (self, relative_time);
+
+finally:
+  emtr_sequence_table_unlock (priv->sequences, &sequence_key);
+  emtr_sequence_key_clear (&sequence_key);
   if (key != NULL)
     g_variant_unref (key);
 
-  auxiliary_payload = get_normalized_form_of_variant (auxiliary_payload);
-
-  append_event_to_sequence (self, event_sequence, relative_time,
-                            auxiliary_payload);
-
-  if (auxiliary_payload != NULL)
-    g_variant_unref (auxiliary_payload);
-
-finally:
-  g_mutex_unlock (&priv->events_by_id_with_key_lock);
+  EMTR_TRACE (record__return, "record_progress", parsed_event_id);
 }
 
 /**
@@ -1186,6 +1811,9 @@ emtr_event_recorder_record_stop (EmtrEventRecorder *self,
                                  GVariant          *key,
                                  GVariant          *auxiliary_payload)
 {
+  if (!recording_is_enabled (self, key, auxiliary_payload))
+    return;
+
   /* Validate inputs before acquiring the lock in record_stop to avoid verbose
      error handling that releases the lock and logs a custom error message. */
   g_return_if_fail (EMTR_IS_EVENT_RECORDER (self));
@@ -1194,7 +1822,7 @@ emtr_event_recorder_record_stop (EmtrEventRecorder *self,
   g_return_if_fail (auxiliary_payload == NULL ||
                     _IS_VARIANT (auxiliary_payload));
 
-  if (contains_maybe_variant (auxiliary_payload))
+  if (emtr_event_recorder_contains_maybe_variant (auxiliary_payload))
     return;
 
 #ifdef DEBUG
@@ -1244,6 +1872,9 @@ emtr_event_recorder_record_stop_sync (EmtrEventRecorder *self,
                                       GVariant          *key,
                                       GVariant          *auxiliary_payload)
 {
+  if (!recording_is_enabled (self, key, auxiliary_payload))
+    return;
+
   /* Validate inputs before acquiring the lock in record_stop to avoid verbose
      error handling that releases the lock and logs a custom error message. */
   g_return_if_fail (EMTR_IS_EVENT_RECORDER (self));
@@ -1252,7 +1883,7 @@ emtr_event_recorder_record_stop_sync (EmtrEventRecorder *self,
   g_return_if_fail (auxiliary_payload == NULL ||
                     _IS_VARIANT (auxiliary_payload));
 
-  if (contains_maybe_variant (auxiliary_payload))
+  if (emtr_event_recorder_contains_maybe_variant (auxiliary_payload))
     return;
 
 #ifdef DEBUG
@@ -1275,6 +1906,211 @@ emtr_event_recorder_record_stop_sync (EmtrEventRecorder *self,
                TRUE /* is_synchronous */);
 }
 
+/**
+ * emtr_event_recorder_flush_sync:
+ * @self: (in): the event recorder
+ *
+ * Sends all asynchronously recorded events that are still buffered, blocking
+ * until either a timeout expires or the event recorder daemon has received
+ * them. Call this before a process that recorded events with
+ * emtr_event_recorder_record_event() or the other asynchronous functions
+ * closes, so that the events are not lost; for the same reason, it is also
+ * called when the event recorder is finalized.
+ *
+ * Since: 0.6
+ */
+void
+emtr_event_recorder_flush_sync (EmtrEventRecorder *self)
+{
+  g_return_if_fail (EMTR_IS_EVENT_RECORDER (self));
+
+  EmtrEventRecorderPrivate *priv =
+    emtr_event_recorder_get_instance_private (self);
+
+  emtr_event_sender_flush_sync (priv->sender);
+}
+
+/**
+ * emtr_event_recorder_get_stats:
+ * @self: (in): the event recorder
+ *
+ * Returns counters of what happened to the events recorded with @self since
+ * it was created, to find out whether events are being lost and how much
+ * recording costs. Counting is cheap enough to always be on, and this may be
+ * called from any thread. Events that are being recorded concurrently may or
+ * may not be counted.
+ *
+ * The counters are returned as a dictionary of type `a{sv}`, with these
+ * entries:
+ *
+ * - `events-recorded` (`t`): the events and event sequences that have been
+ *   recorded while recording was enabled
+ * - `events-sent` (`t`): the records that have been handed to the daemon.
+ *   Aggregate events that were summed up over the aggregation window count as
+ *   one record, and records reporting dropped events count too.
+ * - `events-dropped` (`t`): the records that were dropped, for lack of room,
+ *   because recording was disabled, or because the daemon could not be
+ *   reached for too long
+ * - `events-failed` (`t`): the records that the daemon failed to record.
+ *   Failures are only noticed when waiting for replies, see
+ *   #EmtrEventRecorder:wait-for-replies.
+ * - `events` (`a{sa{st}}`): the same four counts per event ID, as
+ *   `recorded`, `sent`, `dropped` and `failed`
+ * - `bytes-serialized` (`t`): the size of the records that have been sent
+ * - `sequences-in-progress` (`u`): the event sequences that have been started
+ *   but not stopped
+ * - `sequences-memory` (`t`): an estimate of the bytes taken up by those
+ *   sequences
+ * - `sequence-lock-contentions` (`t`): the times that recording an event
+ *   sequence had to wait for another thread recording one, which happens
+ *   when they share a key or when their keys hash alike
+ * - `sequence-lock-wait-ns` (`t`): the nanoseconds spent in those waits
+ * - `calls-in-flight` (`u`): the asynchronous messages that have been sent to
+ *   the daemon and not written out or replied to yet
+ * - `aggregate-timers` (`u`): the aggregate timers that have been started and
+ *   not stopped or freed
+ * - `profiling` (`b`): the value of #EmtrEventRecorder:profile-phases
+ * - `phases` (`a{s(tt)}`): while profiling, the number of times each step of
+ *   recording was timed and the total nanoseconds spent in it, by step:
+ *   `clock`, `check-payload`, `debug-log`, `parse-event-id` and `enqueue` in
+ *   the recording functions, and `normalize`, `box`, `build-record`,
+ *   `build-batch` and `send` on the sender thread. Steps that were never
+ *   timed are left out.
+ * - `phases-by-event` (`a{sa{s(tt)}}`): the same, per event ID, for the steps
+ *   that concern a single event ID. Batches are shared by several event IDs,
+ *   so `build-batch` and asynchronous sends only appear in `phases`.
+ *
+ * More entries may be added in the future.
+ *
+ * Returns: (transfer full): the counters, as a new non-floating #GVariant
+ *
+ * Since: 0.6
+ */
+GVariant *
+emtr_event_recorder_get_stats (EmtrEventRecorder *self)
+{
+  g_return_val_if_fail (EMTR_IS_EVENT_RECORDER (self), NULL);
+
+  EmtrEventRecorderPrivate *priv =
+    emtr_event_recorder_get_instance_private (self);
+  GVariantBuilder builder;
+  guint num_sequences;
+  gsize sequences_size;
+  guint64 num_lock_contentions, lock_wait_time;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+  emtr_stats_snapshot (emtr_event_sender_get_stats (priv->sender), &builder);
+
+  emtr_sequence_table_get_usage (priv->sequences, &num_sequences,
+                                 &sequences_size);
+  g_variant_builder_add (&builder, "{sv}", "sequences-in-progress",
+                         g_variant_new_uint32 (num_sequences));
+  g_variant_builder_add (&builder, "{sv}", "sequences-memory",
+                         g_variant_new_uint64 (sequences_size));
+
+  emtr_sequence_table_get_lock_stats (priv->sequences, &num_lock_contentions,
+                                      &lock_wait_time);
+  g_variant_builder_add (&builder, "{sv}", "sequence-lock-contentions",
+                         g_variant_new_uint64 (num_lock_contentions));
+  g_variant_builder_add (&builder, "{sv}", "sequence-lock-wait-ns",
+                         g_variant_new_uint64 (lock_wait_time));
+
+  g_variant_builder_add (&builder, "{sv}", "calls-in-flight",
+                         g_variant_new_uint32 (emtr_event_sender_get_num_in_flight (priv->sender)));
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+/**
+ * emtr_event_recorder_get_recent_events:
+ * @self: (in): the event recorder
+ *
+ * Returns the last things that happened to the events recorded with @self,
+ * oldest first, to find out what a process recorded just before it
+ * misbehaved. A fixed number of entries is kept, and keeping them never
+ * allocates or takes locks, so this is always on. May be called from any
+ * thread.
+ *
+ * The entries are returned as an array of type `a(sxssuu)`, each with:
+ *
+ * - the event ID, as a string
+ * - the relative time of the event, or of the last event of a sequence, in
+ *   nanoseconds
+ * - the kind of record: `singular`, `aggregate` or `sequence`
+ * - what happened to it: `recorded`, `sent`, `dropped` or `failed`, in the
+ *   sense of the counters returned by emtr_event_recorder_get_stats()
+ * - the size of its serialized auxiliary payloads, in bytes
+ * - a 32-bit FNV-1a hash of its serialized auxiliary payloads
+ *
+ * A record that is recorded and then sent has an entry for each. The size and
+ * hash are 0 for records that were dropped before being serialized.
+ *
+ * Returns: (transfer full): the entries, as a new non-floating #GVariant
+ *
+ * Since: 0.6
+ */
+GVariant *
+emtr_event_recorder_get_recent_events (EmtrEventRecorder *self)
+{
+  g_return_val_if_fail (EMTR_IS_EVENT_RECORDER (self), NULL);
+
+  EmtrEventRecorderPrivate *priv =
+    emtr_event_recorder_get_instance_private (self);
+
+  return g_variant_ref_sink (emtr_event_sender_get_recent_events (priv->sender));
+}
+
+/**
+ * emtr_event_recorder_get_latency_histogram:
+ * @self: (in): the event recorder
+ * @kind: (in): the latency to return the histogram of
+ *
+ * Returns the distribution of the latencies of @kind measured since @self was
+ * created, or since emtr_event_recorder_reset_latency_histograms() was last
+ * called. Latencies are measured on every call, and this may be called from
+ * any thread.
+ *
+ * Returns: (transfer full): a snapshot of the histogram, which does not change
+ *   as more latencies are measured
+ *
+ * Since: 0.6
+ */
+EmtrLatencyHistogram *
+emtr_event_recorder_get_latency_histogram (EmtrEventRecorder *self,
+                                           EmtrLatencyKind    kind)
+{
+  g_return_val_if_fail (EMTR_IS_EVENT_RECORDER (self), NULL);
+  g_return_val_if_fail ((guint) kind < EMTR_NUM_LATENCY_KINDS, NULL);
+
+  EmtrEventRecorderPrivate *priv =
+    emtr_event_recorder_get_instance_private (self);
+
+  return emtr_stats_get_latency_histogram (emtr_event_sender_get_stats (priv->sender),
+                                           kind);
+}
+
+/**
+ * emtr_event_recorder_reset_latency_histograms:
+ * @self: (in): the event recorder
+ *
+ * Forgets the latencies of all kinds that have been measured so far, for
+ * example to measure them over a given period. Latencies that are measured
+ * concurrently may or may not be forgotten.
+ *
+ * Since: 0.6
+ */
+void
+emtr_event_recorder_reset_latency_histograms (EmtrEventRecorder *self)
+{
+  g_return_if_fail (EMTR_IS_EVENT_RECORDER (self));
+
+  EmtrEventRecorderPrivate *priv =
+    emtr_event_recorder_get_instance_private (self);
+
+  emtr_stats_reset_latencies (emtr_event_sender_get_stats (priv->sender));
+}
+
 /**
  * emtr_event_recorder_start_aggregate_timer:
  * @self: an #EmtrEventRecorder
@@ -1324,23 +2160,20 @@ emtr_event_recorder_start_aggregate_timer_with_uid (EmtrEventRecorder *self,
   g_return_val_if_fail (auxiliary_payload == NULL ||
                         _IS_VARIANT (auxiliary_payload), NULL);
 
-  if (contains_maybe_variant (auxiliary_payload))
-    return NULL;
-
-  if (!priv->recording_enabled)
+  if (emtr_event_recorder_contains_maybe_variant (auxiliary_payload))
     return NULL;
 
-  if (!parse_event_id (event_id, parsed_event_id))
+  if (!emtr_event_recorder_parse_event_id (event_id, parsed_event_id))
     return NULL;
 
-  get_uuid_builder (parsed_event_id, &event_id_builder);
+  emtr_event_recorder_get_uuid_builder (parsed_event_id, &event_id_builder);
 
   if (auxiliary_payload == NULL)
     maybe_payload = priv->empty_auxiliary_payload;
   else
     maybe_payload = g_variant_new_variant (auxiliary_payload);
 
-  return emtr_aggregate_timer_new (priv->dbus_proxy,
+  return emtr_aggregate_timer_new (priv->sender,
                                    uid,
                                    g_variant_builder_end (&event_id_builder),
                                    auxiliary_payload != NULL,
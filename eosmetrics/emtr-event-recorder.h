@@ -80,6 +80,11 @@ struct _EmtrEventRecorderClass
   GObjectClass parent_class;
 };
 
+#define EMTR_TYPE_DROP_POLICY (emtr_drop_policy_get_type ())
+
+EMTR_AVAILABLE_IN_0_6
+GType              emtr_drop_policy_get_type              (void) G_GNUC_CONST;
+
 EMTR_AVAILABLE_IN_0_0
 GType              emtr_event_recorder_get_type           (void) G_GNUC_CONST;
 
@@ -111,6 +116,43 @@ void               emtr_event_recorder_record_events_sync (EmtrEventRecorder *se
                                                            gint64             num_events,
                                                            GVariant          *auxiliary_payload);
 
+EMTR_AVAILABLE_IN_0_6
+EmtrEventHandle   *emtr_event_recorder_register_event     (EmtrEventRecorder *self,
+                                                           const gchar       *event_id);
+
+EMTR_AVAILABLE_IN_0_6
+void               emtr_event_recorder_record_event_with_handle       (EmtrEventRecorder *self,
+                                                                       EmtrEventHandle   *handle,
+                                                                       GVariant          *auxiliary_payload);
+
+EMTR_AVAILABLE_IN_0_6
+void               emtr_event_recorder_record_event_with_handle_sync  (EmtrEventRecorder *self,
+                                                                       EmtrEventHandle   *handle,
+                                                                       GVariant          *auxiliary_payload);
+
+EMTR_AVAILABLE_IN_0_6
+void               emtr_event_recorder_record_events_with_handle      (EmtrEventRecorder *self,
+                                                                       EmtrEventHandle   *handle,
+                                                                       gint64             num_events,
+                                                                       GVariant          *auxiliary_payload);
+
+EMTR_AVAILABLE_IN_0_6
+void               emtr_event_recorder_record_events_with_handle_sync (EmtrEventRecorder *self,
+                                                                       EmtrEventHandle   *handle,
+                                                                       gint64             num_events,
+                                                                       GVariant          *auxiliary_payload);
+
+EMTR_AVAILABLE_IN_0_6
+void               emtr_event_recorder_record_event_with_id  (EmtrEventRecorder *self,
+                                                              const guint8      *event_id,
+                                                              GVariant          *auxiliary_payload);
+
+EMTR_AVAILABLE_IN_0_6
+void               emtr_event_recorder_record_events_with_id (EmtrEventRecorder *self,
+                                                              const guint8      *event_id,
+                                                              gint64             num_events,
+                                                              GVariant          *auxiliary_payload);
+
 EMTR_AVAILABLE_IN_0_0
 void               emtr_event_recorder_record_start       (EmtrEventRecorder *self,
                                                            const gchar       *event_id,
@@ -135,6 +177,22 @@ void               emtr_event_recorder_record_stop_sync   (EmtrEventRecorder *se
                                                            GVariant          *key,
                                                            GVariant          *auxiliary_payload);
 
+EMTR_AVAILABLE_IN_0_6
+void               emtr_event_recorder_flush_sync         (EmtrEventRecorder *self);
+
+EMTR_AVAILABLE_IN_0_6
+GVariant          *emtr_event_recorder_get_stats          (EmtrEventRecorder *self);
+
+EMTR_AVAILABLE_IN_0_6
+GVariant          *emtr_event_recorder_get_recent_events  (EmtrEventRecorder *self);
+
+EMTR_AVAILABLE_IN_0_6
+EmtrLatencyHistogram *emtr_event_recorder_get_latency_histogram (EmtrEventRecorder *self,
+                                                                 EmtrLatencyKind    kind);
+
+EMTR_AVAILABLE_IN_0_6
+void               emtr_event_recorder_reset_latency_histograms (EmtrEventRecorder *self);
+
 EMTR_AVAILABLE_IN_0_5
 EmtrAggregateTimer *emtr_event_recorder_start_aggregate_timer (EmtrEventRecorder *self,
                                                                const gchar       *event_id,
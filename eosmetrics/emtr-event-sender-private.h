@@ -0,0 +1,127 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "emer-event-recorder-server.h"
+#include "emtr-enums.h"
+#include "emtr-stats-private.h"
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The number of bytes in a parsed event ID */
+#define EMTR_EVENT_ID_LENGTH 16
+
+/*
+ * The kinds of records that the sender delivers to the daemon. They may be
+ * batched together in a single RecordEvents call, in which each kind is sent
+ * as a separate array argument.
+ */
+typedef enum
+{
+  EMTR_RECORD_SINGULAR_EVENT,
+  EMTR_RECORD_AGGREGATE_EVENT,
+  EMTR_RECORD_EVENT_SEQUENCE,
+  EMTR_NUM_RECORD_KINDS
+} EmtrRecordKind;
+
+/* One event of an event sequence that has not been sent yet */
+typedef struct
+{
+  gint64 relative_time;
+  GVariant *payload; /* (owned) (nullable): not yet in normal form */
+} EmtrSequenceEvent;
+
+typedef struct _EmtrEventSender EmtrEventSender;
+
+/* Called from the sender thread with the proxy of the daemon, or NULL if
+   connecting to it failed */
+typedef void (*EmtrProxyCallback) (EmerEventRecorderServer *dbus_proxy,
+                                   gpointer                 user_data);
+
+EmtrEventSender *emtr_event_sender_new                 (void);
+
+void             emtr_event_sender_free                (EmtrEventSender         *self);
+
+GMainContext    *emtr_event_sender_get_context         (EmtrEventSender         *self);
+
+void             emtr_event_sender_invoke_with_proxy   (EmtrEventSender         *self,
+                                                        EmtrProxyCallback        callback,
+                                                        gpointer                 user_data,
+                                                        GDestroyNotify           destroy_user_data);
+
+EmtrStats       *emtr_event_sender_get_stats           (EmtrEventSender         *self);
+
+guint            emtr_event_sender_get_num_in_flight   (EmtrEventSender         *self);
+
+GVariant        *emtr_event_sender_get_recent_events   (EmtrEventSender         *self);
+
+void             emtr_event_sender_add_queue_depths    (EmtrEventSender         *self,
+                                                        GVariantBuilder         *builder);
+
+gboolean         emtr_event_sender_is_enabled          (EmtrEventSender         *self);
+
+void             emtr_event_sender_set_max_batch_size  (EmtrEventSender         *self,
+                                                        guint                    max_batch_size);
+
+void             emtr_event_sender_set_flush_interval  (EmtrEventSender         *self,
+                                                        guint                    flush_interval_ms);
+
+void             emtr_event_sender_set_aggregation_window
+                                                       (EmtrEventSender         *self,
+                                                        guint                    aggregation_window_ms);
+
+void             emtr_event_sender_set_wait_for_replies
+                                                       (EmtrEventSender         *self,
+                                                        gboolean                 wait_for_replies);
+
+void             emtr_event_sender_set_memfd_threshold (EmtrEventSender         *self,
+                                                        guint                    memfd_threshold);
+
+void             emtr_event_sender_set_max_queued_bytes
+                                                       (EmtrEventSender         *self,
+                                                        guint                    max_queued_bytes);
+
+void             emtr_event_sender_set_max_in_flight   (EmtrEventSender         *self,
+                                                        guint                    max_in_flight);
+
+void             emtr_event_sender_set_drop_policy     (EmtrEventSender         *self,
+                                                        EmtrDropPolicy           drop_policy,
+                                                        guint                    block_timeout_ms);
+
+void             emtr_event_sender_send_event          (EmtrEventSender         *self,
+                                                        EmtrRecordKind           kind,
+                                                        const guchar            *event_id,
+                                                        gint64                   relative_time,
+                                                        gint64                   num_events,
+                                                        GVariant                *payload,
+                                                        gboolean                 is_synchronous);
+
+void             emtr_event_sender_send_event_sequence (EmtrEventSender         *self,
+                                                        const guchar            *event_id,
+                                                        GArray                  *events,
+                                                        gboolean                 is_synchronous);
+
+void             emtr_event_sender_flush_sync          (EmtrEventSender         *self);
+
+G_END_DECLS
@@ -0,0 +1,3894 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/* For memfd_create() and file sealing */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "emtr-event-sender-private.h"
+#include "emtr-flight-recorder-private.h"
+#include "emtr-shm-ring-private.h"
+#include "emtr-spool-private.h"
+#include "emtr-stats-private.h"
+#include "emtr-trace-private.h"
+#include "eosmetrics/emtr-util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include <uuid/uuid.h>
+
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+#include <glib.h>
+#include <glib-unix.h>
+
+#if defined (MFD_ALLOW_SEALING) && defined (F_ADD_SEALS)
+#define HAVE_SEALED_MEMFD 1
+#endif
+
+/*
+ * The event sender owns a thread with its own main context, from which all
+ * D-Bus calls that deliver events to the daemon are made. Recording threads
+ * only copy the already validated event into a record and hand it over.
+ * Normalizing payloads, building the GVariants that are sent, batching and
+ * talking to the bus all happen on the sender thread, so that the cost of
+ * recording an event does not depend on the state of the bus, and the replies
+ * to asynchronous calls are dispatched even if the recording thread never runs
+ * a main loop.
+ *
+ * Each recording thread gets its own single-producer, single-consumer ring of
+ * fixed-size records for asynchronous events, so that threads recording
+ * concurrently never contend on a lock or on a shared cache line. Synchronous
+ * records, flush requests and records that do not fit in a full ring go
+ * through a shared GAsyncQueue instead. The sender thread merges what it
+ * drains by timestamp, so that events are sent in chronological order.
+ *
+ * Records are drained by a source whose ready time is set by the recording
+ * threads: immediately for synchronous records or once a ring holds
+ * max_batch_size records, and otherwise flush_interval_ms after a record found
+ * its ring empty.
+ *
+ * Creating a sender only allocates memory. The thread is started when the
+ * first record is handed over, and the connection to the daemon is made
+ * asynchronously from the thread when the first records are drained. Records
+ * drained before the connection is ready are held, up to
+ * MAX_PRECONNECT_RECORDS of them.
+ *
+ * None of the daemon's methods report anything but D-Bus errors, so unless
+ * wait_for_replies is set, asynchronous records are sent as messages that
+ * expect no reply, straight on the proxy's connection. Until a RecordEvents
+ * call has succeeded, batches are still sent with a reply, because an error
+ * is how daemons that predate RecordEvents are told apart.
+ *
+ * Asynchronous batches that are sent with a reply are kept until the daemon
+ * acknowledges them. After a transient failure, such as the daemon not
+ * replying within BATCH_CALL_TIMEOUT_MS, they are sent again with exponential
+ * backoff and jitter, until RETRY_DEADLINE_S after they were first sent. Each
+ * batch carries a client-id option, a random UUID per sender, and a
+ * sequence-number option that increases with each batch, so that the daemon
+ * can drop batches that it receives twice. Batches that are sent again may
+ * arrive after later ones.
+ *
+ * If the daemon hands out the address of a private socket through
+ * GetDirectAddress, records are sent over a peer-to-peer connection to that
+ * socket, so that they bypass the bus daemon. The bus is used if the daemon
+ * does not offer one, if connecting to it fails, or once it is closed. The
+ * daemon's properties and aggregate timers always go through the bus.
+ *
+ * If the daemon also hands out an event ring through OpenEventRing, batched
+ * records are copied into memory shared with it instead, and the daemon is
+ * woken up once per batch; see emtr-shm-ring.c. D-Bus calls are used for
+ * synchronous records, for whatever does not fit in the ring, and if the
+ * daemon has no ring to offer.
+ *
+ * Batches of at least memfd_threshold bytes are written to a sealed memfd,
+ * which is passed to RecordEventsFromFd, so that large payloads cross the bus
+ * as a file descriptor rather than being copied into the message and again by
+ * the bus daemon. Smaller batches are sent inline.
+ *
+ * While the daemon is unavailable, because the system bus cannot be reached or
+ * because nobody owns its name, records are appended to a spool in the user's
+ * cache directory instead of being sent; see emtr-spool.c. The spool is
+ * replayed, along with what other processes left in it, once the daemon's name
+ * has an owner again. It is replayed as far as the in-flight window and half
+ * of max_queued_bytes have room, so that replayed records are never dropped,
+ * and the rest once messages in flight complete. If the system bus could not
+ * be reached, connecting to it is tried again after a delay that doubles with
+ * each attempt, up to RECONNECT_MAX_DELAY_S, so that the spool is replayed
+ * once it is back.
+ * Asynchronous records that were already sent when the daemon went away are
+ * lost.
+ *
+ * The memory taken up by records that have not been sent is bounded. At most
+ * max_in_flight messages carrying records are sent asynchronously without
+ * having been written out or replied to; further batches are held back until
+ * one of them completes. Records waiting to be batched take up at most
+ * max_queued_bytes, past which the drop policy applies: either the newest
+ * records are dropped, by recording threads as long as the sender is
+ * congested, or the oldest waiting records are dropped to make room, or
+ * recording threads wait for room for up to block_timeout_ms before dropping
+ * their records. Records that do not fit in a thread's ring also count
+ * against MAX_QUEUED_RECORDS. Dropped records are counted by event ID, and the
+ * counts are sent to the daemon as aggregate events of dropped_events_event_id
+ * every DROP_REPORT_INTERVAL_S seconds and on flushes.
+ *
+ * Recording is disabled if the EOS_DISABLE_METRICS environment variable is set
+ * when the sender is created, or while the daemon's Enabled property is FALSE.
+ * Recording threads check this with a single atomic load and skip all work
+ * while it is disabled; records that were already handed over are dropped.
+ */
+
+/* A record kind that carries no event, used to flush pending records. */
+#define RECORD_FLUSH EMTR_NUM_RECORD_KINDS
+
+/* The number of records in each ring. Must be a power of two. */
+#define RING_SIZE 256u
+#define RING_MASK (RING_SIZE - 1)
+
+/* Used to keep fields written by different threads on separate cache lines */
+#define CACHE_LINE_SIZE 64
+
+/* The number of asynchronous records held while connecting to the daemon */
+#define MAX_PRECONNECT_RECORDS 1024u
+
+/* The number of event ID variants kept for reuse */
+#define MAX_CACHED_EVENT_IDS 256u
+
+/* The number of records that do not fit in their thread's ring that may be
+   waiting for the sender thread */
+#define MAX_QUEUED_RECORDS 4096u
+
+/* How often the counts of dropped records are sent to the daemon */
+#define DROP_REPORT_INTERVAL_S 60
+
+/* How long the daemon has to acknowledge an asynchronous batch before the
+   call is made again, in milliseconds. This is much shorter than the default
+   D-Bus timeout, so that a stalled daemon is retried soon. */
+#define BATCH_CALL_TIMEOUT_MS 5000
+
+/* The delay before the first retry of a batch, which doubles with each
+   retry up to the maximum, in milliseconds */
+#define RETRY_INITIAL_DELAY_MS 100u
+#define RETRY_MAX_DELAY_MS 5000u
+
+/* How long a batch is retried for before it is given up on, in seconds */
+#define RETRY_DEADLINE_S 60
+
+/* The delay before connecting to the bus again after failing to, which
+   doubles with each attempt up to the maximum, in seconds */
+#define RECONNECT_INITIAL_DELAY_S 1u
+#define RECONNECT_MAX_DELAY_S 300u
+
+/*
+ * The event ID of the aggregate events that report records dropped for lack of
+ * room or given up on after failing to be sent,
+ * 56caeb40-9174-4875-8048-e580205502c4. Their count is the number of records
+ * dropped, and their payload the event ID of those records, as a string.
+ */
+static const guchar dropped_events_event_id[] = {
+  0x56, 0xca, 0xeb, 0x40, 0x91, 0x74, 0x48, 0x75,
+  0x80, 0x48, 0xe5, 0x80, 0x20, 0x55, 0x02, 0xc4,
+};
+
+typedef enum
+{
+  CONNECTION_NONE,
+  CONNECTION_PENDING,
+  CONNECTION_READY,
+  CONNECTION_FAILED,
+} ConnectionState;
+
+/* The D-Bus method that records a single record of each EmtrRecordKind */
+static const gchar * const record_method_names[EMTR_NUM_RECORD_KINDS] = {
+  "RecordSingularEvent",
+  "RecordAggregateEvent",
+  "RecordEventSequence",
+};
+
+/* The EmtrLatencyKind of the per-kind D-Bus method of each EmtrRecordKind,
+   in record_method_names */
+static const EmtrLatencyKind record_latency_kinds[EMTR_NUM_RECORD_KINDS] = {
+  EMTR_LATENCY_RECORD_SINGULAR_EVENT,
+  EMTR_LATENCY_RECORD_AGGREGATE_EVENT,
+  EMTR_LATENCY_RECORD_EVENT_SEQUENCE,
+};
+
+/* The D-Bus type of a single record of each EmtrRecordKind */
+static const gchar * const record_types[EMTR_NUM_RECORD_KINDS] = {
+  "(uayxbv)",
+  "(uayxxbv)",
+  "(uaya(xbv))",
+};
+
+struct _EmtrEventSender
+{
+  /* Distinguishes this sender from all others in the rings of a thread */
+  guint id;
+
+  guint32 uid;
+
+  /* A random UUID, which tells the daemon which sender the sequence numbers
+     of batches belong to */
+  gchar client_id[37];
+
+  /* See the comment in EmtrEventRecorderPrivate */
+  GVariant *empty_auxiliary_payload; /* (owned) */
+
+  GMainContext *context; /* (owned) */
+  GMainLoop *loop; /* (owned) */
+  GThread *thread; /* (owned) (nullable): started on first use */
+  gsize thread_started; /* (atomic) */
+  GSource *flush_source; /* (owned) */
+
+  /* Set while the flush source has a ready time pending for the flush
+     interval, so that other threads don't postpone it. */
+  gint flush_armed; /* (atomic) */
+
+  /* The rings of all threads that have recorded events with this sender */
+  GPtrArray *rings; /* (owned) (element-type ProducerRing) */
+  GMutex rings_lock;
+
+  /* Synchronous records, flush requests and overflowing records */
+  GAsyncQueue *queue; /* (owned) (element-type Record) */
+
+  guint max_batch_size; /* (atomic) */
+  guint flush_interval_ms; /* (atomic) */
+  guint aggregation_window_ms; /* (atomic) */
+  gint wait_for_replies; /* (atomic) */
+  guint memfd_threshold; /* (atomic) */
+  guint max_queued_bytes; /* (atomic) */
+  guint max_in_flight; /* (atomic) */
+  gint drop_policy; /* (atomic): an EmtrDropPolicy */
+  guint block_timeout_ms; /* (atomic) */
+
+  /* Set by the sender thread once records waiting to be batched have not fit
+     in max_queued_bytes, until they take up half of it */
+  gint congested; /* (atomic) */
+
+  /* The number of recording threads waiting for room, which the sender
+     thread wakes up through sync_cond */
+  gint num_blocked_threads; /* (atomic) */
+
+  /* The number of records dropped for lack of room or given up on, by event
+     ID, since they were last reported */
+  GHashTable *dropped_counts; /* (owned) (element-type guint8* guint64) */
+  GMutex dropped_counts_lock;
+  GSource *drop_report_source; /* (owned) */
+
+  /* What happened to the events recorded with this sender, for
+     emtr_event_sender_get_stats() */
+  EmtrStats *stats; /* (owned) */
+
+  /* The last things that happened to records, for
+     emtr_event_sender_get_recent_events() */
+  EmtrFlightRecorder *flight_recorder; /* (owned) */
+
+  /* Prints the flight recorder on the signal given by
+     EOS_METRICS_DUMP_SIGNAL, if it was set when the sender was created */
+  GSource *dump_signal_source; /* (owned) (nullable) */
+
+  /* FALSE if EOS_DISABLE_METRICS was set when the sender was created */
+  gboolean enabled_by_environment;
+
+  /* Whether events are recorded at all; see emtr_event_sender_is_enabled() */
+  gint enabled; /* (atomic) */
+
+  /* Used to wait for synchronous records to be sent */
+  GMutex sync_lock;
+  GCond sync_cond;
+
+  /* Keeps records while the daemon is unavailable */
+  EmtrSpool *spool; /* (owned) */
+
+  /*
+   * The fields below are only accessed from the sender thread.
+   */
+  ConnectionState connection_state;
+  EmerEventRecorderServer *dbus_proxy; /* (owned) (nullable) */
+  gulong properties_changed_id;
+
+  /* The daemon's interface on a private connection to it, if it offered one */
+  EmerEventRecorderServer *direct_proxy; /* (owned) (nullable) */
+  gulong direct_closed_id;
+
+  /* The proxy that records are sent with: direct_proxy if there is one, and
+     dbus_proxy otherwise */
+  EmerEventRecorderServer *sending_proxy; /* (unowned) (nullable) */
+
+  /* Shared with the daemon, which opened it for the connection of
+     sending_proxy */
+  EmtrShmRing *shm_ring; /* (owned) (nullable) */
+  gulong name_owner_changed_id;
+
+  /* Whether the daemon's name has an owner */
+  gboolean daemon_present;
+
+  /* Set while the spool may hold records to send once the daemon is
+     available */
+  gboolean spool_replay_pending;
+
+  /* Set once the bus has been asked to start the daemon, until it appears */
+  gboolean activation_requested;
+
+  /* Set while appending to the spool fails, so that each run of failures is
+     only warned about once */
+  gboolean spool_failed;
+
+  /* Set while waiting to connect to the bus again after failing to */
+  GSource *reconnect_source; /* (owned) (nullable) */
+  guint reconnect_delay_s;
+
+  /* Callbacks waiting for the connection to be ready */
+  GQueue proxy_waiters; /* (element-type ProxyWaiter) */
+
+  /* Synchronous records that have been popped from the queue but not sent,
+     because the connection is not ready yet */
+  GQueue synchronous_records; /* (element-type Record) */
+
+  /* The number of records dropped while connecting, reported once
+     connected */
+  guint num_dropped_records;
+
+  /*
+   * Records waiting to be sent in the next RecordEvents call, indexed by
+   * EmtrRecordKind. Each element is a GVariant of the corresponding type in
+   * record_types.
+   */
+  GPtrArray *pending_records[EMTR_NUM_RECORD_KINDS];
+  guint num_pending_records;
+
+  /* The size of the serialized pending records */
+  gsize queued_bytes;
+
+  /* Messages carrying records that were sent asynchronously, and have not
+     been written out or replied to yet. Only written by the sender thread. */
+  gint num_in_flight; /* (atomic) */
+
+  /* Set when pending records were not sent because num_in_flight had reached
+     max_in_flight */
+  gboolean records_held_back;
+
+  /* Batches whose asynchronous call failed transiently, waiting to be sent
+     again. They still count as in flight. */
+  GQueue retrying_batches; /* (element-type BatchData) */
+
+  /* The sequence number of the next batch, which lets the daemon recognize
+     batches that it receives twice because they were sent again */
+  guint64 next_sequence_number;
+
+  /* Asynchronous records drained from the rings, reused between flushes */
+  GArray *drained_records; /* (owned) (element-type Record) */
+
+  /*
+   * The same few event IDs are sent over and over, so their "ay" variants are
+   * built once. Keys point to the data of the values.
+   */
+  GHashTable *event_id_variants; /* (owned) (element-type guint8* GVariant) */
+
+  /*
+   * Counts of asynchronous aggregate events that are being summed up over the
+   * aggregation window. Keys are "(ayb v)" variants of the event ID and the
+   * boxed, normalized payload.
+   */
+  GHashTable *aggregated_counts; /* (owned) (element-type GVariant AggregatedCount) */
+
+  /* Emits the aggregated counts when the current window ends, or NULL if no
+     window has been opened. */
+  GSource *aggregation_source; /* (owned) (nullable) */
+
+  /* Set once the daemon has turned out not to implement RecordEvents, or
+     once a RecordEvents call has succeeded. */
+  gboolean batching_unsupported;
+  gboolean batching_supported;
+
+  /* The same for RecordEventsFromFd */
+  gboolean fd_passing_unsupported;
+  gboolean fd_passing_supported;
+};
+
+/* An event handed over by a recording thread */
+typedef struct
+{
+  gint kind; /* an EmtrRecordKind or RECORD_FLUSH */
+  guchar event_id[EMTR_EVENT_ID_LENGTH];
+  gint64 relative_time;
+  gint64 num_events;
+  GVariant *payload; /* (owned) (nullable) */
+  GArray *events; /* (owned) (nullable) (element-type EmtrSequenceEvent) */
+
+  /* Set to TRUE once a synchronous record has been sent, or NULL if the
+     record is asynchronous. Points to the stack of the recording thread. */
+  gboolean *done;
+} Record;
+
+/*
+ * The records that one thread has recorded with one sender. Only that thread
+ * advances tail and only the sender thread advances head; both only ever
+ * increase, and wrap around.
+ */
+typedef struct
+{
+  guint tail; /* (atomic) */
+  guint8 tail_padding[CACHE_LINE_SIZE - sizeof (guint)];
+  guint head; /* (atomic) */
+  guint8 head_padding[CACHE_LINE_SIZE - sizeof (guint)];
+
+  gint ref_count; /* (atomic) */
+  guint sender_id;
+  gint closed; /* (atomic): set once the sender has been freed */
+
+  Record slots[RING_SIZE];
+} ProducerRing;
+
+/* The sum of the aggregate events recorded for one key during a window */
+typedef struct
+{
+  gint64 relative_time; /* of the first event in the window */
+  gint64 num_events;
+} AggregatedCount;
+
+/* Callback to make the finish call after async D-Bus calls */
+typedef gboolean (*FinishCallback) (EmerEventRecorderServer *, GAsyncResult *, GError **);
+
+/* A callback waiting for the connection to the daemon to be ready */
+typedef struct
+{
+  EmtrProxyCallback callback;
+  gpointer user_data;
+  GDestroyNotify destroy_user_data;
+  EmtrEventSender *sender; /* (unowned) */
+} ProxyWaiter;
+
+/*
+ * Data for an asynchronous RecordEvents or RecordEventsFromFd call, which is
+ * made again after transient failures until the daemon acknowledges the batch
+ */
+typedef struct
+{
+  EmtrEventSender *sender; /* (unowned) */
+  GVariant *batch; /* (owned) */
+  gint64 deadline; /* monotonic time after which the batch is given up on */
+  guint retry_delay_ms; /* before the next attempt, without jitter */
+  gboolean in_memfd; /* whether the last attempt passed the batch in a memfd */
+  gint64 call_time; /* monotonic time at which the last attempt was made */
+  GSource *retry_source; /* (owned) (nullable): set while waiting to retry */
+} BatchData;
+
+/* Data for the asynchronous calls that record a single record */
+typedef struct
+{
+  EmtrEventSender *sender; /* (unowned) */
+  GVariant *record; /* (owned) */
+  EmtrRecordKind kind;
+  gint64 call_time; /* monotonic */
+  FinishCallback finish_callback;
+} RecordCallData;
+
+/* The rings of the current thread, one per sender it has recorded events
+   with. Released when the thread exits. */
+static GPrivate thread_rings = G_PRIVATE_INIT ((GDestroyNotify) g_ptr_array_unref);
+
+static gint next_sender_id = 0; /* (atomic) */
+
+static void
+record_init (Record       *record,
+             gint          kind,
+             const guchar *event_id)
+{
+  memset (record, 0, sizeof (Record));
+
+  record->kind = kind;
+  if (event_id != NULL)
+    memcpy (record->event_id, event_id, EMTR_EVENT_ID_LENGTH);
+}
+
+static void
+record_clear (Record *record)
+{
+  g_clear_pointer (&record->payload, g_variant_unref);
+  g_clear_pointer (&record->events, g_array_unref);
+}
+
+static void
+record_free (Record *record)
+{
+  record_clear (record);
+  g_free (record);
+}
+
+/*
+ * Counts @num_records records of @event_id as dropped for lack of room, so
+ * that they are reported to the daemon. Safe to call from any thread.
+ */
+static void
+count_dropped_records (EmtrEventSender *self,
+                       const guchar    *event_id,
+                       guint            num_records)
+{
+  emtr_stats_count_events (self->stats, event_id, EMTR_EVENT_STAT_DROPPED,
+                           num_records);
+
+  g_mutex_lock (&self->dropped_counts_lock);
+
+  gboolean first_drop = g_hash_table_size (self->dropped_counts) == 0;
+  guint64 *count = g_hash_table_lookup (self->dropped_counts, event_id);
+
+  if (count == NULL)
+    {
+      guchar *key = g_malloc (EMTR_EVENT_ID_LENGTH);
+      memcpy (key, event_id, EMTR_EVENT_ID_LENGTH);
+      count = g_new0 (guint64, 1);
+      g_hash_table_insert (self->dropped_counts, key, count);
+    }
+
+  *count += num_records;
+
+  g_mutex_unlock (&self->dropped_counts_lock);
+
+  if (first_drop)
+    g_source_set_ready_time (self->drop_report_source,
+                             g_get_monotonic_time () +
+                             DROP_REPORT_INTERVAL_S * G_TIME_SPAN_SECOND);
+}
+
+static ProducerRing *
+ring_new (guint sender_id)
+{
+  ProducerRing *ring = g_new0 (ProducerRing, 1);
+
+  ring->ref_count = 1;
+  ring->sender_id = sender_id;
+
+  return ring;
+}
+
+static ProducerRing *
+ring_ref (ProducerRing *ring)
+{
+  g_atomic_int_inc (&ring->ref_count);
+  return ring;
+}
+
+static void
+ring_unref (ProducerRing *ring)
+{
+  if (!g_atomic_int_dec_and_test (&ring->ref_count))
+    return;
+
+  for (guint i = ring->head; i != ring->tail; i++)
+    record_clear (&ring->slots[i & RING_MASK]);
+
+  g_free (ring);
+}
+
+/*
+ * Returns the ring of the current thread for @self, creating and registering
+ * it on first use. Rings of senders that have been freed are dropped along the
+ * way.
+ */
+static ProducerRing *
+get_thread_ring (EmtrEventSender *self)
+{
+  GPtrArray *rings = g_private_get (&thread_rings);
+
+  if (rings == NULL)
+    {
+      rings = g_ptr_array_new_with_free_func ((GDestroyNotify) ring_unref);
+      g_private_set (&thread_rings, rings);
+    }
+
+  for (guint i = 0; i < rings->len; i++)
+    {
+      ProducerRing *ring = g_ptr_array_index (rings, i);
+      if (ring->sender_id == self->id)
+        return ring;
+    }
+
+  for (guint i = rings->len; i > 0; i--)
+    {
+      ProducerRing *ring = g_ptr_array_index (rings, i - 1);
+      if (g_atomic_int_get (&ring->closed))
+        g_ptr_array_remove_index_fast (rings, i - 1);
+    }
+
+  ProducerRing *ring = ring_new (self->id);
+  g_ptr_array_add (rings, ring);
+
+  g_mutex_lock (&self->rings_lock);
+  g_ptr_array_add (self->rings, ring_ref (ring));
+  g_mutex_unlock (&self->rings_lock);
+
+  return ring;
+}
+
+/*
+ * Copies @record into @ring, which must belong to the current thread. Returns
+ * FALSE if the ring is full. Otherwise, sets @num_records to the number of
+ * records in the ring that the sender thread has not started draining.
+ */
+static gboolean
+ring_push (ProducerRing *ring,
+           const Record *record,
+           guint        *num_records)
+{
+  guint tail = ring->tail;
+
+  if (tail - (guint) g_atomic_int_get (&ring->head) >= RING_SIZE)
+    return FALSE;
+
+  ring->slots[tail & RING_MASK] = *record;
+  g_atomic_int_set (&ring->tail, tail + 1);
+
+  /* Read head again after publishing the record. Either this sees the sender
+     thread's latest update of head, or the sender thread sees the new tail
+     after that update and rearms the flush source itself. */
+  *num_records = tail + 1 - (guint) g_atomic_int_get (&ring->head);
+  return TRUE;
+}
+
+static guint
+event_id_hash (gconstpointer key)
+{
+  guint hash;
+
+  /* Event IDs are random UUIDs, so any of their bytes will do. */
+  memcpy (&hash, key, sizeof (hash));
+  return hash;
+}
+
+static gboolean
+event_id_equal (gconstpointer a,
+                gconstpointer b)
+{
+  return memcmp (a, b, EMTR_EVENT_ID_LENGTH) == 0;
+}
+
+/* Returns the "ay" variant for @event_id, which the sender keeps a reference
+   to. */
+static GVariant *
+get_event_id_variant (EmtrEventSender *self,
+                      const guchar    *event_id)
+{
+  GVariant *variant = g_hash_table_lookup (self->event_id_variants, event_id);
+
+  if (variant != NULL)
+    return variant;
+
+  if (g_hash_table_size (self->event_id_variants) >= MAX_CACHED_EVENT_IDS)
+    g_hash_table_remove_all (self->event_id_variants);
+
+  variant = g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, event_id,
+                                       EMTR_EVENT_ID_LENGTH, sizeof (guchar));
+  g_variant_ref_sink (variant);
+  g_hash_table_insert (self->event_id_variants,
+                       (gpointer) g_variant_get_data (variant), variant);
+
+  return variant;
+}
+
+/* Hashes the serialized data of a variant, since g_variant_hash() only handles
+   basic types. */
+static guint
+variant_data_hash (gconstpointer key)
+{
+  GVariant *variant = (GVariant *) key;
+  const guchar *data = g_variant_get_data (variant);
+  gsize size = g_variant_get_size (variant);
+  guint hash = 5381;
+
+  for (gsize i = 0; i < size; i++)
+    hash = (hash << 5) + hash + data[i];
+
+  return hash;
+}
+
+/*
+ * Wraps @payload, which need not be in normal form, in a variant so that it can
+ * be sent to D-Bus, or returns the empty auxiliary payload if @payload is NULL.
+ * Either way, the return value is suitable for passing to g_variant_new() with
+ * a format string of "@v".
+ */
+static GVariant *
+box_payload (EmtrEventSender *self,
+             GVariant        *payload,
+             EmtrProfile     *profile)
+{
+  if (payload == NULL)
+    return self->empty_auxiliary_payload;
+
+  emtr_profile_phase (profile, EMTR_PHASE_BUILD_RECORD);
+  GVariant *normalized_payload = g_variant_get_normal_form (payload);
+  emtr_profile_phase (profile, EMTR_PHASE_NORMALIZE);
+  GVariant *boxed_payload = g_variant_new_variant (normalized_payload);
+  g_variant_unref (normalized_payload);
+  emtr_profile_phase (profile, EMTR_PHASE_BOX);
+  return boxed_payload;
+}
+
+/* Builds the D-Bus representation of @record, as a floating reference. */
+static GVariant *
+record_to_variant (EmtrEventSender *self,
+                   Record          *record)
+{
+  GVariant *event_id = get_event_id_variant (self, record->event_id);
+  GVariant *variant;
+  EmtrProfile profile;
+
+  emtr_stats_profile_begin (self->stats, &profile);
+
+  switch (record->kind)
+    {
+    case EMTR_RECORD_SINGULAR_EVENT:
+      variant = g_variant_new ("(u@ayxb@v)", self->uid, event_id,
+                               record->relative_time, record->payload != NULL,
+                               box_payload (self, record->payload, &profile));
+      break;
+
+    case EMTR_RECORD_AGGREGATE_EVENT:
+      variant = g_variant_new ("(u@ayxxb@v)", self->uid, event_id,
+                               record->num_events, record->relative_time,
+                               record->payload != NULL,
+                               box_payload (self, record->payload, &profile));
+      break;
+
+    case EMTR_RECORD_EVENT_SEQUENCE:
+      {
+        GVariantBuilder events_builder;
+
+        g_variant_builder_init (&events_builder, G_VARIANT_TYPE ("a(xbv)"));
+        for (guint i = 0; i < record->events->len; i++)
+          {
+            EmtrSequenceEvent *event =
+              &g_array_index (record->events, EmtrSequenceEvent, i);
+            g_variant_builder_add (&events_builder, "(xb@v)",
+                                   event->relative_time,
+                                   event->payload != NULL,
+                                   box_payload (self, event->payload,
+                                                &profile));
+          }
+
+        variant = g_variant_new ("(u@aya(xbv))", self->uid, event_id,
+                                 &events_builder);
+        break;
+      }
+
+    default:
+      g_assert_not_reached ();
+    }
+
+  emtr_profile_phase (&profile, EMTR_PHASE_BUILD_RECORD);
+  emtr_stats_profile_end (self->stats, &profile, record->event_id);
+
+  return variant;
+}
+
+static void message_completed (EmtrEventSender *self);
+
+/*
+ * Counts a message carrying records as in flight, until message_completed() is
+ * called for it.
+ */
+static void
+message_sent (EmtrEventSender *self)
+{
+  g_atomic_int_inc (&self->num_in_flight);
+}
+
+/* Continues @hash over the serialized payload in @boxed_payload, adding its
+   size to @size, unless @has_payload is FALSE. */
+static void
+hash_payload (GVariant *boxed_payload,
+              gboolean  has_payload,
+              guint32  *hash,
+              gsize    *size)
+{
+  if (!has_payload)
+    return;
+
+  GVariant *payload = g_variant_get_variant (boxed_payload);
+  gsize payload_size = g_variant_get_size (payload);
+
+  *hash = emtr_flight_recorder_hash (*hash, g_variant_get_data (payload),
+                                     payload_size);
+  *size += payload_size;
+  g_variant_unref (payload);
+}
+
+/* Notes that @outcome happened to @record, a record variant, in the flight
+   recorder. */
+static void
+log_record (EmtrEventSender *self,
+            GVariant        *record,
+            EmtrEventStat    outcome)
+{
+  GVariant *event_id = g_variant_get_child_value (record, 1);
+  gsize length;
+  const guchar *event_id_bytes =
+    g_variant_get_fixed_array (event_id, &length, sizeof (guchar));
+  guint32 payload_hash = EMTR_FLIGHT_RECORDER_HASH_INIT;
+  gsize payload_size = 0;
+  EmtrRecordKind kind;
+  gint64 relative_time;
+  gboolean has_payload;
+  GVariant *payload;
+
+  if (length != EMTR_EVENT_ID_LENGTH)
+    {
+      g_variant_unref (event_id);
+      return;
+    }
+
+  if (g_variant_is_of_type (record, G_VARIANT_TYPE (record_types[EMTR_RECORD_SINGULAR_EVENT])))
+    {
+      kind = EMTR_RECORD_SINGULAR_EVENT;
+      g_variant_get_child (record, 2, "x", &relative_time);
+      g_variant_get_child (record, 3, "b", &has_payload);
+      payload = g_variant_get_child_value (record, 4);
+      hash_payload (payload, has_payload, &payload_hash, &payload_size);
+      g_variant_unref (payload);
+    }
+  else if (g_variant_is_of_type (record, G_VARIANT_TYPE (record_types[EMTR_RECORD_AGGREGATE_EVENT])))
+    {
+      kind = EMTR_RECORD_AGGREGATE_EVENT;
+      g_variant_get_child (record, 3, "x", &relative_time);
+      g_variant_get_child (record, 4, "b", &has_payload);
+      payload = g_variant_get_child_value (record, 5);
+      hash_payload (payload, has_payload, &payload_hash, &payload_size);
+      g_variant_unref (payload);
+    }
+  else
+    {
+      GVariant *events = g_variant_get_child_value (record, 2);
+      gsize num_events = g_variant_n_children (events);
+
+      /* Like records, sequences are timed by their last event. */
+      kind = EMTR_RECORD_EVENT_SEQUENCE;
+      relative_time = 0;
+      for (gsize i = 0; i < num_events; i++)
+        {
+          g_variant_get_child (events, i, "(xb@v)", &relative_time,
+                               &has_payload, &payload);
+          hash_payload (payload, has_payload, &payload_hash, &payload_size);
+          g_variant_unref (payload);
+        }
+      g_variant_unref (events);
+    }
+
+  emtr_flight_recorder_add (self->flight_recorder, event_id_bytes,
+                            relative_time, kind, payload_hash, payload_size,
+                            outcome);
+  g_variant_unref (event_id);
+}
+
+/* Notes that @record, which has not been turned into a variant, was dropped.
+   Its payload is not in normal form yet, so it is not hashed. */
+static void
+log_dropped_record (EmtrEventSender *self,
+                    Record          *record)
+{
+  emtr_flight_recorder_add (self->flight_recorder, record->event_id,
+                            record->relative_time, record->kind, 0, 0,
+                            EMTR_EVENT_STAT_DROPPED);
+}
+
+/* Counts @record, a record variant, as @stat. */
+static void
+count_record (EmtrEventSender *self,
+              GVariant        *record,
+              EmtrEventStat    stat)
+{
+  log_record (self, record, stat);
+
+  GVariant *event_id = g_variant_get_child_value (record, 1);
+  gsize length;
+  const guchar *event_id_bytes =
+    g_variant_get_fixed_array (event_id, &length, sizeof (guchar));
+
+  if (length == EMTR_EVENT_ID_LENGTH)
+    emtr_stats_count_events (self->stats, event_id_bytes, stat, 1);
+
+  g_variant_unref (event_id);
+}
+
+/* Counts @record, a record variant, as sent, along with its size. */
+static void
+count_sent_record (EmtrEventSender *self,
+                   GVariant        *record)
+{
+  count_record (self, record, EMTR_EVENT_STAT_SENT);
+  emtr_stats_count_bytes (self->stats, g_variant_get_size (record));
+}
+
+/* Counts the round trip of a D-Bus call made at @call_time, as returned by
+   g_get_monotonic_time(), which has just been replied to. */
+static void
+count_round_trip (EmtrEventSender *self,
+                  EmtrLatencyKind  kind,
+                  gint64           call_time)
+{
+  gint64 round_trip_us = g_get_monotonic_time () - call_time;
+
+  emtr_stats_add_latency (self->stats, kind, round_trip_us * 1000);
+}
+
+/* Returns the 16 bytes of the event ID of @record, which remain valid for as
+   long as @record does */
+static const guchar *
+get_record_event_id (GVariant *record)
+{
+  GVariant *event_id = g_variant_get_child_value (record, 1);
+  gsize length;
+  const guchar *bytes = g_variant_get_fixed_array (event_id, &length, 1);
+
+  g_variant_unref (event_id);
+  return bytes;
+}
+
+static void
+trace_record_send (EmtrRecordKind  kind,
+                   GVariant       *record)
+{
+  if (EMTR_TRACE_ENABLED (dbus__send))
+    EMTR_TRACE (dbus__send, record_method_names[kind],
+                get_record_event_id (record),
+                (guint64) g_variant_get_size (record));
+}
+
+static void
+trace_record_complete (EmtrRecordKind  kind,
+                       GVariant       *record,
+                       gboolean        success)
+{
+  if (EMTR_TRACE_ENABLED (dbus__complete))
+    EMTR_TRACE (dbus__complete, record_method_names[kind],
+                get_record_event_id (record), success);
+}
+
+static const gchar *
+get_batch_method_name (gboolean in_memfd)
+{
+  return in_memfd ? "RecordEventsFromFd" : "RecordEvents";
+}
+
+static void
+trace_batch_send (GVariant *batch,
+                  gboolean  in_memfd)
+{
+  if (EMTR_TRACE_ENABLED (dbus__send))
+    EMTR_TRACE (dbus__send, get_batch_method_name (in_memfd), NULL,
+                (guint64) g_variant_get_size (batch));
+}
+
+static void
+trace_batch_complete (gboolean      in_memfd,
+                      const GError *error)
+{
+  EMTR_TRACE (dbus__complete, get_batch_method_name (in_memfd), NULL,
+              error == NULL);
+}
+
+/* Returns the data for an asynchronous call that records @record, a record of
+   @kind, which is in flight until it has been finished with
+   @finish_callback. */
+static RecordCallData *
+record_call_data_new (EmtrEventSender *self,
+                      EmtrRecordKind   kind,
+                      GVariant        *record,
+                      FinishCallback   finish_callback)
+{
+  RecordCallData *data = g_new (RecordCallData, 1);
+
+  data->sender = self;
+  data->record = g_variant_ref (record);
+  data->kind = kind;
+  data->call_time = g_get_monotonic_time ();
+  data->finish_callback = finish_callback;
+  message_sent (self);
+
+  return data;
+}
+
+/*
+ * The callback for the asynchronous D-Bus calls that record a single event or
+ * event sequence. Calls the finish method in @data.
+ */
+static void
+send_record_to_dbus_finish_callback (EmerEventRecorderServer *dbus_proxy,
+                                     GAsyncResult            *res,
+                                     RecordCallData          *data)
+{
+  GError *error = NULL;
+  gboolean success = data->finish_callback (dbus_proxy, res, &error);
+
+  count_round_trip (data->sender, record_latency_kinds[data->kind],
+                    data->call_time);
+  trace_record_complete (data->kind, data->record, success);
+
+  if (!success)
+    {
+      g_warning ("Failed to send event to event recorder daemon: %s.",
+                 error->message);
+      count_record (data->sender, data->record, EMTR_EVENT_STAT_FAILED);
+      g_error_free (error);
+    }
+
+  message_completed (data->sender);
+  g_variant_unref (data->record);
+  g_free (data);
+}
+
+/*
+ * Builds a call of @method_name on the daemon with @arguments, a tuple, and
+ * the file descriptors in @fd_list if it is not NULL.
+ */
+static GDBusMessage *
+new_method_call (EmtrEventSender *self,
+                 const gchar     *method_name,
+                 GVariant        *arguments,
+                 GUnixFDList     *fd_list)
+{
+  GDBusProxy *proxy = G_DBUS_PROXY (self->sending_proxy);
+  GDBusMessage *message =
+    g_dbus_message_new_method_call (g_dbus_proxy_get_name (proxy),
+                                    g_dbus_proxy_get_object_path (proxy),
+                                    g_dbus_proxy_get_interface_name (proxy),
+                                    method_name);
+
+  g_dbus_message_set_body (message, arguments);
+  if (fd_list != NULL)
+    g_dbus_message_set_unix_fd_list (message, fd_list);
+
+  return message;
+}
+
+static void
+message_written_cb (GObject      *source_object,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+  /* Failures are reported by the connection closing. */
+  g_dbus_connection_flush_finish (G_DBUS_CONNECTION (source_object), result,
+                                  NULL /* GError */);
+  message_completed (user_data);
+}
+
+/*
+ * Sends @message, a method call on the daemon, without asking for a reply.
+ * Failures to send the message are reported, but whether the daemon accepted
+ * the call is never known. The message is in flight until the connection has
+ * written it out.
+ */
+static void
+send_message_without_reply (EmtrEventSender *self,
+                            GDBusMessage    *message)
+{
+  GDBusProxy *proxy = G_DBUS_PROXY (self->sending_proxy);
+  GError *error = NULL;
+
+  g_dbus_message_set_flags (message, G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED);
+
+  if (g_dbus_connection_send_message (g_dbus_proxy_get_connection (proxy),
+                                      message,
+                                      G_DBUS_SEND_MESSAGE_FLAGS_NONE,
+                                      NULL /* out_serial */,
+                                      &error))
+    {
+      message_sent (self);
+      g_dbus_connection_flush (g_dbus_proxy_get_connection (proxy),
+                               NULL /* GCancellable */,
+                               message_written_cb,
+                               self);
+    }
+  else
+    {
+      g_warning ("Failed to send events to event recorder daemon: %s.",
+                 error->message);
+      g_error_free (error);
+    }
+}
+
+/* Calls @method_name on the daemon with @arguments, a tuple, without asking
+   for a reply; see send_message_without_reply(). */
+static void
+send_without_reply (EmtrEventSender *self,
+                    const gchar     *method_name,
+                    GVariant        *arguments)
+{
+  GDBusMessage *message =
+    new_method_call (self, method_name, arguments, NULL /* GUnixFDList */);
+
+  send_message_without_reply (self, message);
+  g_object_unref (message);
+}
+
+/*
+ * Sends a single record with the D-Bus method dedicated to records of its kind,
+ * rather than as part of a batch. @record must be of the type given for @kind
+ * in record_types.
+ */
+static void
+send_record_to_dbus (EmtrEventSender *self,
+                     EmtrRecordKind   kind,
+                     GVariant        *record,
+                     gboolean         is_synchronous)
+{
+  EmerEventRecorderServer *dbus_proxy = self->sending_proxy;
+  guint32 uid;
+  GVariant *event_id;
+  gint64 num_events, relative_time;
+  gboolean has_payload;
+  GVariant *payload = NULL;
+  GVariant *events = NULL;
+  GError *error = NULL;
+  gboolean success = TRUE;
+
+  trace_record_send (kind, record);
+
+  if (!is_synchronous && !g_atomic_int_get (&self->wait_for_replies))
+    {
+      send_without_reply (self, record_method_names[kind], record);
+      return;
+    }
+
+  gint64 call_time = g_get_monotonic_time ();
+
+  switch (kind)
+    {
+    case EMTR_RECORD_SINGULAR_EVENT:
+      g_variant_get (record, "(u@ayxb@v)", &uid, &event_id, &relative_time,
+                     &has_payload, &payload);
+      if (is_synchronous)
+        success =
+          emer_event_recorder_server_call_record_singular_event_sync (dbus_proxy,
+                                                                      uid,
+                                                                      event_id,
+                                                                      relative_time,
+                                                                      has_payload,
+                                                                      payload,
+                                                                      NULL /* GCancellable */,
+                                                                      &error);
+      else
+        emer_event_recorder_server_call_record_singular_event (dbus_proxy,
+                                                               uid,
+                                                               event_id,
+                                                               relative_time,
+                                                               has_payload,
+                                                               payload,
+                                                               NULL /* GCancellable */,
+                                                               (GAsyncReadyCallback) send_record_to_dbus_finish_callback,
+                                                               record_call_data_new (self, kind, record, (FinishCallback) emer_event_recorder_server_call_record_singular_event_finish));
+      break;
+
+    case EMTR_RECORD_AGGREGATE_EVENT:
+      g_variant_get (record, "(u@ayxxb@v)", &uid, &event_id, &num_events,
+                     &relative_time, &has_payload, &payload);
+      if (is_synchronous)
+        success =
+          emer_event_recorder_server_call_record_aggregate_event_sync (dbus_proxy,
+                                                                       uid,
+                                                                       event_id,
+                                                                       num_events,
+                                                                       relative_time,
+                                                                       has_payload,
+                                                                       payload,
+                                                                       NULL /* GCancellable */,
+                                                                       &error);
+      else
+        emer_event_recorder_server_call_record_aggregate_event (dbus_proxy,
+                                                                uid,
+                                                                event_id,
+                                                                num_events,
+                                                                relative_time,
+                                                                has_payload,
+                                                                payload,
+                                                                NULL /* GCancellable */,
+                                                                (GAsyncReadyCallback) send_record_to_dbus_finish_callback,
+                                                                record_call_data_new (self, kind, record, (FinishCallback) emer_event_recorder_server_call_record_aggregate_event_finish));
+      break;
+
+    case EMTR_RECORD_EVENT_SEQUENCE:
+      g_variant_get (record, "(u@ay@a(xbv))", &uid, &event_id, &events);
+      if (is_synchronous)
+        success =
+          emer_event_recorder_server_call_record_event_sequence_sync (dbus_proxy,
+                                                                      uid,
+                                                                      event_id,
+                                                                      events,
+                                                                      NULL /* GCancellable */,
+                                                                      &error);
+      else
+        emer_event_recorder_server_call_record_event_sequence (dbus_proxy,
+                                                               uid,
+                                                               event_id,
+                                                               events,
+                                                               NULL /* GCancellable */,
+                                                               (GAsyncReadyCallback) send_record_to_dbus_finish_callback,
+                                                               record_call_data_new (self, kind, record, (FinishCallback) emer_event_recorder_server_call_record_event_sequence_finish));
+      break;
+
+    default:
+      g_assert_not_reached ();
+    }
+
+  if (is_synchronous)
+    {
+      count_round_trip (self, record_latency_kinds[kind], call_time);
+      trace_record_complete (kind, record, success);
+    }
+
+  if (!success)
+    {
+      g_warning ("Failed to send event to event recorder daemon: %s.",
+                 error->message);
+      count_record (self, record, EMTR_EVENT_STAT_FAILED);
+      g_error_free (error);
+    }
+
+  g_variant_unref (event_id);
+  g_clear_pointer (&payload, g_variant_unref);
+  g_clear_pointer (&events, g_variant_unref);
+}
+
+/* Whether records can be sent to the daemon, rather than spooled */
+static gboolean
+daemon_is_available (EmtrEventSender *self)
+{
+  return self->connection_state == CONNECTION_READY && self->daemon_present;
+}
+
+static void
+activation_requested_cb (GObject      *source_object,
+                         GAsyncResult *result,
+                         gpointer      user_data)
+{
+  GError *error = NULL;
+  GVariant *reply =
+    g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object), result,
+                                   &error);
+
+  if (reply == NULL)
+    {
+      g_debug ("Unable to start the event recorder daemon: %s",
+               error->message);
+      g_error_free (error);
+      return;
+    }
+
+  g_variant_unref (reply);
+}
+
+/*
+ * Asks the bus to start the daemon, once each time it goes away. Sending to
+ * its name would have started it, but records are spooled instead.
+ */
+static void
+request_activation (EmtrEventSender *self)
+{
+  if (self->connection_state != CONNECTION_READY || self->daemon_present ||
+      self->activation_requested)
+    return;
+
+  self->activation_requested = TRUE;
+
+  GDBusProxy *proxy = G_DBUS_PROXY (self->dbus_proxy);
+  g_dbus_connection_call (g_dbus_proxy_get_connection (proxy),
+                          "org.freedesktop.DBus",
+                          "/org/freedesktop/DBus",
+                          "org.freedesktop.DBus",
+                          "StartServiceByName",
+                          g_variant_new ("(su)",
+                                         g_dbus_proxy_get_name (proxy), 0),
+                          G_VARIANT_TYPE ("(u)"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1 /* timeout */,
+                          NULL /* GCancellable */,
+                          activation_requested_cb,
+                          NULL /* user_data */);
+}
+
+/* Counts @record, a record variant, as dropped. */
+static void
+count_dropped_record (EmtrEventSender *self,
+                      GVariant        *record)
+{
+  log_record (self, record, EMTR_EVENT_STAT_DROPPED);
+
+  GVariant *event_id = g_variant_get_child_value (record, 1);
+  gsize length;
+  const guchar *event_id_bytes =
+    g_variant_get_fixed_array (event_id, &length, sizeof (guchar));
+
+  if (length == EMTR_EVENT_ID_LENGTH)
+    count_dropped_records (self, event_id_bytes, 1);
+
+  g_variant_unref (event_id);
+}
+
+/*
+ * Appends @variant, a record of @kind, to the spool, so that it is sent once
+ * the daemon is available. It is counted as dropped if it cannot be.
+ */
+static void
+spool_record (EmtrEventSender *self,
+              EmtrRecordKind   kind,
+              GVariant        *variant)
+{
+  GError *error = NULL;
+
+  if (!emtr_spool_append (self->spool, kind, g_variant_get_data (variant),
+                          g_variant_get_size (variant), &error))
+    {
+      if (!self->spool_failed)
+        g_warning ("Unable to keep events until the event recorder daemon is "
+                   "available: %s.", error->message);
+      else
+        g_debug ("Unable to keep event until the event recorder daemon is "
+                 "available: %s.", error->message);
+      self->spool_failed = TRUE;
+      g_error_free (error);
+      count_dropped_record (self, variant);
+    }
+  else
+    {
+      self->spool_failed = FALSE;
+    }
+
+  request_activation (self);
+}
+
+/* Appends the records of @batch, which holds the arguments of a RecordEvents
+   call, to the spool. */
+static void
+spool_batch (EmtrEventSender *self,
+             GVariant        *batch)
+{
+  for (gint kind = 0; kind < EMTR_NUM_RECORD_KINDS; kind++)
+    {
+      GVariant *records = g_variant_get_child_value (batch, kind);
+      GVariantIter iter;
+      GVariant *record;
+
+      g_variant_iter_init (&iter, records);
+      while ((record = g_variant_iter_next_value (&iter)) != NULL)
+        {
+          spool_record (self, kind, record);
+          g_variant_unref (record);
+        }
+
+      g_variant_unref (records);
+    }
+}
+
+/* Counts the records of @batch, which holds the arguments of a RecordEvents
+   call, as dropped. */
+static void
+count_dropped_batch (EmtrEventSender *self,
+                     GVariant        *batch)
+{
+  for (gint kind = 0; kind < EMTR_NUM_RECORD_KINDS; kind++)
+    {
+      GVariant *records = g_variant_get_child_value (batch, kind);
+      GVariantIter iter;
+      GVariant *record;
+
+      g_variant_iter_init (&iter, records);
+      while ((record = g_variant_iter_next_value (&iter)) != NULL)
+        {
+          count_dropped_record (self, record);
+          g_variant_unref (record);
+        }
+
+      g_variant_unref (records);
+    }
+}
+
+/* Counts the records of @batch, which holds the arguments of a RecordEvents
+   call, as @stat. */
+static void
+count_batch (EmtrEventSender *self,
+             GVariant        *batch,
+             EmtrEventStat    stat)
+{
+  for (gint kind = 0; kind < EMTR_NUM_RECORD_KINDS; kind++)
+    {
+      GVariant *records = g_variant_get_child_value (batch, kind);
+      GVariantIter iter;
+      GVariant *record;
+
+      g_variant_iter_init (&iter, records);
+      while ((record = g_variant_iter_next_value (&iter)) != NULL)
+        {
+          count_record (self, record, stat);
+          g_variant_unref (record);
+        }
+
+      g_variant_unref (records);
+    }
+}
+
+/*
+ * Sends each record in @batch, which holds the arguments of a RecordEvents
+ * call, with its own D-Bus call. This is used with versions of the daemon that
+ * predate RecordEvents.
+ */
+static void
+send_batch_individually (EmtrEventSender *self,
+                         GVariant        *batch,
+                         gboolean         is_synchronous)
+{
+  for (gint kind = 0; kind < EMTR_NUM_RECORD_KINDS; kind++)
+    {
+      GVariant *records = g_variant_get_child_value (batch, kind);
+      GVariantIter iter;
+      GVariant *record;
+
+      g_variant_iter_init (&iter, records);
+      while ((record = g_variant_iter_next_value (&iter)) != NULL)
+        {
+          send_record_to_dbus (self, kind, record, is_synchronous);
+          g_variant_unref (record);
+        }
+
+      g_variant_unref (records);
+    }
+}
+
+/*
+ * Writes the serialized data of @contents to a new memfd and seals it, so that
+ * the daemon can map it without the contents changing under its feet. Returns
+ * the file descriptor, or -1 with @error set.
+ */
+static gint
+create_sealed_memfd (GVariant  *contents,
+                     GError   **error)
+{
+#ifdef HAVE_SEALED_MEMFD
+  const gchar *data = g_variant_get_data (contents);
+  gsize size = g_variant_get_size (contents);
+  gint saved_errno;
+  gint fd = memfd_create ("eosmetrics-events",
+                          MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+  if (fd < 0)
+    goto fail;
+
+  while (size > 0)
+    {
+      gssize written = write (fd, data, size);
+
+      if (written < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          goto fail;
+        }
+
+      data += written;
+      size -= written;
+    }
+
+  if (fcntl (fd, F_ADD_SEALS,
+             F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+    goto fail;
+
+  return fd;
+
+fail:
+  saved_errno = errno;
+  if (fd >= 0)
+    close (fd);
+  g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+               "Unable to create sealed memfd: %s", g_strerror (saved_errno));
+  return -1;
+#else
+  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                       "Sealed memfds are not supported on this system");
+  return -1;
+#endif /* HAVE_SEALED_MEMFD */
+}
+
+/* Whether @batch should be sent in a memfd rather than inline */
+static gboolean
+should_send_in_memfd (EmtrEventSender *self,
+                      GVariant        *batch)
+{
+  guint memfd_threshold = g_atomic_int_get (&self->memfd_threshold);
+  GDBusConnection *connection =
+    g_dbus_proxy_get_connection (G_DBUS_PROXY (self->sending_proxy));
+
+  return memfd_threshold > 0 && !self->fd_passing_unsupported &&
+    (g_dbus_connection_get_capabilities (connection) &
+     G_DBUS_CAPABILITY_FLAGS_UNIX_FD_PASSING) != 0 &&
+    g_variant_get_size (batch) >= memfd_threshold;
+}
+
+/*
+ * Builds a call that sends @batch, which holds the arguments of a RecordEvents
+ * call: a RecordEventsFromFd call passing it in a sealed memfd if it is large
+ * enough, and a RecordEvents call otherwise, or if the memfd could not be
+ * created. Sets @in_memfd accordingly.
+ */
+static GDBusMessage *
+new_record_events_call (EmtrEventSender *self,
+                        GVariant        *batch,
+                        gboolean        *in_memfd)
+{
+  *in_memfd = FALSE;
+
+  if (!should_send_in_memfd (self, batch))
+    return new_method_call (self, "RecordEvents", batch,
+                            NULL /* GUnixFDList */);
+
+  GError *error = NULL;
+  gint fd = create_sealed_memfd (batch, &error);
+
+  if (fd < 0)
+    {
+      g_debug ("Sending events inline: %s", error->message);
+      g_error_free (error);
+      return new_method_call (self, "RecordEvents", batch,
+                              NULL /* GUnixFDList */);
+    }
+
+  /* The list takes ownership of the file descriptor. */
+  GUnixFDList *fd_list = g_unix_fd_list_new_from_array (&fd, 1);
+  GDBusMessage *message =
+    new_method_call (self, "RecordEventsFromFd", g_variant_new ("(h)", 0),
+                     fd_list);
+  g_object_unref (fd_list);
+
+  *in_memfd = TRUE;
+  return message;
+}
+
+/* Remembers that the daemon implements the method of a successful batch
+   call, which passed the batch in a memfd if @in_memfd. */
+static void
+batch_method_succeeded (EmtrEventSender *self,
+                        gboolean         in_memfd)
+{
+  if (in_memfd)
+    self->fd_passing_supported = TRUE;
+  else
+    self->batching_supported = TRUE;
+}
+
+/*
+ * Handles a batch call that failed with @error because the daemon does not
+ * implement its method: RecordEventsFromFd if @in_memfd, and RecordEvents
+ * otherwise. Returns TRUE if so, in which case the caller should send the
+ * batch again, inline or individually, and FALSE if the call failed for
+ * another reason.
+ */
+static gboolean
+batch_method_unsupported (EmtrEventSender *self,
+                          const GError    *error,
+                          gboolean         in_memfd)
+{
+  if (!g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD))
+    return FALSE;
+
+  if (in_memfd)
+    {
+      g_debug ("Event recorder daemon does not support RecordEventsFromFd; "
+               "sending events inline.");
+      self->fd_passing_unsupported = TRUE;
+    }
+  else
+    {
+      g_debug ("Event recorder daemon does not support RecordEvents; sending "
+               "events individually.");
+      self->batching_unsupported = TRUE;
+    }
+
+  return TRUE;
+}
+
+/*
+ * Whether a batch call that failed with @error may succeed if it is made
+ * again: because the daemon did not reply in time, was busy, or went away,
+ * or because the connection the call was made on was closed.
+ */
+static gboolean
+is_transient_error (const GError *error)
+{
+  if (error->domain == G_DBUS_ERROR)
+    {
+      switch (error->code)
+        {
+        case G_DBUS_ERROR_NO_MEMORY:
+        case G_DBUS_ERROR_SERVICE_UNKNOWN:
+        case G_DBUS_ERROR_NAME_HAS_NO_OWNER:
+        case G_DBUS_ERROR_NO_REPLY:
+        case G_DBUS_ERROR_TIMEOUT:
+        case G_DBUS_ERROR_DISCONNECTED:
+        case G_DBUS_ERROR_LIMITS_EXCEEDED:
+        case G_DBUS_ERROR_TIMED_OUT:
+          return TRUE;
+
+        default:
+          return FALSE;
+        }
+    }
+
+  return g_error_matches (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT) ||
+    g_error_matches (error, G_IO_ERROR, G_IO_ERROR_BUSY) ||
+    g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CLOSED);
+}
+
+/* Sends @batch and blocks until the daemon has replied. Synchronous batches
+   are not retried, and wait for as long as the bus lets them. */
+static void
+send_batch_sync (EmtrEventSender *self,
+                 GVariant        *batch)
+{
+  GDBusConnection *connection =
+    g_dbus_proxy_get_connection (G_DBUS_PROXY (self->sending_proxy));
+
+  /* Each failure for lack of a method makes the next attempt fall back
+     further, to inline and then individual calls. */
+  while (!self->batching_unsupported)
+    {
+      GError *error = NULL;
+      gboolean in_memfd;
+      GDBusMessage *message = new_record_events_call (self, batch, &in_memfd);
+      trace_batch_send (batch, in_memfd);
+      gint64 call_time = g_get_monotonic_time ();
+      GDBusMessage *reply =
+        g_dbus_connection_send_message_with_reply_sync (connection, message,
+                                                        G_DBUS_SEND_MESSAGE_FLAGS_NONE,
+                                                        -1 /* timeout */,
+                                                        NULL /* out_serial */,
+                                                        NULL /* GCancellable */,
+                                                        &error);
+      count_round_trip (self, EMTR_LATENCY_RECORD_EVENTS, call_time);
+      g_object_unref (message);
+
+      if (reply != NULL)
+        {
+          g_dbus_message_to_gerror (reply, &error);
+          g_object_unref (reply);
+        }
+
+      trace_batch_complete (in_memfd, error);
+
+      if (error == NULL)
+        {
+          batch_method_succeeded (self, in_memfd);
+          return;
+        }
+
+      if (!batch_method_unsupported (self, error, in_memfd))
+        {
+          g_warning ("Failed to send events to event recorder daemon: %s.",
+                     error->message);
+          count_batch (self, batch, EMTR_EVENT_STAT_FAILED);
+          g_error_free (error);
+          return;
+        }
+
+      g_error_free (error);
+    }
+
+  send_batch_individually (self, batch, TRUE /* is_synchronous */);
+}
+
+/*
+ * Returns the data for an asynchronous call that sends @batch, which is in
+ * flight until the daemon has acknowledged it, or until it has been given up
+ * on after RETRY_DEADLINE_S.
+ */
+static BatchData *
+batch_data_new (EmtrEventSender *self,
+                GVariant        *batch)
+{
+  BatchData *data = g_new0 (BatchData, 1);
+
+  data->sender = self;
+  data->batch = g_variant_ref (batch);
+  data->deadline =
+    g_get_monotonic_time () + RETRY_DEADLINE_S * G_TIME_SPAN_SECOND;
+  data->retry_delay_ms = RETRY_INITIAL_DELAY_MS;
+  message_sent (self);
+
+  return data;
+}
+
+/* Frees @data, whose batch has been acknowledged or given up on. */
+static void
+batch_data_free (BatchData *data)
+{
+  EmtrEventSender *self = data->sender;
+
+  g_variant_unref (data->batch);
+  g_free (data);
+
+  message_completed (self);
+}
+
+static void call_record_events (EmtrEventSender *self,
+                                BatchData       *data);
+
+static gboolean
+retry_batch_cb (gpointer user_data)
+{
+  BatchData *data = user_data;
+  EmtrEventSender *self = data->sender;
+
+  /* The source is about to be destroyed by returning G_SOURCE_REMOVE. */
+  g_clear_pointer (&data->retry_source, g_source_unref);
+  g_queue_remove (&self->retrying_batches, data);
+
+  /* Nothing is sent if recording has been disabled in the meantime. */
+  if (!g_atomic_int_get (&self->enabled))
+    {
+      batch_data_free (data);
+    }
+  else if (daemon_is_available (self))
+    {
+      call_record_events (self, data);
+    }
+  else
+    {
+      spool_batch (self, data->batch);
+      batch_data_free (data);
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Handles an asynchronous batch call that failed with @error. If the failure
+ * is transient, the call is made again after a delay that doubles with each
+ * attempt, up to RETRY_MAX_DELAY_MS. Each delay is picked at random between
+ * half and all of that, so that processes that failed together don't retry
+ * together. The batch is given up on if the failure is not transient, or if
+ * the next attempt would be past its deadline.
+ */
+static void
+retry_batch (EmtrEventSender *self,
+             BatchData       *data,
+             const GError    *error)
+{
+  guint delay_ms =
+    g_random_int_range (data->retry_delay_ms / 2, data->retry_delay_ms + 1);
+
+  if (!is_transient_error (error))
+    {
+      g_warning ("Failed to send events to event recorder daemon: %s.",
+                 error->message);
+      count_batch (self, data->batch, EMTR_EVENT_STAT_FAILED);
+      batch_data_free (data);
+      return;
+    }
+
+  if (g_get_monotonic_time () + delay_ms * G_TIME_SPAN_MILLISECOND >
+      data->deadline)
+    {
+      g_warning ("Gave up sending events to event recorder daemon after "
+                 "%d seconds: %s.", RETRY_DEADLINE_S, error->message);
+      count_dropped_batch (self, data->batch);
+      batch_data_free (data);
+      return;
+    }
+
+  g_debug ("Sending events to event recorder daemon again in %u ms: %s",
+           delay_ms, error->message);
+
+  data->retry_delay_ms = MIN (data->retry_delay_ms * 2, RETRY_MAX_DELAY_MS);
+  data->retry_source = g_timeout_source_new (delay_ms);
+  g_source_set_name (data->retry_source, "[eosmetrics] retry sending events");
+  g_source_set_callback (data->retry_source, retry_batch_cb, data, NULL);
+  g_source_attach (data->retry_source, self->context);
+  g_queue_push_tail (&self->retrying_batches, data);
+}
+
+static void
+record_events_finish_callback (GObject      *source_object,
+                               GAsyncResult *res,
+                               gpointer      user_data)
+{
+  BatchData *data = user_data;
+  EmtrEventSender *self = data->sender;
+  GError *error = NULL;
+  GDBusMessage *reply =
+    g_dbus_connection_send_message_with_reply_finish (G_DBUS_CONNECTION (source_object),
+                                                      res, &error);
+
+  count_round_trip (self, EMTR_LATENCY_RECORD_EVENTS, data->call_time);
+
+  if (reply != NULL)
+    {
+      g_dbus_message_to_gerror (reply, &error);
+      g_object_unref (reply);
+    }
+
+  trace_batch_complete (data->in_memfd, error);
+
+  if (error == NULL)
+    {
+      batch_method_succeeded (self, data->in_memfd);
+      batch_data_free (data);
+    }
+  else if (batch_method_unsupported (self, error, data->in_memfd))
+    {
+      call_record_events (self, data);
+    }
+  else
+    {
+      retry_batch (self, data, error);
+    }
+
+  g_clear_error (&error);
+}
+
+/*
+ * Makes an asynchronous call that sends the batch of @data and waits for the
+ * daemon to acknowledge it, for at most BATCH_CALL_TIMEOUT_MS. Old daemons
+ * get the records of the batch individually instead.
+ */
+static void
+call_record_events (EmtrEventSender *self,
+                    BatchData       *data)
+{
+  if (self->batching_unsupported)
+    {
+      send_batch_individually (self, data->batch, FALSE /* is_synchronous */);
+      batch_data_free (data);
+      return;
+    }
+
+  GDBusConnection *connection =
+    g_dbus_proxy_get_connection (G_DBUS_PROXY (self->sending_proxy));
+  GDBusMessage *message =
+    new_record_events_call (self, data->batch, &data->in_memfd);
+
+  trace_batch_send (data->batch, data->in_memfd);
+  data->call_time = g_get_monotonic_time ();
+  g_dbus_connection_send_message_with_reply (connection, message,
+                                             G_DBUS_SEND_MESSAGE_FLAGS_NONE,
+                                             BATCH_CALL_TIMEOUT_MS,
+                                             NULL /* out_serial */,
+                                             NULL /* GCancellable */,
+                                             record_events_finish_callback,
+                                             data);
+  g_object_unref (message);
+}
+
+/* Sends @batch, which holds the arguments of a RecordEvents call, to D-Bus. */
+static void
+send_batch_to_dbus (EmtrEventSender *self,
+                    GVariant        *batch,
+                    gboolean         is_synchronous)
+{
+  if (self->batching_unsupported)
+    {
+      send_batch_individually (self, batch, is_synchronous);
+      return;
+    }
+
+  if (is_synchronous)
+    {
+      send_batch_sync (self, batch);
+      return;
+    }
+
+  /* Calls are only made without a reply once the daemon is known to
+     implement their method. */
+  if (self->batching_supported && !g_atomic_int_get (&self->wait_for_replies) &&
+      (self->fd_passing_supported || !should_send_in_memfd (self, batch)))
+    {
+      gboolean in_memfd;
+      GDBusMessage *message = new_record_events_call (self, batch, &in_memfd);
+
+      trace_batch_send (batch, in_memfd);
+      send_message_without_reply (self, message);
+      g_object_unref (message);
+      return;
+    }
+
+  call_record_events (self, batch_data_new (self, batch));
+}
+
+/*
+ * Copies the records that are waiting to be batched into the event ring, and
+ * wakes the daemon up. Returns FALSE if some of them did not fit, in which
+ * case they are left waiting.
+ */
+static gboolean
+write_pending_records_to_ring (EmtrEventSender *self)
+{
+  gboolean all_written = TRUE;
+
+  for (gint kind = 0; kind < EMTR_NUM_RECORD_KINDS && all_written; kind++)
+    {
+      GPtrArray *records = self->pending_records[kind];
+      guint num_written = 0;
+
+      for (; num_written < records->len; num_written++)
+        {
+          GVariant *record = g_ptr_array_index (records, num_written);
+
+          if (!emtr_shm_ring_write (self->shm_ring, kind,
+                                    g_variant_get_data (record),
+                                    g_variant_get_size (record)))
+            {
+              all_written = FALSE;
+              break;
+            }
+
+          count_sent_record (self, record);
+          self->queued_bytes -= g_variant_get_size (record);
+        }
+
+      g_ptr_array_remove_range (records, 0, num_written);
+      self->num_pending_records -= num_written;
+    }
+
+  emtr_shm_ring_commit (self->shm_ring);
+
+  return all_written;
+}
+
+/* Wakes up the recording threads that are waiting for room, if any. */
+static void
+wake_blocked_threads (EmtrEventSender *self)
+{
+  if (g_atomic_int_get (&self->num_blocked_threads) == 0)
+    return;
+
+  g_mutex_lock (&self->sync_lock);
+  g_cond_broadcast (&self->sync_cond);
+  g_mutex_unlock (&self->sync_lock);
+}
+
+/* Tells recording threads whether the records waiting to be batched have room
+   for more. */
+static void
+set_congested (EmtrEventSender *self,
+               gboolean         congested)
+{
+  if (g_atomic_int_get (&self->congested) == congested)
+    return;
+
+  g_atomic_int_set (&self->congested, congested);
+
+  if (!congested)
+    wake_blocked_threads (self);
+}
+
+/* Ends congestion once the records waiting to be batched are down to half of
+   max_queued_bytes, so that recording threads don't flap around the limit. */
+static void
+update_congested (EmtrEventSender *self)
+{
+  guint max_queued_bytes = g_atomic_int_get (&self->max_queued_bytes);
+
+  if (max_queued_bytes == 0 || self->queued_bytes <= max_queued_bytes / 2)
+    set_congested (self, FALSE);
+}
+
+/* Whether as many messages are in flight as max_in_flight allows */
+static gboolean
+in_flight_window_is_full (EmtrEventSender *self)
+{
+  guint max_in_flight = g_atomic_int_get (&self->max_in_flight);
+
+  return max_in_flight > 0 &&
+    (guint) g_atomic_int_get (&self->num_in_flight) >= max_in_flight;
+}
+
+/* Sends all records that are waiting to be batched, unless too many messages
+   are in flight for an asynchronous batch. */
+static void
+flush_pending_records (EmtrEventSender *self,
+                       gboolean         is_synchronous)
+{
+  GVariant *arguments[EMTR_NUM_RECORD_KINDS + 1];
+
+  if (!daemon_is_available (self))
+    {
+      for (gint kind = 0; kind < EMTR_NUM_RECORD_KINDS; kind++)
+        {
+          GPtrArray *records = self->pending_records[kind];
+
+          for (guint i = 0; i < records->len; i++)
+            spool_record (self, kind, g_ptr_array_index (records, i));
+          g_ptr_array_set_size (records, 0);
+        }
+
+      self->num_pending_records = 0;
+      self->queued_bytes = 0;
+      update_congested (self);
+      return;
+    }
+
+  if (self->shm_ring != NULL && !g_atomic_int_get (&self->wait_for_replies) &&
+      write_pending_records_to_ring (self))
+    {
+      update_congested (self);
+      return;
+    }
+
+  if (!is_synchronous && in_flight_window_is_full (self))
+    {
+      self->records_held_back = TRUE;
+      return;
+    }
+
+  EmtrProfile profile;
+  emtr_stats_profile_begin (self->stats, &profile);
+
+  for (gint kind = 0; kind < EMTR_NUM_RECORD_KINDS; kind++)
+    {
+      GPtrArray *records = self->pending_records[kind];
+
+      for (guint i = 0; i < records->len; i++)
+        count_sent_record (self, g_ptr_array_index (records, i));
+
+      arguments[kind] =
+        g_variant_new_array (G_VARIANT_TYPE (record_types[kind]),
+                             (GVariant **) records->pdata, records->len);
+      g_ptr_array_set_size (records, 0);
+    }
+
+  GVariantBuilder options;
+  g_variant_builder_init (&options, G_VARIANT_TYPE ("a{sv}"));
+  g_variant_builder_add (&options, "{sv}", "client-id",
+                         g_variant_new_string (self->client_id));
+  g_variant_builder_add (&options, "{sv}", "sequence-number",
+                         g_variant_new_uint64 (self->next_sequence_number++));
+  arguments[EMTR_NUM_RECORD_KINDS] = g_variant_builder_end (&options);
+
+  self->num_pending_records = 0;
+  self->queued_bytes = 0;
+  self->records_held_back = FALSE;
+
+  GVariant *batch =
+    g_variant_ref_sink (g_variant_new_tuple (arguments,
+                                             EMTR_NUM_RECORD_KINDS + 1));
+  emtr_profile_phase (&profile, EMTR_PHASE_BUILD_BATCH);
+  send_batch_to_dbus (self, batch, is_synchronous);
+  emtr_profile_phase (&profile, EMTR_PHASE_SEND);
+  emtr_stats_profile_end (self->stats, &profile, NULL);
+  g_variant_unref (batch);
+
+  update_congested (self);
+}
+
+/* Sends all records that are waiting to be batched, if there are any, and
+   marks the flush in sysprof captures. */
+static void
+send_pending_records (EmtrEventSender *self,
+                      gboolean         is_synchronous)
+{
+  guint num_records = self->num_pending_records;
+  gsize num_bytes = self->queued_bytes;
+
+  if (num_records == 0)
+    return;
+
+  gint64 mark_time = emtr_trace_begin_mark ();
+  flush_pending_records (self, is_synchronous);
+  emtr_trace_end_mark (mark_time, "Flush",
+                       "%u records, %" G_GSIZE_FORMAT " bytes%s",
+                       num_records, num_bytes,
+                       is_synchronous ? ", synchronous" : "");
+}
+
+/*
+ * Called once a message carrying records has been written out or replied to.
+ * Sends the records that were held back while too many messages were in
+ * flight.
+ */
+static void
+message_completed (EmtrEventSender *self)
+{
+  g_atomic_int_add (&self->num_in_flight, -1);
+
+  if (self->records_held_back && !in_flight_window_is_full (self))
+    send_pending_records (self, FALSE /* is_synchronous */);
+
+  /* Replay more of the spool now that there is room for it. */
+  if (self->spool_replay_pending && !self->records_held_back)
+    g_source_set_ready_time (self->flush_source, 0);
+}
+
+/* Wakes up the recording thread that is waiting for @record to be sent. */
+static void
+complete_record (EmtrEventSender *self,
+                 Record          *record)
+{
+  g_mutex_lock (&self->sync_lock);
+  *record->done = TRUE;
+  g_cond_broadcast (&self->sync_cond);
+  g_mutex_unlock (&self->sync_lock);
+}
+
+/* Makes sure that the flush source dispatches within the flush interval. */
+static void
+arm_flush_source (EmtrEventSender *self)
+{
+  if (!g_atomic_int_compare_and_exchange (&self->flush_armed, FALSE, TRUE))
+    return;
+
+  guint flush_interval_ms = g_atomic_int_get (&self->flush_interval_ms);
+  g_source_set_ready_time (self->flush_source,
+                           g_get_monotonic_time () +
+                           flush_interval_ms * G_TIME_SPAN_MILLISECOND);
+}
+
+/*
+ * Moves the records that are in the rings into @records. Returns TRUE if more
+ * records were pushed in the meantime.
+ */
+static gboolean
+drain_rings (EmtrEventSender *self,
+             GArray          *records)
+{
+  gboolean more_records = FALSE;
+
+  g_mutex_lock (&self->rings_lock);
+
+  for (guint i = 0; i < self->rings->len; )
+    {
+      ProducerRing *ring = g_ptr_array_index (self->rings, i);
+      guint head = ring->head;
+      guint tail = g_atomic_int_get (&ring->tail);
+
+      for (; head != tail; head++)
+        g_array_append_val (records, ring->slots[head & RING_MASK]);
+
+      g_atomic_int_set (&ring->head, head);
+
+      if ((guint) g_atomic_int_get (&ring->tail) != head)
+        {
+          more_records = TRUE;
+        }
+      else if (g_atomic_int_get (&ring->ref_count) == 1)
+        {
+          /* The thread has exited, and its ring is empty. */
+          g_ptr_array_remove_index_fast (self->rings, i);
+          continue;
+        }
+
+      i++;
+    }
+
+  g_mutex_unlock (&self->rings_lock);
+
+  return more_records;
+}
+
+static gint
+compare_records_by_time (gconstpointer a,
+                         gconstpointer b)
+{
+  const Record *record_a = a;
+  const Record *record_b = b;
+
+  return (record_a->relative_time > record_b->relative_time) -
+    (record_a->relative_time < record_b->relative_time);
+}
+
+/* Adds @variant, a record of @kind, to the next batch. Consumes a floating
+   reference. */
+static void
+add_pending_record (EmtrEventSender *self,
+                    EmtrRecordKind   kind,
+                    GVariant        *variant,
+                    guint            max_batch_size)
+{
+  g_ptr_array_add (self->pending_records[kind], g_variant_ref_sink (variant));
+  self->queued_bytes += g_variant_get_size (variant);
+
+  if (++self->num_pending_records >= max_batch_size)
+    send_pending_records (self, FALSE /* is_synchronous */);
+}
+
+/* Returns the time by which records are ordered: that of the event, or of the
+   last event of an event sequence. */
+static gint64
+get_record_time (EmtrRecordKind  kind,
+                 GVariant       *record)
+{
+  gint64 relative_time;
+
+  switch (kind)
+    {
+    case EMTR_RECORD_SINGULAR_EVENT:
+      g_variant_get_child (record, 2, "x", &relative_time);
+      return relative_time;
+
+    case EMTR_RECORD_AGGREGATE_EVENT:
+      g_variant_get_child (record, 3, "x", &relative_time);
+      return relative_time;
+
+    case EMTR_RECORD_EVENT_SEQUENCE:
+      {
+        GVariant *events = g_variant_get_child_value (record, 2);
+        gsize num_events = g_variant_n_children (events);
+
+        relative_time = 0;
+        if (num_events > 0)
+          g_variant_get_child (events, num_events - 1, "(xbv)",
+                               &relative_time, NULL, NULL);
+        g_variant_unref (events);
+        return relative_time;
+      }
+
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+/*
+ * Drops the oldest records waiting to be batched until they take up at most
+ * @max_bytes. Records are only ordered within their kind, so the oldest of the
+ * first records of each kind goes first.
+ */
+static void
+drop_oldest_pending_records (EmtrEventSender *self,
+                             gsize            max_bytes)
+{
+  guint num_dropped[EMTR_NUM_RECORD_KINDS] = { 0, };
+
+  while (self->queued_bytes > max_bytes)
+    {
+      gint oldest_kind = -1;
+      gint64 oldest_time = G_MAXINT64;
+
+      for (gint kind = 0; kind < EMTR_NUM_RECORD_KINDS; kind++)
+        {
+          GPtrArray *records = self->pending_records[kind];
+
+          if (num_dropped[kind] == records->len)
+            continue;
+
+          gint64 relative_time =
+            get_record_time (kind, g_ptr_array_index (records,
+                                                      num_dropped[kind]));
+          if (oldest_kind < 0 || relative_time < oldest_time)
+            {
+              oldest_kind = kind;
+              oldest_time = relative_time;
+            }
+        }
+
+      if (oldest_kind < 0)
+        break;
+
+      GVariant *record =
+        g_ptr_array_index (self->pending_records[oldest_kind],
+                           num_dropped[oldest_kind]);
+      count_dropped_record (self, record);
+      self->queued_bytes -= g_variant_get_size (record);
+      num_dropped[oldest_kind]++;
+    }
+
+  for (gint kind = 0; kind < EMTR_NUM_RECORD_KINDS; kind++)
+    {
+      if (num_dropped[kind] == 0)
+        continue;
+
+      g_ptr_array_remove_range (self->pending_records[kind], 0,
+                                num_dropped[kind]);
+      self->num_pending_records -= num_dropped[kind];
+    }
+}
+
+/*
+ * Adds @variant, a record of @kind, to the next batch if there is room for it
+ * in max_queued_bytes, applying the drop policy otherwise. A record always
+ * fits if nothing else is waiting. Consumes a floating reference.
+ */
+static void
+queue_record (EmtrEventSender *self,
+              EmtrRecordKind   kind,
+              GVariant        *variant,
+              guint            max_batch_size)
+{
+  guint max_queued_bytes = g_atomic_int_get (&self->max_queued_bytes);
+
+  g_variant_ref_sink (variant);
+  log_record (self, variant, EMTR_EVENT_STAT_RECORDED);
+
+  gsize size = g_variant_get_size (variant);
+
+  if (max_queued_bytes > 0 && self->queued_bytes > 0 &&
+      self->queued_bytes + size > max_queued_bytes)
+    {
+      set_congested (self, TRUE);
+
+      /* Make room for a quarter of the limit at once, rather than dropping a
+         record for each new one. */
+      if (g_atomic_int_get (&self->drop_policy) == EMTR_DROP_POLICY_DROP_OLDEST)
+        {
+          gsize room = MAX (size, max_queued_bytes / 4);
+          drop_oldest_pending_records (self, room < max_queued_bytes ?
+                                       max_queued_bytes - room : 0);
+        }
+
+      if (self->queued_bytes > 0 &&
+          self->queued_bytes + size > max_queued_bytes)
+        {
+          count_dropped_record (self, variant);
+          g_variant_unref (variant);
+          return;
+        }
+    }
+
+  add_pending_record (self, kind, variant, max_batch_size);
+  g_variant_unref (variant);
+}
+
+/*
+ * Adds one aggregate event per event ID of which records were dropped since
+ * the last report to the next batch, counting them. These are never dropped
+ * themselves.
+ */
+static void
+report_dropped_records (EmtrEventSender *self,
+                        guint            max_batch_size)
+{
+  GHashTable *dropped_counts;
+  GHashTableIter iter;
+  const guchar *event_id;
+  guint64 *count;
+  gint64 relative_time;
+
+  g_mutex_lock (&self->dropped_counts_lock);
+  if (g_hash_table_size (self->dropped_counts) == 0)
+    {
+      g_mutex_unlock (&self->dropped_counts_lock);
+      return;
+    }
+  dropped_counts = self->dropped_counts;
+  self->dropped_counts =
+    g_hash_table_new_full (event_id_hash, event_id_equal, g_free, g_free);
+  g_mutex_unlock (&self->dropped_counts_lock);
+
+  if (!emtr_util_get_current_time (CLOCK_BOOTTIME, &relative_time))
+    relative_time = 0;
+
+  g_hash_table_iter_init (&iter, dropped_counts);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &event_id,
+                                 (gpointer *) &count))
+    {
+      gchar unparsed_event_id[37];
+
+      uuid_unparse_lower (event_id, unparsed_event_id);
+      add_pending_record (self, EMTR_RECORD_AGGREGATE_EVENT,
+                          g_variant_new ("(u@ayxxb@v)", self->uid,
+                                         get_event_id_variant (self,
+                                                               dropped_events_event_id),
+                                         (gint64) MIN (*count, G_MAXINT64),
+                                         relative_time, TRUE,
+                                         g_variant_new_variant (g_variant_new_string (unparsed_event_id))),
+                          max_batch_size);
+    }
+
+  g_hash_table_unref (dropped_counts);
+}
+
+static gboolean
+report_dropped_records_cb (gpointer user_data)
+{
+  EmtrEventSender *self = user_data;
+
+  /* Nothing is reported while recording is disabled. */
+  if (!g_atomic_int_get (&self->enabled))
+    {
+      g_mutex_lock (&self->dropped_counts_lock);
+      g_hash_table_remove_all (self->dropped_counts);
+      g_mutex_unlock (&self->dropped_counts_lock);
+      return G_SOURCE_CONTINUE;
+    }
+
+  report_dropped_records (self, g_atomic_int_get (&self->max_batch_size));
+  send_pending_records (self, FALSE /* is_synchronous */);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/*
+ * Adds a record read back from the spool to the next batch, unless it was kept
+ * during an earlier boot, in which case its time means nothing anymore and it
+ * is counted as dropped. Returns FALSE, leaving the record in the spool, while
+ * batches are held back or if it does not fit in half of max_queued_bytes, so
+ * that replayed records are never dropped and leave room for new ones.
+ */
+static gboolean
+replay_record_cb (guint32  kind,
+                  GBytes  *data,
+                  gboolean is_stale,
+                  gpointer user_data)
+{
+  EmtrEventSender *self = user_data;
+  guint max_queued_bytes = g_atomic_int_get (&self->max_queued_bytes);
+
+  if (kind >= EMTR_NUM_RECORD_KINDS)
+    return TRUE;
+
+  if (!is_stale &&
+      (self->records_held_back ||
+       (max_queued_bytes > 0 && self->queued_bytes > 0 &&
+        self->queued_bytes + g_bytes_get_size (data) > max_queued_bytes / 2)))
+    return FALSE;
+
+  GVariant *record =
+    g_variant_new_from_bytes (G_VARIANT_TYPE (record_types[kind]), data,
+                              FALSE /* trusted */);
+
+  if (is_stale)
+    {
+      g_variant_ref_sink (record);
+      count_dropped_record (self, record);
+      g_variant_unref (record);
+      return TRUE;
+    }
+
+  queue_record (self, kind, record, g_atomic_int_get (&self->max_batch_size));
+  return TRUE;
+}
+
+/*
+ * Replays the spool one segment at a time, sending the records of each as
+ * batches, for as long as the daemon is available and the in-flight window has
+ * room. What is left is replayed on a later dispatch, once messages in flight
+ * have completed.
+ */
+static void
+replay_spool (EmtrEventSender *self)
+{
+  guint num_replayed = 0;
+
+  while (self->spool_replay_pending && daemon_is_available (self) &&
+         !self->records_held_back)
+    {
+      if (!emtr_spool_replay (self->spool, replay_record_cb, self,
+                              &num_replayed))
+        self->spool_replay_pending = FALSE;
+
+      send_pending_records (self, FALSE /* is_synchronous */);
+    }
+
+  if (num_replayed > 0)
+    g_debug ("Sending %u events that were kept while the event recorder "
+             "daemon was unavailable.", num_replayed);
+}
+
+/*
+ * Adds one aggregate record per key counted during the current aggregation
+ * window to the next batch, and closes the window. Each one carries the
+ * timestamp of the first event of its key in the window.
+ */
+static void
+emit_aggregated_counts (EmtrEventSender *self,
+                        guint            max_batch_size)
+{
+  GHashTableIter iter;
+  GVariant *key;
+  AggregatedCount *count;
+
+  if (self->aggregation_source != NULL)
+    {
+      g_source_destroy (self->aggregation_source);
+      g_clear_pointer (&self->aggregation_source, g_source_unref);
+    }
+
+  g_hash_table_iter_init (&iter, self->aggregated_counts);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &key, (gpointer *) &count))
+    {
+      GVariant *event_id, *payload;
+      gboolean has_payload;
+
+      g_variant_get (key, "(@ayb@v)", &event_id, &has_payload, &payload);
+      queue_record (self, EMTR_RECORD_AGGREGATE_EVENT,
+                    g_variant_new ("(u@ayxxb@v)", self->uid, event_id,
+                                   count->num_events, count->relative_time,
+                                   has_payload, payload),
+                    max_batch_size);
+      g_variant_unref (event_id);
+      g_variant_unref (payload);
+
+      g_hash_table_iter_remove (&iter);
+    }
+}
+
+static gboolean
+aggregation_window_ended_cb (gpointer user_data)
+{
+  EmtrEventSender *self = user_data;
+
+  /* The source is about to be destroyed by returning G_SOURCE_REMOVE. */
+  g_clear_pointer (&self->aggregation_source, g_source_unref);
+
+  emit_aggregated_counts (self, g_atomic_int_get (&self->max_batch_size));
+  send_pending_records (self, FALSE /* is_synchronous */);
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Adds the events of @record, an asynchronous aggregate record, to the count
+ * of its key in the current aggregation window, opening a window of
+ * @aggregation_window_ms if none is open.
+ */
+static void
+aggregate_record (EmtrEventSender *self,
+                  Record          *record,
+                  guint            aggregation_window_ms)
+{
+  EmtrProfile profile;
+
+  emtr_stats_profile_begin (self->stats, &profile);
+
+  GVariant *key =
+    g_variant_new ("(@ayb@v)", get_event_id_variant (self, record->event_id),
+                   record->payload != NULL,
+                   box_payload (self, record->payload, &profile));
+  g_variant_ref_sink (key);
+  emtr_profile_phase (&profile, EMTR_PHASE_BUILD_RECORD);
+  emtr_stats_profile_end (self->stats, &profile, record->event_id);
+
+  AggregatedCount *count = g_hash_table_lookup (self->aggregated_counts, key);
+
+  if (count != NULL)
+    {
+      count->num_events += record->num_events;
+      g_variant_unref (key);
+      return;
+    }
+
+  count = g_new (AggregatedCount, 1);
+  count->relative_time = record->relative_time;
+  count->num_events = record->num_events;
+  g_hash_table_insert (self->aggregated_counts, key, count);
+
+  if (self->aggregation_source == NULL)
+    {
+      self->aggregation_source = g_timeout_source_new (aggregation_window_ms);
+      g_source_set_name (self->aggregation_source,
+                         "[eosmetrics] emit aggregated events");
+      g_source_set_callback (self->aggregation_source,
+                             aggregation_window_ended_cb, self, NULL);
+      g_source_attach (self->aggregation_source, self->context);
+    }
+}
+
+static void
+proxy_waiter_free (ProxyWaiter *waiter)
+{
+  if (waiter->destroy_user_data != NULL)
+    waiter->destroy_user_data (waiter->user_data);
+  g_free (waiter);
+}
+
+/* Calls the callbacks waiting for the connection, once it is ready or has
+   failed. */
+static void
+notify_proxy_waiters (EmtrEventSender *self)
+{
+  ProxyWaiter *waiter;
+
+  while ((waiter = g_queue_pop_head (&self->proxy_waiters)) != NULL)
+    {
+      waiter->callback (self->dbus_proxy, waiter->user_data);
+      proxy_waiter_free (waiter);
+    }
+}
+
+/* Follows the daemon's Enabled property. The property is missing if the
+   daemon is too old to have it, in which case recording is enabled. */
+static void
+update_enabled (EmtrEventSender *self)
+{
+  GVariant *daemon_enabled =
+    g_dbus_proxy_get_cached_property (G_DBUS_PROXY (self->dbus_proxy),
+                                      "Enabled");
+  gboolean enabled = self->enabled_by_environment;
+
+  if (daemon_enabled != NULL)
+    {
+      if (g_variant_is_of_type (daemon_enabled, G_VARIANT_TYPE_BOOLEAN))
+        enabled = enabled && g_variant_get_boolean (daemon_enabled);
+      g_variant_unref (daemon_enabled);
+    }
+
+  if (enabled != g_atomic_int_get (&self->enabled))
+    g_debug ("Event recording %s by the event recorder daemon.",
+             enabled ? "enabled" : "disabled");
+
+  g_atomic_int_set (&self->enabled, enabled);
+}
+
+static void
+properties_changed_cb (GDBusProxy          *dbus_proxy,
+                       GVariant            *changed_properties,
+                       const gchar * const *invalidated_properties,
+                       gpointer             user_data)
+{
+  update_enabled (user_data);
+}
+
+/* Goes back to sending records over the bus. */
+static void
+clear_direct_proxy (EmtrEventSender *self)
+{
+  if (self->direct_proxy == NULL)
+    return;
+
+  GDBusConnection *connection =
+    g_dbus_proxy_get_connection (G_DBUS_PROXY (self->direct_proxy));
+  g_signal_handler_disconnect (connection, self->direct_closed_id);
+  self->direct_closed_id = 0;
+
+  g_clear_object (&self->direct_proxy);
+  self->sending_proxy = self->dbus_proxy;
+
+  /* The daemon closes a ring along with the connection that opened it. */
+  g_clear_pointer (&self->shm_ring, emtr_shm_ring_free);
+}
+
+static void
+direct_connection_closed_cb (GDBusConnection *connection,
+                             gboolean         remote_peer_vanished,
+                             GError          *error,
+                             gpointer         user_data)
+{
+  g_debug ("Direct connection to the event recorder daemon closed; sending "
+           "events over the bus.");
+  clear_direct_proxy (user_data);
+}
+
+/* Ends connecting to the daemon, and sends or drops what was held
+   meanwhile. */
+static void
+finish_connecting (EmtrEventSender *self,
+                   ConnectionState  connection_state)
+{
+  self->connection_state = connection_state;
+
+  if (self->num_dropped_records > 0)
+    {
+      g_warning ("Dropped %u events that were recorded while connecting to "
+                 "the event recorder daemon.", self->num_dropped_records);
+      self->num_dropped_records = 0;
+    }
+
+  notify_proxy_waiters (self);
+
+  /* Send, spool or drop what was held while connecting. */
+  g_source_set_ready_time (self->flush_source, 0);
+}
+
+static void
+event_ring_opened_cb (GObject      *source_object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+  EmtrEventSender *self = user_data;
+  GError *error = NULL;
+  GDBusMessage *reply =
+    g_dbus_connection_send_message_with_reply_finish (G_DBUS_CONNECTION (source_object),
+                                                      result, &error);
+
+  if (reply != NULL && !g_dbus_message_to_gerror (reply, &error))
+    {
+      GVariant *body = g_dbus_message_get_body (reply);
+      GUnixFDList *fd_list = g_dbus_message_get_unix_fd_list (reply);
+      gint32 ring_handle, wakeup_handle;
+      gint ring_fd = -1, wakeup_fd = -1;
+
+      if (body == NULL || fd_list == NULL ||
+          !g_variant_is_of_type (body, G_VARIANT_TYPE ("(hh)")))
+        {
+          g_set_error_literal (&error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                               "Invalid reply to OpenEventRing");
+        }
+      else
+        {
+          g_variant_get (body, "(hh)", &ring_handle, &wakeup_handle);
+          ring_fd = g_unix_fd_list_get (fd_list, ring_handle, &error);
+          if (ring_fd >= 0)
+            wakeup_fd = g_unix_fd_list_get (fd_list, wakeup_handle, &error);
+
+          if (wakeup_fd >= 0)
+            self->shm_ring = emtr_shm_ring_new (ring_fd, wakeup_fd, &error);
+          else if (ring_fd >= 0)
+            close (ring_fd);
+        }
+    }
+
+  g_clear_object (&reply);
+
+  if (error != NULL)
+    {
+      /* Daemons that predate OpenEventRing only take D-Bus calls. */
+      if (!g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD))
+        g_debug ("Unable to use an event ring; sending events with D-Bus "
+                 "calls: %s", error->message);
+      g_error_free (error);
+    }
+
+  finish_connecting (self, CONNECTION_READY);
+}
+
+/*
+ * Asks the daemon for an event ring on the connection that records are sent
+ * on, then finishes connecting whether it has one to offer or not.
+ */
+static void
+open_event_ring (EmtrEventSender *self)
+{
+  GDBusConnection *connection =
+    g_dbus_proxy_get_connection (G_DBUS_PROXY (self->sending_proxy));
+
+  if ((g_dbus_connection_get_capabilities (connection) &
+       G_DBUS_CAPABILITY_FLAGS_UNIX_FD_PASSING) == 0)
+    {
+      finish_connecting (self, CONNECTION_READY);
+      return;
+    }
+
+  GDBusMessage *message =
+    new_method_call (self, "OpenEventRing", g_variant_new ("()"),
+                     NULL /* GUnixFDList */);
+  g_dbus_connection_send_message_with_reply (connection, message,
+                                             G_DBUS_SEND_MESSAGE_FLAGS_NONE,
+                                             -1 /* timeout */,
+                                             NULL /* out_serial */,
+                                             NULL /* GCancellable */,
+                                             event_ring_opened_cb,
+                                             self);
+  g_object_unref (message);
+}
+
+/*
+ * Replays the spool when the daemon appears, and drops the event ring if the
+ * daemon that opened it goes away.
+ */
+static void
+name_owner_changed_cb (GObject    *object,
+                       GParamSpec *pspec,
+                       gpointer    user_data)
+{
+  EmtrEventSender *self = user_data;
+  gchar *name_owner = g_dbus_proxy_get_name_owner (G_DBUS_PROXY (object));
+
+  self->daemon_present = (name_owner != NULL);
+  g_free (name_owner);
+
+  if (self->daemon_present)
+    {
+      self->activation_requested = FALSE;
+      self->spool_replay_pending = TRUE;
+      g_source_set_ready_time (self->flush_source, 0);
+      return;
+    }
+
+  if (self->shm_ring != NULL && self->direct_proxy == NULL)
+    {
+      g_debug ("Event recorder daemon went away; sending events with D-Bus "
+               "calls.");
+      g_clear_pointer (&self->shm_ring, emtr_shm_ring_free);
+    }
+}
+
+static void
+direct_proxy_created_cb (GObject      *source_object,
+                         GAsyncResult *result,
+                         gpointer      user_data)
+{
+  EmtrEventSender *self = user_data;
+  GError *error = NULL;
+
+  self->direct_proxy =
+    emer_event_recorder_server_proxy_new_finish (result, &error);
+
+  if (self->direct_proxy == NULL)
+    {
+      g_debug ("Unable to use the direct connection to the event recorder "
+               "daemon; sending events over the bus: %s", error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      GDBusConnection *connection =
+        g_dbus_proxy_get_connection (G_DBUS_PROXY (self->direct_proxy));
+      self->direct_closed_id =
+        g_signal_connect (connection, "closed",
+                          G_CALLBACK (direct_connection_closed_cb), self);
+      self->sending_proxy = self->direct_proxy;
+    }
+
+  open_event_ring (self);
+}
+
+static void
+direct_connection_created_cb (GObject      *source_object,
+                              GAsyncResult *result,
+                              gpointer      user_data)
+{
+  EmtrEventSender *self = user_data;
+  GError *error = NULL;
+  GDBusConnection *connection =
+    g_dbus_connection_new_for_address_finish (result, &error);
+
+  if (connection == NULL)
+    {
+      g_debug ("Unable to connect directly to the event recorder daemon; "
+               "sending events over the bus: %s", error->message);
+      g_error_free (error);
+      open_event_ring (self);
+      return;
+    }
+
+  /* There is no bus name on a peer-to-peer connection. */
+  emer_event_recorder_server_proxy_new (connection,
+                                        G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
+                                        G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS,
+                                        NULL /* name */,
+                                        "/com/endlessm/Metrics",
+                                        NULL /* GCancellable */,
+                                        direct_proxy_created_cb,
+                                        self);
+  g_object_unref (connection);
+}
+
+static void
+direct_address_cb (GObject      *source_object,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+  EmtrEventSender *self = user_data;
+  GError *error = NULL;
+  gchar *address = NULL;
+
+  if (!emer_event_recorder_server_call_get_direct_address_finish (self->dbus_proxy,
+                                                                  &address,
+                                                                  result,
+                                                                  &error))
+    {
+      /* Daemons that predate GetDirectAddress only serve the bus. */
+      if (!g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD))
+        g_debug ("Event recorder daemon offers no direct connection; sending "
+                 "events over the bus: %s", error->message);
+      g_error_free (error);
+      open_event_ring (self);
+      return;
+    }
+
+  g_dbus_connection_new_for_address (address,
+                                     G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                     NULL /* GDBusAuthObserver */,
+                                     NULL /* GCancellable */,
+                                     direct_connection_created_cb,
+                                     self);
+  g_free (address);
+}
+
+static void create_proxy (EmtrEventSender *self);
+
+static gboolean
+reconnect_cb (gpointer user_data)
+{
+  EmtrEventSender *self = user_data;
+
+  g_clear_pointer (&self->reconnect_source, g_source_unref);
+  create_proxy (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Tries connecting to the bus again after a delay that doubles with each
+ * attempt. Records are spooled meanwhile, since the connection has failed.
+ */
+static void
+schedule_reconnect (EmtrEventSender *self)
+{
+  guint delay_s = self->reconnect_delay_s;
+
+  self->reconnect_delay_s = MIN (delay_s * 2, RECONNECT_MAX_DELAY_S);
+  self->reconnect_source = g_timeout_source_new_seconds (delay_s);
+  g_source_set_name (self->reconnect_source,
+                     "[eosmetrics] connect to the event recorder daemon");
+  g_source_set_callback (self->reconnect_source, reconnect_cb, self, NULL);
+  g_source_attach (self->reconnect_source, self->context);
+}
+
+static void
+proxy_created_cb (GObject      *source_object,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+  EmtrEventSender *self = user_data;
+  GError *error = NULL;
+
+  self->dbus_proxy =
+    emer_event_recorder_server_proxy_new_for_bus_finish (result, &error);
+
+  if (self->dbus_proxy == NULL)
+    {
+      /* Only the first failure is reported; what is recorded until connecting
+         succeeds is spooled. */
+      if (self->connection_state == CONNECTION_PENDING)
+        {
+          g_critical ("Unable to connect to the D-Bus event recorder server: "
+                      "%s", error->message);
+          finish_connecting (self, CONNECTION_FAILED);
+        }
+      else
+        {
+          g_debug ("Unable to connect to the D-Bus event recorder server: %s",
+                   error->message);
+        }
+      g_error_free (error);
+      schedule_reconnect (self);
+      return;
+    }
+
+  if (self->connection_state == CONNECTION_FAILED)
+    g_debug ("Connected to the D-Bus event recorder server after failing to.");
+
+  gchar *name_owner =
+    g_dbus_proxy_get_name_owner (G_DBUS_PROXY (self->dbus_proxy));
+  self->daemon_present = (name_owner != NULL);
+  g_free (name_owner);
+
+  self->sending_proxy = self->dbus_proxy;
+  self->properties_changed_id =
+    g_signal_connect (self->dbus_proxy, "g-properties-changed",
+                      G_CALLBACK (properties_changed_cb), self);
+  self->name_owner_changed_id =
+    g_signal_connect (self->dbus_proxy, "notify::g-name-owner",
+                      G_CALLBACK (name_owner_changed_cb), self);
+  update_enabled (self);
+
+  /* Nothing is sent until it is known which connection to send it on, so
+     that records are not reordered by switching connections. */
+  emer_event_recorder_server_call_get_direct_address (self->dbus_proxy,
+                                                      NULL /* GCancellable */,
+                                                      direct_address_cb,
+                                                      self);
+}
+
+/*
+ * Creates the proxy for the daemon. Its properties are loaded and kept up to
+ * date, so that the Enabled property can be followed, but nothing needs the
+ * signals of its interface.
+ */
+static void
+create_proxy (EmtrEventSender *self)
+{
+  emer_event_recorder_server_proxy_new_for_bus (G_BUS_TYPE_SYSTEM,
+                                                G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS,
+                                                "com.endlessm.Metrics",
+                                                "/com/endlessm/Metrics",
+                                                NULL /* GCancellable */,
+                                                proxy_created_cb,
+                                                self);
+}
+
+/* Starts connecting to the daemon, unless that has been started already. */
+static void
+connect_to_daemon (EmtrEventSender *self)
+{
+  if (self->connection_state != CONNECTION_NONE)
+    return;
+
+  self->connection_state = CONNECTION_PENDING;
+  create_proxy (self);
+}
+
+/* Drops the asynchronous records in @records beyond the first @max_records. */
+static void
+drop_records (EmtrEventSender *self,
+              GArray          *records,
+              guint            max_records)
+{
+  if (records->len <= max_records)
+    return;
+
+  for (guint i = max_records; i < records->len; i++)
+    {
+      Record *record = &g_array_index (records, Record, i);
+
+      log_dropped_record (self, record);
+
+      /* Records are dropped on purpose while recording is disabled, so they
+         are not reported to the daemon. */
+      if (self->connection_state == CONNECTION_PENDING)
+        count_dropped_records (self, record->event_id, 1);
+      else
+        emtr_stats_count_events (self->stats, record->event_id,
+                                 EMTR_EVENT_STAT_DROPPED, 1);
+      record_clear (record);
+    }
+
+  if (self->connection_state == CONNECTION_PENDING)
+    self->num_dropped_records += records->len - max_records;
+
+  g_array_set_size (records, max_records);
+}
+
+/*
+ * Drains the rings and the queue. Runs on the sender thread whenever the flush
+ * source becomes ready.
+ */
+static gboolean
+process_queue (gpointer user_data)
+{
+  EmtrEventSender *self = user_data;
+  guint max_batch_size = g_atomic_int_get (&self->max_batch_size);
+  guint aggregation_window_ms =
+    g_atomic_int_get (&self->aggregation_window_ms);
+  GArray *records = self->drained_records;
+  Record *record;
+
+  /* Clear the flag before draining, so that records pushed while the rings
+     are being drained rearm the flush source rather than being forgotten. */
+  g_atomic_int_set (&self->flush_armed, FALSE);
+
+  /* Pop from the queue before draining the rings: a synchronous record must
+     not overtake asynchronous records that its thread pushed before it. */
+  while ((record = g_async_queue_try_pop (self->queue)) != NULL)
+    {
+      if (record->done != NULL)
+        {
+          g_queue_push_tail (&self->synchronous_records, record);
+        }
+      else
+        {
+          g_array_append_val (records, *record);
+          g_free (record);
+        }
+    }
+
+  /* Recording threads may be waiting for the queue to shrink. */
+  wake_blocked_threads (self);
+
+  gboolean more_records = drain_rings (self, records);
+
+  if (self->connection_state == CONNECTION_NONE ||
+      self->connection_state == CONNECTION_PENDING ||
+      !g_atomic_int_get (&self->enabled))
+    {
+      if (self->connection_state == CONNECTION_FAILED ||
+          self->connection_state == CONNECTION_READY)
+        {
+          /* Recording has been disabled since they were recorded. */
+          drop_records (self, records, 0);
+          while ((record = g_queue_pop_head (&self->synchronous_records)) != NULL)
+            {
+              if (record->kind != RECORD_FLUSH)
+                {
+                  log_dropped_record (self, record);
+                  emtr_stats_count_events (self->stats, record->event_id,
+                                           EMTR_EVENT_STAT_DROPPED, 1);
+                }
+              complete_record (self, record);
+              record_free (record);
+            }
+        }
+      else
+        {
+          connect_to_daemon (self);
+          drop_records (self, records, MAX_PRECONNECT_RECORDS);
+        }
+
+      if (more_records)
+        arm_flush_source (self);
+
+      return G_SOURCE_CONTINUE;
+    }
+
+  /* Records kept while the daemon was unavailable go first. */
+  replay_spool (self);
+
+  /* Sorting is stable, so records with equal timestamps keep their order. */
+  g_array_sort (records, compare_records_by_time);
+
+  for (guint i = 0; i < records->len; i++)
+    {
+      record = &g_array_index (records, Record, i);
+
+      if (record->kind == EMTR_RECORD_AGGREGATE_EVENT &&
+          aggregation_window_ms > 0)
+        aggregate_record (self, record, aggregation_window_ms);
+      else
+        queue_record (self, record->kind, record_to_variant (self, record),
+                      max_batch_size);
+
+      record_clear (record);
+    }
+
+  g_array_set_size (records, 0);
+
+  /* Don't hold on to counts if aggregation has been turned off since. */
+  if (aggregation_window_ms == 0)
+    emit_aggregated_counts (self, max_batch_size);
+
+  while ((record = g_queue_pop_head (&self->synchronous_records)) != NULL)
+    {
+      /* Send anything batched or aggregated first so that the daemon receives
+         events in the order in which they were recorded. */
+      emit_aggregated_counts (self, max_batch_size);
+      report_dropped_records (self, max_batch_size);
+      send_pending_records (self, TRUE /* is_synchronous */);
+
+      if (record->kind != RECORD_FLUSH)
+        {
+          GVariant *variant =
+            g_variant_ref_sink (record_to_variant (self, record));
+          log_record (self, variant, EMTR_EVENT_STAT_RECORDED);
+          if (daemon_is_available (self))
+            {
+              EmtrProfile profile;
+
+              count_sent_record (self, variant);
+              emtr_stats_profile_begin (self->stats, &profile);
+              send_record_to_dbus (self, record->kind, variant,
+                                   TRUE /* is_synchronous */);
+              emtr_profile_phase (&profile, EMTR_PHASE_SEND);
+              emtr_stats_profile_end (self->stats, &profile,
+                                      record->event_id);
+            }
+          else
+            spool_record (self, record->kind, variant);
+          g_variant_unref (variant);
+        }
+
+      complete_record (self, record);
+      record_free (record);
+    }
+
+  send_pending_records (self, FALSE /* is_synchronous */);
+
+  if (more_records)
+    arm_flush_source (self);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+flush_source_dispatch (GSource     *source,
+                       GSourceFunc  callback,
+                       gpointer     user_data)
+{
+  g_source_set_ready_time (source, -1);
+  return callback (user_data);
+}
+
+static GSourceFuncs flush_source_funcs = {
+  NULL, /* prepare */
+  NULL, /* check */
+  flush_source_dispatch,
+  NULL, /* finalize */
+};
+
+static gpointer
+sender_thread_func (gpointer user_data)
+{
+  EmtrEventSender *self = user_data;
+
+  /* Replies to asynchronous D-Bus calls are dispatched in the thread-default
+     main context of the thread that made them. */
+  g_main_context_push_thread_default (self->context);
+  g_main_loop_run (self->loop);
+  g_main_context_pop_thread_default (self->context);
+
+  return NULL;
+}
+
+/*
+ * Stops the sender thread. Batches that are waiting to be sent again are kept
+ * in the spool, for the next process to send.
+ */
+static gboolean
+stop_thread_cb (gpointer user_data)
+{
+  EmtrEventSender *self = user_data;
+  BatchData *data;
+
+  while ((data = g_queue_pop_head (&self->retrying_batches)) != NULL)
+    {
+      g_source_destroy (data->retry_source);
+      g_clear_pointer (&data->retry_source, g_source_unref);
+      spool_batch (self, data->batch);
+      batch_data_free (data);
+    }
+
+  g_main_loop_quit (self->loop);
+  return G_SOURCE_REMOVE;
+}
+
+/* Starts the sender thread, unless it is running already. */
+static void
+ensure_thread (EmtrEventSender *self)
+{
+  if (g_once_init_enter (&self->thread_started))
+    {
+      self->thread = g_thread_new ("emtr-sender", sender_thread_func, self);
+      g_once_init_leave (&self->thread_started, 1);
+    }
+}
+
+static gboolean
+invoke_with_proxy_cb (gpointer user_data)
+{
+  ProxyWaiter *waiter = user_data;
+  EmtrEventSender *self = waiter->sender;
+
+  if (self->connection_state == CONNECTION_READY ||
+      self->connection_state == CONNECTION_FAILED)
+    {
+      waiter->callback (self->dbus_proxy, waiter->user_data);
+      return G_SOURCE_REMOVE;
+    }
+
+  /* Move the waiter to the queue, so that it outlives this source. */
+  ProxyWaiter *queued_waiter = g_new (ProxyWaiter, 1);
+  *queued_waiter = *waiter;
+  waiter->destroy_user_data = NULL;
+  g_queue_push_tail (&self->proxy_waiters, queued_waiter);
+
+  connect_to_daemon (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Whether there is room for another asynchronous record: in the sender
+ * thread's pending records or, if @overflowing, in the queue of records that
+ * did not fit in their thread's ring.
+ */
+static gboolean
+has_room_for_record (EmtrEventSender *self,
+                     gboolean         overflowing)
+{
+  if (overflowing)
+    return g_async_queue_length (self->queue) < (gint) MAX_QUEUED_RECORDS;
+
+  return !g_atomic_int_get (&self->congested);
+}
+
+/*
+ * Called from a recording thread when there is no room for another
+ * asynchronous record. Returns TRUE if the record may be handed over anyway,
+ * after waiting for room if the drop policy says so, and FALSE if it should be
+ * dropped.
+ */
+static gboolean
+wait_for_room (EmtrEventSender *self,
+               gboolean         overflowing)
+{
+  switch (g_atomic_int_get (&self->drop_policy))
+    {
+    case EMTR_DROP_POLICY_DROP_OLDEST:
+      /* The sender thread makes room among its pending records, but cannot
+         reach the queue while it is busy. */
+      return !overflowing;
+
+    case EMTR_DROP_POLICY_BLOCK:
+      break;
+
+    case EMTR_DROP_POLICY_DROP_NEWEST:
+    default:
+      return FALSE;
+    }
+
+  guint block_timeout_ms = g_atomic_int_get (&self->block_timeout_ms);
+  gint64 end_time =
+    g_get_monotonic_time () + block_timeout_ms * G_TIME_SPAN_MILLISECOND;
+  gboolean has_room;
+
+  g_atomic_int_inc (&self->num_blocked_threads);
+  g_mutex_lock (&self->sync_lock);
+
+  while (!(has_room = has_room_for_record (self, overflowing)))
+    {
+      if (!g_cond_wait_until (&self->sync_cond, &self->sync_lock, end_time))
+        {
+          has_room = has_room_for_record (self, overflowing);
+          break;
+        }
+    }
+
+  g_mutex_unlock (&self->sync_lock);
+  g_atomic_int_add (&self->num_blocked_threads, -1);
+
+  return has_room;
+}
+
+/* Drops @record for lack of room, and counts it. */
+static void
+drop_record (EmtrEventSender *self,
+             Record          *record)
+{
+  log_dropped_record (self, record);
+  count_dropped_records (self, record->event_id, 1);
+  record_clear (record);
+}
+
+/*
+ * Hands @record, which is copied, over to the sender thread. If
+ * @is_synchronous is TRUE, blocks until it has been sent. Asynchronous records
+ * may be dropped for lack of room instead.
+ */
+static void
+enqueue_record (EmtrEventSender *self,
+                Record          *record,
+                gboolean         is_synchronous)
+{
+  gboolean done = FALSE;
+  guint num_records;
+
+  if (record->kind != RECORD_FLUSH)
+    emtr_stats_count_events (self->stats, record->event_id,
+                             EMTR_EVENT_STAT_RECORDED, 1);
+
+  ensure_thread (self);
+
+  if (!is_synchronous)
+    {
+      if (!has_room_for_record (self, FALSE /* overflowing */) &&
+          !wait_for_room (self, FALSE /* overflowing */))
+        {
+          drop_record (self, record);
+          return;
+        }
+
+      ProducerRing *ring = get_thread_ring (self);
+
+      if (ring_push (ring, record, &num_records))
+        {
+          guint max_batch_size = g_atomic_int_get (&self->max_batch_size);
+
+          if (num_records == MAX (max_batch_size, 1))
+            g_source_set_ready_time (self->flush_source, 0);
+          else if (num_records == 1)
+            arm_flush_source (self);
+
+          return;
+        }
+
+      if (!has_room_for_record (self, TRUE /* overflowing */) &&
+          !wait_for_room (self, TRUE /* overflowing */))
+        {
+          drop_record (self, record);
+          return;
+        }
+    }
+
+  Record *queued_record = g_new (Record, 1);
+  *queued_record = *record;
+  if (is_synchronous)
+    queued_record->done = &done;
+
+  g_async_queue_push (self->queue, queued_record);
+  g_source_set_ready_time (self->flush_source, 0);
+
+  if (!is_synchronous)
+    return;
+
+  g_mutex_lock (&self->sync_lock);
+  while (!done)
+    g_cond_wait (&self->sync_cond, &self->sync_lock);
+  g_mutex_unlock (&self->sync_lock);
+}
+
+/* Returns the signal that the EOS_METRICS_DUMP_SIGNAL environment variable
+   asks the flight recorder to be printed on, or 0 if none. */
+static gint
+get_dump_signal (void)
+{
+  const gchar *val = g_getenv ("EOS_METRICS_DUMP_SIGNAL");
+
+  if (val == NULL || *val == '\0')
+    return 0;
+
+  if (g_str_has_prefix (val, "SIG"))
+    val += strlen ("SIG");
+
+  if (g_strcmp0 (val, "USR1") == 0)
+    return SIGUSR1;
+  if (g_strcmp0 (val, "USR2") == 0)
+    return SIGUSR2;
+
+  g_warning ("Ignoring EOS_METRICS_DUMP_SIGNAL=%s: only USR1 and USR2 are "
+             "supported", val);
+  return 0;
+}
+
+static gboolean
+dump_signal_cb (gpointer user_data)
+{
+  EmtrEventSender *self = user_data;
+
+  emtr_flight_recorder_print (self->flight_recorder);
+  return G_SOURCE_CONTINUE;
+}
+
+/* Check the EOS_DISABLE_METRICS environment variable to see if we should
+ * skip submitting any metrics. This is intended to be set when running unit
+ * tests in other modules, for example, to avoid submitting metrics from unit
+ * test runs. */
+static gboolean
+disable_event_submission (void)
+{
+  const gchar *val = g_getenv ("EOS_DISABLE_METRICS");
+
+  return (val != NULL &&
+          (g_str_equal (val, "") || g_str_equal (val, "1")));
+}
+
+/*
+ * Creates a sender for the event recorder daemon on the system bus. Neither
+ * the thread nor the connection are started until they are needed. Free with
+ * emtr_event_sender_free().
+ */
+EmtrEventSender *
+emtr_event_sender_new (void)
+{
+  EmtrEventSender *self = g_new0 (EmtrEventSender, 1);
+
+  self->id = g_atomic_int_add (&next_sender_id, 1);
+  self->uid = getuid ();
+
+  uuid_t client_id;
+  uuid_generate (client_id);
+  uuid_unparse_lower (client_id, self->client_id);
+  self->enabled_by_environment = !disable_event_submission ();
+  self->enabled = self->enabled_by_environment;
+
+  GVariant *unboxed_variant = g_variant_new_boolean (FALSE);
+  self->empty_auxiliary_payload = g_variant_new_variant (unboxed_variant);
+  g_variant_ref_sink (self->empty_auxiliary_payload);
+
+  self->rings = g_ptr_array_new_with_free_func ((GDestroyNotify) ring_unref);
+  g_mutex_init (&self->rings_lock);
+  self->queue = g_async_queue_new ();
+  g_mutex_init (&self->sync_lock);
+  g_cond_init (&self->sync_cond);
+  self->dropped_counts =
+    g_hash_table_new_full (event_id_hash, event_id_equal, g_free, g_free);
+  g_mutex_init (&self->dropped_counts_lock);
+  self->stats = emtr_stats_new ();
+
+  gchar *spool_directory =
+    g_build_filename (g_get_user_cache_dir (), "eosmetrics", "spool", NULL);
+  self->spool = emtr_spool_new (spool_directory);
+  g_free (spool_directory);
+  /* Replay what earlier processes could not send once connected. */
+  self->spool_replay_pending = TRUE;
+  self->reconnect_delay_s = RECONNECT_INITIAL_DELAY_S;
+
+  for (gint i = 0; i < EMTR_NUM_RECORD_KINDS; i++)
+    self->pending_records[i] =
+      g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+  self->drained_records = g_array_new (FALSE, FALSE, sizeof (Record));
+  self->event_id_variants =
+    g_hash_table_new_full (event_id_hash, event_id_equal, NULL,
+                           (GDestroyNotify) g_variant_unref);
+  self->aggregated_counts =
+    g_hash_table_new_full (variant_data_hash, g_variant_equal,
+                           (GDestroyNotify) g_variant_unref, g_free);
+
+  self->context = g_main_context_new ();
+  self->loop = g_main_loop_new (self->context, FALSE);
+
+  self->flush_source = g_source_new (&flush_source_funcs, sizeof (GSource));
+  g_source_set_name (self->flush_source, "[eosmetrics] flush events");
+  g_source_set_callback (self->flush_source, process_queue, self, NULL);
+  g_source_attach (self->flush_source, self->context);
+
+  self->drop_report_source =
+    g_source_new (&flush_source_funcs, sizeof (GSource));
+  g_source_set_name (self->drop_report_source,
+                     "[eosmetrics] report dropped events");
+  g_source_set_callback (self->drop_report_source, report_dropped_records_cb,
+                         self, NULL);
+  g_source_attach (self->drop_report_source, self->context);
+
+  self->flight_recorder = emtr_flight_recorder_new ();
+  gint dump_signal = get_dump_signal ();
+  if (dump_signal != 0)
+    {
+      self->dump_signal_source = g_unix_signal_source_new (dump_signal);
+      g_source_set_name (self->dump_signal_source,
+                         "[eosmetrics] dump recent events");
+      g_source_set_callback (self->dump_signal_source, dump_signal_cb, self,
+                             NULL);
+      g_source_attach (self->dump_signal_source, self->context);
+    }
+
+  g_queue_init (&self->proxy_waiters);
+  g_queue_init (&self->synchronous_records);
+  g_queue_init (&self->retrying_batches);
+
+  return self;
+}
+
+/*
+ * Sends everything that is still queued or batched, then stops the sender
+ * thread and frees @self. Replies to asynchronous calls that are still in
+ * flight are not waited for, and batches waiting to be sent again are spooled.
+ * No other thread may record events with @self concurrently.
+ */
+void
+emtr_event_sender_free (EmtrEventSender *self)
+{
+  if (self->thread != NULL)
+    {
+      emtr_event_sender_flush_sync (self);
+
+      g_main_context_invoke (self->context, stop_thread_cb, self);
+      g_thread_join (self->thread);
+    }
+
+  /* Unlike the bus connection, the direct connection is closed once @self is
+     freed, so don't lose messages that have not been written yet. */
+  if (self->direct_proxy != NULL)
+    {
+      GDBusConnection *connection =
+        g_dbus_proxy_get_connection (G_DBUS_PROXY (self->direct_proxy));
+      g_dbus_connection_flush_sync (connection, NULL /* GCancellable */,
+                                    NULL /* GError */);
+      clear_direct_proxy (self);
+    }
+
+  g_source_destroy (self->flush_source);
+  g_source_unref (self->flush_source);
+  g_source_destroy (self->drop_report_source);
+  g_source_unref (self->drop_report_source);
+  if (self->dump_signal_source != NULL)
+    {
+      g_source_destroy (self->dump_signal_source);
+      g_source_unref (self->dump_signal_source);
+    }
+  if (self->reconnect_source != NULL)
+    {
+      g_source_destroy (self->reconnect_source);
+      g_source_unref (self->reconnect_source);
+    }
+  /* The final flush normally emitted the aggregated counts already. */
+  if (self->aggregation_source != NULL)
+    {
+      g_source_destroy (self->aggregation_source);
+      g_source_unref (self->aggregation_source);
+    }
+  g_main_loop_unref (self->loop);
+  g_main_context_unref (self->context);
+
+  /* Threads drop their references to the rings lazily. */
+  for (guint i = 0; i < self->rings->len; i++)
+    {
+      ProducerRing *ring = g_ptr_array_index (self->rings, i);
+      g_atomic_int_set (&ring->closed, TRUE);
+    }
+  g_ptr_array_unref (self->rings);
+  g_mutex_clear (&self->rings_lock);
+
+  for (gint i = 0; i < EMTR_NUM_RECORD_KINDS; i++)
+    g_ptr_array_unref (self->pending_records[i]);
+  g_array_unref (self->drained_records);
+  g_hash_table_unref (self->event_id_variants);
+  g_hash_table_unref (self->aggregated_counts);
+
+  g_async_queue_unref (self->queue);
+  g_mutex_clear (&self->sync_lock);
+  g_cond_clear (&self->sync_cond);
+  g_hash_table_unref (self->dropped_counts);
+  g_mutex_clear (&self->dropped_counts_lock);
+  emtr_stats_unref (self->stats);
+  emtr_flight_recorder_free (self->flight_recorder);
+
+  /* What could not be sent stays in the spool, for the next process. */
+  emtr_spool_free (self->spool);
+
+  /* Callbacks that were still waiting for a connection are never called. */
+  ProxyWaiter *waiter;
+  while ((waiter = g_queue_pop_head (&self->proxy_waiters)) != NULL)
+    proxy_waiter_free (waiter);
+
+  g_variant_unref (self->empty_auxiliary_payload);
+  if (self->properties_changed_id != 0)
+    g_signal_handler_disconnect (self->dbus_proxy,
+                                 self->properties_changed_id);
+  if (self->name_owner_changed_id != 0)
+    g_signal_handler_disconnect (self->dbus_proxy,
+                                 self->name_owner_changed_id);
+  g_clear_pointer (&self->shm_ring, emtr_shm_ring_free);
+  g_clear_object (&self->dbus_proxy);
+
+  g_free (self);
+}
+
+/*
+ * Returns the main context of the sender thread, in which other D-Bus calls
+ * related to event recording, such as those of aggregate timers, may be made.
+ */
+GMainContext *
+emtr_event_sender_get_context (EmtrEventSender *self)
+{
+  return self->context;
+}
+
+/*
+ * Calls @callback from the sender thread once the connection to the daemon is
+ * ready, connecting if needed. @callback receives %NULL if connecting failed.
+ * @destroy_user_data, if not %NULL, is called on @user_data afterwards, or if
+ * @self is freed first.
+ */
+void
+emtr_event_sender_invoke_with_proxy (EmtrEventSender   *self,
+                                     EmtrProxyCallback  callback,
+                                     gpointer           user_data,
+                                     GDestroyNotify     destroy_user_data)
+{
+  ProxyWaiter *waiter = g_new (ProxyWaiter, 1);
+
+  waiter->callback = callback;
+  waiter->user_data = user_data;
+  waiter->destroy_user_data = destroy_user_data;
+  waiter->sender = self;
+
+  ensure_thread (self);
+  g_main_context_invoke_full (self->context, G_PRIORITY_DEFAULT,
+                              invoke_with_proxy_cb, waiter,
+                              (GDestroyNotify) proxy_waiter_free);
+}
+
+/*
+ * Returns the counters of what happened to the events recorded with @self,
+ * which outlive @self if a reference is taken. Safe to call from any thread.
+ */
+EmtrStats *
+emtr_event_sender_get_stats (EmtrEventSender *self)
+{
+  return self->stats;
+}
+
+/*
+ * Returns the number of messages carrying records that have been sent
+ * asynchronously, and have not been written out or replied to yet, including
+ * batches waiting to be sent again. Safe to call from any thread.
+ */
+guint
+emtr_event_sender_get_num_in_flight (EmtrEventSender *self)
+{
+  return g_atomic_int_get (&self->num_in_flight);
+}
+
+/*
+ * Returns the last things that happened to records of @self, oldest first, as
+ * a floating variant of the type described in emtr_flight_recorder_snapshot().
+ * Safe to call from any thread.
+ */
+GVariant *
+emtr_event_sender_get_recent_events (EmtrEventSender *self)
+{
+  return emtr_flight_recorder_snapshot (self->flight_recorder);
+}
+
+/*
+ * Adds the number of records waiting at each stage of their way to the daemon
+ * to @builder, of type a{sv}. Must be called from the sender thread.
+ */
+void
+emtr_event_sender_add_queue_depths (EmtrEventSender *self,
+                                    GVariantBuilder *builder)
+{
+  guint records_in_rings = 0;
+
+  g_mutex_lock (&self->rings_lock);
+
+  for (guint i = 0; i < self->rings->len; i++)
+    {
+      ProducerRing *ring = g_ptr_array_index (self->rings, i);
+
+      records_in_rings += g_atomic_int_get (&ring->tail) - ring->head;
+    }
+
+  g_mutex_unlock (&self->rings_lock);
+
+  g_variant_builder_add (builder, "{sv}", "records-pending",
+                         g_variant_new_uint32 (self->num_pending_records));
+  g_variant_builder_add (builder, "{sv}", "bytes-pending",
+                         g_variant_new_uint64 (self->queued_bytes));
+  g_variant_builder_add (builder, "{sv}", "records-in-rings",
+                         g_variant_new_uint32 (records_in_rings));
+  g_variant_builder_add (builder, "{sv}", "records-queued",
+                         g_variant_new_uint32 (MAX (g_async_queue_length (self->queue), 0)));
+  g_variant_builder_add (builder, "{sv}", "batches-retrying",
+                         g_variant_new_uint32 (self->retrying_batches.length));
+}
+
+/*
+ * Returns FALSE if events need not be recorded at all, because recording has
+ * been disabled in the environment or by the daemon. Until the connection to
+ * the daemon is ready, only the environment is taken into account. Safe to
+ * call from any thread.
+ */
+gboolean
+emtr_event_sender_is_enabled (EmtrEventSender *self)
+{
+  return g_atomic_int_get (&self->enabled);
+}
+
+void
+emtr_event_sender_set_max_batch_size (EmtrEventSender *self,
+                                      guint            max_batch_size)
+{
+  g_atomic_int_set (&self->max_batch_size, max_batch_size);
+}
+
+void
+emtr_event_sender_set_flush_interval (EmtrEventSender *self,
+                                      guint            flush_interval_ms)
+{
+  g_atomic_int_set (&self->flush_interval_ms, flush_interval_ms);
+}
+
+/*
+ * Sets the window over which the counts of asynchronous aggregate events with
+ * the same event ID and payload are summed up before being sent, or 0 to send
+ * each of them as it is recorded.
+ */
+void
+emtr_event_sender_set_aggregation_window (EmtrEventSender *self,
+                                          guint            aggregation_window_ms)
+{
+  g_atomic_int_set (&self->aggregation_window_ms, aggregation_window_ms);
+}
+
+/*
+ * Sets whether asynchronous records are sent with D-Bus calls that expect a
+ * reply, so that calls the daemon fails are reported with a warning, and
+ * batches that fail transiently are sent again. This costs a pending call per
+ * message.
+ */
+void
+emtr_event_sender_set_wait_for_replies (EmtrEventSender *self,
+                                        gboolean         wait_for_replies)
+{
+  g_atomic_int_set (&self->wait_for_replies, wait_for_replies);
+}
+
+/*
+ * Sets the size in bytes from which batches are passed to the daemon in a
+ * sealed memfd rather than inline, or 0 to always send them inline.
+ */
+void
+emtr_event_sender_set_memfd_threshold (EmtrEventSender *self,
+                                       guint            memfd_threshold)
+{
+  g_atomic_int_set (&self->memfd_threshold, memfd_threshold);
+}
+
+/*
+ * Sets the size in bytes that records waiting to be batched may take up before
+ * the drop policy applies, or 0 for no limit.
+ */
+void
+emtr_event_sender_set_max_queued_bytes (EmtrEventSender *self,
+                                        guint            max_queued_bytes)
+{
+  g_atomic_int_set (&self->max_queued_bytes, max_queued_bytes);
+}
+
+/*
+ * Sets the number of messages carrying records that may be sent
+ * asynchronously before earlier ones have been written out or replied to, or
+ * 0 for no limit.
+ */
+void
+emtr_event_sender_set_max_in_flight (EmtrEventSender *self,
+                                     guint            max_in_flight)
+{
+  g_atomic_int_set (&self->max_in_flight, max_in_flight);
+}
+
+/*
+ * Sets what happens to asynchronous records that there is no room for, and for
+ * how long recording threads wait for room with %EMTR_DROP_POLICY_BLOCK.
+ */
+void
+emtr_event_sender_set_drop_policy (EmtrEventSender *self,
+                                   EmtrDropPolicy   drop_policy,
+                                   guint            block_timeout_ms)
+{
+  g_atomic_int_set (&self->drop_policy, drop_policy);
+  g_atomic_int_set (&self->block_timeout_ms, block_timeout_ms);
+}
+
+/*
+ * Queues a singular or aggregate event to be sent. @event_id must point to
+ * EMTR_EVENT_ID_LENGTH bytes. @num_events is ignored for singular events.
+ * @payload must not be floating; a reference is taken. If @is_synchronous is
+ * TRUE, blocks until the event has been sent.
+ */
+void
+emtr_event_sender_send_event (EmtrEventSender *self,
+                              EmtrRecordKind   kind,
+                              const guchar    *event_id,
+                              gint64           relative_time,
+                              gint64           num_events,
+                              GVariant        *payload,
+                              gboolean         is_synchronous)
+{
+  Record record;
+
+  g_return_if_fail (kind == EMTR_RECORD_SINGULAR_EVENT ||
+                    kind == EMTR_RECORD_AGGREGATE_EVENT);
+
+  record_init (&record, kind, event_id);
+  record.relative_time = relative_time;
+  record.num_events = num_events;
+  if (payload != NULL)
+    record.payload = g_variant_ref (payload);
+
+  enqueue_record (self, &record, is_synchronous);
+}
+
+/*
+ * Queues an event sequence to be sent. Takes ownership of @events, a non-empty
+ * array of EmtrSequenceEvent, which must not be modified afterwards. If
+ * @is_synchronous is TRUE, blocks until the event sequence has been sent.
+ */
+void
+emtr_event_sender_send_event_sequence (EmtrEventSender *self,
+                                       const guchar    *event_id,
+                                       GArray          *events,
+                                       gboolean         is_synchronous)
+{
+  Record record;
+
+  g_return_if_fail (events->len > 0);
+
+  record_init (&record, EMTR_RECORD_EVENT_SEQUENCE, event_id);
+  /* Event sequences are ordered by the time at which they were stopped. */
+  record.relative_time =
+    g_array_index (events, EmtrSequenceEvent, events->len - 1).relative_time;
+  record.events = events;
+
+  enqueue_record (self, &record, is_synchronous);
+}
+
+/* Sends everything that is queued or batched, and blocks until it is sent. */
+void
+emtr_event_sender_flush_sync (EmtrEventSender *self)
+{
+  Record record;
+
+  record_init (&record, RECORD_FLUSH, NULL);
+  enqueue_record (self, &record, TRUE /* is_synchronous */);
+}
@@ -0,0 +1,60 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "emtr-event-sender-private.h"
+#include "emtr-stats-private.h"
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The number of entries that the flight recorder keeps. A power of two. */
+#define EMTR_FLIGHT_RECORDER_SIZE 256u
+
+/* The value to start hashing payloads with emtr_flight_recorder_hash() from */
+#define EMTR_FLIGHT_RECORDER_HASH_INIT 2166136261u
+
+typedef struct _EmtrFlightRecorder EmtrFlightRecorder;
+
+EmtrFlightRecorder *emtr_flight_recorder_new      (void);
+
+void                emtr_flight_recorder_free     (EmtrFlightRecorder *self);
+
+guint32             emtr_flight_recorder_hash     (guint32             hash,
+                                                   gconstpointer       data,
+                                                   gsize               size);
+
+void                emtr_flight_recorder_add      (EmtrFlightRecorder *self,
+                                                   const guchar       *event_id,
+                                                   gint64              relative_time,
+                                                   EmtrRecordKind      kind,
+                                                   guint32             payload_hash,
+                                                   gsize               payload_size,
+                                                   EmtrEventStat       outcome);
+
+GVariant           *emtr_flight_recorder_snapshot (EmtrFlightRecorder *self);
+
+void                emtr_flight_recorder_print    (EmtrFlightRecorder *self);
+
+G_END_DECLS
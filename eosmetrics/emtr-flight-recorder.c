@@ -0,0 +1,220 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "emtr-flight-recorder-private.h"
+
+#include <string.h>
+#include <uuid/uuid.h>
+
+#include <glib.h>
+
+/*
+ * The flight recorder keeps the last EMTR_FLIGHT_RECORDER_SIZE things that
+ * happened to records: that the sender took them in, sent them, dropped them
+ * or failed to send them. It is written to on the hot paths of the recording
+ * threads and of the sender thread, so adding an entry takes no lock and never
+ * allocates: writers claim a slot by incrementing a ticket, and each slot is a
+ * sequence lock, whose sequence is odd while the slot is being written.
+ * Readers skip slots that are being written, or that were overwritten while
+ * they were being read.
+ *
+ * GLib's atomic operations are full memory barriers, which orders the plain
+ * accesses to the contents of a slot with respect to its sequence.
+ */
+
+#define SLOT_MASK (EMTR_FLIGHT_RECORDER_SIZE - 1)
+
+G_STATIC_ASSERT ((EMTR_FLIGHT_RECORDER_SIZE & SLOT_MASK) == 0);
+
+typedef struct
+{
+  guchar event_id[EMTR_EVENT_ID_LENGTH];
+  gint64 relative_time;
+  guint32 payload_hash;
+  guint32 payload_size;
+  guint8 kind; /* an EmtrRecordKind */
+  guint8 outcome; /* an EmtrEventStat */
+} Entry;
+
+typedef struct
+{
+  /* 2 * ticket + 1 while the entry for ticket is being written, and
+     2 * ticket + 2 once it has been */
+  gsize sequence; /* (atomic) */
+  Entry entry;
+} Slot;
+
+struct _EmtrFlightRecorder
+{
+  gsize next_ticket; /* (atomic) */
+  Slot slots[EMTR_FLIGHT_RECORDER_SIZE];
+};
+
+static const gchar * const kind_names[EMTR_NUM_RECORD_KINDS] = {
+  "singular",
+  "aggregate",
+  "sequence",
+};
+
+/* The same words as the keys of the per-event counts of emtr_stats_snapshot() */
+static const gchar * const outcome_names[EMTR_NUM_EVENT_STATS] = {
+  "recorded",
+  "sent",
+  "dropped",
+  "failed",
+};
+
+EmtrFlightRecorder *
+emtr_flight_recorder_new (void)
+{
+  return g_new0 (EmtrFlightRecorder, 1);
+}
+
+void
+emtr_flight_recorder_free (EmtrFlightRecorder *self)
+{
+  g_free (self);
+}
+
+/* Continues the 32-bit FNV-1a hash @hash over @size bytes at @data. */
+guint32
+emtr_flight_recorder_hash (guint32       hash,
+                           gconstpointer data,
+                           gsize         size)
+{
+  const guchar *bytes = data;
+
+  for (gsize i = 0; i < size; i++)
+    {
+      hash ^= bytes[i];
+      hash *= 16777619u;
+    }
+
+  return hash;
+}
+
+/*
+ * Notes that @outcome happened to a record of @kind. @payload_hash and
+ * @payload_size describe the serialized payloads of the record, and are 0 if
+ * they are not known. Safe to call from any thread.
+ */
+void
+emtr_flight_recorder_add (EmtrFlightRecorder *self,
+                          const guchar       *event_id,
+                          gint64              relative_time,
+                          EmtrRecordKind      kind,
+                          guint32             payload_hash,
+                          gsize               payload_size,
+                          EmtrEventStat       outcome)
+{
+  gsize ticket = g_atomic_pointer_add (&self->next_ticket, 1);
+  Slot *slot = &self->slots[ticket & SLOT_MASK];
+
+  g_atomic_pointer_set (&slot->sequence, 2 * ticket + 1);
+
+  memcpy (slot->entry.event_id, event_id, EMTR_EVENT_ID_LENGTH);
+  slot->entry.relative_time = relative_time;
+  slot->entry.payload_hash = payload_hash;
+  slot->entry.payload_size = MIN (payload_size, G_MAXUINT32);
+  slot->entry.kind = kind;
+  slot->entry.outcome = outcome;
+
+  g_atomic_pointer_set (&slot->sequence, 2 * ticket + 2);
+}
+
+/* Copies the entry for @ticket into @entry. Returns FALSE if it has been
+   overwritten, or is being written. */
+static gboolean
+read_entry (EmtrFlightRecorder *self,
+            gsize               ticket,
+            Entry              *entry)
+{
+  Slot *slot = &self->slots[ticket & SLOT_MASK];
+  gsize sequence = 2 * ticket + 2;
+
+  if ((gsize) g_atomic_pointer_get (&slot->sequence) != sequence)
+    return FALSE;
+
+  *entry = slot->entry;
+
+  return (gsize) g_atomic_pointer_get (&slot->sequence) == sequence;
+}
+
+/*
+ * Returns the entries of the flight recorder, oldest first, as a floating
+ * variant of type a(sxssuu): the event ID, the time of the event on
+ * CLOCK_BOOTTIME in nanoseconds, the kind of record, the outcome, and the size
+ * and hash of the payload. Safe to call from any thread.
+ */
+GVariant *
+emtr_flight_recorder_snapshot (EmtrFlightRecorder *self)
+{
+  gsize end = g_atomic_pointer_get (&self->next_ticket);
+  gsize start = end > EMTR_FLIGHT_RECORDER_SIZE ?
+    end - EMTR_FLIGHT_RECORDER_SIZE : 0;
+  GVariantBuilder builder;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sxssuu)"));
+
+  for (gsize ticket = start; ticket != end; ticket++)
+    {
+      Entry entry;
+      gchar unparsed_event_id[37];
+
+      if (!read_entry (self, ticket, &entry) ||
+          entry.kind >= EMTR_NUM_RECORD_KINDS ||
+          entry.outcome >= EMTR_NUM_EVENT_STATS)
+        continue;
+
+      uuid_unparse_lower (entry.event_id, unparsed_event_id);
+      g_variant_builder_add (&builder, "(sxssuu)", unparsed_event_id,
+                             entry.relative_time, kind_names[entry.kind],
+                             outcome_names[entry.outcome],
+                             entry.payload_size, entry.payload_hash);
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
+/* Prints the entries of the flight recorder to stderr, oldest first. */
+void
+emtr_flight_recorder_print (EmtrFlightRecorder *self)
+{
+  GVariant *snapshot = g_variant_ref_sink (emtr_flight_recorder_snapshot (self));
+  GVariantIter iter;
+  const gchar *event_id, *kind, *outcome;
+  gint64 relative_time;
+  guint32 payload_size, payload_hash;
+
+  g_printerr ("Last %" G_GSIZE_FORMAT " events recorded by %s:\n",
+              g_variant_n_children (snapshot),
+              g_get_prgname () != NULL ? g_get_prgname () : "this process");
+
+  g_variant_iter_init (&iter, snapshot);
+  while (g_variant_iter_next (&iter, "(&sx&s&suu)", &event_id, &relative_time,
+                              &kind, &outcome, &payload_size, &payload_hash))
+    g_printerr ("  %" G_GINT64_FORMAT " %s %-9s %-8s %u bytes %08x\n",
+                relative_time, event_id, kind, outcome, payload_size,
+                payload_hash);
+
+  g_variant_unref (snapshot);
+}
@@ -0,0 +1,39 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "emtr-latency-histogram.h"
+
+G_BEGIN_DECLS
+
+/* The number of values of EmtrLatencyKind */
+#define EMTR_NUM_LATENCY_KINDS (EMTR_LATENCY_STOP_TIMER + 1)
+
+EmtrLatencyHistogram *emtr_latency_histogram_new   (void);
+
+void                  emtr_latency_histogram_add   (EmtrLatencyHistogram *self,
+                                                    gint64                latency_ns);
+
+EmtrLatencyHistogram *emtr_latency_histogram_copy  (EmtrLatencyHistogram *self);
+
+void                  emtr_latency_histogram_reset (EmtrLatencyHistogram *self);
+
+G_END_DECLS
@@ -0,0 +1,358 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "emtr-latency-histogram-private.h"
+
+/**
+ * SECTION:emtr-latency-histogram
+ * @title: Latency histogram
+ * @short_description: Distribution of the latencies of event recording.
+ * @include: eosmetrics/eosmetrics.h
+ *
+ * An #EmtrLatencyHistogram is a snapshot of how long an operation related to
+ * event recording took, obtained with
+ * emtr_event_recorder_get_latency_histogram(). Latencies are in nanoseconds.
+ *
+ * Latencies are counted in buckets of logarithmic width, so that histograms
+ * take up the same memory however many latencies they count, and counting is
+ * a single atomic addition. Latencies below 16 nanoseconds are counted
+ * exactly, and others to within 1/16th of their value, so percentiles are
+ * precise to about 6%. Percentiles are rounded up to the largest latency of
+ * their bucket, so they are never lower than the actual latency, and never
+ * higher than the largest latency counted.
+ *
+ * Histograms are immutable, so they may be shared between threads.
+ */
+
+/**
+ * EmtrLatencyKind:
+ * @EMTR_LATENCY_RECORD_CALL: The cost of the recording functions of
+ *   #EmtrEventRecorder to their caller, from when they take the timestamp of
+ *   the event until they have handed it over to be sent. Synchronous
+ *   functions include the time they spend waiting for the daemon.
+ * @EMTR_LATENCY_RECORD_SINGULAR_EVENT: The round trip of the
+ *   `RecordSingularEvent` D-Bus method.
+ * @EMTR_LATENCY_RECORD_AGGREGATE_EVENT: The round trip of the
+ *   `RecordAggregateEvent` D-Bus method.
+ * @EMTR_LATENCY_RECORD_EVENT_SEQUENCE: The round trip of the
+ *   `RecordEventSequence` D-Bus method.
+ * @EMTR_LATENCY_RECORD_EVENTS: The round trip of the `RecordEvents` and
+ *   `RecordEventsFromFd` D-Bus methods, which send batches of events.
+ * @EMTR_LATENCY_START_AGGREGATE_TIMER: The round trip of the
+ *   `StartAggregateTimer` D-Bus method.
+ * @EMTR_LATENCY_STOP_TIMER: The round trip of the `StopTimer` D-Bus method of
+ *   aggregate timers.
+ *
+ * The latencies that an #EmtrEventRecorder keeps histograms of. Round trips
+ * are only measured for D-Bus calls that wait for a reply, see
+ * #EmtrEventRecorder:wait-for-replies.
+ *
+ * Since: 0.6
+ */
+
+/* Latencies below 2^SUB_BUCKET_BITS nanoseconds each have a bucket. Above
+   that, each power of two is split into SUB_BUCKET_COUNT buckets. */
+#define SUB_BUCKET_BITS 4
+#define SUB_BUCKET_COUNT (1u << SUB_BUCKET_BITS)
+#define NUM_BUCKETS ((64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT)
+
+struct _EmtrLatencyHistogram
+{
+  gint ref_count; /* (atomic) */
+
+  /* The largest latency counted, which saturates on 32-bit systems */
+  gsize max; /* (atomic) */
+
+  gsize buckets[NUM_BUCKETS]; /* (atomic) */
+};
+
+G_DEFINE_BOXED_TYPE (EmtrLatencyHistogram, emtr_latency_histogram,
+                     emtr_latency_histogram_ref, emtr_latency_histogram_unref)
+
+EMTR_DEFINE_ENUM_TYPE (EmtrLatencyKind, emtr_latency_kind,
+                       EMTR_ENUM_VALUE (EMTR_LATENCY_RECORD_CALL, record-call)
+                       EMTR_ENUM_VALUE (EMTR_LATENCY_RECORD_SINGULAR_EVENT, record-singular-event)
+                       EMTR_ENUM_VALUE (EMTR_LATENCY_RECORD_AGGREGATE_EVENT, record-aggregate-event)
+                       EMTR_ENUM_VALUE (EMTR_LATENCY_RECORD_EVENT_SEQUENCE, record-event-sequence)
+                       EMTR_ENUM_VALUE (EMTR_LATENCY_RECORD_EVENTS, record-events)
+                       EMTR_ENUM_VALUE (EMTR_LATENCY_START_AGGREGATE_TIMER, start-aggregate-timer)
+                       EMTR_ENUM_VALUE (EMTR_LATENCY_STOP_TIMER, stop-timer))
+
+/* Returns the index of the most significant bit set in @value, which must not
+   be 0. gulong may only have 32 bits. */
+static guint
+find_most_significant_bit (guint64 value)
+{
+  guint msb = 0;
+
+  if (value >> 32 != 0)
+    {
+      msb = 32;
+      value >>= 32;
+    }
+
+  return msb + g_bit_storage ((gulong) value) - 1;
+}
+
+static guint
+get_bucket_index (guint64 value)
+{
+  if (value < SUB_BUCKET_COUNT)
+    return value;
+
+  /* The bits below the most significant one and the SUB_BUCKET_BITS - 1
+     after it pick the bucket within the power of two. */
+  guint shift = find_most_significant_bit (value) - SUB_BUCKET_BITS;
+
+  return (shift + 1) * SUB_BUCKET_COUNT +
+    (guint) (value >> shift) - SUB_BUCKET_COUNT;
+}
+
+/* Returns the largest latency counted in the bucket at @index. */
+static guint64
+get_bucket_upper_bound (guint index)
+{
+  if (index < SUB_BUCKET_COUNT)
+    return index;
+
+  guint shift = index / SUB_BUCKET_COUNT - 1;
+  guint64 mantissa = index % SUB_BUCKET_COUNT + SUB_BUCKET_COUNT;
+
+  return ((mantissa + 1) << shift) - 1;
+}
+
+/* Creates an empty histogram, to count latencies into with
+   emtr_latency_histogram_add(). */
+EmtrLatencyHistogram *
+emtr_latency_histogram_new (void)
+{
+  EmtrLatencyHistogram *self = g_new0 (EmtrLatencyHistogram, 1);
+
+  self->ref_count = 1;
+
+  return self;
+}
+
+/* Counts @latency_ns. Safe to call from any thread, without a lock. */
+void
+emtr_latency_histogram_add (EmtrLatencyHistogram *self,
+                            gint64                latency_ns)
+{
+  guint64 value = MAX (latency_ns, 0);
+  gsize saturated = MIN (value, G_MAXSIZE);
+
+  g_atomic_pointer_add (&self->buckets[get_bucket_index (value)], 1);
+
+  gsize max = (gsize) g_atomic_pointer_get (&self->max);
+  while (saturated > max &&
+         !g_atomic_pointer_compare_and_exchange (&self->max, max, saturated))
+    max = (gsize) g_atomic_pointer_get (&self->max);
+}
+
+/* Returns a copy of @self, which latencies are counted into concurrently. The
+   copy is not a consistent snapshot of all buckets at once. */
+EmtrLatencyHistogram *
+emtr_latency_histogram_copy (EmtrLatencyHistogram *self)
+{
+  EmtrLatencyHistogram *copy = emtr_latency_histogram_new ();
+
+  for (guint i = 0; i < NUM_BUCKETS; i++)
+    copy->buckets[i] = (gsize) g_atomic_pointer_get (&self->buckets[i]);
+  copy->max = (gsize) g_atomic_pointer_get (&self->max);
+
+  return copy;
+}
+
+/* Forgets the latencies counted so far. Latencies that are counted
+   concurrently may or may not be forgotten. */
+void
+emtr_latency_histogram_reset (EmtrLatencyHistogram *self)
+{
+  for (guint i = 0; i < NUM_BUCKETS; i++)
+    g_atomic_pointer_set (&self->buckets[i], 0);
+  g_atomic_pointer_set (&self->max, 0);
+}
+
+/**
+ * emtr_latency_histogram_ref:
+ * @self: an #EmtrLatencyHistogram
+ *
+ * Increases the reference count of @self.
+ *
+ * Returns: (transfer full): @self
+ *
+ * Since: 0.6
+ */
+EmtrLatencyHistogram *
+emtr_latency_histogram_ref (EmtrLatencyHistogram *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+  return self;
+}
+
+/**
+ * emtr_latency_histogram_unref:
+ * @self: (transfer full): an #EmtrLatencyHistogram
+ *
+ * Decreases the reference count of @self, and frees it when the count drops to
+ * zero.
+ *
+ * Since: 0.6
+ */
+void
+emtr_latency_histogram_unref (EmtrLatencyHistogram *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (g_atomic_int_dec_and_test (&self->ref_count))
+    g_free (self);
+}
+
+/**
+ * emtr_latency_histogram_get_count:
+ * @self: an #EmtrLatencyHistogram
+ *
+ * Returns: the number of latencies counted in @self
+ *
+ * Since: 0.6
+ */
+guint64
+emtr_latency_histogram_get_count (EmtrLatencyHistogram *self)
+{
+  guint64 count = 0;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  for (guint i = 0; i < NUM_BUCKETS; i++)
+    count += self->buckets[i];
+
+  return count;
+}
+
+/**
+ * emtr_latency_histogram_get_max:
+ * @self: an #EmtrLatencyHistogram
+ *
+ * Returns: the largest latency counted in @self, in nanoseconds, or 0 if
+ *   @self is empty
+ *
+ * Since: 0.6
+ */
+gint64
+emtr_latency_histogram_get_max (EmtrLatencyHistogram *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->max;
+}
+
+/**
+ * emtr_latency_histogram_get_percentile:
+ * @self: an #EmtrLatencyHistogram
+ * @percentile: the percentage of latencies, between 0 and 100
+ *
+ * Returns the latency that @percentile percent of the latencies counted in
+ * @self are lower than or equal to.
+ *
+ * Returns: the latency in nanoseconds, or 0 if @self is empty
+ *
+ * Since: 0.6
+ */
+gint64
+emtr_latency_histogram_get_percentile (EmtrLatencyHistogram *self,
+                                       gdouble               percentile)
+{
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (percentile >= 0 && percentile <= 100, 0);
+
+  guint64 count = emtr_latency_histogram_get_count (self);
+  if (count == 0)
+    return 0;
+
+  /* The rank of the latency, rounded up without pulling in libm */
+  gdouble exact_rank = percentile / 100 * count;
+  guint64 rank = MAX ((guint64) exact_rank, 1);
+  if (rank < exact_rank)
+    rank++;
+
+  guint64 cumulative_count = 0;
+
+  for (guint i = 0; i < NUM_BUCKETS; i++)
+    {
+      cumulative_count += self->buckets[i];
+      if (cumulative_count >= rank)
+        return MIN (get_bucket_upper_bound (i), self->max);
+    }
+
+  return self->max;
+}
+
+/**
+ * emtr_latency_histogram_get_p50:
+ * @self: an #EmtrLatencyHistogram
+ *
+ * Returns the median of the latencies counted in @self. See
+ * emtr_latency_histogram_get_percentile().
+ *
+ * Returns: the latency in nanoseconds, or 0 if @self is empty
+ *
+ * Since: 0.6
+ */
+gint64
+emtr_latency_histogram_get_p50 (EmtrLatencyHistogram *self)
+{
+  return emtr_latency_histogram_get_percentile (self, 50);
+}
+
+/**
+ * emtr_latency_histogram_get_p99:
+ * @self: an #EmtrLatencyHistogram
+ *
+ * Returns the 99th percentile of the latencies counted in @self. See
+ * emtr_latency_histogram_get_percentile().
+ *
+ * Returns: the latency in nanoseconds, or 0 if @self is empty
+ *
+ * Since: 0.6
+ */
+gint64
+emtr_latency_histogram_get_p99 (EmtrLatencyHistogram *self)
+{
+  return emtr_latency_histogram_get_percentile (self, 99);
+}
+
+/**
+ * emtr_latency_histogram_get_p999:
+ * @self: an #EmtrLatencyHistogram
+ *
+ * Returns the 99.9th percentile of the latencies counted in @self. See
+ * emtr_latency_histogram_get_percentile().
+ *
+ * Returns: the latency in nanoseconds, or 0 if @self is empty
+ *
+ * Since: 0.6
+ */
+gint64
+emtr_latency_histogram_get_p999 (EmtrLatencyHistogram *self)
+{
+  return emtr_latency_histogram_get_percentile (self, 99.9);
+}
@@ -0,0 +1,112 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "emtr-event-sender-private.h"
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* How the value of an EmtrSequenceKey is stored */
+typedef enum
+{
+  EMTR_SEQUENCE_KEY_NONE,
+  EMTR_SEQUENCE_KEY_INTEGER,
+  EMTR_SEQUENCE_KEY_STRING,
+  EMTR_SEQUENCE_KEY_VARIANT,
+} EmtrSequenceKeyKind;
+
+/*
+ * Identifies an event sequence that has been started but not stopped: the
+ * event ID along with the key passed to emtr_event_recorder_record_start().
+ * Keys of basic integer and string types are stored by value, so that looking
+ * them up never builds a GVariant.
+ */
+typedef struct
+{
+  guchar event_id[EMTR_EVENT_ID_LENGTH];
+  guint64 hash;
+
+  EmtrSequenceKeyKind kind;
+  GVariantClass type; /* of the key variant, unless kind is NONE */
+  union
+  {
+    guint64 integer;
+    const gchar *string; /* (unowned) */
+    GVariant *variant; /* (owned): in normal form */
+  } value;
+} EmtrSequenceKey;
+
+typedef struct _EmtrSequenceTable EmtrSequenceTable;
+
+/* Hidden, so that they are not exported from the library along with the
+   public emtr_ functions. */
+
+G_GNUC_INTERNAL
+void               emtr_sequence_key_init      (EmtrSequenceKey       *key,
+                                                const guchar          *event_id,
+                                                GVariant              *variant);
+
+G_GNUC_INTERNAL
+void               emtr_sequence_key_clear     (EmtrSequenceKey       *key);
+
+G_GNUC_INTERNAL
+EmtrSequenceTable *emtr_sequence_table_new     (void);
+
+G_GNUC_INTERNAL
+void               emtr_sequence_table_free    (EmtrSequenceTable     *self);
+
+G_GNUC_INTERNAL
+void               emtr_sequence_table_lock    (EmtrSequenceTable     *self,
+                                                const EmtrSequenceKey *key);
+
+G_GNUC_INTERNAL
+void               emtr_sequence_table_unlock  (EmtrSequenceTable     *self,
+                                                const EmtrSequenceKey *key);
+
+G_GNUC_INTERNAL
+GArray            *emtr_sequence_table_lookup  (EmtrSequenceTable     *self,
+                                                const EmtrSequenceKey *key);
+
+G_GNUC_INTERNAL
+gboolean           emtr_sequence_table_insert  (EmtrSequenceTable     *self,
+                                                const EmtrSequenceKey *key,
+                                                GArray                *events);
+
+G_GNUC_INTERNAL
+GArray            *emtr_sequence_table_steal   (EmtrSequenceTable     *self,
+                                                const EmtrSequenceKey *key);
+
+G_GNUC_INTERNAL
+void               emtr_sequence_table_get_usage
+                                               (EmtrSequenceTable     *self,
+                                                guint                 *num_sequences,
+                                                gsize                 *num_bytes);
+
+G_GNUC_INTERNAL
+void               emtr_sequence_table_get_lock_stats
+                                               (EmtrSequenceTable     *self,
+                                                guint64               *num_contentions,
+                                                guint64               *wait_time);
+
+G_END_DECLS
@@ -0,0 +1,585 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "emtr-sequence-table-private.h"
+#include "emtr-trace-private.h"
+#include "emtr-util.h"
+
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+/*
+ * The sequence table holds the events of the event sequences that have been
+ * started but not stopped yet. It is split into shards, each with its own lock,
+ * so that threads recording unrelated event sequences rarely contend. Each
+ * shard is an open-addressing hash table with linear probing, in which removed
+ * entries leave tombstones behind until the shard is rehashed.
+ *
+ * Callers lock the shard of a key around the operations on that key, so that
+ * they can take a timestamp under the lock and keep the events of a sequence
+ * in chronological order.
+ */
+
+/* The number of shards. Must be a power of two. */
+#define NUM_SHARDS 16u
+#define SHARD_MASK (NUM_SHARDS - 1)
+
+/* The number of entries a shard starts with. Must be a power of two. */
+#define MIN_CAPACITY 8u
+
+/* Used to keep the locks of different shards on separate cache lines */
+#define CACHE_LINE_SIZE 64
+
+/* 64-bit FNV-1a */
+#define FNV_OFFSET_BASIS G_GUINT64_CONSTANT (0xcbf29ce484222325)
+#define FNV_PRIME G_GUINT64_CONSTANT (0x100000001b3)
+
+typedef enum
+{
+  ENTRY_EMPTY,
+  ENTRY_OCCUPIED,
+  ENTRY_TOMBSTONE,
+} EntryState;
+
+/* The key of an occupied entry owns its string, if any. */
+typedef struct
+{
+  EntryState state;
+  EmtrSequenceKey key;
+  GArray *events; /* (owned) (nullable) (element-type EmtrSequenceEvent) */
+} Entry;
+
+typedef struct
+{
+  GMutex lock;
+  Entry *entries; /* (owned) (array length=capacity) (nullable) */
+  guint capacity; /* 0 or a power of two */
+  guint num_occupied;
+  guint num_tombstones;
+
+  /* How often the lock was already held when taking it, and for how long in
+     total threads then waited for it. Only changed under the lock. */
+  guint64 num_contentions;
+  guint64 wait_time;
+} Shard;
+
+typedef union
+{
+  Shard shard;
+  guint8 padding[CACHE_LINE_SIZE];
+} PaddedShard;
+
+G_STATIC_ASSERT (sizeof (Shard) <= CACHE_LINE_SIZE);
+
+struct _EmtrSequenceTable
+{
+  PaddedShard shards[NUM_SHARDS];
+};
+
+static guint64
+hash_bytes (guint64       hash,
+            gconstpointer data,
+            gsize         size)
+{
+  const guchar *bytes = data;
+
+  for (gsize i = 0; i < size; i++)
+    {
+      hash ^= bytes[i];
+      hash *= FNV_PRIME;
+    }
+
+  return hash;
+}
+
+/*
+ * Initializes @key for @event_id, which must point to EMTR_EVENT_ID_LENGTH
+ * bytes, and @variant, which may be NULL. Keys of basic string types point to
+ * the string in @variant, so @variant must outlive @key. Free with
+ * emtr_sequence_key_clear().
+ */
+void
+emtr_sequence_key_init (EmtrSequenceKey *key,
+                        const guchar    *event_id,
+                        GVariant        *variant)
+{
+  memset (key, 0, sizeof (EmtrSequenceKey));
+  memcpy (key->event_id, event_id, EMTR_EVENT_ID_LENGTH);
+
+  guint64 hash = hash_bytes (FNV_OFFSET_BASIS, event_id, EMTR_EVENT_ID_LENGTH);
+
+  if (variant == NULL)
+    {
+      key->kind = EMTR_SEQUENCE_KEY_NONE;
+      key->hash = hash;
+      return;
+    }
+
+  key->type = g_variant_classify (variant);
+  hash = hash_bytes (hash, &key->type, sizeof (key->type));
+
+  switch (key->type)
+    {
+    case G_VARIANT_CLASS_BOOLEAN:
+      key->value.integer = g_variant_get_boolean (variant);
+      break;
+    case G_VARIANT_CLASS_BYTE:
+      key->value.integer = g_variant_get_byte (variant);
+      break;
+    case G_VARIANT_CLASS_INT16:
+      key->value.integer = (guint64) g_variant_get_int16 (variant);
+      break;
+    case G_VARIANT_CLASS_UINT16:
+      key->value.integer = g_variant_get_uint16 (variant);
+      break;
+    case G_VARIANT_CLASS_INT32:
+      key->value.integer = (guint64) g_variant_get_int32 (variant);
+      break;
+    case G_VARIANT_CLASS_UINT32:
+      key->value.integer = g_variant_get_uint32 (variant);
+      break;
+    case G_VARIANT_CLASS_INT64:
+      key->value.integer = (guint64) g_variant_get_int64 (variant);
+      break;
+    case G_VARIANT_CLASS_UINT64:
+      key->value.integer = g_variant_get_uint64 (variant);
+      break;
+    case G_VARIANT_CLASS_HANDLE:
+      key->value.integer = (guint64) g_variant_get_handle (variant);
+      break;
+
+    case G_VARIANT_CLASS_STRING:
+    case G_VARIANT_CLASS_OBJECT_PATH:
+    case G_VARIANT_CLASS_SIGNATURE:
+      {
+        gsize length;
+
+        key->kind = EMTR_SEQUENCE_KEY_STRING;
+        key->value.string = g_variant_get_string (variant, &length);
+        key->hash = hash_bytes (hash, key->value.string, length);
+        return;
+      }
+
+    default:
+      {
+        /* Keys that are built by the caller are usually in normal form
+           already, in which case their data is hashed in place. */
+        GVariant *normalized = g_variant_is_normal_form (variant) ?
+          g_variant_ref (variant) : g_variant_get_normal_form (variant);
+        const gchar *type_string = g_variant_get_type_string (normalized);
+
+        key->kind = EMTR_SEQUENCE_KEY_VARIANT;
+        key->value.variant = normalized;
+        hash = hash_bytes (hash, type_string, strlen (type_string));
+        key->hash = hash_bytes (hash, g_variant_get_data (normalized),
+                                g_variant_get_size (normalized));
+        return;
+      }
+    }
+
+  key->kind = EMTR_SEQUENCE_KEY_INTEGER;
+  key->hash = hash_bytes (hash, &key->value.integer,
+                          sizeof (key->value.integer));
+}
+
+void
+emtr_sequence_key_clear (EmtrSequenceKey *key)
+{
+  if (key->kind == EMTR_SEQUENCE_KEY_VARIANT)
+    g_clear_pointer (&key->value.variant, g_variant_unref);
+}
+
+static gboolean
+key_equal (const EmtrSequenceKey *a,
+           const EmtrSequenceKey *b)
+{
+  if (a->hash != b->hash || a->kind != b->kind || a->type != b->type ||
+      memcmp (a->event_id, b->event_id, EMTR_EVENT_ID_LENGTH) != 0)
+    return FALSE;
+
+  switch (a->kind)
+    {
+    case EMTR_SEQUENCE_KEY_NONE:
+      return TRUE;
+
+    case EMTR_SEQUENCE_KEY_INTEGER:
+      return a->value.integer == b->value.integer;
+
+    case EMTR_SEQUENCE_KEY_STRING:
+      return strcmp (a->value.string, b->value.string) == 0;
+
+    case EMTR_SEQUENCE_KEY_VARIANT:
+      return g_variant_equal (a->value.variant, b->value.variant);
+
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+/* Copies @key into @entry, which then owns what @key points to. */
+static void
+entry_set_key (Entry                 *entry,
+               const EmtrSequenceKey *key)
+{
+  entry->key = *key;
+
+  if (key->kind == EMTR_SEQUENCE_KEY_STRING)
+    entry->key.value.string = g_strdup (key->value.string);
+  else if (key->kind == EMTR_SEQUENCE_KEY_VARIANT)
+    g_variant_ref (key->value.variant);
+}
+
+static void
+entry_clear_key (Entry *entry)
+{
+  if (entry->key.kind == EMTR_SEQUENCE_KEY_STRING)
+    g_free ((gchar *) entry->key.value.string);
+  else
+    emtr_sequence_key_clear (&entry->key);
+}
+
+static Shard *
+get_shard (EmtrSequenceTable     *self,
+           const EmtrSequenceKey *key)
+{
+  /* The low bits of the hash pick the slot within the shard. */
+  return &self->shards[(key->hash >> 32) & SHARD_MASK].shard;
+}
+
+/*
+ * Returns the entry for @key in @shard, or NULL if there is none. If
+ * @free_entry is not NULL, it is set to the entry in which @key would be
+ * inserted. The shard must have a non-zero capacity.
+ */
+static Entry *
+shard_find (Shard                 *shard,
+            const EmtrSequenceKey *key,
+            Entry                **free_entry)
+{
+  guint mask = shard->capacity - 1;
+  Entry *first_tombstone = NULL;
+
+  for (guint i = key->hash & mask; ; i = (i + 1) & mask)
+    {
+      Entry *entry = &shard->entries[i];
+
+      switch (entry->state)
+        {
+        case ENTRY_EMPTY:
+          if (free_entry != NULL)
+            *free_entry = first_tombstone != NULL ? first_tombstone : entry;
+          return NULL;
+
+        case ENTRY_TOMBSTONE:
+          if (first_tombstone == NULL)
+            first_tombstone = entry;
+          break;
+
+        case ENTRY_OCCUPIED:
+          if (key_equal (&entry->key, key))
+            return entry;
+          break;
+
+        default:
+          g_assert_not_reached ();
+        }
+    }
+}
+
+/* Moves the occupied entries of @shard into a new array of @capacity entries,
+   dropping the tombstones. */
+static void
+shard_resize (Shard *shard,
+              guint  capacity)
+{
+  Entry *old_entries = shard->entries;
+  guint old_capacity = shard->capacity;
+
+  shard->entries = g_new0 (Entry, capacity);
+  shard->capacity = capacity;
+  shard->num_tombstones = 0;
+
+  for (guint i = 0; i < old_capacity; i++)
+    {
+      Entry *free_entry;
+
+      if (old_entries[i].state != ENTRY_OCCUPIED)
+        continue;
+
+      shard_find (shard, &old_entries[i].key, &free_entry);
+      *free_entry = old_entries[i];
+    }
+
+  g_free (old_entries);
+}
+
+/* Makes sure that @shard has room for one more entry, keeping it at most three
+   quarters full, tombstones included. */
+static void
+shard_reserve (Shard *shard)
+{
+  if (shard->capacity == 0)
+    {
+      shard_resize (shard, MIN_CAPACITY);
+      return;
+    }
+
+  if ((shard->num_occupied + shard->num_tombstones + 1) * 4 <=
+      shard->capacity * 3)
+    return;
+
+  /* Only grow if the shard is mostly full of live entries; otherwise getting
+     rid of the tombstones is enough. */
+  if ((shard->num_occupied + 1) * 2 > shard->capacity)
+    shard_resize (shard, shard->capacity * 2);
+  else
+    shard_resize (shard, shard->capacity);
+}
+
+/* Creates an empty sequence table. Free with emtr_sequence_table_free(). */
+EmtrSequenceTable *
+emtr_sequence_table_new (void)
+{
+  EmtrSequenceTable *self = g_new0 (EmtrSequenceTable, 1);
+
+  for (guint i = 0; i < NUM_SHARDS; i++)
+    g_mutex_init (&self->shards[i].shard.lock);
+
+  return self;
+}
+
+/* Frees @self along with the events of the sequences that were never
+   stopped. */
+void
+emtr_sequence_table_free (EmtrSequenceTable *self)
+{
+  for (guint i = 0; i < NUM_SHARDS; i++)
+    {
+      Shard *shard = &self->shards[i].shard;
+
+      for (guint j = 0; j < shard->capacity; j++)
+        {
+          Entry *entry = &shard->entries[j];
+
+          if (entry->state != ENTRY_OCCUPIED)
+            continue;
+
+          entry_clear_key (entry);
+          g_array_unref (entry->events);
+        }
+
+      g_free (shard->entries);
+      g_mutex_clear (&shard->lock);
+    }
+
+  g_free (self);
+}
+
+/*
+ * Locks the shard that holds @key. The lookup, insert and steal functions may
+ * only be called for @key while it is locked.
+ */
+void
+emtr_sequence_table_lock (EmtrSequenceTable     *self,
+                          const EmtrSequenceKey *key)
+{
+  Shard *shard = get_shard (self, key);
+
+  EMTR_TRACE (sequence__lock__wait, key->event_id);
+
+  /* Only time the wait when there is one, so that taking a free lock costs
+     no more than it otherwise would. */
+  if (!g_mutex_trylock (&shard->lock))
+    {
+      gint64 start_time, end_time;
+      gboolean have_start_time =
+        emtr_util_get_current_time (CLOCK_MONOTONIC, &start_time);
+
+      g_mutex_lock (&shard->lock);
+
+      shard->num_contentions++;
+      if (have_start_time &&
+          emtr_util_get_current_time (CLOCK_MONOTONIC, &end_time))
+        shard->wait_time += end_time - start_time;
+    }
+
+  EMTR_TRACE (sequence__lock__acquired, key->event_id);
+}
+
+void
+emtr_sequence_table_unlock (EmtrSequenceTable     *self,
+                            const EmtrSequenceKey *key)
+{
+  g_mutex_unlock (&get_shard (self, key)->lock);
+}
+
+/* Returns the events of the sequence for @key, or NULL if it has not been
+   started. The table keeps ownership of them. */
+GArray *
+emtr_sequence_table_lookup (EmtrSequenceTable     *self,
+                            const EmtrSequenceKey *key)
+{
+  Shard *shard = get_shard (self, key);
+
+  if (shard->num_occupied == 0)
+    return NULL;
+
+  Entry *entry = shard_find (shard, key, NULL);
+  return entry != NULL ? entry->events : NULL;
+}
+
+/*
+ * Starts the sequence for @key with @events, taking ownership of them. If the
+ * sequence had already been started, its previous events are dropped and FALSE
+ * is returned.
+ */
+gboolean
+emtr_sequence_table_insert (EmtrSequenceTable     *self,
+                            const EmtrSequenceKey *key,
+                            GArray                *events)
+{
+  Shard *shard = get_shard (self, key);
+  Entry *free_entry;
+
+  shard_reserve (shard);
+
+  Entry *entry = shard_find (shard, key, &free_entry);
+  if (entry != NULL)
+    {
+      g_array_unref (entry->events);
+      entry->events = events;
+      return FALSE;
+    }
+
+  if (free_entry->state == ENTRY_TOMBSTONE)
+    shard->num_tombstones--;
+
+  free_entry->state = ENTRY_OCCUPIED;
+  entry_set_key (free_entry, key);
+  free_entry->events = events;
+  shard->num_occupied++;
+
+  return TRUE;
+}
+
+/* Removes the sequence for @key and returns its events, or returns NULL if it
+   has not been started. */
+GArray *
+emtr_sequence_table_steal (EmtrSequenceTable     *self,
+                           const EmtrSequenceKey *key)
+{
+  Shard *shard = get_shard (self, key);
+
+  if (shard->num_occupied == 0)
+    return NULL;
+
+  Entry *entry = shard_find (shard, key, NULL);
+  if (entry == NULL)
+    return NULL;
+
+  GArray *events = entry->events;
+
+  entry_clear_key (entry);
+  entry->state = ENTRY_TOMBSTONE;
+  entry->events = NULL;
+  shard->num_occupied--;
+  shard->num_tombstones++;
+
+  return events;
+}
+
+/*
+ * Sets @num_sequences to the number of sequences that have been started but
+ * not stopped, and @num_bytes to an estimate of the memory they take up: the
+ * entries of the shards, and the events, payloads and keys of the sequences.
+ * Takes each lock in turn, so the result is not a consistent snapshot of the
+ * whole table.
+ */
+void
+emtr_sequence_table_get_usage (EmtrSequenceTable *self,
+                               guint             *num_sequences,
+                               gsize             *num_bytes)
+{
+  *num_sequences = 0;
+  *num_bytes = sizeof (EmtrSequenceTable);
+
+  for (guint i = 0; i < NUM_SHARDS; i++)
+    {
+      Shard *shard = &self->shards[i].shard;
+
+      g_mutex_lock (&shard->lock);
+
+      *num_sequences += shard->num_occupied;
+      *num_bytes += shard->capacity * sizeof (Entry);
+
+      for (guint j = 0; j < shard->capacity; j++)
+        {
+          Entry *entry = &shard->entries[j];
+
+          if (entry->state != ENTRY_OCCUPIED)
+            continue;
+
+          if (entry->key.kind == EMTR_SEQUENCE_KEY_STRING)
+            *num_bytes += strlen (entry->key.value.string) + 1;
+          else if (entry->key.kind == EMTR_SEQUENCE_KEY_VARIANT)
+            *num_bytes += g_variant_get_size (entry->key.value.variant);
+
+          *num_bytes += entry->events->len * sizeof (EmtrSequenceEvent);
+
+          for (guint k = 0; k < entry->events->len; k++)
+            {
+              EmtrSequenceEvent *event =
+                &g_array_index (entry->events, EmtrSequenceEvent, k);
+
+              if (event->payload != NULL)
+                *num_bytes += g_variant_get_size (event->payload);
+            }
+        }
+
+      g_mutex_unlock (&shard->lock);
+    }
+}
+
+/*
+ * Sets @num_contentions to the number of times a thread found the lock of a
+ * shard held by another thread, and @wait_time to the nanoseconds that threads
+ * then spent waiting for it, since @self was created.
+ */
+void
+emtr_sequence_table_get_lock_stats (EmtrSequenceTable *self,
+                                    guint64           *num_contentions,
+                                    guint64           *wait_time)
+{
+  *num_contentions = 0;
+  *wait_time = 0;
+
+  for (guint i = 0; i < NUM_SHARDS; i++)
+    {
+      Shard *shard = &self->shards[i].shard;
+
+      g_mutex_lock (&shard->lock);
+      *num_contentions += shard->num_contentions;
+      *wait_time += shard->wait_time;
+      g_mutex_unlock (&shard->lock);
+    }
+}
@@ -0,0 +1,84 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* "EMRG" */
+#define EMTR_SHM_RING_MAGIC 0x454d5247u
+#define EMTR_SHM_RING_VERSION 1u
+
+/* The kind of an entry that only skips the rest of the data area */
+#define EMTR_SHM_RING_PADDING G_MAXUINT32
+
+/*
+ * The layout of the start of the shared memory that the daemon hands out with
+ * OpenEventRing. It is shared between processes, so it only uses types of a
+ * fixed size.
+ */
+typedef struct
+{
+  guint32 magic;
+  guint32 version;
+  guint32 data_offset; /* of the data area from the start of the memory */
+  guint32 data_size; /* of the data area; a power of two */
+  guint8 padding0[48];
+
+  /* Byte positions in the data area, which only ever increase and wrap
+     around. The daemon advances head; the client advances tail. */
+  guint32 head; /* (atomic) */
+  guint8 padding1[60];
+  guint32 tail; /* (atomic) */
+  guint8 padding2[60];
+} EmtrShmRingHeader;
+
+/*
+ * Each entry in the data area starts with this header, which is followed by
+ * @size bytes and padded to a multiple of 8 bytes. An entry never wraps
+ * around: if it does not fit before the end of the data area, an entry of kind
+ * EMTR_SHM_RING_PADDING fills the rest, and the entry starts again at the
+ * beginning.
+ */
+typedef struct
+{
+  guint32 size;
+  guint32 kind;
+} EmtrShmRingEntry;
+
+typedef struct _EmtrShmRing EmtrShmRing;
+
+EmtrShmRing *emtr_shm_ring_new    (gint            ring_fd,
+                                   gint            wakeup_fd,
+                                   GError        **error);
+
+void         emtr_shm_ring_free   (EmtrShmRing    *self);
+
+gboolean     emtr_shm_ring_write  (EmtrShmRing    *self,
+                                   guint32         kind,
+                                   gconstpointer   data,
+                                   gsize           size);
+
+void         emtr_shm_ring_commit (EmtrShmRing    *self);
+
+G_END_DECLS
@@ -0,0 +1,299 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/* For file sealing */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "emtr-shm-ring-private.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+#include <glib.h>
+
+/*
+ * The client side of a single-producer, single-consumer ring of records in
+ * memory shared with the daemon. The daemon creates the memory and an eventfd,
+ * and hands both out with OpenEventRing. The client copies records into the
+ * data area and publishes them by advancing tail; writing to the eventfd then
+ * wakes the daemon up, once per batch of records rather than once per record.
+ *
+ * The daemon drains the ring before it handles any other call made on the
+ * connection that opened it, so that records sent with D-Bus calls afterwards,
+ * synchronous ones in particular, are received after those in the ring.
+ */
+
+#define ENTRY_ALIGNMENT 8u
+#define ALIGN_ENTRY(size) (((size) + ENTRY_ALIGNMENT - 1) & ~(ENTRY_ALIGNMENT - 1))
+
+G_STATIC_ASSERT (G_STRUCT_OFFSET (EmtrShmRingHeader, head) == 64);
+G_STATIC_ASSERT (G_STRUCT_OFFSET (EmtrShmRingHeader, tail) == 128);
+G_STATIC_ASSERT (sizeof (EmtrShmRingEntry) == ENTRY_ALIGNMENT);
+
+struct _EmtrShmRing
+{
+  gpointer memory; /* (owned): mapped */
+  gsize memory_size;
+  EmtrShmRingHeader *header; /* (unowned): at the start of memory */
+  guint8 *data; /* (unowned): in memory */
+  guint32 data_size;
+
+  /* The position up to which records have been written. It is published to
+     the daemon by emtr_shm_ring_commit(). */
+  guint32 tail;
+
+  gint wakeup_fd; /* (owned) */
+};
+
+static gboolean
+set_error_from_errno (GError      **error,
+                      const gchar  *message)
+{
+  gint saved_errno = errno;
+
+  g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+               "%s: %s", message, g_strerror (saved_errno));
+  return FALSE;
+}
+
+/*
+ * Checks that the memory behind @ring_fd cannot shrink under our feet, which
+ * would make accessing the mapping crash, and returns its size.
+ */
+static gboolean
+check_ring_fd (gint     ring_fd,
+               gsize   *size,
+               GError **error)
+{
+  struct stat buf;
+
+#ifdef F_GET_SEALS
+  gint seals = fcntl (ring_fd, F_GET_SEALS);
+
+  if (seals < 0)
+    return set_error_from_errno (error, "Unable to get seals of event ring");
+
+  if (!(seals & F_SEAL_SHRINK))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "Event ring is not sealed against shrinking");
+      return FALSE;
+    }
+#else
+  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                       "File sealing is not supported on this system");
+  return FALSE;
+#endif /* F_GET_SEALS */
+
+  if (fstat (ring_fd, &buf) < 0)
+    return set_error_from_errno (error, "Unable to get size of event ring");
+
+  *size = buf.st_size;
+  return TRUE;
+}
+
+/*
+ * Checks the header of the mapped ring, including the positions it starts
+ * from: writing assumes that tail is aligned and that the records between
+ * head and tail fit in the data area.
+ */
+static gboolean
+check_header (const EmtrShmRingHeader  *header,
+              gsize                     memory_size,
+              GError                  **error)
+{
+  guint32 data_offset = header->data_offset;
+  guint32 data_size = header->data_size;
+  guint32 head = g_atomic_int_get (&header->head);
+  guint32 tail = g_atomic_int_get (&header->tail);
+
+  if (header->magic != EMTR_SHM_RING_MAGIC ||
+      header->version != EMTR_SHM_RING_VERSION)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "Unsupported event ring format");
+      return FALSE;
+    }
+
+  if (data_offset < sizeof (EmtrShmRingHeader) ||
+      data_offset % ENTRY_ALIGNMENT != 0 ||
+      data_size < ENTRY_ALIGNMENT || data_size > G_MAXINT32 ||
+      (data_size & (data_size - 1)) != 0 ||
+      data_offset > memory_size || data_size > memory_size - data_offset)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "Invalid event ring layout");
+      return FALSE;
+    }
+
+  /* Positions wrap around, so only their difference is meaningful. */
+  if (tail % ENTRY_ALIGNMENT != 0 || tail - head > data_size)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "Invalid event ring positions");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/*
+ * Maps the event ring in @ring_fd, whose records are announced by writing to
+ * the eventfd @wakeup_fd. Takes ownership of both file descriptors, even on
+ * failure. Free with emtr_shm_ring_free().
+ */
+EmtrShmRing *
+emtr_shm_ring_new (gint     ring_fd,
+                   gint     wakeup_fd,
+                   GError **error)
+{
+  EmtrShmRing *self;
+  EmtrShmRingHeader *header;
+  gsize memory_size;
+  gpointer memory;
+
+  if (!check_ring_fd (ring_fd, &memory_size, error))
+    goto fail;
+
+  if (memory_size < sizeof (EmtrShmRingHeader))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "Event ring is too small");
+      goto fail;
+    }
+
+  memory = mmap (NULL, memory_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 ring_fd, 0);
+  if (memory == MAP_FAILED)
+    {
+      set_error_from_errno (error, "Unable to map event ring");
+      goto fail;
+    }
+
+  /* The mapping keeps the memory alive. */
+  close (ring_fd);
+  ring_fd = -1;
+
+  header = memory;
+  if (!check_header (header, memory_size, error))
+    {
+      munmap (memory, memory_size);
+      goto fail;
+    }
+
+  self = g_new0 (EmtrShmRing, 1);
+  self->memory = memory;
+  self->memory_size = memory_size;
+  self->header = header;
+  self->data = (guint8 *) memory + header->data_offset;
+  self->data_size = header->data_size;
+  self->tail = g_atomic_int_get (&header->tail);
+  self->wakeup_fd = wakeup_fd;
+
+  return self;
+
+fail:
+  if (ring_fd >= 0)
+    close (ring_fd);
+  close (wakeup_fd);
+  return NULL;
+}
+
+void
+emtr_shm_ring_free (EmtrShmRing *self)
+{
+  munmap (self->memory, self->memory_size);
+  close (self->wakeup_fd);
+  g_free (self);
+}
+
+/*
+ * Copies an entry of @kind holding the @size bytes at @data into the ring,
+ * without publishing it yet. Returns FALSE if there is no room for it.
+ */
+gboolean
+emtr_shm_ring_write (EmtrShmRing   *self,
+                     guint32        kind,
+                     gconstpointer  data,
+                     gsize          size)
+{
+  guint32 data_mask = self->data_size - 1;
+  guint32 head = g_atomic_int_get (&self->header->head);
+  guint32 tail = self->tail;
+  guint32 free_space = self->data_size - (tail - head);
+
+  if (size > self->data_size - sizeof (EmtrShmRingEntry))
+    return FALSE;
+
+  guint32 entry_size = ALIGN_ENTRY (sizeof (EmtrShmRingEntry) + size);
+  guint32 offset = tail & data_mask;
+  guint32 contiguous_space = self->data_size - offset;
+  guint32 padding_size = contiguous_space < entry_size ? contiguous_space : 0;
+
+  if (entry_size + padding_size > free_space)
+    return FALSE;
+
+  if (padding_size > 0)
+    {
+      EmtrShmRingEntry *padding = (EmtrShmRingEntry *) (self->data + offset);
+      padding->size = padding_size - sizeof (EmtrShmRingEntry);
+      padding->kind = EMTR_SHM_RING_PADDING;
+
+      tail += padding_size;
+      offset = 0;
+    }
+
+  EmtrShmRingEntry *entry = (EmtrShmRingEntry *) (self->data + offset);
+  entry->size = size;
+  entry->kind = kind;
+  memcpy (entry + 1, data, size);
+
+  self->tail = tail + entry_size;
+  return TRUE;
+}
+
+/*
+ * Publishes the entries written since the last call, and wakes the daemon up
+ * if there were any.
+ */
+void
+emtr_shm_ring_commit (EmtrShmRing *self)
+{
+  guint64 increment = 1;
+
+  if ((guint32) g_atomic_int_get (&self->header->tail) == self->tail)
+    return;
+
+  /* Orders the writes of the entries before that of tail. */
+  g_atomic_int_set (&self->header->tail, self->tail);
+
+  /* The counter can only be full if the daemon has a wakeup pending anyway. */
+  while (write (self->wakeup_fd, &increment, sizeof (increment)) < 0 &&
+         errno == EINTR)
+    ;
+}
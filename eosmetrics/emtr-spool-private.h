@@ -0,0 +1,54 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EmtrSpool EmtrSpool;
+
+/* Called for each record found in the spool. @data holds the record as it was
+   appended. @is_stale is set if it was appended during an earlier boot.
+   Returns FALSE if there is no room for the record yet, in which case replaying
+   stops, to pass it again later. */
+typedef gboolean (*EmtrSpoolReplayFunc) (guint32  kind,
+                                         GBytes  *data,
+                                         gboolean is_stale,
+                                         gpointer user_data);
+
+EmtrSpool *emtr_spool_new             (const gchar          *directory);
+
+void       emtr_spool_free            (EmtrSpool            *self);
+
+gboolean   emtr_spool_append          (EmtrSpool            *self,
+                                       guint32               kind,
+                                       gconstpointer         data,
+                                       gsize                 size,
+                                       GError              **error);
+
+gboolean   emtr_spool_replay          (EmtrSpool            *self,
+                                       EmtrSpoolReplayFunc   func,
+                                       gpointer              user_data,
+                                       guint                *num_records);
+
+G_END_DECLS
@@ -0,0 +1,574 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/* For flock() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "emtr-spool-private.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+/*
+ * The spool keeps records that could not be sent to the daemon, so that they
+ * can be sent once it is back, even by another process. It is a directory of
+ * segment files, each of which is created at a fixed size and mapped into
+ * memory, so that appending a record is a copy into the mapping. Nothing is
+ * synced to disk: the page cache keeps the records if the process crashes, and
+ * records torn by a system crash are detected by their checksum.
+ *
+ * A segment is locked with flock() by the process that appends to it or
+ * replays it, so that replaying never touches a segment that is still being
+ * written, and no two processes replay the same segment. Segments are named
+ * after the time at which they were created, so that they are replayed in
+ * order. Once the directory holds MAX_SEGMENTS segments, the oldest ones are
+ * deleted to make room for new ones.
+ *
+ * Replaying goes one segment at a time, and stops at any record that the
+ * caller has no room for, to carry on from there on the next call. Each record
+ * that has been handed off is marked as replayed in the segment, so that a
+ * segment that was only partly replayed when its process exited is replayed
+ * from where it stopped. A segment is only deleted once all of its records
+ * have been handed off.
+ *
+ * Records carry times relative to the boot they were recorded in, so each
+ * segment is stamped with the boot ID, and records left from an earlier boot
+ * are replayed as stale, to be counted as dropped rather than sent.
+ */
+
+/* "EMSP" */
+#define SEGMENT_MAGIC 0x454d5350u
+#define SEGMENT_VERSION 1u
+
+#define SEGMENT_SIZE (1024u * 1024u)
+#define MAX_SEGMENTS 16u
+
+#define SEGMENT_SUFFIX ".spool"
+
+#define BOOT_ID_PATH "/proc/sys/kernel/random/boot_id"
+
+#define RECORD_ALIGNMENT 8u
+#define ALIGN_RECORD(size) (((size) + RECORD_ALIGNMENT - 1) & ~(RECORD_ALIGNMENT - 1))
+
+typedef struct
+{
+  guint32 magic;
+  guint32 version;
+  guint64 boot_id; /* the first half of the boot ID, or 0 if unknown */
+} SegmentHeader;
+
+/*
+ * Precedes each record in a segment. The record follows, padded to a multiple
+ * of 8 bytes. A size of 0 marks the end of the records in a segment, the rest
+ * of which is zeroed.
+ */
+typedef struct
+{
+  guint32 size;
+  guint32 kind;
+  guint32 crc; /* of the record */
+  guint32 flags;
+} RecordHeader;
+
+/* Set in RecordHeader.flags once the record has been handed off by replaying */
+#define RECORD_REPLAYED (1u << 0)
+
+struct _EmtrSpool
+{
+  gchar *directory; /* (owned) */
+  guint64 boot_id;
+
+  /* The segment being appended to, or -1 if there is none */
+  gint fd;
+  guint8 *memory; /* (owned) (nullable): mapping of SEGMENT_SIZE bytes */
+  gsize used;
+
+  /* The segment being replayed, or -1 if there is none */
+  gint replay_fd;
+  gchar *replay_path; /* (owned) (nullable) */
+  guint8 *replay_memory; /* (owned) (nullable): mapping of replay_size bytes */
+  gsize replay_size;
+  gsize replay_offset; /* of the next record to replay */
+};
+
+static guint32 crc_table[256];
+static gsize crc_table_initialized = 0;
+
+/* Builds the table for the CRC-32 used by zlib and Ethernet, among others. */
+static void
+init_crc_table (void)
+{
+  if (!g_once_init_enter (&crc_table_initialized))
+    return;
+
+  for (guint32 i = 0; i < G_N_ELEMENTS (crc_table); i++)
+    {
+      guint32 crc = i;
+
+      for (gint bit = 0; bit < 8; bit++)
+        crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320u : crc >> 1;
+
+      crc_table[i] = crc;
+    }
+
+  g_once_init_leave (&crc_table_initialized, 1);
+}
+
+static guint32
+crc32 (gconstpointer data,
+       gsize         size)
+{
+  const guint8 *bytes = data;
+  guint32 crc = 0xffffffffu;
+
+  init_crc_table ();
+
+  for (gsize i = 0; i < size; i++)
+    crc = crc_table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+
+  return crc ^ 0xffffffffu;
+}
+
+/*
+ * Returns the first 64 bits of the ID of the current boot, which the kernel
+ * formats as a UUID, or 0 if it cannot be read.
+ */
+static guint64
+read_boot_id (void)
+{
+  gchar *contents = NULL;
+  guint64 boot_id = 0;
+  gint num_digits = 0;
+
+  if (!g_file_get_contents (BOOT_ID_PATH, &contents, NULL, NULL))
+    return 0;
+
+  for (const gchar *c = contents; *c != '\0' && num_digits < 16; c++)
+    {
+      gint digit = g_ascii_xdigit_value (*c);
+
+      if (digit < 0)
+        continue;
+
+      boot_id = (boot_id << 4) | (guint64) digit;
+      num_digits++;
+    }
+
+  g_free (contents);
+
+  return num_digits == 16 ? boot_id : 0;
+}
+
+/* g_ptr_array_sort() passes pointers to the elements. */
+static gint
+compare_names (gconstpointer a,
+               gconstpointer b)
+{
+  return g_strcmp0 (*(const gchar * const *) a, *(const gchar * const *) b);
+}
+
+/* Returns the segments in the spool directory, oldest first. */
+static GPtrArray *
+list_segments (EmtrSpool *self)
+{
+  GPtrArray *names = g_ptr_array_new_with_free_func (g_free);
+  GDir *dir = g_dir_open (self->directory, 0, NULL);
+  const gchar *name;
+
+  if (dir == NULL)
+    return names;
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      if (g_str_has_suffix (name, SEGMENT_SUFFIX))
+        g_ptr_array_add (names, g_strdup (name));
+    }
+
+  g_dir_close (dir);
+
+  g_ptr_array_sort (names, compare_names);
+  for (guint i = 0; i < names->len; i++)
+    {
+      gchar *path = g_build_filename (self->directory,
+                                      g_ptr_array_index (names, i), NULL);
+      g_free (g_ptr_array_index (names, i));
+      names->pdata[i] = path;
+    }
+
+  return names;
+}
+
+/*
+ * Opens @path and locks it, unless another process holds the lock or it has
+ * been deleted in the meantime. Returns -1 in that case.
+ */
+static gint
+open_and_lock (const gchar *path,
+               gint         flags)
+{
+  struct stat buf;
+  gint fd = open (path, flags | O_RDWR | O_CLOEXEC, 0600);
+
+  if (fd < 0)
+    return -1;
+
+  if (flock (fd, LOCK_EX | LOCK_NB) < 0 ||
+      fstat (fd, &buf) < 0 || buf.st_nlink == 0)
+    {
+      close (fd);
+      return -1;
+    }
+
+  return fd;
+}
+
+/* Deletes the oldest segments that nobody is writing to, so that a new one can
+   be created without going over MAX_SEGMENTS. */
+static void
+enforce_size_cap (EmtrSpool *self)
+{
+  GPtrArray *segments = list_segments (self);
+
+  for (guint i = 0; i < segments->len && segments->len - i >= MAX_SEGMENTS;
+       i++)
+    {
+      const gchar *path = g_ptr_array_index (segments, i);
+      gint fd = open_and_lock (path, 0);
+
+      if (fd < 0)
+        continue;
+
+      g_debug ("Spool is full; dropping events in %s.", path);
+      g_unlink (path);
+      close (fd);
+    }
+
+  g_ptr_array_unref (segments);
+}
+
+static void
+close_segment (EmtrSpool *self)
+{
+  if (self->fd < 0)
+    return;
+
+  munmap (self->memory, SEGMENT_SIZE);
+  self->memory = NULL;
+  close (self->fd);
+  self->fd = -1;
+}
+
+static void
+close_replay_segment (EmtrSpool *self)
+{
+  if (self->replay_fd < 0)
+    return;
+
+  munmap (self->replay_memory, self->replay_size);
+  self->replay_memory = NULL;
+  g_clear_pointer (&self->replay_path, g_free);
+  close (self->replay_fd);
+  self->replay_fd = -1;
+}
+
+static gboolean
+open_new_segment (EmtrSpool  *self,
+                  GError    **error)
+{
+  gint saved_errno;
+
+  if (g_mkdir_with_parents (self->directory, 0700) < 0)
+    {
+      saved_errno = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Unable to create spool directory %s: %s", self->directory,
+                   g_strerror (saved_errno));
+      return FALSE;
+    }
+
+  enforce_size_cap (self);
+
+  gchar *name = g_strdup_printf ("%016" G_GINT64_MODIFIER "x-%d" SEGMENT_SUFFIX,
+                                 g_get_real_time (), (gint) getpid ());
+  gchar *path = g_build_filename (self->directory, name, NULL);
+  gint fd = open_and_lock (path, O_CREAT | O_EXCL);
+  saved_errno = errno;
+  g_free (name);
+
+  /* Allocate the blocks now, rather than getting SIGBUS when writing to the
+     mapping on a full disk. */
+  if (fd < 0 || (saved_errno = posix_fallocate (fd, 0, SEGMENT_SIZE)) != 0)
+    {
+      if (fd >= 0)
+        {
+          g_unlink (path);
+          close (fd);
+        }
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Unable to create spool segment %s: %s", path,
+                   g_strerror (saved_errno));
+      g_free (path);
+      return FALSE;
+    }
+
+  gpointer memory = mmap (NULL, SEGMENT_SIZE, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, fd, 0);
+  if (memory == MAP_FAILED)
+    {
+      saved_errno = errno;
+      g_unlink (path);
+      close (fd);
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Unable to map spool segment %s: %s", path,
+                   g_strerror (saved_errno));
+      g_free (path);
+      return FALSE;
+    }
+
+  g_free (path);
+
+  SegmentHeader *header = memory;
+  header->magic = SEGMENT_MAGIC;
+  header->version = SEGMENT_VERSION;
+  header->boot_id = self->boot_id;
+
+  self->fd = fd;
+  self->memory = memory;
+  self->used = sizeof (SegmentHeader);
+
+  return TRUE;
+}
+
+/*
+ * Creates a spool in @directory, which is only created once records are
+ * appended. Free with emtr_spool_free(), which leaves the records that have
+ * been appended in the directory.
+ */
+EmtrSpool *
+emtr_spool_new (const gchar *directory)
+{
+  EmtrSpool *self = g_new0 (EmtrSpool, 1);
+
+  self->directory = g_strdup (directory);
+  self->boot_id = read_boot_id ();
+  self->fd = -1;
+  self->replay_fd = -1;
+
+  return self;
+}
+
+/* Records of the segment being replayed that have not been handed off yet are
+   left in it, for the next replay. */
+void
+emtr_spool_free (EmtrSpool *self)
+{
+  close_segment (self);
+  close_replay_segment (self);
+  g_free (self->directory);
+  g_free (self);
+}
+
+/*
+ * Appends the @size bytes of the record at @data, of @kind, to the spool,
+ * starting a new segment if the current one is full.
+ */
+gboolean
+emtr_spool_append (EmtrSpool      *self,
+                   guint32         kind,
+                   gconstpointer   data,
+                   gsize           size,
+                   GError        **error)
+{
+  gsize record_size = ALIGN_RECORD (sizeof (RecordHeader) + size);
+
+  if (size == 0 ||
+      record_size > SEGMENT_SIZE - sizeof (SegmentHeader) - sizeof (RecordHeader))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                   "Record of %" G_GSIZE_FORMAT " bytes cannot be spooled",
+                   size);
+      return FALSE;
+    }
+
+  /* Keep room for the terminating header. */
+  if (self->fd >= 0 &&
+      self->used + record_size > SEGMENT_SIZE - sizeof (RecordHeader))
+    close_segment (self);
+
+  if (self->fd < 0 && !open_new_segment (self, error))
+    return FALSE;
+
+  RecordHeader *header = (RecordHeader *) (self->memory + self->used);
+  memcpy (header + 1, data, size);
+  header->kind = kind;
+  header->crc = crc32 (data, size);
+  /* A nonzero size marks the record as present, so it is written last. */
+  header->size = size;
+
+  self->used += record_size;
+  return TRUE;
+}
+
+/*
+ * Opens the oldest segment that is not being appended to by another process
+ * or spool, nor replayed by another process, for replaying. Records appended
+ * to @self are included. Segments that cannot be read are deleted. Returns
+ * FALSE if there is no segment to replay.
+ */
+static gboolean
+open_replay_segment (EmtrSpool *self)
+{
+  GPtrArray *segments;
+  gboolean found = FALSE;
+
+  close_segment (self);
+
+  segments = list_segments (self);
+
+  for (guint i = 0; i < segments->len && !found; i++)
+    {
+      const gchar *path = g_ptr_array_index (segments, i);
+      const SegmentHeader *header;
+      struct stat buf;
+      gint fd = open_and_lock (path, 0);
+
+      if (fd < 0)
+        continue;
+
+      /* Written to, in order to mark records as replayed */
+      gpointer memory = MAP_FAILED;
+      if (fstat (fd, &buf) == 0 && buf.st_size >= (off_t) sizeof (SegmentHeader))
+        memory = mmap (NULL, buf.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fd, 0);
+
+      header = memory;
+      if (memory == MAP_FAILED ||
+          header->magic != SEGMENT_MAGIC || header->version != SEGMENT_VERSION)
+        {
+          if (memory != MAP_FAILED)
+            munmap (memory, buf.st_size);
+
+          /* Delete the segment before unlocking it, so that nobody tries it
+             again. */
+          g_unlink (path);
+          close (fd);
+          continue;
+        }
+
+      self->replay_fd = fd;
+      self->replay_path = g_strdup (path);
+      self->replay_memory = memory;
+      self->replay_size = buf.st_size;
+      self->replay_offset = sizeof (SegmentHeader);
+      found = TRUE;
+    }
+
+  g_ptr_array_unref (segments);
+
+  return found;
+}
+
+/*
+ * Calls @func on the records of one segment in the spool, oldest first,
+ * starting where the previous call stopped. Stops at the first record that
+ * @func does not take, to pass it again on the next call. Once all records of
+ * the segment have been taken, it is deleted.
+ *
+ * Records from an earlier boot are passed as stale. The number of records
+ * taken that are not stale is added to @num_records. Returns FALSE if the
+ * spool held no records to replay.
+ */
+gboolean
+emtr_spool_replay (EmtrSpool           *self,
+                   EmtrSpoolReplayFunc  func,
+                   gpointer             user_data,
+                   guint               *num_records)
+{
+  const SegmentHeader *segment_header;
+  guint num_stale = 0;
+  gboolean is_stale;
+  gboolean all_taken = TRUE;
+
+  if (self->replay_fd < 0 && !open_replay_segment (self))
+    return FALSE;
+
+  segment_header = (const SegmentHeader *) self->replay_memory;
+  is_stale = segment_header->boot_id != self->boot_id;
+
+  while (self->replay_offset + sizeof (RecordHeader) <= self->replay_size)
+    {
+      RecordHeader *header =
+        (RecordHeader *) (self->replay_memory + self->replay_offset);
+      gsize space = self->replay_size - self->replay_offset;
+
+      if (header->size == 0 || header->size > space - sizeof (RecordHeader))
+        break;
+
+      /* Skip records that were torn, but trust the sizes of those after. */
+      if (!(header->flags & RECORD_REPLAYED) &&
+          crc32 (header + 1, header->size) == header->crc)
+        {
+          GBytes *data = g_bytes_new (header + 1, header->size);
+          gboolean taken = func (header->kind, data, is_stale, user_data);
+          g_bytes_unref (data);
+
+          if (!taken)
+            {
+              all_taken = FALSE;
+              break;
+            }
+
+          header->flags |= RECORD_REPLAYED;
+          if (is_stale)
+            num_stale++;
+          else
+            (*num_records)++;
+        }
+
+      self->replay_offset += ALIGN_RECORD (sizeof (RecordHeader) + header->size);
+    }
+
+  if (num_stale > 0)
+    g_debug ("Dropping %u events that were kept during an earlier boot.",
+             num_stale);
+
+  /* Keep the segment until all of its records have been taken. */
+  if (!all_taken)
+    return TRUE;
+
+  /* Delete the segment before unlocking it, so that nobody replays it
+     again. */
+  g_unlink (self->replay_path);
+  close_replay_segment (self);
+
+  return TRUE;
+}
@@ -0,0 +1,159 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "emtr-latency-histogram-private.h"
+
+#include <glib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+G_BEGIN_DECLS
+
+/* What can happen to an event, each of which is counted per event ID */
+typedef enum
+{
+  EMTR_EVENT_STAT_RECORDED,
+  EMTR_EVENT_STAT_SENT,
+  EMTR_EVENT_STAT_DROPPED,
+  EMTR_EVENT_STAT_FAILED,
+  EMTR_NUM_EVENT_STATS
+} EmtrEventStat;
+
+/* The steps of recording an event that are timed while profiling. The first
+   ones run in the recording call, the others on the sender thread. */
+typedef enum
+{
+  EMTR_PHASE_CLOCK,          /* reading the time of the event */
+  EMTR_PHASE_CHECK_PAYLOAD,  /* checking arguments, for maybe types too */
+  EMTR_PHASE_DEBUG_LOG,      /* the g_debug() call of the recording function */
+  EMTR_PHASE_PARSE_EVENT_ID, /* parsing an event ID given as a string */
+  EMTR_PHASE_ENQUEUE,        /* handing the record over to the sender */
+  EMTR_PHASE_NORMALIZE,      /* putting payloads in normal form */
+  EMTR_PHASE_BOX,            /* boxing payloads in variants */
+  EMTR_PHASE_BUILD_RECORD,   /* building the record variant */
+  EMTR_PHASE_BUILD_BATCH,    /* gathering pending records into a batch */
+  EMTR_PHASE_SEND,           /* serializing and sending a message */
+  EMTR_NUM_PHASES
+} EmtrPhase;
+
+/*
+ * Times the phases of one recording call, or of the handling of one record or
+ * batch on the sender thread. Lives on the stack: start it with
+ * emtr_stats_profile_begin(), end each phase with emtr_profile_phase(), and
+ * add it up with emtr_stats_profile_end().
+ */
+typedef struct
+{
+  guint64 last; /* ticks at the end of the previous phase, or 0 if not
+                   profiling */
+  guint phases; /* bit mask of the phases that were timed */
+  guint64 ticks[EMTR_NUM_PHASES];
+} EmtrProfile;
+
+/*
+ * Reads the cheapest counter that ticks at a constant rate: the time stamp
+ * counter on x86, the virtual counter on ARM64, and the monotonic clock in
+ * nanoseconds elsewhere. Ticks are converted to nanoseconds when reported.
+ */
+static inline guint64
+emtr_profile_read_ticks (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc ();
+#elif defined(__aarch64__)
+  guint64 ticks;
+  __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (ticks));
+  return ticks;
+#else
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (guint64) ts.tv_sec * G_GUINT64_CONSTANT (1000000000) + ts.tv_nsec;
+#endif
+}
+
+/* Adds the ticks since the end of the previous phase of @profile to @phase. */
+static inline void
+emtr_profile_phase (EmtrProfile *profile,
+                    EmtrPhase    phase)
+{
+  if (G_LIKELY (profile->last == 0))
+    return;
+
+  guint64 now = emtr_profile_read_ticks ();
+
+  profile->ticks[phase] += now - profile->last;
+  profile->phases |= 1u << phase;
+  profile->last = now;
+}
+
+typedef struct _EmtrStats EmtrStats;
+
+EmtrStats *emtr_stats_new            (void);
+
+EmtrStats *emtr_stats_ref            (EmtrStats       *self);
+
+void       emtr_stats_unref          (EmtrStats       *self);
+
+void       emtr_stats_count_events   (EmtrStats       *self,
+                                      const guchar    *event_id,
+                                      EmtrEventStat    stat,
+                                      gsize            num_events);
+
+void       emtr_stats_count_bytes    (EmtrStats       *self,
+                                      gsize            num_bytes);
+
+void       emtr_stats_timer_started  (EmtrStats       *self);
+
+void       emtr_stats_timer_stopped  (EmtrStats       *self);
+
+void       emtr_stats_snapshot       (EmtrStats       *self,
+                                      GVariantBuilder *builder);
+
+void       emtr_stats_add_latency    (EmtrStats       *self,
+                                      EmtrLatencyKind  kind,
+                                      gint64           latency_ns);
+
+EmtrLatencyHistogram *
+           emtr_stats_get_latency_histogram
+                                     (EmtrStats       *self,
+                                      EmtrLatencyKind  kind);
+
+void       emtr_stats_reset_latencies
+                                     (EmtrStats       *self);
+
+void       emtr_stats_set_profiling  (EmtrStats       *self,
+                                      gboolean         profiling);
+
+gboolean   emtr_stats_is_profiling   (EmtrStats       *self);
+
+void       emtr_stats_profile_begin  (EmtrStats       *self,
+                                      EmtrProfile     *profile);
+
+void       emtr_stats_profile_end    (EmtrStats       *self,
+                                      EmtrProfile     *profile,
+                                      const guchar    *event_id);
+
+G_END_DECLS
@@ -0,0 +1,711 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "emtr-stats-private.h"
+
+#include "emtr-event-sender-private.h"
+
+#include <string.h>
+#include <uuid/uuid.h>
+
+#include <glib.h>
+
+/*
+ * Counters of what happens to the events recorded with one sender. Events are
+ * counted on the recording threads and on the sender thread, on their hot
+ * paths, so each thread counts into counters of its own, which only it writes
+ * to. Counting is a plain store, not an atomic read-modify-write, and takes no
+ * lock except when a thread counts an event ID for the first time. Readers sum
+ * up the counters of all threads.
+ *
+ * Counters are gsize, which is loaded and stored atomically wherever GLib
+ * runs. They wrap around on 32-bit systems.
+ *
+ * While profiling, the time spent in each EmtrPhase is added up too, in total
+ * and per event ID. Those sums are 64-bit, so they are protected by the lock of
+ * the thread instead; profiling is only turned on for a while, to find out
+ * where the time goes, and an uncontended lock is cheap enough for that.
+ */
+
+/* The time spent in each phase, in ticks of emtr_profile_read_ticks(), and
+   the number of times that it was timed */
+typedef struct
+{
+  guint64 ticks[EMTR_NUM_PHASES];
+  guint64 calls[EMTR_NUM_PHASES];
+} PhaseTimes;
+
+/* The counts of one event ID */
+typedef struct
+{
+  guchar event_id[EMTR_EVENT_ID_LENGTH];
+  gsize counts[EMTR_NUM_EVENT_STATS]; /* (atomic) */
+
+  /* Only allocated once the event ID has been profiled */
+  PhaseTimes *phase_times; /* (owned) (nullable) */
+} EventCounts;
+
+/* The counters of one thread for one EmtrStats */
+typedef struct
+{
+  gint ref_count; /* (atomic): held by the thread and by the EmtrStats */
+  guint stats_id;
+  gint closed; /* (atomic): set once the EmtrStats has been freed */
+
+  /* Taken by the thread to add event IDs and phase times, and by readers */
+  GMutex lock;
+  GHashTable *event_counts; /* (owned) (element-type guint8* EventCounts) */
+
+  gsize bytes_serialized; /* (atomic) */
+
+  /* The time spent in each phase by this thread, for all event IDs.
+     Protected by lock. */
+  PhaseTimes phase_times;
+
+  /* The counts of the event ID that was counted last, which are found without
+     hashing, since threads tend to record the same events over and over */
+  EventCounts *last_counts; /* (unowned) (nullable) */
+} ThreadStats;
+
+struct _EmtrStats
+{
+  gint ref_count; /* (atomic) */
+
+  /* Distinguishes these stats from all others in the counters of a thread */
+  guint id;
+
+  /* Protects threads, the counts of exited threads and the calibration */
+  GMutex lock;
+
+  /* The counters of all threads that have counted something */
+  GPtrArray *threads; /* (owned) (element-type ThreadStats) */
+
+  /* The sums of the counters of the threads that have exited since */
+  GHashTable *exited_event_counts; /* (owned) (element-type guint8* EventCounts) */
+  gsize exited_bytes_serialized;
+  PhaseTimes exited_phase_times;
+
+  /* Whether the phases of recording are timed */
+  gint profiling; /* (atomic) */
+
+  /* A reading of emtr_profile_read_ticks() and of the monotonic clock, taken
+     when profiling was first turned on, to convert ticks to nanoseconds.
+     Protected by lock. */
+  guint64 calibration_ticks;
+  gint64 calibration_time_us;
+
+  /* The number of aggregate timers that have been started and not stopped */
+  gint num_timers; /* (atomic) */
+
+  /* Indexed by EmtrLatencyKind. Counted into by all threads at once, which
+     is cheap enough for latencies, since they are only measured around
+     calls that take much longer than an atomic addition. */
+  EmtrLatencyHistogram *latencies[EMTR_NUM_LATENCY_KINDS]; /* (owned) */
+};
+
+static const gchar * const stat_names[EMTR_NUM_EVENT_STATS] = {
+  "recorded",
+  "sent",
+  "dropped",
+  "failed",
+};
+
+static const gchar * const total_names[EMTR_NUM_EVENT_STATS] = {
+  "events-recorded",
+  "events-sent",
+  "events-dropped",
+  "events-failed",
+};
+
+static const gchar * const phase_names[EMTR_NUM_PHASES] = {
+  "clock",
+  "check-payload",
+  "debug-log",
+  "parse-event-id",
+  "enqueue",
+  "normalize",
+  "box",
+  "build-record",
+  "build-batch",
+  "send",
+};
+
+/* The counters of the current thread, one per EmtrStats it has counted with.
+   Released when the thread exits. */
+static GPrivate thread_stats = G_PRIVATE_INIT ((GDestroyNotify) g_ptr_array_unref);
+
+static gint next_stats_id = 0; /* (atomic) */
+
+/* Only the thread that owns @counter writes to it. */
+static inline void
+counter_add (gsize *counter,
+             gsize  n)
+{
+  g_atomic_pointer_set (counter, *counter + n);
+}
+
+static inline gsize
+counter_get (gsize *counter)
+{
+  return (gsize) g_atomic_pointer_get (counter);
+}
+
+static guint
+event_id_hash (gconstpointer key)
+{
+  guint hash;
+
+  /* Event IDs are random UUIDs, so any of their bytes will do. */
+  memcpy (&hash, key, sizeof (hash));
+  return hash;
+}
+
+static gboolean
+event_id_equal (gconstpointer a,
+                gconstpointer b)
+{
+  return memcmp (a, b, EMTR_EVENT_ID_LENGTH) == 0;
+}
+
+static EventCounts *
+event_counts_new (const guchar *event_id)
+{
+  EventCounts *counts = g_new0 (EventCounts, 1);
+
+  memcpy (counts->event_id, event_id, EMTR_EVENT_ID_LENGTH);
+  return counts;
+}
+
+static void
+event_counts_free (EventCounts *counts)
+{
+  g_free (counts->phase_times);
+  g_free (counts);
+}
+
+static GHashTable *
+event_counts_table_new (void)
+{
+  /* Keys point to the event IDs in the values. */
+  return g_hash_table_new_full (event_id_hash, event_id_equal, NULL,
+                                (GDestroyNotify) event_counts_free);
+}
+
+static void
+add_phase_times (PhaseTimes       *to,
+                 const PhaseTimes *from)
+{
+  for (gint phase = 0; phase < EMTR_NUM_PHASES; phase++)
+    {
+      to->ticks[phase] += from->ticks[phase];
+      to->calls[phase] += from->calls[phase];
+    }
+}
+
+/* Adds the phases timed in @profile to @times. */
+static void
+add_profile (PhaseTimes        *times,
+             const EmtrProfile *profile)
+{
+  for (gint phase = 0; phase < EMTR_NUM_PHASES; phase++)
+    {
+      if ((profile->phases & (1u << phase)) == 0)
+        continue;
+
+      times->ticks[phase] += profile->ticks[phase];
+      times->calls[phase]++;
+    }
+}
+
+/* Adds the counts in @from to those in @to, which no thread counts into. */
+static void
+add_event_counts (GHashTable *to,
+                  GHashTable *from)
+{
+  GHashTableIter iter;
+  EventCounts *counts;
+
+  g_hash_table_iter_init (&iter, from);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &counts))
+    {
+      EventCounts *sums = g_hash_table_lookup (to, counts->event_id);
+
+      if (sums == NULL)
+        {
+          sums = event_counts_new (counts->event_id);
+          g_hash_table_insert (to, sums->event_id, sums);
+        }
+
+      for (gint stat = 0; stat < EMTR_NUM_EVENT_STATS; stat++)
+        sums->counts[stat] += counter_get (&counts->counts[stat]);
+
+      if (counts->phase_times != NULL)
+        {
+          if (sums->phase_times == NULL)
+            sums->phase_times = g_new0 (PhaseTimes, 1);
+          add_phase_times (sums->phase_times, counts->phase_times);
+        }
+    }
+}
+
+static ThreadStats *
+thread_stats_new (guint stats_id)
+{
+  ThreadStats *thread = g_new0 (ThreadStats, 1);
+
+  thread->ref_count = 1;
+  thread->stats_id = stats_id;
+  g_mutex_init (&thread->lock);
+  thread->event_counts = event_counts_table_new ();
+
+  return thread;
+}
+
+static ThreadStats *
+thread_stats_ref (ThreadStats *thread)
+{
+  g_atomic_int_inc (&thread->ref_count);
+  return thread;
+}
+
+static void
+thread_stats_unref (ThreadStats *thread)
+{
+  if (!g_atomic_int_dec_and_test (&thread->ref_count))
+    return;
+
+  g_hash_table_unref (thread->event_counts);
+  g_mutex_clear (&thread->lock);
+  g_free (thread);
+}
+
+/*
+ * Adds the counters of the threads that have exited to those of exited
+ * threads, and drops them, so that threads that come and go don't pile up.
+ * Called with the lock held.
+ */
+static void
+fold_exited_threads (EmtrStats *self)
+{
+  for (guint i = self->threads->len; i > 0; i--)
+    {
+      ThreadStats *thread = g_ptr_array_index (self->threads, i - 1);
+
+      /* Once the thread has exited, its counters won't change anymore. */
+      if (g_atomic_int_get (&thread->ref_count) != 1)
+        continue;
+
+      add_event_counts (self->exited_event_counts, thread->event_counts);
+      self->exited_bytes_serialized += thread->bytes_serialized;
+      add_phase_times (&self->exited_phase_times, &thread->phase_times);
+      g_ptr_array_remove_index_fast (self->threads, i - 1);
+    }
+}
+
+/*
+ * Returns the counters of the current thread for @self, creating them the
+ * first time the thread counts something with @self. Counters left behind by
+ * freed stats, and by threads that have exited, are dropped meanwhile.
+ */
+static ThreadStats *
+get_thread_stats (EmtrStats *self)
+{
+  GPtrArray *threads = g_private_get (&thread_stats);
+
+  if (threads == NULL)
+    {
+      threads =
+        g_ptr_array_new_with_free_func ((GDestroyNotify) thread_stats_unref);
+      g_private_set (&thread_stats, threads);
+    }
+
+  for (guint i = 0; i < threads->len; i++)
+    {
+      ThreadStats *thread = g_ptr_array_index (threads, i);
+      if (thread->stats_id == self->id)
+        return thread;
+    }
+
+  for (guint i = threads->len; i > 0; i--)
+    {
+      ThreadStats *thread = g_ptr_array_index (threads, i - 1);
+      if (g_atomic_int_get (&thread->closed))
+        g_ptr_array_remove_index_fast (threads, i - 1);
+    }
+
+  ThreadStats *thread = thread_stats_new (self->id);
+  g_ptr_array_add (threads, thread);
+
+  g_mutex_lock (&self->lock);
+  fold_exited_threads (self);
+  g_ptr_array_add (self->threads, thread_stats_ref (thread));
+  g_mutex_unlock (&self->lock);
+
+  return thread;
+}
+
+/* Creates counters that are all zero. Release with emtr_stats_unref(). */
+EmtrStats *
+emtr_stats_new (void)
+{
+  EmtrStats *self = g_new0 (EmtrStats, 1);
+
+  self->ref_count = 1;
+  self->id = g_atomic_int_add (&next_stats_id, 1);
+  g_mutex_init (&self->lock);
+  self->threads =
+    g_ptr_array_new_with_free_func ((GDestroyNotify) thread_stats_unref);
+  self->exited_event_counts = event_counts_table_new ();
+
+  for (gint kind = 0; kind < EMTR_NUM_LATENCY_KINDS; kind++)
+    self->latencies[kind] = emtr_latency_histogram_new ();
+
+  return self;
+}
+
+EmtrStats *
+emtr_stats_ref (EmtrStats *self)
+{
+  g_atomic_int_inc (&self->ref_count);
+  return self;
+}
+
+void
+emtr_stats_unref (EmtrStats *self)
+{
+  if (!g_atomic_int_dec_and_test (&self->ref_count))
+    return;
+
+  /* Threads drop their references to their counters lazily. */
+  for (guint i = 0; i < self->threads->len; i++)
+    {
+      ThreadStats *thread = g_ptr_array_index (self->threads, i);
+      g_atomic_int_set (&thread->closed, TRUE);
+    }
+  g_ptr_array_unref (self->threads);
+  g_hash_table_unref (self->exited_event_counts);
+  g_mutex_clear (&self->lock);
+
+  for (gint kind = 0; kind < EMTR_NUM_LATENCY_KINDS; kind++)
+    emtr_latency_histogram_unref (self->latencies[kind]);
+
+  g_free (self);
+}
+
+/*
+ * Adds @num_events to the count of @stat for @event_id, which must point to
+ * EMTR_EVENT_ID_LENGTH bytes. Safe to call from any thread.
+ */
+void
+emtr_stats_count_events (EmtrStats     *self,
+                         const guchar  *event_id,
+                         EmtrEventStat  stat,
+                         gsize          num_events)
+{
+  ThreadStats *thread = get_thread_stats (self);
+  EventCounts *counts = thread->last_counts;
+
+  if (counts == NULL ||
+      memcmp (counts->event_id, event_id, EMTR_EVENT_ID_LENGTH) != 0)
+    {
+      /* Only this thread adds to its table, so looking up needs no lock. */
+      counts = g_hash_table_lookup (thread->event_counts, event_id);
+
+      if (counts == NULL)
+        {
+          counts = event_counts_new (event_id);
+
+          g_mutex_lock (&thread->lock);
+          g_hash_table_insert (thread->event_counts, counts->event_id, counts);
+          g_mutex_unlock (&thread->lock);
+        }
+
+      thread->last_counts = counts;
+    }
+
+  counter_add (&counts->counts[stat], num_events);
+}
+
+/* Adds @num_bytes to the size of the records serialized to be sent. Safe to
+   call from any thread. */
+void
+emtr_stats_count_bytes (EmtrStats *self,
+                        gsize      num_bytes)
+{
+  ThreadStats *thread = get_thread_stats (self);
+
+  counter_add (&thread->bytes_serialized, num_bytes);
+}
+
+void
+emtr_stats_timer_started (EmtrStats *self)
+{
+  g_atomic_int_inc (&self->num_timers);
+}
+
+void
+emtr_stats_timer_stopped (EmtrStats *self)
+{
+  g_atomic_int_add (&self->num_timers, -1);
+}
+
+/* Returns the number of nanoseconds per tick of emtr_profile_read_ticks(), or
+   0 if profiling has not run long enough to tell. Called with the lock held. */
+static gdouble
+get_ns_per_tick (EmtrStats *self)
+{
+  if (self->calibration_ticks == 0)
+    return 0;
+
+  guint64 ticks = emtr_profile_read_ticks () - self->calibration_ticks;
+  gint64 time_us = g_get_monotonic_time () - self->calibration_time_us;
+
+  if (ticks == 0 || time_us <= 0)
+    return 0;
+
+  return time_us * 1000.0 / ticks;
+}
+
+/* Returns the number of times that each phase was timed and the nanoseconds
+   spent in it, as a floating variant of type a{s(tt)}. */
+static GVariant *
+phase_times_to_variant (const PhaseTimes *times,
+                        gdouble           ns_per_tick)
+{
+  GVariantBuilder builder;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(tt)}"));
+
+  for (gint phase = 0; phase < EMTR_NUM_PHASES; phase++)
+    {
+      if (times->calls[phase] == 0)
+        continue;
+
+      g_variant_builder_add (&builder, "{s(tt)}", phase_names[phase],
+                             times->calls[phase],
+                             (guint64) (times->ticks[phase] * ns_per_tick));
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
+/*
+ * Adds the counts of all threads to @builder, of type a{sv}: the total of each
+ * EmtrEventStat, the counts of each event ID, the number of bytes serialized,
+ * the number of aggregate timers running, and the time spent in each phase
+ * while profiling, in total and per event ID. Counts made concurrently may or
+ * may not be included.
+ */
+void
+emtr_stats_snapshot (EmtrStats       *self,
+                     GVariantBuilder *builder)
+{
+  GHashTable *event_counts = event_counts_table_new ();
+  gsize bytes_serialized;
+  PhaseTimes phase_times;
+  gdouble ns_per_tick;
+
+  g_mutex_lock (&self->lock);
+
+  fold_exited_threads (self);
+
+  add_event_counts (event_counts, self->exited_event_counts);
+  bytes_serialized = self->exited_bytes_serialized;
+  phase_times = self->exited_phase_times;
+  ns_per_tick = get_ns_per_tick (self);
+
+  for (guint i = 0; i < self->threads->len; i++)
+    {
+      ThreadStats *thread = g_ptr_array_index (self->threads, i);
+
+      g_mutex_lock (&thread->lock);
+      add_event_counts (event_counts, thread->event_counts);
+      add_phase_times (&phase_times, &thread->phase_times);
+      g_mutex_unlock (&thread->lock);
+      bytes_serialized += counter_get (&thread->bytes_serialized);
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  GVariantBuilder events_builder, phases_by_event_builder;
+  GHashTableIter iter;
+  EventCounts *counts;
+  guint64 totals[EMTR_NUM_EVENT_STATS] = { 0, };
+
+  g_variant_builder_init (&events_builder, G_VARIANT_TYPE ("a{sa{st}}"));
+  g_variant_builder_init (&phases_by_event_builder,
+                          G_VARIANT_TYPE ("a{sa{s(tt)}}"));
+
+  g_hash_table_iter_init (&iter, event_counts);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &counts))
+    {
+      gchar unparsed_event_id[37];
+
+      uuid_unparse_lower (counts->event_id, unparsed_event_id);
+      g_variant_builder_open (&events_builder, G_VARIANT_TYPE ("{sa{st}}"));
+      g_variant_builder_add (&events_builder, "s", unparsed_event_id);
+      g_variant_builder_open (&events_builder, G_VARIANT_TYPE ("a{st}"));
+
+      for (gint stat = 0; stat < EMTR_NUM_EVENT_STATS; stat++)
+        {
+          g_variant_builder_add (&events_builder, "{st}", stat_names[stat],
+                                 (guint64) counts->counts[stat]);
+          totals[stat] += counts->counts[stat];
+        }
+
+      g_variant_builder_close (&events_builder);
+      g_variant_builder_close (&events_builder);
+
+      if (counts->phase_times != NULL)
+        g_variant_builder_add (&phases_by_event_builder, "{s@a{s(tt)}}",
+                               unparsed_event_id,
+                               phase_times_to_variant (counts->phase_times,
+                                                       ns_per_tick));
+    }
+
+  g_hash_table_unref (event_counts);
+
+  for (gint stat = 0; stat < EMTR_NUM_EVENT_STATS; stat++)
+    g_variant_builder_add (builder, "{sv}", total_names[stat],
+                           g_variant_new_uint64 (totals[stat]));
+
+  g_variant_builder_add (builder, "{sv}", "events",
+                         g_variant_builder_end (&events_builder));
+  g_variant_builder_add (builder, "{sv}", "bytes-serialized",
+                         g_variant_new_uint64 (bytes_serialized));
+  g_variant_builder_add (builder, "{sv}", "aggregate-timers",
+                         g_variant_new_uint32 (MAX (g_atomic_int_get (&self->num_timers), 0)));
+  g_variant_builder_add (builder, "{sv}", "profiling",
+                         g_variant_new_boolean (emtr_stats_is_profiling (self)));
+  g_variant_builder_add (builder, "{sv}", "phases",
+                         phase_times_to_variant (&phase_times, ns_per_tick));
+  g_variant_builder_add (builder, "{sv}", "phases-by-event",
+                         g_variant_builder_end (&phases_by_event_builder));
+}
+
+/* Counts @latency_ns in the histogram for @kind. Safe to call from any
+   thread. */
+void
+emtr_stats_add_latency (EmtrStats       *self,
+                        EmtrLatencyKind  kind,
+                        gint64           latency_ns)
+{
+  emtr_latency_histogram_add (self->latencies[kind], latency_ns);
+}
+
+/* Returns a copy of the histogram for @kind. Free with
+   emtr_latency_histogram_unref(). */
+EmtrLatencyHistogram *
+emtr_stats_get_latency_histogram (EmtrStats       *self,
+                                  EmtrLatencyKind  kind)
+{
+  return emtr_latency_histogram_copy (self->latencies[kind]);
+}
+
+/* Empties the histograms of all kinds of latencies. */
+void
+emtr_stats_reset_latencies (EmtrStats *self)
+{
+  for (gint kind = 0; kind < EMTR_NUM_LATENCY_KINDS; kind++)
+    emtr_latency_histogram_reset (self->latencies[kind]);
+}
+
+/*
+ * Turns timing the phases of recording on or off. The times that were added up
+ * are kept when profiling is turned off, so that turning it on again carries
+ * on from there. Safe to call from any thread.
+ */
+void
+emtr_stats_set_profiling (EmtrStats *self,
+                          gboolean   profiling)
+{
+  if (profiling)
+    {
+      g_mutex_lock (&self->lock);
+      if (self->calibration_ticks == 0)
+        {
+          self->calibration_ticks = emtr_profile_read_ticks ();
+          self->calibration_time_us = g_get_monotonic_time ();
+        }
+      g_mutex_unlock (&self->lock);
+    }
+
+  g_atomic_int_set (&self->profiling, profiling);
+}
+
+gboolean
+emtr_stats_is_profiling (EmtrStats *self)
+{
+  return g_atomic_int_get (&self->profiling);
+}
+
+/* Starts timing the phases of @profile, if profiling is on. */
+void
+emtr_stats_profile_begin (EmtrStats   *self,
+                          EmtrProfile *profile)
+{
+  if (G_LIKELY (!g_atomic_int_get (&self->profiling)))
+    {
+      profile->last = 0;
+      return;
+    }
+
+  memset (profile->ticks, 0, sizeof (profile->ticks));
+  profile->phases = 0;
+  profile->last = emtr_profile_read_ticks ();
+}
+
+/*
+ * Adds the phases timed in @profile to the totals of the current thread, and
+ * to those of @event_id unless it is %NULL, for phases that several event IDs
+ * share. Does nothing if @profile was begun while profiling was off.
+ */
+void
+emtr_stats_profile_end (EmtrStats    *self,
+                        EmtrProfile  *profile,
+                        const guchar *event_id)
+{
+  if (G_LIKELY (profile->last == 0) || profile->phases == 0)
+    return;
+
+  ThreadStats *thread = get_thread_stats (self);
+  EventCounts *counts = NULL;
+
+  if (event_id != NULL)
+    {
+      /* Counting the event ID makes sure that it is in the table. */
+      emtr_stats_count_events (self, event_id, EMTR_EVENT_STAT_RECORDED, 0);
+      counts = thread->last_counts;
+    }
+
+  g_mutex_lock (&thread->lock);
+
+  add_profile (&thread->phase_times, profile);
+
+  if (counts != NULL)
+    {
+      if (counts->phase_times == NULL)
+        counts->phase_times = g_new0 (PhaseTimes, 1);
+      add_profile (counts->phase_times, profile);
+    }
+
+  g_mutex_unlock (&thread->lock);
+}
@@ -0,0 +1,117 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Static tracepoints, which perf, bpftrace or SystemTap can attach to as
+ * sdt:eosmetrics:<name>. They are compiled in when <sys/sdt.h> is available,
+ * and are a single no-op instruction each until a tracer attaches to them.
+ * Each tracepoint has a semaphore, which attached tracers increment, so that
+ * arguments that cost something to compute, such as the size of a payload,
+ * are only computed under EMTR_TRACE_ENABLED().
+ *
+ * Event IDs are passed as pointers to their 16 bytes, and are NULL for probes
+ * about batches, which hold events of many IDs.
+ *
+ * record__entry (const char *function, const guint8 *event_id, guint64 payload_size)
+ * record__return (const char *function, const guint8 *event_id)
+ *   around the work done by the emtr_event_recorder_record_*() functions,
+ *   once the event ID has been parsed.
+ * sequence__lock__wait (const guint8 *event_id)
+ * sequence__lock__acquired (const guint8 *event_id)
+ *   around taking the lock of an event sequence.
+ * dbus__send (const char *method, const guint8 *event_id, guint64 size)
+ * dbus__complete (const char *method, const guint8 *event_id, int success)
+ *   around a D-Bus call on the daemon carrying records; calls made without
+ *   asking for a reply never complete.
+ * timer__start (const guint8 *event_id, guint64 payload_size)
+ * timer__stop (const guint8 *event_id)
+ *   when an aggregate timer is started or stopped.
+ */
+
+#ifdef EMTR_ENABLE_TRACEPOINTS
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define EMTR_TRACE_SEMAPHORE(name) eosmetrics_##name##_semaphore
+
+#define EMTR_TRACE_ENABLED(name) G_UNLIKELY (EMTR_TRACE_SEMAPHORE (name) != 0)
+
+#define EMTR_TRACE(name, ...) STAP_PROBEV (eosmetrics, name, ##__VA_ARGS__)
+
+extern unsigned short EMTR_TRACE_SEMAPHORE (record__entry);
+extern unsigned short EMTR_TRACE_SEMAPHORE (record__return);
+extern unsigned short EMTR_TRACE_SEMAPHORE (sequence__lock__wait);
+extern unsigned short EMTR_TRACE_SEMAPHORE (sequence__lock__acquired);
+extern unsigned short EMTR_TRACE_SEMAPHORE (dbus__send);
+extern unsigned short EMTR_TRACE_SEMAPHORE (dbus__complete);
+extern unsigned short EMTR_TRACE_SEMAPHORE (timer__start);
+extern unsigned short EMTR_TRACE_SEMAPHORE (timer__stop);
+
+#else /* !EMTR_ENABLE_TRACEPOINTS */
+
+#define EMTR_TRACE_ENABLED(name) FALSE
+
+/* The arguments are still referenced, but never evaluated, so that values
+   computed only for tracepoints don't look unused. */
+#define EMTR_TRACE(name, ...) \
+  G_STMT_START { if (0) emtr_trace_discard (0, ##__VA_ARGS__); } G_STMT_END
+
+static inline void
+emtr_trace_discard (int unused,
+                    ...)
+{
+}
+
+#endif /* EMTR_ENABLE_TRACEPOINTS */
+
+/* The size of @payload for tracepoints, which is 0 if it is NULL. May
+   serialize @payload, so only call it under EMTR_TRACE_ENABLED(). */
+static inline guint64
+emtr_trace_payload_size (GVariant *payload)
+{
+  return payload != NULL ? g_variant_get_size (payload) : 0;
+}
+
+/*
+ * Marks in a sysprof capture, if the library was built with sysprof support
+ * and the process is being profiled. @begin_time is the time at which the
+ * marked span started, as returned by emtr_trace_begin_mark().
+ */
+gint64 emtr_trace_begin_mark (void);
+
+void   emtr_trace_end_mark   (gint64       begin_time,
+                              const gchar *name,
+                              const gchar *message_format,
+                              ...) G_GNUC_PRINTF (3, 4);
+
+G_END_DECLS
@@ -0,0 +1,83 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "emtr-trace-private.h"
+
+#ifdef HAVE_SYSPROF
+#include <sysprof-capture.h>
+#endif
+
+#include <glib.h>
+
+#ifdef EMTR_ENABLE_TRACEPOINTS
+
+/* Tracers find the semaphores through the notes of the tracepoints, so they
+   need not be exported. */
+#define EMTR_DEFINE_TRACE_SEMAPHORE(name) \
+  unsigned short EMTR_TRACE_SEMAPHORE (name) __attribute__ ((section (".probes")))
+
+EMTR_DEFINE_TRACE_SEMAPHORE (record__entry);
+EMTR_DEFINE_TRACE_SEMAPHORE (record__return);
+EMTR_DEFINE_TRACE_SEMAPHORE (sequence__lock__wait);
+EMTR_DEFINE_TRACE_SEMAPHORE (sequence__lock__acquired);
+EMTR_DEFINE_TRACE_SEMAPHORE (dbus__send);
+EMTR_DEFINE_TRACE_SEMAPHORE (dbus__complete);
+EMTR_DEFINE_TRACE_SEMAPHORE (timer__start);
+EMTR_DEFINE_TRACE_SEMAPHORE (timer__stop);
+
+#endif /* EMTR_ENABLE_TRACEPOINTS */
+
+gint64
+emtr_trace_begin_mark (void)
+{
+#ifdef HAVE_SYSPROF
+  if (sysprof_collector_is_active ())
+    return SYSPROF_CAPTURE_CURRENT_TIME;
+#endif
+
+  return 0;
+}
+
+/* Does nothing if @begin_time is 0, because no capture was running when the
+   span started. */
+void
+emtr_trace_end_mark (gint64       begin_time,
+                     const gchar *name,
+                     const gchar *message_format,
+                     ...)
+{
+#ifdef HAVE_SYSPROF
+  if (begin_time == 0 || !sysprof_collector_is_active ())
+    return;
+
+  va_list args;
+  gchar *message;
+
+  va_start (args, message_format);
+  message = g_strdup_vprintf (message_format, args);
+  va_end (args);
+
+  sysprof_collector_mark (begin_time, SYSPROF_CAPTURE_CURRENT_TIME - begin_time,
+                          "EosMetrics", name, message);
+  g_free (message);
+#endif
+}
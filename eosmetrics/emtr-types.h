@@ -30,5 +30,7 @@
 
 /* Shared typedefs for structures */
 typedef struct _EmtrAggregateTimer EmtrAggregateTimer;
+typedef struct _EmtrEventHandle EmtrEventHandle;
+typedef struct _EmtrLatencyHistogram EmtrLatencyHistogram;
 
 #endif /* EMTR_TYPES_H */
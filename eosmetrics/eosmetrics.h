@@ -28,8 +28,10 @@ G_BEGIN_DECLS
 
 /* Pull in other header files */
 #include "emtr-aggregate-timer.h"
+#include "emtr-event-handle.h"
 #include "emtr-event-recorder.h"
 #include "emtr-event-types.h"
+#include "emtr-latency-histogram.h"
 #include "emtr-types.h"
 #include "emtr-util.h"
 
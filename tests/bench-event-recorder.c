@@ -0,0 +1,1698 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Measures the throughput and latency of each public recording API, end to
+ * end, against a stand-in for the metrics daemon that runs in a thread of this
+ * process and only counts what it receives. A private dbus-daemon is started
+ * with GTestDBus and used as the system bus, so nothing leaves the process
+ * except through it.
+ *
+ * For each workload, reports as JSON on stdout:
+ *
+ * - the calls per second seen by the caller, and the events per second until
+ *   the stand-in daemon received all of them
+ * - the 50th and 99th percentiles and the maximum of the latency of each call
+ * - the allocations per call made by the calling thread, and those made by
+ *   the whole process except the stand-in daemon, where malloc() can be
+ *   interposed (glibc)
+ *
+ * With --threads, it instead runs each of a few workloads from every number
+ * of threads in the given list at once, on a single recorder, and reports
+ * how throughput, tail latency and the time spent waiting for the locks of
+ * event sequences scale with the number of threads. The same JSON is
+ * followed by a table on stderr.
+ *
+ * With --memory, it instead measures how much the heap, as told by
+ * mallinfo2(), and the resident set grow per event sequence that is started
+ * but not stopped, per progress event recorded in those, and per aggregate
+ * timer that is running, along with what is left once they are stopped.
+ *
+ * Run it with --help for the knobs. It is built, but not run by make check;
+ * compare the output of two versions before rolling one out.
+ */
+
+#include "eosmetrics/eosmetrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+#include <malloc.h>
+#define HAVE_MALLINFO2 1
+#endif
+
+#include <gio/gio.h>
+#include <glib.h>
+
+#define BENCH_EVENT "350ac4ff-3026-4c25-9e7e-e8103b4fd5d8"
+
+#define DAEMON_NAME "com.endlessm.Metrics"
+#define DAEMON_OBJECT_PATH "/com/endlessm/Metrics"
+#define TIMER_OBJECT_PATH_PREFIX "/com/endlessm/Metrics/AggregateTimer"
+
+/* How long to wait for the stand-in daemon to receive everything */
+#define DELIVERY_TIMEOUT_US (60 * G_USEC_PER_SEC)
+
+#define MAX_THREADS 1024
+
+/* The part of com.endlessm.Metrics.xml that the library uses. Methods that
+   are left out, such as GetDirectAddress and OpenEventRing, fail with
+   UnknownMethod, which the library falls back from. */
+static const gchar daemon_xml[] =
+  "<node>"
+  "  <interface name='com.endlessm.Metrics.EventRecorderServer'>"
+  "    <property name='Enabled' type='b' access='read'/>"
+  "    <method name='RecordSingularEvent'>"
+  "      <arg type='u'/><arg type='ay'/><arg type='x'/><arg type='b'/>"
+  "      <arg type='v'/>"
+  "    </method>"
+  "    <method name='RecordAggregateEvent'>"
+  "      <arg type='u'/><arg type='ay'/><arg type='x'/><arg type='x'/>"
+  "      <arg type='b'/><arg type='v'/>"
+  "    </method>"
+  "    <method name='RecordEventSequence'>"
+  "      <arg type='u'/><arg type='ay'/><arg type='a(xbv)'/>"
+  "    </method>"
+  "    <method name='RecordEvents'>"
+  "      <arg type='a(uayxbv)'/><arg type='a(uayxxbv)'/>"
+  "      <arg type='a(uaya(xbv))'/><arg type='a{sv}'/>"
+  "    </method>"
+  "    <method name='StartAggregateTimer'>"
+  "      <arg type='u'/><arg type='ay'/><arg type='b'/><arg type='v'/>"
+  "      <arg type='o' direction='out'/>"
+  "    </method>"
+  "  </interface>"
+  "  <interface name='com.endlessm.Metrics.AggregateTimer'>"
+  "    <method name='StopTimer'/>"
+  "  </interface>"
+  "</node>";
+
+/* Allocation counting */
+
+/* Set on the thread of the stand-in daemon, whose allocations don't count */
+static __thread gboolean ignore_allocations = FALSE;
+static __thread guint64 thread_allocations = 0;
+static gsize process_allocations = 0; /* (atomic) */
+
+#ifdef __GLIBC__
+#define HAVE_ALLOCATION_COUNTS 1
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t n_members, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static inline void
+count_allocation (void)
+{
+  if (ignore_allocations)
+    return;
+
+  thread_allocations++;
+  g_atomic_pointer_add (&process_allocations, 1);
+}
+
+/* These take the place of the allocator of libc for the whole process. */
+void *
+malloc (size_t size)
+{
+  count_allocation ();
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n_members,
+        size_t size)
+{
+  count_allocation ();
+  return __libc_calloc (n_members, size);
+}
+
+void *
+realloc (void   *ptr,
+         size_t  size)
+{
+  count_allocation ();
+  return __libc_realloc (ptr, size);
+}
+#else
+#define HAVE_ALLOCATION_COUNTS 0
+#endif /* __GLIBC__ */
+
+/* The stand-in daemon */
+
+typedef struct
+{
+  gchar *address; /* (owned) */
+
+  GThread *thread; /* (owned) */
+  GMainContext *context; /* (owned) */
+  GMainLoop *loop; /* (owned) */
+  GDBusConnection *connection; /* (owned) */
+  GDBusNodeInfo *node_info; /* (owned) */
+  guint object_id;
+  guint timers_id;
+
+  /* Set once the daemon owns its name, or failed to */
+  GMutex lock;
+  GCond ready_cond;
+  gboolean ready;
+  GError *error; /* (owned) (nullable) */
+
+  /* Counted on the daemon thread, read from the benchmark */
+  gsize records_received; /* (atomic) */
+  gsize timers_started; /* (atomic) */
+  gsize timers_stopped; /* (atomic) */
+  guint next_timer_id;
+} StandInDaemon;
+
+static void
+handle_daemon_method_call (GDBusConnection       *connection,
+                           const gchar           *sender,
+                           const gchar           *object_path,
+                           const gchar           *interface_name,
+                           const gchar           *method_name,
+                           GVariant              *parameters,
+                           GDBusMethodInvocation *invocation,
+                           gpointer               user_data)
+{
+  StandInDaemon *daemon = user_data;
+
+  if (g_str_equal (method_name, "RecordEvents"))
+    {
+      gsize num_records = 0;
+
+      for (gsize i = 0; i < 3; i++)
+        {
+          GVariant *records = g_variant_get_child_value (parameters, i);
+          num_records += g_variant_n_children (records);
+          g_variant_unref (records);
+        }
+
+      g_atomic_pointer_add (&daemon->records_received, num_records);
+      g_dbus_method_invocation_return_value (invocation, NULL);
+    }
+  else if (g_str_equal (method_name, "StartAggregateTimer"))
+    {
+      gchar *path = g_strdup_printf (TIMER_OBJECT_PATH_PREFIX "/%u",
+                                     daemon->next_timer_id++);
+
+      g_atomic_pointer_add (&daemon->timers_started, 1);
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_new ("(o)", path));
+      g_free (path);
+    }
+  else
+    {
+      /* One of the methods recording a single record */
+      g_atomic_pointer_add (&daemon->records_received, 1);
+      g_dbus_method_invocation_return_value (invocation, NULL);
+    }
+}
+
+static GVariant *
+handle_daemon_get_property (GDBusConnection *connection,
+                            const gchar     *sender,
+                            const gchar     *object_path,
+                            const gchar     *interface_name,
+                            const gchar     *property_name,
+                            GError         **error,
+                            gpointer         user_data)
+{
+  /* Enabled is the only property. */
+  return g_variant_new_boolean (TRUE);
+}
+
+static const GDBusInterfaceVTable daemon_vtable = {
+  handle_daemon_method_call,
+  handle_daemon_get_property,
+  NULL,
+};
+
+static void
+handle_timer_method_call (GDBusConnection       *connection,
+                          const gchar           *sender,
+                          const gchar           *object_path,
+                          const gchar           *interface_name,
+                          const gchar           *method_name,
+                          GVariant              *parameters,
+                          GDBusMethodInvocation *invocation,
+                          gpointer               user_data)
+{
+  StandInDaemon *daemon = user_data;
+
+  g_atomic_pointer_add (&daemon->timers_stopped, 1);
+  g_dbus_method_invocation_return_value (invocation, NULL);
+}
+
+static const GDBusInterfaceVTable timer_vtable = {
+  handle_timer_method_call,
+  NULL,
+  NULL,
+};
+
+/* Timers are served from a subtree, so that they need not be registered one
+   by one. */
+static gchar **
+enumerate_timers (GDBusConnection *connection,
+                  const gchar     *sender,
+                  const gchar     *object_path,
+                  gpointer         user_data)
+{
+  return g_new0 (gchar *, 1);
+}
+
+static GDBusInterfaceInfo **
+introspect_timer (GDBusConnection *connection,
+                  const gchar     *sender,
+                  const gchar     *object_path,
+                  const gchar     *node,
+                  gpointer         user_data)
+{
+  StandInDaemon *daemon = user_data;
+  GDBusInterfaceInfo **interfaces = g_new0 (GDBusInterfaceInfo *, 2);
+
+  if (node != NULL)
+    interfaces[0] = g_dbus_interface_info_ref (daemon->node_info->interfaces[1]);
+
+  return interfaces;
+}
+
+static const GDBusInterfaceVTable *
+dispatch_timer (GDBusConnection *connection,
+                const gchar     *sender,
+                const gchar     *object_path,
+                const gchar     *interface_name,
+                const gchar     *node,
+                gpointer        *out_user_data,
+                gpointer         user_data)
+{
+  *out_user_data = user_data;
+  return &timer_vtable;
+}
+
+static const GDBusSubtreeVTable timers_vtable = {
+  enumerate_timers,
+  introspect_timer,
+  dispatch_timer,
+};
+
+static gboolean
+start_daemon_on_thread (StandInDaemon  *daemon,
+                        GError        **error)
+{
+  daemon->connection =
+    g_dbus_connection_new_for_address_sync (daemon->address,
+                                            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                            G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                            NULL, NULL, error);
+  if (daemon->connection == NULL)
+    return FALSE;
+
+  daemon->object_id =
+    g_dbus_connection_register_object (daemon->connection, DAEMON_OBJECT_PATH,
+                                       daemon->node_info->interfaces[0],
+                                       &daemon_vtable, daemon, NULL, error);
+  if (daemon->object_id == 0)
+    return FALSE;
+
+  daemon->timers_id =
+    g_dbus_connection_register_subtree (daemon->connection,
+                                        TIMER_OBJECT_PATH_PREFIX,
+                                        &timers_vtable,
+                                        G_DBUS_SUBTREE_FLAGS_DISPATCH_TO_UNENUMERATED_NODES,
+                                        daemon, NULL, error);
+  if (daemon->timers_id == 0)
+    return FALSE;
+
+  GVariant *reply =
+    g_dbus_connection_call_sync (daemon->connection, "org.freedesktop.DBus",
+                                 "/org/freedesktop/DBus",
+                                 "org.freedesktop.DBus", "RequestName",
+                                 g_variant_new ("(su)", DAEMON_NAME,
+                                                0x4 /* DO_NOT_QUEUE */),
+                                 G_VARIANT_TYPE ("(u)"),
+                                 G_DBUS_CALL_FLAGS_NONE, -1, NULL, error);
+  if (reply == NULL)
+    return FALSE;
+
+  guint32 result;
+  g_variant_get (reply, "(u)", &result);
+  g_variant_unref (reply);
+
+  if (result != 1 /* PRIMARY_OWNER */)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_EXISTS,
+                   "Unable to own %s", DAEMON_NAME);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gpointer
+run_daemon (gpointer user_data)
+{
+  StandInDaemon *daemon = user_data;
+  GError *error = NULL;
+
+  ignore_allocations = TRUE;
+  g_main_context_push_thread_default (daemon->context);
+
+  gboolean started = start_daemon_on_thread (daemon, &error);
+
+  g_mutex_lock (&daemon->lock);
+  daemon->ready = TRUE;
+  daemon->error = error;
+  g_cond_signal (&daemon->ready_cond);
+  g_mutex_unlock (&daemon->lock);
+
+  if (started)
+    g_main_loop_run (daemon->loop);
+
+  if (daemon->connection != NULL)
+    {
+      if (daemon->timers_id != 0)
+        g_dbus_connection_unregister_subtree (daemon->connection,
+                                              daemon->timers_id);
+      if (daemon->object_id != 0)
+        g_dbus_connection_unregister_object (daemon->connection,
+                                             daemon->object_id);
+      g_dbus_connection_close_sync (daemon->connection, NULL, NULL);
+      g_clear_object (&daemon->connection);
+    }
+
+  g_main_context_pop_thread_default (daemon->context);
+  return NULL;
+}
+
+static void stand_in_daemon_free (StandInDaemon *daemon);
+
+/* Starts serving the metrics daemon's interface on the bus at @address */
+static StandInDaemon *
+stand_in_daemon_new (const gchar  *address,
+                     GError      **error)
+{
+  StandInDaemon *daemon = g_new0 (StandInDaemon, 1);
+
+  daemon->address = g_strdup (address);
+  daemon->node_info = g_dbus_node_info_new_for_xml (daemon_xml, NULL);
+  daemon->context = g_main_context_new ();
+  daemon->loop = g_main_loop_new (daemon->context, FALSE);
+  g_mutex_init (&daemon->lock);
+  g_cond_init (&daemon->ready_cond);
+
+  daemon->thread = g_thread_new ("stand-in daemon", run_daemon, daemon);
+
+  g_mutex_lock (&daemon->lock);
+  while (!daemon->ready)
+    g_cond_wait (&daemon->ready_cond, &daemon->lock);
+  g_mutex_unlock (&daemon->lock);
+
+  if (daemon->error != NULL)
+    {
+      g_propagate_error (error, daemon->error);
+      daemon->error = NULL;
+      stand_in_daemon_free (daemon);
+      return NULL;
+    }
+
+  return daemon;
+}
+
+static gboolean
+quit_daemon_cb (gpointer user_data)
+{
+  StandInDaemon *daemon = user_data;
+
+  g_main_loop_quit (daemon->loop);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+stand_in_daemon_free (StandInDaemon *daemon)
+{
+  g_main_context_invoke (daemon->context, quit_daemon_cb, daemon);
+  g_thread_join (daemon->thread);
+
+  g_main_loop_unref (daemon->loop);
+  g_main_context_unref (daemon->context);
+  g_dbus_node_info_unref (daemon->node_info);
+  g_mutex_clear (&daemon->lock);
+  g_cond_clear (&daemon->ready_cond);
+  g_free (daemon->address);
+  g_free (daemon);
+}
+
+/* Workloads */
+
+static gint opt_events = 100000;
+static gint opt_sync_events = 5000;
+static gint opt_payload_size = 0;
+static gint opt_keys = 1;
+static gchar **opt_workloads = NULL;
+static gchar *opt_threads = NULL;
+static gboolean opt_memory = FALSE;
+static gint opt_objects = 10000;
+static gint opt_progress_events = 10;
+
+static GOptionEntry entries[] = {
+  { "events", 'n', 0, G_OPTION_ARG_INT, &opt_events,
+    "Calls to make in each asynchronous workload (default: 100000)", "N" },
+  { "sync-events", 0, 0, G_OPTION_ARG_INT, &opt_sync_events,
+    "Calls to make in each synchronous and aggregate timer workload "
+    "(default: 5000)", "N" },
+  { "payload-size", 's', 0, G_OPTION_ARG_INT, &opt_payload_size,
+    "Bytes in the payload of each event, or 0 for none (default: 0)", "BYTES" },
+  { "keys", 'k', 0, G_OPTION_ARG_INT, &opt_keys,
+    "Distinct payloads and sequence keys, and sequences or timers open at "
+    "once (default: 1)", "N" },
+  { "workload", 'w', 0, G_OPTION_ARG_STRING_ARRAY, &opt_workloads,
+    "Only run this workload; may be repeated", "NAME" },
+  { "threads", 't', 0, G_OPTION_ARG_STRING, &opt_threads,
+    "Measure how the recorder scales to each number of threads in LIST, "
+    "such as 1,2,4,8,16,32,64", "LIST" },
+  { "memory", 0, 0, G_OPTION_ARG_NONE, &opt_memory,
+    "Measure the memory taken up by event sequences and aggregate timers",
+    NULL },
+  { "objects", 0, 0, G_OPTION_ARG_INT, &opt_objects,
+    "Sequences or timers to keep running with --memory (default: 10000)",
+    "N" },
+  { "progress-events", 0, 0, G_OPTION_ARG_INT, &opt_progress_events,
+    "Progress events to record in each sequence with --memory (default: 10)",
+    "M" },
+  { NULL }
+};
+
+typedef struct
+{
+  EmtrEventRecorder *recorder; /* (owned) */
+  EmtrEventHandle *handle; /* (owned) */
+
+  /* opt_keys payloads, or NULL if opt_payload_size is 0 */
+  GVariant **payloads; /* (owned) */
+
+  /* opt_keys sequence keys per thread */
+  GVariant **keys; /* (owned) */
+  guint num_keys;
+
+  /* Open aggregate timers, by key */
+  EmtrAggregateTimer **timers; /* (owned) */
+  guint64 timers_started;
+} Bench;
+
+typedef void (*CallFunc) (Bench  *bench,
+                          guint64 i);
+
+typedef struct
+{
+  const gchar *name;
+  CallFunc call;
+  gboolean is_synchronous;
+  /* Number of calls that make up a round for each key, after which no
+     sequence or timer is left open */
+  guint calls_per_round;
+} Workload;
+
+static inline GVariant *
+get_payload (Bench  *bench,
+             guint64 i)
+{
+  return bench->payloads != NULL ? bench->payloads[i % opt_keys] : NULL;
+}
+
+static void
+call_record_event (Bench  *bench,
+                   guint64 i)
+{
+  emtr_event_recorder_record_event (bench->recorder, BENCH_EVENT,
+                                    get_payload (bench, i));
+}
+
+static void
+call_record_event_sync (Bench  *bench,
+                        guint64 i)
+{
+  emtr_event_recorder_record_event_sync (bench->recorder, BENCH_EVENT,
+                                         get_payload (bench, i));
+}
+
+static void
+call_record_event_with_handle (Bench  *bench,
+                               guint64 i)
+{
+  emtr_event_recorder_record_event_with_handle (bench->recorder,
+                                                bench->handle,
+                                                get_payload (bench, i));
+}
+
+static void
+call_record_events (Bench  *bench,
+                    guint64 i)
+{
+  emtr_event_recorder_record_events (bench->recorder, BENCH_EVENT, 1,
+                                     get_payload (bench, i));
+}
+
+static void
+call_record_events_sync (Bench  *bench,
+                         guint64 i)
+{
+  emtr_event_recorder_record_events_sync (bench->recorder, BENCH_EVENT, 1,
+                                          get_payload (bench, i));
+}
+
+/* Starts opt_keys sequences, then records progress in each, then stops them,
+   over and over. */
+static void
+call_start_progress_stop (Bench  *bench,
+                          guint64 i)
+{
+  GVariant *key = bench->keys[i % opt_keys];
+  GVariant *payload = get_payload (bench, i);
+
+  switch ((i / opt_keys) % 3)
+    {
+    case 0:
+      emtr_event_recorder_record_start (bench->recorder, BENCH_EVENT, key,
+                                        payload);
+      break;
+
+    case 1:
+      emtr_event_recorder_record_progress (bench->recorder, BENCH_EVENT, key,
+                                           payload);
+      break;
+
+    default:
+      emtr_event_recorder_record_stop (bench->recorder, BENCH_EVENT, key,
+                                       payload);
+    }
+}
+
+static void
+call_start_stop_sync (Bench  *bench,
+                      guint64 i)
+{
+  GVariant *key = bench->keys[i % opt_keys];
+  GVariant *payload = get_payload (bench, i);
+
+  if ((i / opt_keys) % 2 == 0)
+    emtr_event_recorder_record_start (bench->recorder, BENCH_EVENT, key,
+                                      payload);
+  else
+    emtr_event_recorder_record_stop_sync (bench->recorder, BENCH_EVENT, key,
+                                          payload);
+}
+
+static void
+call_aggregate_timer (Bench  *bench,
+                      guint64 i)
+{
+  EmtrAggregateTimer **timer = &bench->timers[i % opt_keys];
+
+  if ((i / opt_keys) % 2 == 0)
+    {
+      *timer = emtr_event_recorder_start_aggregate_timer (bench->recorder,
+                                                          BENCH_EVENT,
+                                                          get_payload (bench, i));
+      bench->timers_started++;
+    }
+  else
+    {
+      emtr_aggregate_timer_stop (*timer);
+      g_clear_object (timer);
+    }
+}
+
+static const Workload workloads[] = {
+  { "record-event", call_record_event, FALSE, 1 },
+  { "record-event-sync", call_record_event_sync, TRUE, 1 },
+  { "record-event-with-handle", call_record_event_with_handle, FALSE, 1 },
+  { "record-events", call_record_events, FALSE, 1 },
+  { "record-events-sync", call_record_events_sync, TRUE, 1 },
+  { "start-progress-stop", call_start_progress_stop, FALSE, 3 },
+  { "start-stop-sync", call_start_stop_sync, TRUE, 2 },
+  { "aggregate-timer", call_aggregate_timer, TRUE, 2 },
+};
+
+/* Measurement */
+
+static inline gint64
+get_time_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (gint64) ts.tv_sec * G_GINT64_CONSTANT (1000000000) + ts.tv_nsec;
+}
+
+static gint
+compare_latencies (gconstpointer a,
+                   gconstpointer b)
+{
+  gint64 latency_a = *(const gint64 *) a;
+  gint64 latency_b = *(const gint64 *) b;
+
+  return (latency_a > latency_b) - (latency_a < latency_b);
+}
+
+static guint64
+lookup_stat (EmtrEventRecorder *recorder,
+             const gchar       *key)
+{
+  GVariant *stats = emtr_event_recorder_get_stats (recorder);
+  guint64 value = 0;
+
+  g_variant_lookup (stats, key, "t", &value);
+  g_variant_unref (stats);
+  return value;
+}
+
+/* Waits until *@counter reaches @target. Returns FALSE on timeout. */
+static gboolean
+wait_for_counter (gsize  *counter,
+                  guint64 target)
+{
+  gint64 deadline = g_get_monotonic_time () + DELIVERY_TIMEOUT_US;
+
+  while ((guint64) g_atomic_pointer_get (counter) < target)
+    {
+      if (g_get_monotonic_time () > deadline)
+        return FALSE;
+      g_usleep (100);
+    }
+
+  return TRUE;
+}
+
+static Bench *
+bench_new (guint num_threads)
+{
+  Bench *bench = g_new0 (Bench, 1);
+
+  bench->recorder = emtr_event_recorder_new ();
+  bench->handle = emtr_event_recorder_register_event (bench->recorder,
+                                                      BENCH_EVENT);
+  bench->num_keys = opt_keys * num_threads;
+  bench->keys = g_new0 (GVariant *, bench->num_keys);
+  bench->timers = g_new0 (EmtrAggregateTimer *, opt_keys);
+
+  for (guint k = 0; k < bench->num_keys; k++)
+    bench->keys[k] = g_variant_ref_sink (g_variant_new_uint32 (k));
+
+  if (opt_payload_size > 0)
+    {
+      guchar *bytes = g_malloc (opt_payload_size);
+
+      bench->payloads = g_new0 (GVariant *, opt_keys);
+      for (gint k = 0; k < opt_keys; k++)
+        {
+          memset (bytes, k, opt_payload_size);
+          GVariant *data =
+            g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, bytes,
+                                       opt_payload_size, sizeof (guchar));
+          bench->payloads[k] =
+            g_variant_ref_sink (g_variant_new ("(u@ay)", k, data));
+        }
+
+      g_free (bytes);
+    }
+
+  return bench;
+}
+
+static void
+bench_free (Bench *bench)
+{
+  for (guint k = 0; k < bench->num_keys; k++)
+    g_variant_unref (bench->keys[k]);
+
+  for (gint k = 0; k < opt_keys; k++)
+    {
+      if (bench->payloads != NULL)
+        g_variant_unref (bench->payloads[k]);
+      g_clear_object (&bench->timers[k]);
+    }
+
+  g_free (bench->keys);
+  g_free (bench->payloads);
+  g_free (bench->timers);
+  emtr_event_handle_unref (bench->handle);
+  g_object_unref (bench->recorder);
+  g_free (bench);
+}
+
+/* Stops the sequences and timers that the first @num_calls calls left open,
+   by continuing to the end of the round without starting any more, then
+   flushes the recorder and waits until the stand-in daemon received all that
+   was sent. Returns FALSE if it did not in time. */
+static gboolean
+finish_calls (const Workload *workload,
+              Bench          *bench,
+              StandInDaemon  *daemon,
+              guint64         num_calls,
+              guint64         records_received_before,
+              guint64         timers_stopped_before)
+{
+  guint64 calls_per_round = workload->calls_per_round * opt_keys;
+  guint64 round_end = (num_calls + calls_per_round - 1) / calls_per_round *
+    calls_per_round;
+
+  for (guint64 i = num_calls; i < round_end; i++)
+    if ((i / opt_keys) % workload->calls_per_round != 0)
+      workload->call (bench, i);
+
+  emtr_event_recorder_flush_sync (bench->recorder);
+
+  guint64 records_sent = lookup_stat (bench->recorder, "events-sent");
+
+  return wait_for_counter (&daemon->records_received,
+                           records_received_before + records_sent) &&
+    wait_for_counter (&daemon->timers_stopped,
+                      timers_stopped_before + bench->timers_started);
+}
+
+static void
+run_workload (const Workload *workload,
+              StandInDaemon  *daemon,
+              gboolean        is_first)
+{
+  guint64 num_calls = workload->is_synchronous ? opt_sync_events : opt_events;
+  gint64 *latencies = g_new (gint64, num_calls);
+  Bench *bench = bench_new (1);
+  guint64 records_received_at_start =
+    g_atomic_pointer_get (&daemon->records_received);
+  guint64 timers_stopped_at_start =
+    g_atomic_pointer_get (&daemon->timers_stopped);
+
+  /* Connect to the daemon and warm up before measuring. */
+  guint64 num_warmup_calls = MIN (num_calls, 1000);
+  for (guint64 i = 0; i < num_warmup_calls; i++)
+    workload->call (bench, i);
+  finish_calls (workload, bench, daemon, num_warmup_calls,
+                records_received_at_start, timers_stopped_at_start);
+
+  guint64 sent_before = lookup_stat (bench->recorder, "events-sent");
+  guint64 dropped_before = lookup_stat (bench->recorder, "events-dropped");
+  guint64 received_before = g_atomic_pointer_get (&daemon->records_received);
+  guint64 thread_allocations_before = thread_allocations;
+  guint64 process_allocations_before =
+    g_atomic_pointer_get (&process_allocations);
+
+  gint64 start_time = get_time_ns ();
+
+  for (guint64 i = 0; i < num_calls; i++)
+    {
+      gint64 call_start_time = get_time_ns ();
+      workload->call (bench, i);
+      latencies[i] = get_time_ns () - call_start_time;
+    }
+
+  gint64 calls_end_time = get_time_ns ();
+  guint64 num_allocations = thread_allocations - thread_allocations_before;
+
+  gboolean delivered = finish_calls (workload, bench, daemon, num_calls,
+                                     records_received_at_start,
+                                     timers_stopped_at_start);
+  guint64 records_sent =
+    lookup_stat (bench->recorder, "events-sent") - sent_before;
+
+  gint64 end_time = get_time_ns ();
+  guint64 num_process_allocations =
+    g_atomic_pointer_get (&process_allocations) - process_allocations_before;
+  guint64 records_received =
+    g_atomic_pointer_get (&daemon->records_received) - received_before;
+  guint64 records_dropped =
+    lookup_stat (bench->recorder, "events-dropped") - dropped_before;
+
+  qsort (latencies, num_calls, sizeof (gint64), compare_latencies);
+
+  gdouble call_seconds = (calls_end_time - start_time) / 1e9;
+  gdouble total_seconds = (end_time - start_time) / 1e9;
+
+  g_print ("%s    {\n", is_first ? "" : ",\n");
+  g_print ("      \"name\": \"%s\",\n", workload->name);
+  g_print ("      \"calls\": %" G_GUINT64_FORMAT ",\n", num_calls);
+  g_print ("      \"call_seconds\": %.6f,\n", call_seconds);
+  g_print ("      \"total_seconds\": %.6f,\n", total_seconds);
+  g_print ("      \"calls_per_second\": %.1f,\n", num_calls / call_seconds);
+  g_print ("      \"delivered_per_second\": %.1f,\n",
+           num_calls / total_seconds);
+  g_print ("      \"all_delivered\": %s,\n", delivered ? "true" : "false");
+  g_print ("      \"records_sent\": %" G_GUINT64_FORMAT ",\n", records_sent);
+  g_print ("      \"records_received\": %" G_GUINT64_FORMAT ",\n",
+           records_received);
+  g_print ("      \"records_dropped\": %" G_GUINT64_FORMAT ",\n",
+           records_dropped);
+  g_print ("      \"latency_ns\": { \"p50\": %" G_GINT64_FORMAT
+           ", \"p99\": %" G_GINT64_FORMAT ", \"max\": %" G_GINT64_FORMAT
+           " },\n", latencies[num_calls / 2],
+           latencies[MIN (num_calls - 1, num_calls * 99 / 100)],
+           latencies[num_calls - 1]);
+
+  if (HAVE_ALLOCATION_COUNTS)
+    g_print ("      \"allocations_per_call\": %.2f,\n"
+             "      \"process_allocations_per_call\": %.2f\n",
+             num_allocations / (gdouble) num_calls,
+             num_process_allocations / (gdouble) num_calls);
+  else
+    g_print ("      \"allocations_per_call\": null,\n"
+             "      \"process_allocations_per_call\": null\n");
+
+  g_print ("    }");
+
+  bench_free (bench);
+  g_free (latencies);
+}
+
+static gboolean
+workload_is_selected (const gchar *workload_name)
+{
+  if (opt_workloads == NULL)
+    return TRUE;
+
+  for (gchar **name = opt_workloads; *name != NULL; name++)
+    if (g_str_equal (*name, workload_name))
+      return TRUE;
+
+  return FALSE;
+}
+
+/* Thread scaling */
+
+typedef void (*ScalingCallFunc) (Bench  *bench,
+                                 guint   thread_index,
+                                 guint64 i);
+
+typedef void (*ScalingFinishFunc) (Bench  *bench,
+                                   guint   thread_index,
+                                   guint64 num_calls);
+
+typedef struct
+{
+  const gchar *name;
+  ScalingCallFunc call;
+  /* Stops the sequences that a thread left open, if any */
+  ScalingFinishFunc finish;
+  /* Whether the calls record progress in sequences that all threads share,
+     started before and stopped after them */
+  gboolean shares_sequences;
+} ScalingWorkload;
+
+typedef struct
+{
+  Bench *bench;
+  const ScalingWorkload *workload;
+  guint index;
+  guint64 num_calls;
+  gint *started; /* (atomic) */
+
+  /* Results */
+  gint64 *latencies; /* (array length=num_calls) */
+  gint64 end_time;
+  guint64 num_allocations;
+} Worker;
+
+/* Each thread starts, records progress in and stops sequences of its own
+   keys, opt_keys at a time. */
+static void
+record_sequence_step (Bench  *bench,
+                      guint   thread_index,
+                      guint64 n)
+{
+  GVariant *key = bench->keys[thread_index * opt_keys + n % opt_keys];
+  GVariant *payload = get_payload (bench, n);
+
+  switch ((n / opt_keys) % 3)
+    {
+    case 0:
+      emtr_event_recorder_record_start (bench->recorder, BENCH_EVENT, key,
+                                        payload);
+      break;
+
+    case 1:
+      emtr_event_recorder_record_progress (bench->recorder, BENCH_EVENT, key,
+                                           payload);
+      break;
+
+    default:
+      emtr_event_recorder_record_stop (bench->recorder, BENCH_EVENT, key,
+                                       payload);
+    }
+}
+
+static void
+finish_sequence_steps (Bench  *bench,
+                       guint   thread_index,
+                       guint64 num_steps)
+{
+  guint64 steps_per_round = 3 * opt_keys;
+  guint64 round_end = (num_steps + steps_per_round - 1) / steps_per_round *
+    steps_per_round;
+
+  for (guint64 n = num_steps; n < round_end; n++)
+    if ((n / opt_keys) % 3 != 0)
+      record_sequence_step (bench, thread_index, n);
+}
+
+static void
+scale_record_event (Bench  *bench,
+                    guint   thread_index,
+                    guint64 i)
+{
+  call_record_event (bench, i);
+}
+
+static void
+scale_record_events (Bench  *bench,
+                     guint   thread_index,
+                     guint64 i)
+{
+  call_record_events (bench, i);
+}
+
+static void
+scale_disjoint_sequences (Bench  *bench,
+                          guint   thread_index,
+                          guint64 i)
+{
+  record_sequence_step (bench, thread_index, i);
+}
+
+static void
+finish_disjoint_sequences (Bench  *bench,
+                           guint   thread_index,
+                           guint64 num_calls)
+{
+  finish_sequence_steps (bench, thread_index, num_calls);
+}
+
+/* All threads record progress in the sequences of the keys of the first
+   thread, so they all contend for the same locks. */
+static void
+scale_shared_sequences (Bench  *bench,
+                        guint   thread_index,
+                        guint64 i)
+{
+  emtr_event_recorder_record_progress (bench->recorder, BENCH_EVENT,
+                                       bench->keys[i % opt_keys],
+                                       get_payload (bench, i));
+}
+
+/* Out of every four calls, one records an event, one records several, and
+   two take a sequence of the thread's own keys a step further. */
+static void
+scale_mixed (Bench  *bench,
+             guint   thread_index,
+             guint64 i)
+{
+  switch (i % 4)
+    {
+    case 0:
+      call_record_event (bench, i);
+      break;
+
+    case 1:
+      call_record_events (bench, i);
+      break;
+
+    default:
+      record_sequence_step (bench, thread_index, i / 4 * 2 + i % 4 - 2);
+    }
+}
+
+static void
+finish_mixed (Bench  *bench,
+              guint   thread_index,
+              guint64 num_calls)
+{
+  guint64 num_steps = num_calls / 4 * 2 + MAX (num_calls % 4, 2) - 2;
+
+  finish_sequence_steps (bench, thread_index, num_steps);
+}
+
+static const ScalingWorkload scaling_workloads[] = {
+  { "record-event", scale_record_event, NULL, FALSE },
+  { "record-events", scale_record_events, NULL, FALSE },
+  { "sequences-disjoint-keys", scale_disjoint_sequences,
+    finish_disjoint_sequences, FALSE },
+  { "sequences-shared-keys", scale_shared_sequences, NULL, TRUE },
+  { "mixed", scale_mixed, finish_mixed, FALSE },
+};
+
+static gpointer
+run_worker (gpointer user_data)
+{
+  Worker *worker = user_data;
+
+  while (!g_atomic_int_get (worker->started))
+    g_thread_yield ();
+
+  guint64 allocations_before = thread_allocations;
+
+  for (guint64 i = 0; i < worker->num_calls; i++)
+    {
+      gint64 call_start_time = get_time_ns ();
+      worker->workload->call (worker->bench, worker->index, i);
+      worker->latencies[i] = get_time_ns () - call_start_time;
+    }
+
+  worker->end_time = get_time_ns ();
+  worker->num_allocations = thread_allocations - allocations_before;
+
+  if (worker->workload->finish != NULL)
+    worker->workload->finish (worker->bench, worker->index,
+                              worker->num_calls);
+
+  return NULL;
+}
+
+static void
+set_shared_sequences_started (Bench    *bench,
+                              gboolean  started)
+{
+  for (gint k = 0; k < opt_keys; k++)
+    {
+      if (started)
+        emtr_event_recorder_record_start (bench->recorder, BENCH_EVENT,
+                                          bench->keys[k], NULL);
+      else
+        emtr_event_recorder_record_stop (bench->recorder, BENCH_EVENT,
+                                         bench->keys[k], NULL);
+    }
+}
+
+static inline gint64
+get_percentile (const gint64 *sorted_values,
+                guint64       num_values,
+                guint         permille)
+{
+  return sorted_values[MIN (num_values - 1, num_values * permille / 1000)];
+}
+
+/* Runs @workload from @num_threads threads at once, each making an equal
+   share of opt_events calls. */
+static void
+run_scaling_point (const ScalingWorkload *workload,
+                   StandInDaemon         *daemon,
+                   guint                  num_threads,
+                   gboolean               is_first)
+{
+  guint64 calls_per_thread = MAX (1, opt_events / num_threads);
+  guint64 num_calls = calls_per_thread * num_threads;
+  gint64 *latencies = g_new (gint64, num_calls);
+  Worker *workers = g_new0 (Worker, num_threads);
+  GThread **threads = g_new0 (GThread *, num_threads);
+  Bench *bench = bench_new (num_threads);
+  gint started = 0;
+
+  guint64 records_received_at_start =
+    g_atomic_pointer_get (&daemon->records_received);
+
+  /* Connect to the daemon before measuring. */
+  for (guint64 i = 0; i < 100; i++)
+    call_record_event (bench, i);
+  emtr_event_recorder_flush_sync (bench->recorder);
+  wait_for_counter (&daemon->records_received,
+                    records_received_at_start +
+                    lookup_stat (bench->recorder, "events-sent"));
+
+  if (workload->shares_sequences)
+    set_shared_sequences_started (bench, TRUE);
+
+  for (guint t = 0; t < num_threads; t++)
+    {
+      Worker *worker = &workers[t];
+
+      worker->bench = bench;
+      worker->workload = workload;
+      worker->index = t;
+      worker->num_calls = calls_per_thread;
+      worker->started = &started;
+      worker->latencies = latencies + t * calls_per_thread;
+      threads[t] = g_thread_new ("producer", run_worker, worker);
+    }
+
+  guint64 dropped_before = lookup_stat (bench->recorder, "events-dropped");
+  guint64 contentions_before =
+    lookup_stat (bench->recorder, "sequence-lock-contentions");
+  guint64 lock_wait_before =
+    lookup_stat (bench->recorder, "sequence-lock-wait-ns");
+
+  gint64 start_time = get_time_ns ();
+  g_atomic_int_set (&started, 1);
+
+  gint64 calls_end_time = start_time;
+  guint64 num_allocations = 0;
+
+  for (guint t = 0; t < num_threads; t++)
+    {
+      g_thread_join (threads[t]);
+      calls_end_time = MAX (calls_end_time, workers[t].end_time);
+      num_allocations += workers[t].num_allocations;
+    }
+
+  guint64 num_contentions =
+    lookup_stat (bench->recorder, "sequence-lock-contentions") -
+    contentions_before;
+  guint64 lock_wait_time =
+    lookup_stat (bench->recorder, "sequence-lock-wait-ns") - lock_wait_before;
+
+  if (workload->shares_sequences)
+    set_shared_sequences_started (bench, FALSE);
+
+  emtr_event_recorder_flush_sync (bench->recorder);
+  gboolean delivered =
+    wait_for_counter (&daemon->records_received,
+                      records_received_at_start +
+                      lookup_stat (bench->recorder, "events-sent"));
+  gint64 end_time = get_time_ns ();
+  guint64 records_dropped =
+    lookup_stat (bench->recorder, "events-dropped") - dropped_before;
+
+  qsort (latencies, num_calls, sizeof (gint64), compare_latencies);
+
+  gdouble call_seconds = (calls_end_time - start_time) / 1e9;
+  gdouble total_seconds = (end_time - start_time) / 1e9;
+  gint64 p50 = get_percentile (latencies, num_calls, 500);
+  gint64 p99 = get_percentile (latencies, num_calls, 990);
+  gint64 p999 = get_percentile (latencies, num_calls, 999);
+  gint64 max = latencies[num_calls - 1];
+
+  g_print ("%s        {\n", is_first ? "" : ",\n");
+  g_print ("          \"threads\": %u,\n", num_threads);
+  g_print ("          \"calls\": %" G_GUINT64_FORMAT ",\n", num_calls);
+  g_print ("          \"calls_per_second\": %.1f,\n",
+           num_calls / call_seconds);
+  g_print ("          \"delivered_per_second\": %.1f,\n",
+           num_calls / total_seconds);
+  g_print ("          \"all_delivered\": %s,\n", delivered ? "true" : "false");
+  g_print ("          \"records_dropped\": %" G_GUINT64_FORMAT ",\n",
+           records_dropped);
+  g_print ("          \"latency_ns\": { \"p50\": %" G_GINT64_FORMAT
+           ", \"p99\": %" G_GINT64_FORMAT ", \"p999\": %" G_GINT64_FORMAT
+           ", \"max\": %" G_GINT64_FORMAT " },\n", p50, p99, p999, max);
+  g_print ("          \"lock_contentions\": %" G_GUINT64_FORMAT ",\n",
+           num_contentions);
+  g_print ("          \"lock_wait_ns_per_call\": %.2f,\n",
+           lock_wait_time / (gdouble) num_calls);
+
+  if (HAVE_ALLOCATION_COUNTS)
+    g_print ("          \"allocations_per_call\": %.2f\n",
+             num_allocations / (gdouble) num_calls);
+  else
+    g_print ("          \"allocations_per_call\": null\n");
+
+  g_print ("        }");
+
+  g_printerr ("%-24s %7u %12.0f %9" G_GINT64_FORMAT " %9" G_GINT64_FORMAT
+              " %10" G_GINT64_FORMAT " %11" G_GUINT64_FORMAT " %12.1f\n",
+              workload->name, num_threads, num_calls / call_seconds, p50, p99,
+              p999, num_contentions, lock_wait_time / (gdouble) num_calls);
+
+  bench_free (bench);
+  g_free (threads);
+  g_free (workers);
+  g_free (latencies);
+}
+
+/* Parses a comma-separated list of thread counts. */
+static GArray *
+parse_thread_counts (const gchar  *list,
+                     GError      **error)
+{
+  gchar **counts = g_strsplit (list, ",", -1);
+  GArray *thread_counts = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  for (gchar **count = counts; *count != NULL; count++)
+    {
+      gchar *end;
+      guint64 num_threads = g_ascii_strtoull (*count, &end, 10);
+
+      if (end == *count || *end != '\0' || num_threads == 0 ||
+          num_threads > MAX_THREADS)
+        {
+          g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                       "Thread counts must be between 1 and %d, not \"%s\"",
+                       MAX_THREADS, *count);
+          g_array_unref (thread_counts);
+          g_strfreev (counts);
+          return NULL;
+        }
+
+      guint value = num_threads;
+      g_array_append_val (thread_counts, value);
+    }
+
+  g_strfreev (counts);
+  return thread_counts;
+}
+
+static void
+run_scaling_workloads (StandInDaemon *daemon,
+                       GArray        *thread_counts)
+{
+  gboolean is_first_workload = TRUE;
+
+  g_print ("  \"scaling\": [\n");
+  g_printerr ("%-24s %7s %12s %9s %9s %10s %11s %12s\n", "workload",
+              "threads", "calls/s", "p50 ns", "p99 ns", "p99.9 ns",
+              "contentions", "wait ns/call");
+
+  for (gsize i = 0; i < G_N_ELEMENTS (scaling_workloads); i++)
+    {
+      const ScalingWorkload *workload = &scaling_workloads[i];
+
+      if (!workload_is_selected (workload->name))
+        continue;
+
+      g_print ("%s    {\n", is_first_workload ? "" : ",\n");
+      g_print ("      \"name\": \"%s\",\n", workload->name);
+      g_print ("      \"points\": [\n");
+
+      for (guint t = 0; t < thread_counts->len; t++)
+        run_scaling_point (workload, daemon,
+                           g_array_index (thread_counts, guint, t), t == 0);
+
+      g_print ("\n      ]\n    }");
+      is_first_workload = FALSE;
+    }
+
+  g_print ("\n  ]\n");
+}
+
+/* Memory footprint */
+
+/* How long the heap must stay the same size for the timers to be considered
+   set up, and how long to wait for that at most */
+#define SETTLE_INTERVAL_US (100 * 1000)
+#define SETTLE_TIMEOUT_US (30 * G_USEC_PER_SEC)
+
+/* Returns the bytes of heap in use, or -1 if they cannot be told. */
+static gint64
+get_heap_size (void)
+{
+#ifdef HAVE_MALLINFO2
+  struct mallinfo2 info = mallinfo2 ();
+
+  return info.uordblks + info.hblkhd;
+#else
+  return -1;
+#endif
+}
+
+/* Returns the resident set size of the process in bytes, or -1 if it cannot
+   be told. */
+static gint64
+get_rss (void)
+{
+  gchar *contents = NULL;
+  gint64 rss = -1;
+
+  if (g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+    {
+      gchar **fields = g_strsplit (contents, " ", -1);
+
+      if (g_strv_length (fields) >= 2)
+        rss = g_ascii_strtoll (fields[1], NULL, 10) * sysconf (_SC_PAGESIZE);
+
+      g_strfreev (fields);
+      g_free (contents);
+    }
+
+  return rss;
+}
+
+typedef struct
+{
+  gint64 heap;
+  gint64 rss;
+} Footprint;
+
+static void
+get_footprint (Footprint *footprint)
+{
+  footprint->heap = get_heap_size ();
+  footprint->rss = get_rss ();
+}
+
+static void
+print_bytes_per_object (const gchar     *name,
+                        const Footprint *before,
+                        const Footprint *after,
+                        guint64          num_objects,
+                        gint64           estimated_bytes,
+                        gboolean         is_last)
+{
+  g_print ("      \"%s\": { ", name);
+
+  if (before->heap >= 0 && after->heap >= 0)
+    g_print ("\"heap\": %.1f, ",
+             (after->heap - before->heap) / (gdouble) num_objects);
+  else
+    g_print ("\"heap\": null, ");
+
+  if (before->rss >= 0 && after->rss >= 0)
+    g_print ("\"rss\": %.1f",
+             (after->rss - before->rss) / (gdouble) num_objects);
+  else
+    g_print ("\"rss\": null");
+
+  if (estimated_bytes >= 0)
+    g_print (", \"estimated\": %.1f", estimated_bytes / (gdouble) num_objects);
+
+  g_print (" }%s\n", is_last ? "" : ",");
+}
+
+/* Waits until the heap stops growing, for work done on other threads to
+   finish. */
+static void
+wait_for_heap_to_settle (void)
+{
+  gint64 deadline = g_get_monotonic_time () + SETTLE_TIMEOUT_US;
+  gint64 heap_size = get_heap_size ();
+
+  while (g_get_monotonic_time () < deadline)
+    {
+      g_usleep (SETTLE_INTERVAL_US);
+
+      gint64 new_heap_size = get_heap_size ();
+      if (new_heap_size == heap_size)
+        return;
+      heap_size = new_heap_size;
+    }
+}
+
+static GVariant **
+new_keys (guint64 num_keys)
+{
+  GVariant **keys = g_new (GVariant *, num_keys);
+
+  for (guint64 k = 0; k < num_keys; k++)
+    keys[k] = g_variant_ref_sink (g_variant_new_uint32 (k));
+
+  return keys;
+}
+
+static void
+free_keys (GVariant **keys,
+           guint64    num_keys)
+{
+  for (guint64 k = 0; k < num_keys; k++)
+    g_variant_unref (keys[k]);
+  g_free (keys);
+}
+
+/* Connects @bench to the stand-in daemon and waits until it has received
+   everything, so that what is measured next is not mixed up with it. */
+static void
+connect_bench (Bench         *bench,
+               StandInDaemon *daemon)
+{
+  guint64 records_received_at_start =
+    g_atomic_pointer_get (&daemon->records_received);
+
+  for (guint64 i = 0; i < 100; i++)
+    call_record_event (bench, i);
+
+  emtr_event_recorder_flush_sync (bench->recorder);
+  wait_for_counter (&daemon->records_received,
+                    records_received_at_start +
+                    lookup_stat (bench->recorder, "events-sent"));
+}
+
+/* Starts opt_objects sequences, then records opt_progress_events progress
+   events in each. */
+static void
+measure_sequences (StandInDaemon *daemon,
+                   gboolean       is_first)
+{
+  Bench *bench = bench_new (1);
+  GVariant **keys = new_keys (opt_objects);
+  Footprint at_start, started, progressed, stopped;
+
+  connect_bench (bench, daemon);
+  guint64 records_received_at_start =
+    g_atomic_pointer_get (&daemon->records_received);
+  guint64 sent_at_start = lookup_stat (bench->recorder, "events-sent");
+
+  get_footprint (&at_start);
+
+  for (gint i = 0; i < opt_objects; i++)
+    emtr_event_recorder_record_start (bench->recorder, BENCH_EVENT, keys[i],
+                                      get_payload (bench, i));
+
+  get_footprint (&started);
+  guint64 started_estimate = lookup_stat (bench->recorder, "sequences-memory");
+
+  for (gint j = 0; j < opt_progress_events; j++)
+    for (gint i = 0; i < opt_objects; i++)
+      emtr_event_recorder_record_progress (bench->recorder, BENCH_EVENT,
+                                           keys[i], get_payload (bench, i));
+
+  get_footprint (&progressed);
+  guint64 progressed_estimate =
+    lookup_stat (bench->recorder, "sequences-memory");
+
+  for (gint i = 0; i < opt_objects; i++)
+    emtr_event_recorder_record_stop (bench->recorder, BENCH_EVENT, keys[i],
+                                     NULL);
+
+  emtr_event_recorder_flush_sync (bench->recorder);
+  gboolean delivered =
+    wait_for_counter (&daemon->records_received,
+                      records_received_at_start +
+                      lookup_stat (bench->recorder, "events-sent") -
+                      sent_at_start);
+  get_footprint (&stopped);
+
+  g_print ("%s    {\n", is_first ? "" : ",\n");
+  g_print ("      \"name\": \"sequences\",\n");
+  g_print ("      \"sequences\": %d,\n", opt_objects);
+  g_print ("      \"progress_events\": %d,\n", opt_progress_events);
+  g_print ("      \"all_delivered\": %s,\n", delivered ? "true" : "false");
+  print_bytes_per_object ("bytes_per_sequence", &at_start, &started,
+                          opt_objects, started_estimate, FALSE);
+  if (opt_progress_events > 0)
+    print_bytes_per_object ("bytes_per_progress_event", &started,
+                            &progressed,
+                            (guint64) opt_objects * opt_progress_events,
+                            progressed_estimate - started_estimate, FALSE);
+  print_bytes_per_object ("bytes_retained_per_sequence", &at_start,
+                          &stopped, opt_objects, -1, TRUE);
+  g_print ("    }");
+
+  free_keys (keys, opt_objects);
+  bench_free (bench);
+}
+
+/* Starts opt_objects aggregate timers, then stops them. */
+static void
+measure_aggregate_timers (StandInDaemon *daemon,
+                          gboolean       is_first)
+{
+  Bench *bench = bench_new (1);
+  EmtrAggregateTimer **timers = g_new0 (EmtrAggregateTimer *, opt_objects);
+  Footprint at_start, started, stopped;
+
+  connect_bench (bench, daemon);
+  guint64 timers_started_at_start =
+    g_atomic_pointer_get (&daemon->timers_started);
+  guint64 timers_stopped_at_start =
+    g_atomic_pointer_get (&daemon->timers_stopped);
+
+  get_footprint (&at_start);
+
+  for (gint i = 0; i < opt_objects; i++)
+    timers[i] = emtr_event_recorder_start_aggregate_timer (bench->recorder,
+                                                           BENCH_EVENT,
+                                                           get_payload (bench, i));
+
+  /* The D-Bus proxy of each timer is created once the daemon has replied. */
+  gboolean delivered =
+    wait_for_counter (&daemon->timers_started,
+                      timers_started_at_start + opt_objects);
+  wait_for_heap_to_settle ();
+  get_footprint (&started);
+
+  for (gint i = 0; i < opt_objects; i++)
+    {
+      emtr_aggregate_timer_stop (timers[i]);
+      g_clear_object (&timers[i]);
+    }
+
+  delivered = wait_for_counter (&daemon->timers_stopped,
+                                timers_stopped_at_start + opt_objects) &&
+    delivered;
+  wait_for_heap_to_settle ();
+  get_footprint (&stopped);
+
+  g_print ("%s    {\n", is_first ? "" : ",\n");
+  g_print ("      \"name\": \"aggregate-timers\",\n");
+  g_print ("      \"timers\": %d,\n", opt_objects);
+  g_print ("      \"all_delivered\": %s,\n", delivered ? "true" : "false");
+  print_bytes_per_object ("bytes_per_timer", &at_start, &started,
+                          opt_objects, -1, FALSE);
+  print_bytes_per_object ("bytes_retained_per_timer", &at_start, &stopped,
+                          opt_objects, -1, TRUE);
+  g_print ("    }");
+
+  g_free (timers);
+  bench_free (bench);
+}
+
+static void
+run_memory_workloads (StandInDaemon *daemon)
+{
+  gboolean is_first = TRUE;
+
+  g_print ("  \"memory\": [\n");
+
+  if (workload_is_selected ("sequences"))
+    {
+      measure_sequences (daemon, is_first);
+      is_first = FALSE;
+    }
+
+  if (workload_is_selected ("aggregate-timers"))
+    measure_aggregate_timers (daemon, is_first);
+
+  g_print ("\n  ]\n");
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  /* Make GLib allocate with malloc(), so that allocations are counted, and
+     keep the spool of events that could not be sent away from the user's. */
+  g_setenv ("G_SLICE", "always-malloc", TRUE);
+  g_unsetenv ("EOS_DISABLE_METRICS");
+
+  gchar *cache_directory = g_dir_make_tmp ("bench-event-recorder-XXXXXX",
+                                           NULL);
+  if (cache_directory != NULL)
+    g_setenv ("XDG_CACHE_HOME", cache_directory, TRUE);
+
+  GOptionContext *context =
+    g_option_context_new ("- measure the cost of recording events");
+  GError *error = NULL;
+
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+  g_option_context_free (context);
+
+  if (opt_events <= 0 || opt_sync_events <= 0 || opt_payload_size < 0 ||
+      opt_keys <= 0 || opt_objects <= 0 || opt_progress_events < 0)
+    {
+      g_printerr ("Counts must be positive.\n");
+      return EXIT_FAILURE;
+    }
+
+  GArray *thread_counts = NULL;
+  if (opt_threads != NULL)
+    {
+      thread_counts = parse_thread_counts (opt_threads, &error);
+      if (thread_counts == NULL)
+        {
+          g_printerr ("%s\n", error->message);
+          return EXIT_FAILURE;
+        }
+    }
+
+  GTestDBus *bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+  g_test_dbus_up (bus);
+  g_setenv ("DBUS_SYSTEM_BUS_ADDRESS", g_test_dbus_get_bus_address (bus),
+            TRUE);
+
+  StandInDaemon *daemon =
+    stand_in_daemon_new (g_test_dbus_get_bus_address (bus), &error);
+  if (daemon == NULL)
+    {
+      g_printerr ("Unable to start the stand-in daemon: %s\n",
+                  error->message);
+      return EXIT_FAILURE;
+    }
+
+  g_print ("{\n");
+  g_print ("  \"library_version\": \"%d.%d.%d\",\n", EMTR_MAJOR_VERSION,
+           EMTR_MINOR_VERSION, EMTR_MICRO_VERSION);
+  g_print ("  \"payload_size\": %d,\n", opt_payload_size);
+  g_print ("  \"keys\": %d,\n", opt_keys);
+
+  if (opt_memory)
+    {
+      run_memory_workloads (daemon);
+    }
+  else if (thread_counts != NULL)
+    {
+      run_scaling_workloads (daemon, thread_counts);
+    }
+  else
+    {
+      gboolean is_first = TRUE;
+
+      g_print ("  \"workloads\": [\n");
+
+      for (gsize i = 0; i < G_N_ELEMENTS (workloads); i++)
+        {
+          if (!workload_is_selected (workloads[i].name))
+            continue;
+
+          run_workload (&workloads[i], daemon, is_first);
+          is_first = FALSE;
+        }
+
+      g_print ("\n  ]\n");
+    }
+
+  g_print ("}\n");
+
+  stand_in_daemon_free (daemon);
+  g_test_dbus_down (bus);
+  g_object_unref (bus);
+
+  if (cache_directory != NULL)
+    {
+      gchar *spool_directory =
+        g_build_filename (cache_directory, "eosmetrics", "spool", NULL);
+      gchar *eosmetrics_directory =
+        g_build_filename (cache_directory, "eosmetrics", NULL);
+
+      g_rmdir (spool_directory);
+      g_rmdir (eosmetrics_directory);
+      g_rmdir (cache_directory);
+      g_free (eosmetrics_directory);
+      g_free (spool_directory);
+      g_free (cache_directory);
+    }
+
+  g_clear_pointer (&thread_counts, g_array_unref);
+  g_strfreev (opt_workloads);
+  g_free (opt_threads);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,563 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Measures the time taken by the building blocks of the recording functions,
+ * one at a time, with no daemon involved.
+ *
+ * Each benchmark is first run for a number of warm-up batches, sized so that a
+ * batch takes at least --batch-ms, and then for --repetitions batches of the
+ * same size. The minimum, median, mean, standard deviation and maximum of the
+ * time per operation over the repetitions are printed as a table, or as JSON
+ * with --json.
+ *
+ * --save-baseline FILE stores the median of each benchmark in a key file.
+ * --check FILE compares the medians against those stored in FILE and exits
+ * with a failure status if any of them got slower by more than --threshold
+ * percent, so that a release can be checked against the previous one on the
+ * same machine. It is built, but not run by make check, since the results
+ * depend on the machine.
+ */
+
+#include "eosmetrics/eosmetrics.h"
+#include "eosmetrics/emtr-event-recorder-private.h"
+#include "eosmetrics/emtr-event-sender-private.h"
+#include "eosmetrics/emtr-sequence-table-private.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <glib.h>
+#include <uuid/uuid.h>
+
+#define BENCH_EVENT "350ac4ff-3026-4c25-9e7e-e8103b4fd5d8"
+
+/* The number of sequences in the table of the sequence-table-lookup
+   benchmark, which looks up each of them in turn */
+#define NUM_SEQUENCES 1024
+
+/* Events appended to a sequence before it is emptied again */
+#define MAX_SEQUENCE_LENGTH 64
+
+#define BASELINE_KEY "median-ns"
+
+static gint opt_repetitions = 20;
+static gint opt_warmup = 3;
+static gint opt_batch_ms = 10;
+static gdouble opt_threshold = 10.0;
+static gchar **opt_benchmarks = NULL;
+static gchar *opt_save_baseline = NULL;
+static gchar *opt_check = NULL;
+static gboolean opt_json = FALSE;
+
+static GOptionEntry entries[] = {
+  { "repetitions", 'r', 0, G_OPTION_ARG_INT, &opt_repetitions,
+    "Measured batches of each benchmark (default: 20)", "N" },
+  { "warmup", 0, 0, G_OPTION_ARG_INT, &opt_warmup,
+    "Batches to run before measuring (default: 3)", "N" },
+  { "batch-ms", 0, 0, G_OPTION_ARG_INT, &opt_batch_ms,
+    "Minimum duration of a batch (default: 10)", "MILLISECONDS" },
+  { "benchmark", 'b', 0, G_OPTION_ARG_STRING_ARRAY, &opt_benchmarks,
+    "Only run this benchmark; may be repeated", "NAME" },
+  { "json", 0, 0, G_OPTION_ARG_NONE, &opt_json,
+    "Print the results as JSON", NULL },
+  { "save-baseline", 0, 0, G_OPTION_ARG_FILENAME, &opt_save_baseline,
+    "Store the results as the baseline in FILE", "FILE" },
+  { "check", 0, 0, G_OPTION_ARG_FILENAME, &opt_check,
+    "Fail if a result is slower than the baseline in FILE", "FILE" },
+  { "threshold", 't', 0, G_OPTION_ARG_DOUBLE, &opt_threshold,
+    "Percentage by which a result may exceed the baseline (default: 10)",
+    "PERCENT" },
+  { NULL }
+};
+
+/* What the benchmarks work on, built once */
+typedef struct
+{
+  uuid_t event_id;
+  GVariant *payload; /* (owned) */
+  GVariant *integer_key; /* (owned) */
+  GVariant *string_key; /* (owned) */
+  GVariant *variant_key; /* (owned) */
+
+  EmtrSequenceTable *sequences; /* (owned) */
+  EmtrSequenceKey sequence_keys[NUM_SEQUENCES];
+  GVariant *sequence_key_variants[NUM_SEQUENCES]; /* (owned) */
+
+  GArray *event_sequence; /* (owned) */
+} Fixture;
+
+typedef void (*RunFunc) (Fixture *fixture,
+                         guint64  iterations);
+
+typedef struct
+{
+  const gchar *name;
+  RunFunc run;
+} Benchmark;
+
+static void
+run_parse_event_id (Fixture *fixture,
+                    guint64  iterations)
+{
+  uuid_t parsed_event_id;
+
+  for (guint64 i = 0; i < iterations; i++)
+    emtr_event_recorder_parse_event_id (BENCH_EVENT, parsed_event_id);
+}
+
+static void
+run_get_uuid_builder (Fixture *fixture,
+                      guint64  iterations)
+{
+  GVariantBuilder builder;
+
+  for (guint64 i = 0; i < iterations; i++)
+    {
+      emtr_event_recorder_get_uuid_builder (fixture->event_id, &builder);
+      g_variant_unref (g_variant_ref_sink (g_variant_builder_end (&builder)));
+    }
+}
+
+static void
+run_contains_maybe_variant (Fixture *fixture,
+                            guint64  iterations)
+{
+  for (guint64 i = 0; i < iterations; i++)
+    emtr_event_recorder_contains_maybe_variant (fixture->payload);
+}
+
+static inline void
+run_sequence_key (Fixture  *fixture,
+                  GVariant *variant,
+                  guint64   iterations)
+{
+  EmtrSequenceKey key;
+
+  for (guint64 i = 0; i < iterations; i++)
+    {
+      emtr_sequence_key_init (&key, fixture->event_id, variant);
+      emtr_sequence_key_clear (&key);
+    }
+}
+
+static void
+run_sequence_key_none (Fixture *fixture,
+                       guint64  iterations)
+{
+  run_sequence_key (fixture, NULL, iterations);
+}
+
+static void
+run_sequence_key_integer (Fixture *fixture,
+                          guint64  iterations)
+{
+  run_sequence_key (fixture, fixture->integer_key, iterations);
+}
+
+static void
+run_sequence_key_string (Fixture *fixture,
+                         guint64  iterations)
+{
+  run_sequence_key (fixture, fixture->string_key, iterations);
+}
+
+static void
+run_sequence_key_variant (Fixture *fixture,
+                          guint64  iterations)
+{
+  run_sequence_key (fixture, fixture->variant_key, iterations);
+}
+
+static void
+run_sequence_table_lookup (Fixture *fixture,
+                           guint64  iterations)
+{
+  for (guint64 i = 0; i < iterations; i++)
+    {
+      const EmtrSequenceKey *key = &fixture->sequence_keys[i % NUM_SEQUENCES];
+
+      emtr_sequence_table_lock (fixture->sequences, key);
+      emtr_sequence_table_lookup (fixture->sequences, key);
+      emtr_sequence_table_unlock (fixture->sequences, key);
+    }
+}
+
+static void
+run_append_event_to_sequence (Fixture *fixture,
+                              guint64  iterations)
+{
+  for (guint64 i = 0; i < iterations; i++)
+    {
+      if (fixture->event_sequence->len == MAX_SEQUENCE_LENGTH)
+        g_array_set_size (fixture->event_sequence, 0);
+
+      emtr_event_recorder_append_event_to_sequence (fixture->event_sequence, i,
+                                                    fixture->payload);
+    }
+}
+
+static void
+run_get_current_time (Fixture *fixture,
+                      guint64  iterations)
+{
+  gint64 current_time;
+
+  for (guint64 i = 0; i < iterations; i++)
+    emtr_util_get_current_time (CLOCK_BOOTTIME, &current_time);
+}
+
+static const Benchmark benchmarks[] = {
+  { "parse-event-id", run_parse_event_id },
+  { "get-uuid-builder", run_get_uuid_builder },
+  { "contains-maybe-variant", run_contains_maybe_variant },
+  { "sequence-key-none", run_sequence_key_none },
+  { "sequence-key-integer", run_sequence_key_integer },
+  { "sequence-key-string", run_sequence_key_string },
+  { "sequence-key-variant", run_sequence_key_variant },
+  { "sequence-table-lookup", run_sequence_table_lookup },
+  { "append-event-to-sequence", run_append_event_to_sequence },
+  { "get-current-time", run_get_current_time },
+};
+
+static Fixture *
+fixture_new (void)
+{
+  Fixture *fixture = g_new0 (Fixture, 1);
+
+  uuid_parse (BENCH_EVENT, fixture->event_id);
+
+  /* A payload of the shape that applications commonly record */
+  fixture->payload =
+    g_variant_ref_sink (g_variant_new_parsed ("('org.example.App', "
+                                              "{'duration': <@u 42>, "
+                                              "'reason': <'user'>})"));
+  fixture->integer_key = g_variant_ref_sink (g_variant_new_uint32 (42));
+  fixture->string_key =
+    g_variant_ref_sink (g_variant_new_string ("org.example.App"));
+  fixture->variant_key =
+    g_variant_ref_sink (g_variant_new ("(su)", "org.example.App", 42));
+
+  fixture->sequences = emtr_sequence_table_new ();
+  for (gsize i = 0; i < NUM_SEQUENCES; i++)
+    {
+      EmtrSequenceKey *key = &fixture->sequence_keys[i];
+
+      fixture->sequence_key_variants[i] =
+        g_variant_ref_sink (g_variant_new_uint32 (i));
+      emtr_sequence_key_init (key, fixture->event_id,
+                              fixture->sequence_key_variants[i]);
+
+      emtr_sequence_table_lock (fixture->sequences, key);
+      emtr_sequence_table_insert (fixture->sequences, key,
+                                  emtr_event_recorder_new_event_sequence ());
+      emtr_sequence_table_unlock (fixture->sequences, key);
+    }
+
+  fixture->event_sequence = emtr_event_recorder_new_event_sequence ();
+
+  return fixture;
+}
+
+static void
+fixture_free (Fixture *fixture)
+{
+  g_array_unref (fixture->event_sequence);
+
+  emtr_sequence_table_free (fixture->sequences);
+  for (gsize i = 0; i < NUM_SEQUENCES; i++)
+    {
+      emtr_sequence_key_clear (&fixture->sequence_keys[i]);
+      g_variant_unref (fixture->sequence_key_variants[i]);
+    }
+
+  g_variant_unref (fixture->variant_key);
+  g_variant_unref (fixture->string_key);
+  g_variant_unref (fixture->integer_key);
+  g_variant_unref (fixture->payload);
+  g_free (fixture);
+}
+
+/* Measurement */
+
+typedef struct
+{
+  guint64 iterations; /* per batch */
+  gdouble min;
+  gdouble median;
+  gdouble mean;
+  gdouble stddev;
+  gdouble max;
+} Result;
+
+static inline gint64
+get_time_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (gint64) ts.tv_sec * G_GINT64_CONSTANT (1000000000) + ts.tv_nsec;
+}
+
+static gdouble
+time_batch (const Benchmark *benchmark,
+            Fixture         *fixture,
+            guint64          iterations)
+{
+  gint64 start_time = get_time_ns ();
+  benchmark->run (fixture, iterations);
+  return (gdouble) (get_time_ns () - start_time);
+}
+
+static gint
+compare_doubles (gconstpointer a,
+                 gconstpointer b)
+{
+  gdouble double_a = *(const gdouble *) a;
+  gdouble double_b = *(const gdouble *) b;
+
+  return (double_a > double_b) - (double_a < double_b);
+}
+
+static void
+run_benchmark (const Benchmark *benchmark,
+               Fixture         *fixture,
+               Result          *result)
+{
+  gdouble min_batch_ns = opt_batch_ms * 1e6;
+  guint64 iterations = 1;
+
+  /* Find how many iterations make a batch long enough to time. */
+  while (time_batch (benchmark, fixture, iterations) < min_batch_ns &&
+         iterations < G_MAXUINT64 / 2)
+    iterations *= 2;
+
+  for (gint i = 0; i < opt_warmup; i++)
+    time_batch (benchmark, fixture, iterations);
+
+  gdouble *times = g_new (gdouble, opt_repetitions);
+  gdouble sum = 0, sum_of_squares = 0;
+
+  for (gint i = 0; i < opt_repetitions; i++)
+    {
+      times[i] = time_batch (benchmark, fixture, iterations) / iterations;
+      sum += times[i];
+      sum_of_squares += times[i] * times[i];
+    }
+
+  qsort (times, opt_repetitions, sizeof (gdouble), compare_doubles);
+
+  result->iterations = iterations;
+  result->min = times[0];
+  result->max = times[opt_repetitions - 1];
+  result->median = opt_repetitions % 2 == 1 ?
+    times[opt_repetitions / 2] :
+    (times[opt_repetitions / 2 - 1] + times[opt_repetitions / 2]) / 2;
+  result->mean = sum / opt_repetitions;
+  result->stddev =
+    sqrt (MAX (0, sum_of_squares / opt_repetitions -
+               result->mean * result->mean));
+
+  g_free (times);
+}
+
+static gboolean
+benchmark_is_selected (const Benchmark *benchmark)
+{
+  if (opt_benchmarks == NULL)
+    return TRUE;
+
+  for (gchar **name = opt_benchmarks; *name != NULL; name++)
+    if (g_str_equal (*name, benchmark->name))
+      return TRUE;
+
+  return FALSE;
+}
+
+/* Baselines */
+
+static GKeyFile *
+load_baseline (const gchar  *path,
+               GError      **error)
+{
+  GKeyFile *baseline = g_key_file_new ();
+
+  if (!g_key_file_load_from_file (baseline, path, G_KEY_FILE_NONE, error))
+    {
+      g_key_file_unref (baseline);
+      return NULL;
+    }
+
+  return baseline;
+}
+
+/* Returns FALSE if @result regressed compared to @baseline. Benchmarks that
+   are missing from the baseline pass. */
+static gboolean
+check_result (GKeyFile        *baseline,
+              const Benchmark *benchmark,
+              const Result    *result,
+              gdouble         *change)
+{
+  GError *error = NULL;
+  gdouble baseline_median = g_key_file_get_double (baseline, benchmark->name,
+                                                   BASELINE_KEY, &error);
+
+  if (error != NULL || baseline_median <= 0)
+    {
+      g_clear_error (&error);
+      *change = NAN;
+      return TRUE;
+    }
+
+  *change = (result->median / baseline_median - 1) * 100;
+  return *change <= opt_threshold;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  GOptionContext *context =
+    g_option_context_new ("- measure the internals of the event recorder");
+  GError *error = NULL;
+
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+  g_option_context_free (context);
+
+  if (opt_repetitions <= 0 || opt_warmup < 0 || opt_batch_ms <= 0 ||
+      opt_threshold < 0)
+    {
+      g_printerr ("Counts, durations and the threshold must be positive.\n");
+      return EXIT_FAILURE;
+    }
+
+  GKeyFile *baseline = NULL;
+  if (opt_check != NULL)
+    {
+      baseline = load_baseline (opt_check, &error);
+      if (baseline == NULL)
+        {
+          g_printerr ("Unable to load the baseline: %s\n", error->message);
+          return EXIT_FAILURE;
+        }
+    }
+
+  Fixture *fixture = fixture_new ();
+  GKeyFile *new_baseline = g_key_file_new ();
+  guint num_regressions = 0;
+  gboolean is_first = TRUE;
+
+  if (opt_json)
+    g_print ("{\n  \"library_version\": \"%d.%d.%d\",\n"
+             "  \"benchmarks\": [\n", EMTR_MAJOR_VERSION,
+             EMTR_MINOR_VERSION, EMTR_MICRO_VERSION);
+  else
+    g_print ("%-26s %12s %10s %10s %10s %10s %10s%s\n", "benchmark",
+             "iterations", "min ns", "median ns", "mean ns", "stddev",
+             "max ns", baseline != NULL ? "     change" : "");
+
+  for (gsize i = 0; i < G_N_ELEMENTS (benchmarks); i++)
+    {
+      const Benchmark *benchmark = &benchmarks[i];
+      Result result;
+      gboolean passed = TRUE;
+      gdouble change = NAN;
+
+      if (!benchmark_is_selected (benchmark))
+        continue;
+
+      run_benchmark (benchmark, fixture, &result);
+      g_key_file_set_double (new_baseline, benchmark->name, BASELINE_KEY,
+                             result.median);
+
+      if (baseline != NULL)
+        {
+          passed = check_result (baseline, benchmark, &result, &change);
+          if (!passed)
+            num_regressions++;
+        }
+
+      if (opt_json)
+        {
+          g_print ("%s    {\n", is_first ? "" : ",\n");
+          g_print ("      \"name\": \"%s\",\n", benchmark->name);
+          g_print ("      \"iterations\": %" G_GUINT64_FORMAT ",\n",
+                   result.iterations);
+          g_print ("      \"repetitions\": %d,\n", opt_repetitions);
+          g_print ("      \"ns_per_op\": { \"min\": %.3f, \"median\": %.3f, "
+                   "\"mean\": %.3f, \"stddev\": %.3f, \"max\": %.3f }",
+                   result.min, result.median, result.mean, result.stddev,
+                   result.max);
+          if (baseline != NULL && !isnan (change))
+            g_print (",\n      \"change_percent\": %.2f,\n"
+                     "      \"regressed\": %s", change,
+                     passed ? "false" : "true");
+          g_print ("\n    }");
+        }
+      else
+        {
+          g_print ("%-26s %12" G_GUINT64_FORMAT " %10.2f %10.2f %10.2f "
+                   "%10.2f %10.2f", benchmark->name, result.iterations,
+                   result.min, result.median, result.mean, result.stddev,
+                   result.max);
+          if (baseline != NULL && !isnan (change))
+            g_print (" %+9.1f%%%s", change, passed ? "" : " REGRESSED");
+          g_print ("\n");
+        }
+
+      is_first = FALSE;
+    }
+
+  if (opt_json)
+    g_print ("\n  ]\n}\n");
+
+  gint status = EXIT_SUCCESS;
+
+  if (opt_save_baseline != NULL &&
+      !g_key_file_save_to_file (new_baseline, opt_save_baseline, &error))
+    {
+      g_printerr ("Unable to save the baseline: %s\n", error->message);
+      g_clear_error (&error);
+      status = EXIT_FAILURE;
+    }
+
+  if (num_regressions > 0)
+    {
+      g_printerr ("%u benchmarks are more than %.1f%% slower than the "
+                  "baseline.\n", num_regressions, opt_threshold);
+      status = EXIT_FAILURE;
+    }
+
+  g_key_file_unref (new_baseline);
+  g_clear_pointer (&baseline, g_key_file_unref);
+  fixture_free (fixture);
+  g_strfreev (opt_benchmarks);
+  g_free (opt_save_baseline);
+  g_free (opt_check);
+  return status;
+}
@@ -46,6 +46,7 @@ gdbus call --system \
     com.endlessm.Metrics.EventRecorderServer \
     '[("RecordSingularEvent", "uayxbv", "", ""),
     ("RecordAggregateEvent", "uayxxbv", "", ""),
-    ("RecordEventSequence", "uaya(xbv)", "", "")]'
+    ("RecordEventSequence", "uaya(xbv)", "", ""),
+    ("RecordEvents", "a(uayxbv)a(uayxxbv)a(uaya(xbv))a{sv}", "", "")]'
 
 gtester "$@"
@@ -19,8 +19,12 @@
 import dbus
 import dbusmock
 import dbus.mainloop.glib
+import mmap
 import os
+import shutil
+import struct
 import subprocess
+import tempfile
 import time
 import unittest
 import uuid
@@ -32,6 +36,7 @@ from gi.repository import GLib
 class TestDaemonIntegration(dbusmock.DBusTestCase):
     _MOCK_EVENT_NOTHING_HAPPENED = '5071dd96-bdad-4ee5-9c26-3dfef34a9963'
     _MOCK_EVENT_NOTHING_HAPPENED_UUID = uuid.UUID(_MOCK_EVENT_NOTHING_HAPPENED)
+    _DROPPED_EVENTS_UUID = uuid.UUID('56caeb40-9174-4875-8048-e580205502c4')
     _METRICS_BUS_NAME = 'com.endlessm.Metrics'
     _METRICS_OBJECT_PATH = '/com/endlessm/Metrics'
     _METRICS_IFACE = 'com.endlessm.Metrics.EventRecorderServer'
@@ -59,7 +64,24 @@ class TestDaemonIntegration(dbusmock.DBusTestCase):
         os.environ['DBUS_SYSTEM_BUS_ADDRESS'] = os.environ['DBUS_SESSION_BUS_ADDRESS']
         klass.dbus_con = klass.get_dbus(system_bus=True)
 
+        # Keep events spooled by the tests away from the user's cache.
+        klass.cache_dir = tempfile.mkdtemp()
+        os.environ['XDG_CACHE_HOME'] = klass.cache_dir
+
+    @classmethod
+    def tearDownClass(klass):
+        shutil.rmtree(klass.cache_dir, ignore_errors=True)
+        super().tearDownClass()
+
     def setUp(self):
+        self.spawn_mock_daemon()
+
+        self.event_recorder = EosMetrics.EventRecorder()
+        self.interface_mock.ClearCalls()
+        self.mainloop = GLib.MainLoop()
+        self._quit_on_method = ''
+
+    def spawn_mock_daemon(self):
         self.dbus_mock = \
             self.spawn_server(self._METRICS_BUS_NAME, self._METRICS_OBJECT_PATH,
                               self._METRICS_IFACE, system_bus=True,
@@ -101,12 +123,9 @@ class TestDaemonIntegration(dbusmock.DBusTestCase):
             ],
         )
 
-        self.event_recorder = EosMetrics.EventRecorder()
-        self.interface_mock.ClearCalls()
-        self.mainloop = GLib.MainLoop()
-        self._quit_on_method = ''
-
     def tearDown(self):
+        # Don't leave events behind to be spooled once the daemon is gone.
+        self.event_recorder.flush_sync()
         self.dbus_con.remove_signal_receiver(self.handle_dbus_event_received,
                                              signal_name='MethodCalled')
         self.dbus_mock.terminate()
@@ -300,6 +319,23 @@ class TestDaemonIntegration(dbusmock.DBusTestCase):
         actual_uuid = self.dbus_bytes_to_uuid(calls[0][2][1])
         self.assertEqual(self._MOCK_EVENT_NOTHING_HAPPENED_UUID, actual_uuid)
 
+    def test_record_singular_event_with_handle_passes_event_id(self):
+        handle = self.event_recorder.register_event(
+            self._MOCK_EVENT_NOTHING_HAPPENED)
+        self.event_recorder.record_event_with_handle(handle, None)
+        calls = self.await_method_call('RecordSingularEvent')
+        actual_uuid = self.dbus_bytes_to_uuid(calls[0][2][1])
+        self.assertEqual(self._MOCK_EVENT_NOTHING_HAPPENED_UUID, actual_uuid)
+
+    def test_record_aggregate_event_with_handle_sync_passes_event_id(self):
+        handle = self.event_recorder.register_event(
+            self._MOCK_EVENT_NOTHING_HAPPENED)
+        self.event_recorder.record_events_with_handle_sync(handle, 3, None)
+        calls = self.interface_mock.GetCalls()
+        actual_uuid = self.dbus_bytes_to_uuid(calls[0][2][1])
+        self.assertEqual(self._MOCK_EVENT_NOTHING_HAPPENED_UUID, actual_uuid)
+        self.assertEqual(calls[0][2][2], 3)
+
     # Aggregated events' count isn't garbled.
     def test_record_aggregate_event_passes_event_count(self):
         leet_count = 1337
@@ -611,6 +647,548 @@ class TestDaemonIntegration(dbusmock.DBusTestCase):
         self.assertEqual(calls[0][2][2][1][2], progress_string)
         self.assertEqual(calls[0][2][2][2][2], stop_string)
 
+    # Asynchronous events are batched when the daemon supports RecordEvents.
+    def add_record_events_method(self):
+        self.interface_mock.AddMethod('', 'RecordEvents',
+                                      'a(uayxbv)a(uayxxbv)a(uaya(xbv))a{sv}',
+                                      '', '')
+
+    def test_record_events_batches_async_events(self):
+        self.add_record_events_method()
+        self.event_recorder.record_event(self._MOCK_EVENT_NOTHING_HAPPENED,
+                                         None)
+        self.event_recorder.record_events(self._MOCK_EVENT_NOTHING_HAPPENED,
+                                          42, None)
+        self.event_recorder.record_start(self._MOCK_EVENT_NOTHING_HAPPENED,
+                                         None, None)
+        self.event_recorder.record_stop(self._MOCK_EVENT_NOTHING_HAPPENED,
+                                        None, None)
+        calls = self.await_method_call('RecordEvents')
+        self.assertEqual(len(calls), 1)
+        self.assertEqual(calls[0][1], 'RecordEvents')
+
+        singular_events, aggregate_events, event_sequences, options = \
+            calls[0][2]
+        self.assertEqual(len(singular_events), 1)
+        self.assertEqual(singular_events[0][0], os.getuid())
+        self.assertEqual(self.dbus_bytes_to_uuid(singular_events[0][1]),
+                         self._MOCK_EVENT_NOTHING_HAPPENED_UUID)
+        self.assertEqual(len(aggregate_events), 1)
+        self.assertEqual(aggregate_events[0][2], 42)
+        self.assertEqual(len(event_sequences), 1)
+        self.assertEqual(len(event_sequences[0][2]), 2)
+
+    def test_record_events_sends_full_batch(self):
+        self.add_record_events_method()
+        self.event_recorder.props.max_batch_size = 3
+        self.event_recorder.props.flush_interval = 60 * 60 * 1000
+        for count in range(3):
+            self.event_recorder.record_events(
+                self._MOCK_EVENT_NOTHING_HAPPENED, count, None)
+        calls = self.await_method_call('RecordEvents')
+        self.assertEqual(len(calls), 1)
+        self.assertEqual([event[2] for event in calls[0][2][1]], [0, 1, 2])
+
+    def test_flush_sync_sends_buffered_events(self):
+        self.add_record_events_method()
+        payload = GLib.Variant.new_string("Buffered")
+        self.event_recorder.record_event(self._MOCK_EVENT_NOTHING_HAPPENED,
+                                         payload)
+        self.event_recorder.flush_sync()
+        calls = self.interface_mock.GetCalls()
+        self.assertEqual(len(calls), 1)
+        self.assertEqual(calls[0][1], 'RecordEvents')
+        self.assertEqual(calls[0][2][0][0][4], "Buffered")
+
+    def test_sync_event_sends_buffered_events_first(self):
+        self.add_record_events_method()
+        self.event_recorder.record_event(self._MOCK_EVENT_NOTHING_HAPPENED,
+                                         None)
+        self.event_recorder.record_event_sync(
+            self._MOCK_EVENT_NOTHING_HAPPENED, None)
+        calls = self.interface_mock.GetCalls()
+        self.assertEqual([call[1] for call in calls],
+                         ['RecordEvents', 'RecordSingularEvent'])
+
+    # Once the daemon has accepted a batch, further batches are sent without
+    # waiting for replies, in order.
+    def test_batches_sent_without_reply_keep_their_order(self):
+        self.add_record_events_method()
+        self.event_recorder.props.max_batch_size = 1
+        for count in range(3):
+            self.event_recorder.record_events(
+                self._MOCK_EVENT_NOTHING_HAPPENED, count, None)
+        self.event_recorder.flush_sync()
+        calls = self.interface_mock.GetCalls()
+        self.assertEqual([call[1] for call in calls], ['RecordEvents'] * 3)
+        self.assertEqual([call[2][1][0][2] for call in calls], [0, 1, 2])
+        sequence_numbers = [call[2][3]['sequence-number'] for call in calls]
+        self.assertEqual(sequence_numbers, sorted(set(sequence_numbers)))
+
+    # Batches that the daemon fails to acknowledge are sent again as they
+    # were, so that the daemon can tell them apart from new ones.
+    def test_batch_is_sent_again_after_transient_failure(self):
+        self.interface_mock.AddMethod('', 'RecordEvents',
+                                      'a(uayxbv)a(uayxxbv)a(uaya(xbv))a{sv}',
+                                      '', '''
+self.record_events_calls = getattr(self, 'record_events_calls', 0) + 1
+if self.record_events_calls == 1:
+    raise dbus.exceptions.DBusException(
+        'Too busy', name='org.freedesktop.DBus.Error.NoReply')
+''')
+        self.event_recorder.record_events(self._MOCK_EVENT_NOTHING_HAPPENED, 7,
+                                          None)
+
+        deadline = time.monotonic() + 20
+        while len(self.interface_mock.GetCalls()) < 2:
+            self.assertLess(time.monotonic(), deadline)
+            time.sleep(0.01)
+
+        calls = self.interface_mock.GetCalls()
+        self.assertEqual([call[1] for call in calls], ['RecordEvents'] * 2)
+        self.assertEqual(calls[0][2], calls[1][2])
+        self.assertEqual([event[2] for event in calls[1][2][1]], [7])
+        options = calls[1][2][3]
+        self.assertEqual(uuid.UUID(options['client-id']).version, 4)
+        self.assertIn('sequence-number', options)
+
+    def test_record_singular_event_waiting_for_reply_calls_dbus(self):
+        self.event_recorder.props.wait_for_replies = True
+        calls = self.call_singular_event()
+        self.assertEqual(len(calls), 1)
+        self.assertEqual(calls[0][1], 'RecordSingularEvent')
+
+    # Large batches are passed in a sealed memfd when the daemon supports it.
+    def test_large_batch_is_passed_in_memfd(self):
+        self.add_record_events_method()
+        self.interface_mock.AddMethod('', 'RecordEventsFromFd', 'h', '', '')
+        self.event_recorder.props.memfd_threshold = 1
+        self.event_recorder.record_event(self._MOCK_EVENT_NOTHING_HAPPENED,
+                                         None)
+        self.event_recorder.flush_sync()
+        calls = self.interface_mock.GetCalls()
+        self.assertEqual([call[1] for call in calls], ['RecordEventsFromFd'])
+
+    def test_large_batch_is_sent_inline_to_old_daemon(self):
+        self.add_record_events_method()
+        self.event_recorder.props.memfd_threshold = 1
+        payload = GLib.Variant.new_string("Inline")
+        self.event_recorder.record_event(self._MOCK_EVENT_NOTHING_HAPPENED,
+                                         payload)
+        self.event_recorder.flush_sync()
+        calls = self.interface_mock.GetCalls()
+        self.assertEqual([call[1] for call in calls], ['RecordEvents'])
+        self.assertEqual(calls[0][2][0][0][4], "Inline")
+
+    # Events go over the bus if the direct connection the daemon offers fails.
+    def test_events_are_sent_over_bus_when_direct_connection_fails(self):
+        self.interface_mock.AddMethod('', 'GetDirectAddress', '', 's',
+                                      "ret = 'unix:path=/nonexistent/socket'")
+        self.add_record_events_method()
+        event_recorder = EosMetrics.EventRecorder()
+        event_recorder.record_event(self._MOCK_EVENT_NOTHING_HAPPENED, None)
+        event_recorder.flush_sync()
+        calls = self.interface_mock.GetCalls()
+        self.assertEqual([call[1] for call in calls],
+                         ['GetDirectAddress', 'RecordEvents'])
+
+    # Batched records are copied into the event ring when the daemon offers
+    # one. The mock keeps the ring so that the test can read it back.
+    _EVENT_RING_DATA_OFFSET = 192
+    _EVENT_RING_DATA_SIZE = 4096
+
+    def add_open_event_ring_method(self):
+        self.interface_mock.AddMethod('', 'OpenEventRing', '', 'hh', f'''
+import fcntl
+import struct
+fd = os.memfd_create('event-ring', os.MFD_ALLOW_SEALING)
+os.ftruncate(fd, {self._EVENT_RING_DATA_OFFSET + self._EVENT_RING_DATA_SIZE})
+os.pwrite(fd, struct.pack('=IIII', 0x454d5247, 1,
+                          {self._EVENT_RING_DATA_OFFSET},
+                          {self._EVENT_RING_DATA_SIZE}), 0)
+fcntl.fcntl(fd, fcntl.F_ADD_SEALS, fcntl.F_SEAL_SHRINK | fcntl.F_SEAL_GROW)
+self.event_ring_fd = fd
+ret = (dbus.types.UnixFd(fd), dbus.types.UnixFd(os.eventfd(0)))
+''')
+        self.interface_mock.AddMethod('', 'GetEventRingForTest', '', 'h',
+                                      'ret = dbus.types.UnixFd(self.event_ring_fd)')
+
+    def read_event_ring(self):
+        daemon = dbus.Interface(
+            self.dbus_con.get_object(self._METRICS_BUS_NAME,
+                                     self._METRICS_OBJECT_PATH),
+            self._METRICS_IFACE)
+        fd = daemon.GetEventRingForTest().take()
+        offset = self._EVENT_RING_DATA_OFFSET
+        size = self._EVENT_RING_DATA_SIZE
+        records = []
+        with mmap.mmap(fd, offset + size) as memory:
+            head, = struct.unpack_from('=I', memory, 64)
+            tail, = struct.unpack_from('=I', memory, 128)
+            while head != tail:
+                start = offset + head % size
+                record_size, kind = struct.unpack_from('=II', memory, start)
+                records.append((kind, memory[start + 8:start + 8 + record_size]))
+                head += (8 + record_size + 7) & ~7
+        os.close(fd)
+        return records
+
+    @unittest.skipUnless(hasattr(os, 'eventfd'), 'eventfd is not available')
+    def test_batched_events_are_written_to_event_ring(self):
+        self.add_record_events_method()
+        self.add_open_event_ring_method()
+        event_recorder = EosMetrics.EventRecorder()
+        event_recorder.record_event(self._MOCK_EVENT_NOTHING_HAPPENED, None)
+        event_recorder.record_events(self._MOCK_EVENT_NOTHING_HAPPENED, 42,
+                                     None)
+        event_recorder.flush_sync()
+        calls = self.interface_mock.GetCalls()
+        self.assertEqual([call[1] for call in calls], ['OpenEventRing'])
+
+        records = self.read_event_ring()
+        self.assertEqual([kind for kind, data in records], [0, 1])
+        aggregate_event = GLib.Variant.new_from_bytes(
+            GLib.VariantType.new('(uayxxbv)'), GLib.Bytes.new(records[1][1]),
+            False).unpack()
+        self.assertEqual(aggregate_event[0], os.getuid())
+        self.assertEqual(aggregate_event[2], 42)
+
+    # Events recorded before the recorder has connected to the daemon are held
+    # until it has.
+    def test_events_recorded_while_connecting_are_sent_in_order(self):
+        self.add_record_events_method()
+        event_recorder = EosMetrics.EventRecorder()
+        for count in range(5):
+            event_recorder.record_events(self._MOCK_EVENT_NOTHING_HAPPENED,
+                                         count, None)
+        event_recorder.flush_sync()
+        calls = self.interface_mock.GetCalls()
+        self.assertEqual(len(calls), 1)
+        self.assertEqual(calls[0][1], 'RecordEvents')
+        self.assertEqual([event[2] for event in calls[0][2][1]],
+                         [0, 1, 2, 3, 4])
+
+    # Aggregate events are summed up over the aggregation window.
+    def test_record_events_sums_counts_in_aggregation_window(self):
+        self.add_record_events_method()
+        self.event_recorder.props.aggregation_window = 60 * 60 * 1000
+        payload = GLib.Variant.new_string("Counted")
+        for count in (1, 2, 3):
+            self.event_recorder.record_events(
+                self._MOCK_EVENT_NOTHING_HAPPENED, count, payload)
+        self.event_recorder.record_events(
+            self._MOCK_EVENT_NOTHING_HAPPENED, 1 << 40, None)
+        self.event_recorder.flush_sync()
+        calls = self.interface_mock.GetCalls()
+        self.assertEqual(len(calls), 1)
+        self.assertEqual(calls[0][1], 'RecordEvents')
+        aggregate_events = calls[0][2][1]
+        self.assertEqual(sorted(event[2] for event in aggregate_events),
+                         [6, 1 << 40])
+
+    def test_aggregation_window_ends_on_its_own(self):
+        self.add_record_events_method()
+        self.event_recorder.props.aggregation_window = 100
+        self.event_recorder.props.flush_interval = 60 * 60 * 1000
+        for count in (1, 2):
+            self.event_recorder.record_events(
+                self._MOCK_EVENT_NOTHING_HAPPENED, count, None)
+        calls = self.await_method_call('RecordEvents')
+        self.assertEqual(len(calls), 1)
+        self.assertEqual([event[2] for event in calls[0][2][1]], [3])
+
+    # Events that don't fit while the daemon is slow are dropped and counted.
+    def test_events_that_do_not_fit_are_dropped_and_reported(self):
+        self.interface_mock.AddMethod('', 'RecordEvents',
+                                      'a(uayxbv)a(uayxxbv)a(uaya(xbv))a{sv}',
+                                      '', 'import time; time.sleep(0.5)')
+        event_recorder = EosMetrics.EventRecorder()
+        event_recorder.props.max_batch_size = 1
+        event_recorder.props.max_in_flight = 1
+        event_recorder.props.max_queued_bytes = 1
+        event_recorder.props.wait_for_replies = True
+        for _ in range(5):
+            event_recorder.record_event(self._MOCK_EVENT_NOTHING_HAPPENED, None)
+        event_recorder.flush_sync()
+
+        calls = [call for call in self.interface_mock.GetCalls()
+                 if call[1] == 'RecordEvents']
+        singular_events = [event for call in calls for event in call[2][0]]
+        drop_reports = [event for call in calls for event in call[2][1]
+                        if self.dbus_bytes_to_uuid(event[1]) ==
+                        self._DROPPED_EVENTS_UUID]
+        # One event is in flight and one waits for it; the others are dropped.
+        self.assertEqual(len(singular_events), 2)
+        self.assertEqual(len(drop_reports), 1)
+        self.assertEqual(drop_reports[0][2], 3)
+        self.assertEqual(drop_reports[0][5], self._MOCK_EVENT_NOTHING_HAPPENED)
+
+    # Stats count what happened to the recorded events, per event ID.
+    def test_stats_count_recorded_and_sent_events(self):
+        self.add_record_events_method()
+        for _ in range(3):
+            self.event_recorder.record_event(self._MOCK_EVENT_NOTHING_HAPPENED,
+                                             None)
+        self.event_recorder.record_start(self._MOCK_EVENT_NOTHING_HAPPENED,
+                                         GLib.Variant.new_string('key'), None)
+        self.event_recorder.flush_sync()
+
+        stats = self.event_recorder.get_stats().unpack()
+        self.assertEqual(stats['events-recorded'], 3)
+        self.assertEqual(stats['events-sent'], 3)
+        self.assertEqual(stats['events-dropped'], 0)
+        self.assertEqual(stats['events-failed'], 0)
+        self.assertGreater(stats['bytes-serialized'], 0)
+        self.assertEqual(stats['events'][self._MOCK_EVENT_NOTHING_HAPPENED],
+                         {'recorded': 3, 'sent': 3, 'dropped': 0,
+                          'failed': 0})
+        self.assertEqual(stats['sequences-in-progress'], 1)
+        self.assertGreater(stats['sequences-memory'], 0)
+        self.assertEqual(stats['sequence-lock-contentions'], 0)
+        self.assertEqual(stats['sequence-lock-wait-ns'], 0)
+        self.assertEqual(stats['aggregate-timers'], 0)
+
+    # Profiling times the steps of recording, in total and per event ID.
+    def test_profiling_times_recording_phases(self):
+        self.add_record_events_method()
+        self.event_recorder.record_event(self._MOCK_EVENT_NOTHING_HAPPENED,
+                                         None)
+        self.event_recorder.flush_sync()
+        stats = self.event_recorder.get_stats().unpack()
+        self.assertFalse(stats['profiling'])
+        self.assertEqual(stats['phases'], {})
+
+        self.event_recorder.props.profile_phases = True
+        for _ in range(3):
+            self.event_recorder.record_event(self._MOCK_EVENT_NOTHING_HAPPENED,
+                                             GLib.Variant.new_string('x'))
+        self.event_recorder.flush_sync()
+        self.event_recorder.props.profile_phases = False
+
+        stats = self.event_recorder.get_stats().unpack()
+        self.assertFalse(stats['profiling'])
+        phases = stats['phases']
+        for phase in ('clock', 'check-payload', 'parse-event-id', 'enqueue',
+                      'normalize', 'box', 'build-record'):
+            self.assertEqual(phases[phase][0], 3, phase)
+        self.assertGreaterEqual(phases['send'][0], 1)
+        event_phases = \
+            stats['phases-by-event'][self._MOCK_EVENT_NOTHING_HAPPENED]
+        self.assertEqual(event_phases['parse-event-id'][0], 3)
+        self.assertNotIn('build-batch', event_phases)
+
+    # The flight recorder keeps what happened to the last records, in order.
+    def test_recent_events_are_kept_in_order(self):
+        self.add_record_events_method()
+        self.event_recorder.record_event(self._MOCK_EVENT_NOTHING_HAPPENED,
+                                         GLib.Variant.new_string('payload'))
+        self.event_recorder.record_event(self._MOCK_EVENT_NOTHING_HAPPENED,
+                                         None)
+        self.event_recorder.flush_sync()
+
+        events = self.event_recorder.get_recent_events().unpack()
+        self.assertEqual([event[3] for event in events],
+                         ['recorded', 'recorded', 'sent', 'sent'])
+        for event in events:
+            self.assertEqual(event[0], self._MOCK_EVENT_NOTHING_HAPPENED)
+            self.assertEqual(event[2], 'singular')
+        self.assertGreater(events[0][4], 0)
+        self.assertEqual(events[0][4:], events[2][4:])
+        self.assertEqual(events[1][4], 0)
+
+    # Round trips of calls that wait for a reply are measured per method.
+    def test_latency_histograms_measure_round_trips(self):
+        self.call_singular_event_sync()
+        self.call_aggregate_event_sync()
+
+        for kind in (EosMetrics.LatencyKind.RECORD_SINGULAR_EVENT,
+                     EosMetrics.LatencyKind.RECORD_AGGREGATE_EVENT):
+            histogram = self.event_recorder.get_latency_histogram(kind)
+            self.assertEqual(histogram.get_count(), 1)
+            self.assertGreater(histogram.get_p50(), 0)
+        histogram = self.event_recorder.get_latency_histogram(
+            EosMetrics.LatencyKind.RECORD_EVENT_SEQUENCE)
+        self.assertEqual(histogram.get_count(), 0)
+
+    # The default recorder exports its statistics on its own connection when
+    # EOS_METRICS_CLIENT_STATS is set.
+    def get_own_client_stats(self):
+        bus = dbus.Interface(self.dbus_con.get_object('org.freedesktop.DBus',
+                                                      '/org/freedesktop/DBus'),
+                             'org.freedesktop.DBus')
+        for name in bus.ListNames():
+            if (not name.startswith(':') or
+                    bus.GetConnectionUnixProcessID(name) != os.getpid()):
+                continue
+            try:
+                return self.dbus_con.call_blocking(
+                    name, '/com/endlessm/Metrics/ClientStats',
+                    'com.endlessm.Metrics.ClientStats', 'GetStats', '', [])
+            except dbus.exceptions.DBusException:
+                pass
+        return None
+
+    def test_default_recorder_exports_client_stats(self):
+        os.environ['EOS_METRICS_CLIENT_STATS'] = '1'
+        try:
+            event_recorder = EosMetrics.EventRecorder.get_default()
+        finally:
+            del os.environ['EOS_METRICS_CLIENT_STATS']
+        event_recorder.record_event_sync(self._MOCK_EVENT_NOTHING_HAPPENED,
+                                         None)
+
+        stats = None
+        for _ in range(100):
+            stats = self.get_own_client_stats()
+            if stats is not None:
+                break
+            time.sleep(0.05)
+        self.assertIsNotNone(stats)
+        self.assertEqual(stats['events-recorded'], 1)
+        self.assertEqual(stats['events-sent'], 1)
+        self.assertEqual(stats['records-pending'], 0)
+        self.assertEqual(stats['batches-retrying'], 0)
+        self.assertEqual(stats['latencies']['record-call'][0], 1)
+        self.assertEqual(stats['latencies']['record-singular-event'][0], 1)
+
+    # Nothing is sent while the user has opted out of metrics collection.
+    def disable_daemon(self):
+        self.interface_mock.AddProperty(self._METRICS_IFACE, 'Enabled',
+                                        dbus.Boolean(False))
+
+    def test_no_events_are_sent_while_daemon_is_disabled(self):
+        self.add_record_events_method()
+        self.disable_daemon()
+        event_recorder = EosMetrics.EventRecorder()
+        event_recorder.record_event(self._MOCK_EVENT_NOTHING_HAPPENED, None)
+        event_recorder.flush_sync()
+        event_recorder.record_event(self._MOCK_EVENT_NOTHING_HAPPENED, None)
+        event_recorder.record_events_sync(self._MOCK_EVENT_NOTHING_HAPPENED,
+                                          2, None)
+        event_recorder.record_start(self._MOCK_EVENT_NOTHING_HAPPENED, None,
+                                    None)
+        event_recorder.record_stop(self._MOCK_EVENT_NOTHING_HAPPENED, None,
+                                   None)
+        event_recorder.flush_sync()
+        self.assertEqual(self.interface_mock.GetCalls(), [])
+
+    def test_events_are_sent_once_daemon_is_enabled_again(self):
+        self.add_record_events_method()
+        self.disable_daemon()
+        event_recorder = EosMetrics.EventRecorder()
+        event_recorder.record_event(self._MOCK_EVENT_NOTHING_HAPPENED, None)
+        event_recorder.flush_sync()
+
+        daemon_properties = dbus.Interface(
+            self.dbus_con.get_object(self._METRICS_BUS_NAME,
+                                     self._METRICS_OBJECT_PATH),
+            dbus.PROPERTIES_IFACE)
+        daemon_properties.Set(self._METRICS_IFACE, 'Enabled',
+                              dbus.Boolean(True))
+
+        # The recorder follows the property as soon as the PropertiesChanged
+        # signal reaches it.
+        deadline = time.monotonic() + 20
+        while not self.interface_mock.GetCalls():
+            self.assertLess(time.monotonic(), deadline)
+            event_recorder.record_event_sync(
+                self._MOCK_EVENT_NOTHING_HAPPENED, None)
+            time.sleep(0.01)
+
+        calls = self.interface_mock.GetCalls()
+        self.assertEqual(calls[0][1], 'RecordSingularEvent')
+
+    def test_events_recorded_without_daemon_are_sent_once_it_is_back(self):
+        self.dbus_mock.terminate()
+        self.dbus_mock.wait()
+        event_recorder = EosMetrics.EventRecorder()
+        event_recorder.record_events_sync(self._MOCK_EVENT_NOTHING_HAPPENED,
+                                          7, None)
+        # Freeing the recorder leaves its spool to be replayed by others.
+        del event_recorder
+
+        self.spawn_mock_daemon()
+        self.add_record_events_method()
+        event_recorder = EosMetrics.EventRecorder()
+        event_recorder.flush_sync()
+        calls = [call for call in self.interface_mock.GetCalls()
+                 if call[1] == 'RecordEvents']
+        self.assertEqual(len(calls), 1)
+        self.assertEqual([event[2] for event in calls[0][2][1]], [7])
+
+    # The spool is replayed as there is room for its events, rather than
+    # dropping what does not fit in max_queued_bytes.
+    def test_spooled_events_that_exceed_the_queue_are_all_sent(self):
+        num_events = 300
+        self.dbus_mock.terminate()
+        self.dbus_mock.wait()
+        event_recorder = EosMetrics.EventRecorder()
+        for count in range(num_events):
+            event_recorder.record_events(self._MOCK_EVENT_NOTHING_HAPPENED,
+                                         count, None)
+        del event_recorder
+
+        self.spawn_mock_daemon()
+        self.add_record_events_method()
+        event_recorder = EosMetrics.EventRecorder()
+        event_recorder.props.max_in_flight = 1
+        event_recorder.props.max_queued_bytes = 1024
+        event_recorder.props.wait_for_replies = True
+
+        # The rest of the spool is replayed as messages in flight complete.
+        deadline = time.monotonic() + 10
+        while True:
+            event_recorder.flush_sync()
+            calls = [call for call in self.interface_mock.GetCalls()
+                     if call[1] == 'RecordEvents']
+            counts = [event[2] for call in calls for event in call[2][1]
+                      if self.dbus_bytes_to_uuid(event[1]) ==
+                      self._MOCK_EVENT_NOTHING_HAPPENED_UUID]
+            if len(counts) >= num_events or time.monotonic() > deadline:
+                break
+            time.sleep(0.1)
+
+        self.assertGreater(len(calls), 1)
+        self.assertEqual(sorted(counts), list(range(num_events)))
+        stats = event_recorder.get_stats().unpack()
+        self.assertEqual(stats['events-dropped'], 0)
+        spool_dir = os.path.join(self.cache_dir, 'eosmetrics', 'spool')
+        self.assertEqual(os.listdir(spool_dir), [])
+
+    # Their times are relative to the boot they were recorded in.
+    def test_events_spooled_during_another_boot_are_dropped(self):
+        self.dbus_mock.terminate()
+        self.dbus_mock.wait()
+        event_recorder = EosMetrics.EventRecorder()
+        event_recorder.record_events_sync(self._MOCK_EVENT_NOTHING_HAPPENED,
+                                          7, None)
+        del event_recorder
+
+        # Forge the boot ID that follows the magic and version of each segment.
+        spool_dir = os.path.join(self.cache_dir, 'eosmetrics', 'spool')
+        segments = [name for name in os.listdir(spool_dir)
+                    if name.endswith('.spool')]
+        self.assertGreater(len(segments), 0)
+        for name in segments:
+            with open(os.path.join(spool_dir, name), 'r+b') as segment:
+                segment.seek(8)
+                boot_id = segment.read(8)
+                segment.seek(8)
+                segment.write(bytes(byte ^ 0xff for byte in boot_id))
+
+        self.spawn_mock_daemon()
+        self.add_record_events_method()
+        event_recorder = EosMetrics.EventRecorder()
+        event_recorder.flush_sync()
+        calls = [call for call in self.interface_mock.GetCalls()
+                 if call[1] == 'RecordEvents']
+        self.assertEqual([event[2] for call in calls for event in call[2][1]
+                          if self.dbus_bytes_to_uuid(event[1]) ==
+                          self._MOCK_EVENT_NOTHING_HAPPENED_UUID], [])
+        self.assertEqual(os.listdir(spool_dir), [])
+        stats = event_recorder.get_stats().unpack()
+        self.assertEqual(stats['events-dropped'], 1)
+
     def test_start_timer_passes_payload(self):
         payload_string = "com.example.Payload"
         payload_variant = GLib.Variant.new_string(payload_string)
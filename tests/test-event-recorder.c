@@ -21,8 +21,11 @@
 
 #include "eosmetrics/eosmetrics.h"
 
+#include <string.h>
+
 #include <glib.h>
 #include <gio/gio.h>
+#include <uuid/uuid.h>
 
 #define EOS_METRICS_LOG_DOMAIN "EosMetrics"
 
@@ -64,11 +67,148 @@ write_testing_machine_id ()
   return success;
 }
 
+/* Returns the counter called @name in the stats of @recorder. */
+static guint64
+get_stat (EmtrEventRecorder *recorder,
+          const gchar       *name)
+{
+  g_autoptr(GVariant) stats = emtr_event_recorder_get_stats (recorder);
+  g_autoptr(GVariant) value = g_variant_lookup_value (stats, name, NULL);
+
+  g_assert_nonnull (value);
+  if (g_variant_is_of_type (value, G_VARIANT_TYPE_UINT32))
+    return g_variant_get_uint32 (value);
+  return g_variant_get_uint64 (value);
+}
+
+/* Returns the count of @stat, such as "sent", for @event_id in the stats of
+   @recorder, or 0 if nothing was counted for it. */
+static guint64
+get_event_stat (EmtrEventRecorder *recorder,
+                const gchar       *event_id,
+                const gchar       *stat)
+{
+  g_autoptr(GVariant) stats = emtr_event_recorder_get_stats (recorder);
+  g_autoptr(GVariant) events =
+    g_variant_lookup_value (stats, "events", G_VARIANT_TYPE ("a{sa{st}}"));
+  g_autoptr(GVariant) counts =
+    g_variant_lookup_value (events, event_id, G_VARIANT_TYPE ("a{st}"));
+  guint64 count = 0;
+
+  if (counts != NULL)
+    g_variant_lookup (counts, stat, "t", &count);
+  return count;
+}
+
+/* Calls @method on the mock daemon's org.freedesktop.DBus.Mock interface. */
+static GVariant *
+call_mock (const gchar        *method,
+           const GVariantType *reply_type)
+{
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GDBusConnection) bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL,
+                                                   &error);
+  g_assert_no_error (error);
+
+  GVariant *reply =
+    g_dbus_connection_call_sync (bus, "com.endlessm.Metrics",
+                                 "/com/endlessm/Metrics",
+                                 "org.freedesktop.DBus.Mock", method,
+                                 NULL, reply_type, G_DBUS_CALL_FLAGS_NONE, -1,
+                                 NULL, &error);
+  g_assert_no_error (error);
+  return reply;
+}
+
+/* Whether the event ID of @record, a record variant, is @event_id */
+static gboolean
+record_has_event_id (GVariant     *record,
+                     const uuid_t  event_id)
+{
+  g_autoptr(GVariant) record_event_id = g_variant_get_child_value (record, 1);
+  gsize length;
+  const guchar *bytes =
+    g_variant_get_fixed_array (record_event_id, &length, 1);
+
+  return length == sizeof (uuid_t) && memcmp (bytes, event_id, length) == 0;
+}
+
+/* Whether the arguments @args of a call, of type av, hold @event_id at
+   @index */
+static gboolean
+args_have_event_id (GVariant     *args,
+                    gsize         index,
+                    const uuid_t  event_id)
+{
+  g_autoptr(GVariant) boxed = g_variant_get_child_value (args, index);
+  g_autoptr(GVariant) arg = g_variant_get_variant (boxed);
+  gsize length;
+  const guchar *bytes = g_variant_get_fixed_array (arg, &length, 1);
+
+  return length == sizeof (uuid_t) && memcmp (bytes, event_id, length) == 0;
+}
+
+/* The methods that record a single record of each kind */
+static const gchar * const record_methods[] = {
+  "RecordSingularEvent",
+  "RecordAggregateEvent",
+  "RecordEventSequence",
+};
+
+/* Returns the number of records of @event_id that the mock daemon received
+   since the calls were last cleared, by record kind, in @counts. */
+static void
+count_received_records (const gchar *event_id,
+                        guint        counts[3])
+{
+  g_autoptr(GVariant) reply = call_mock ("GetCalls",
+                                         G_VARIANT_TYPE ("(a(tsav))"));
+  g_autoptr(GVariant) calls = g_variant_get_child_value (reply, 0);
+  GVariantIter iter;
+  const gchar *method;
+  GVariant *args;
+  uuid_t parsed_event_id;
+
+  g_assert_cmpint (uuid_parse (event_id, parsed_event_id), ==, 0);
+  memset (counts, 0, 3 * sizeof (guint));
+
+  g_variant_iter_init (&iter, calls);
+  while (g_variant_iter_loop (&iter, "(t&s@av)", NULL, &method, &args))
+    {
+      for (gsize kind = 0; kind < G_N_ELEMENTS (record_methods); kind++)
+        {
+          /* Synchronous records are sent one per call. */
+          if (g_strcmp0 (method, record_methods[kind]) == 0 &&
+              args_have_event_id (args, 1, parsed_event_id))
+            counts[kind]++;
+        }
+
+      if (g_strcmp0 (method, "RecordEvents") != 0)
+        continue;
+
+      for (gsize kind = 0; kind < 3; kind++)
+        {
+          g_autoptr(GVariant) boxed = g_variant_get_child_value (args, kind);
+          g_autoptr(GVariant) records = g_variant_get_variant (boxed);
+
+          for (gsize i = 0; i < g_variant_n_children (records); i++)
+            {
+              g_autoptr(GVariant) record =
+                g_variant_get_child_value (records, i);
+
+              if (record_has_event_id (record, parsed_event_id))
+                counts[kind]++;
+            }
+        }
+    }
+}
+
 static void
 setup (struct RecorderFixture *fixture,
        gconstpointer           unused)
 {
   write_testing_machine_id ();
+  g_variant_unref (call_mock ("ClearCalls", NULL));
   fixture->recorder = emtr_event_recorder_new ();
 }
 
@@ -419,6 +559,252 @@ test_event_recorder_record_auxiliary_payload_with_maybe_throws_critical (struct
   g_test_assert_expected_messages ();
 }
 
+static void
+test_event_recorder_flush_sync (struct RecorderFixture *fixture,
+                                gconstpointer           unused)
+{
+  emtr_event_recorder_record_event (fixture->recorder, MEANINGLESS_EVENT, NULL);
+  emtr_event_recorder_record_events (fixture->recorder, MEANINGLESS_EVENT,
+                                     G_GINT64_CONSTANT (3),
+                                     g_variant_new ("u", 42u));
+  emtr_event_recorder_record_start (fixture->recorder, MEANINGLESS_EVENT, NULL,
+                                    NULL);
+  emtr_event_recorder_record_stop (fixture->recorder, MEANINGLESS_EVENT, NULL,
+                                   NULL);
+  emtr_event_recorder_flush_sync (fixture->recorder);
+
+  guint counts[3];
+  count_received_records (MEANINGLESS_EVENT, counts);
+  g_assert_cmpuint (counts[0], ==, 1);
+  g_assert_cmpuint (counts[1], ==, 1);
+  g_assert_cmpuint (counts[2], ==, 1);
+  g_assert_cmpuint (get_event_stat (fixture->recorder, MEANINGLESS_EVENT,
+                                    "sent"), ==, 3);
+}
+
+static void
+test_event_recorder_record_event_fills_batch (struct RecorderFixture *fixture,
+                                              gconstpointer           unused)
+{
+  guint max_batch_size;
+
+  g_object_set (fixture->recorder, "max-batch-size", 4u, NULL);
+  g_object_get (fixture->recorder, "max-batch-size", &max_batch_size, NULL);
+  g_assert_cmpuint (max_batch_size, ==, 4u);
+
+  for (gint i = 0; i < 10; ++i)
+    emtr_event_recorder_record_event (fixture->recorder, MEANINGLESS_EVENT,
+                                      g_variant_new ("i", i));
+  emtr_event_recorder_flush_sync (fixture->recorder);
+
+  /* Batches are split, but no event is lost. */
+  guint counts[3];
+  count_received_records (MEANINGLESS_EVENT, counts);
+  g_assert_cmpuint (counts[0], ==, 10);
+  g_assert_cmpuint (get_event_stat (fixture->recorder, MEANINGLESS_EVENT,
+                                    "sent"), ==, 10);
+  g_assert_cmpuint (get_stat (fixture->recorder, "events-dropped"), ==, 0);
+}
+
+static void
+test_event_recorder_record_events_in_aggregation_window (struct RecorderFixture *fixture,
+                                                         gconstpointer           unused)
+{
+  guint aggregation_window;
+
+  g_object_get (fixture->recorder, "aggregation-window", &aggregation_window,
+                NULL);
+  g_assert_cmpuint (aggregation_window, ==, 0u);
+
+  g_object_set (fixture->recorder, "aggregation-window", 60u * 1000u, NULL);
+
+  for (gint i = 0; i < 10; ++i)
+    emtr_event_recorder_record_events (fixture->recorder, MEANINGLESS_EVENT,
+                                       G_GINT64_CONSTANT (1) << 40,
+                                       g_variant_new ("u", i % 2));
+  emtr_event_recorder_flush_sync (fixture->recorder);
+
+  /* One aggregate event is sent per payload. */
+  guint counts[3];
+  count_received_records (MEANINGLESS_EVENT, counts);
+  g_assert_cmpuint (counts[1], ==, 2);
+  g_assert_cmpuint (get_event_stat (fixture->recorder, MEANINGLESS_EVENT,
+                                    "recorded"), ==, 10);
+  g_assert_cmpuint (get_event_stat (fixture->recorder, MEANINGLESS_EVENT,
+                                    "sent"), ==, 2);
+}
+
+static void
+test_event_recorder_record_many_keyed_sequences (struct RecorderFixture *fixture,
+                                                 gconstpointer           unused)
+{
+  /* Enough sequences to make the table grow, with keys of each kind. */
+  for (gint i = 0; i < 200; ++i)
+    {
+      gchar *string_key = g_strdup_printf ("window-%d", i);
+
+      emtr_event_recorder_record_start (fixture->recorder, MEANINGLESS_EVENT,
+                                        g_variant_new_int32 (i), NULL);
+      emtr_event_recorder_record_start (fixture->recorder, MEANINGLESS_EVENT,
+                                        g_variant_new_string (string_key),
+                                        NULL);
+      emtr_event_recorder_record_start (fixture->recorder, MEANINGLESS_EVENT,
+                                        g_variant_new ("(is)", i, string_key),
+                                        NULL);
+      g_free (string_key);
+    }
+
+  for (gint i = 0; i < 200; ++i)
+    {
+      gchar *string_key = g_strdup_printf ("window-%d", i);
+
+      emtr_event_recorder_record_progress (fixture->recorder, MEANINGLESS_EVENT,
+                                           g_variant_new ("(is)", i,
+                                                          string_key),
+                                           NULL);
+      emtr_event_recorder_record_stop (fixture->recorder, MEANINGLESS_EVENT,
+                                       g_variant_new_int32 (i), NULL);
+      emtr_event_recorder_record_stop (fixture->recorder, MEANINGLESS_EVENT,
+                                       g_variant_new_string (string_key), NULL);
+      emtr_event_recorder_record_stop (fixture->recorder, MEANINGLESS_EVENT,
+                                       g_variant_new ("(is)", i, string_key),
+                                       NULL);
+      g_free (string_key);
+    }
+
+  g_assert_cmpuint (get_stat (fixture->recorder, "sequences-in-progress"), ==,
+                    0);
+
+  emtr_event_recorder_flush_sync (fixture->recorder);
+
+  guint counts[3];
+  count_received_records (MEANINGLESS_EVENT, counts);
+  g_assert_cmpuint (counts[2], ==, 600);
+}
+
+static void
+test_event_recorder_record_stop_with_key_of_other_type (struct RecorderFixture *fixture,
+                                                        gconstpointer           unused)
+{
+  emtr_event_recorder_record_start (fixture->recorder, MEANINGLESS_EVENT,
+                                    g_variant_new_int32 (5), NULL);
+
+  g_test_expect_message (EOS_METRICS_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+                         "*no corresponding unstopped start event*");
+  emtr_event_recorder_record_stop (fixture->recorder, MEANINGLESS_EVENT,
+                                   g_variant_new_uint32 (5), NULL);
+  g_test_assert_expected_messages ();
+
+  emtr_event_recorder_record_stop (fixture->recorder, MEANINGLESS_EVENT,
+                                   g_variant_new_int32 (5), NULL);
+}
+
+static void
+test_event_recorder_record_event_with_handle (struct RecorderFixture *fixture,
+                                              gconstpointer           unused)
+{
+  g_autoptr(EmtrEventHandle) handle =
+    emtr_event_recorder_register_event (fixture->recorder, MEANINGLESS_EVENT);
+
+  g_assert_nonnull (handle);
+
+  emtr_event_recorder_record_event_with_handle (fixture->recorder, handle,
+                                                NULL);
+  emtr_event_recorder_record_event_with_handle_sync (fixture->recorder, handle,
+                                                     g_variant_new ("u", 3u));
+  emtr_event_recorder_record_events_with_handle (fixture->recorder, handle,
+                                                 G_GINT64_CONSTANT (5), NULL);
+  emtr_event_recorder_record_events_with_handle_sync (fixture->recorder,
+                                                      handle,
+                                                      G_GINT64_CONSTANT (9),
+                                                      NULL);
+  emtr_event_recorder_flush_sync (fixture->recorder);
+
+  guint counts[3];
+  count_received_records (MEANINGLESS_EVENT, counts);
+  g_assert_cmpuint (counts[0], ==, 2);
+  g_assert_cmpuint (counts[1], ==, 2);
+}
+
+static void
+test_event_recorder_register_invalid_event (struct RecorderFixture *fixture,
+                                            gconstpointer           unused)
+{
+  g_test_expect_message (EOS_METRICS_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+                         "*Attempt to parse UUID*");
+  g_assert_null (emtr_event_recorder_register_event (fixture->recorder,
+                                                     "not-a-uuid"));
+  g_test_assert_expected_messages ();
+}
+
+static void
+test_event_recorder_record_event_with_id (struct RecorderFixture *fixture,
+                                          gconstpointer           unused)
+{
+  uuid_t event_id;
+
+  g_assert_cmpint (uuid_parse (MEANINGLESS_EVENT, event_id), ==, 0);
+
+  emtr_event_recorder_record_event_with_id (fixture->recorder, event_id, NULL);
+  emtr_event_recorder_record_events_with_id (fixture->recorder, event_id,
+                                             G_GINT64_CONSTANT (2),
+                                             g_variant_new_string ("x"));
+  emtr_event_recorder_flush_sync (fixture->recorder);
+
+  guint counts[3];
+  count_received_records (MEANINGLESS_EVENT, counts);
+  g_assert_cmpuint (counts[0], ==, 1);
+  g_assert_cmpuint (counts[1], ==, 1);
+}
+
+static gpointer
+record_events_thread_func (gpointer user_data)
+{
+  EmtrEventRecorder *recorder = user_data;
+  guint64 key = GPOINTER_TO_SIZE (g_thread_self ());
+
+  for (gint i = 0; i < 100; ++i)
+    {
+      emtr_event_recorder_record_event (recorder, MEANINGLESS_EVENT,
+                                        g_variant_new ("i", i));
+      emtr_event_recorder_record_start (recorder, MEANINGLESS_EVENT,
+                                        g_variant_new ("t", key),
+                                        NULL);
+      emtr_event_recorder_record_stop (recorder, MEANINGLESS_EVENT,
+                                       g_variant_new ("t", key),
+                                       NULL);
+    }
+
+  return NULL;
+}
+
+static void
+test_event_recorder_record_event_from_threads (struct RecorderFixture *fixture,
+                                               gconstpointer           unused)
+{
+  GThread *threads[4];
+
+  for (gsize i = 0; i < G_N_ELEMENTS (threads); ++i)
+    threads[i] = g_thread_new ("recorder-test", record_events_thread_func,
+                               fixture->recorder);
+  for (gsize i = 0; i < G_N_ELEMENTS (threads); ++i)
+    g_thread_join (threads[i]);
+
+  emtr_event_recorder_flush_sync (fixture->recorder);
+
+  /* Each thread recorded 100 events and 100 sequences, each of which was
+     either received by the daemon or counted as dropped. */
+  guint counts[3];
+  guint64 num_dropped =
+    get_event_stat (fixture->recorder, MEANINGLESS_EVENT, "dropped");
+  count_received_records (MEANINGLESS_EVENT, counts);
+  g_assert_cmpuint (get_event_stat (fixture->recorder, MEANINGLESS_EVENT,
+                                    "recorded"), ==, 800);
+  g_assert_cmpuint (counts[0] + counts[2] + num_dropped, ==, 800);
+  g_assert_cmpuint (get_stat (fixture->recorder, "sequences-in-progress"), ==,
+                    0);
+}
+
 static void
 test_event_recorder_aggregate_start_stop_sync (struct RecorderFixture *fixture,
                                                gconstpointer           unused)
@@ -443,12 +829,118 @@ test_event_recorder_aggregate_start_stop_sync_with_payload (struct RecorderFixtu
   // Destroying the timer should call stop here
 }
 
+static void
+test_event_recorder_latency_histogram (struct RecorderFixture *fixture,
+                                       gconstpointer           unused)
+{
+  g_autoptr(EmtrLatencyHistogram) histogram = NULL;
+  g_autoptr(EmtrLatencyHistogram) reset_histogram = NULL;
+
+  emtr_event_recorder_record_event (fixture->recorder, MEANINGLESS_EVENT, NULL);
+  emtr_event_recorder_record_start (fixture->recorder, MEANINGLESS_EVENT, NULL,
+                                    NULL);
+  emtr_event_recorder_record_stop_sync (fixture->recorder, MEANINGLESS_EVENT,
+                                        NULL, NULL);
+
+  histogram =
+    emtr_event_recorder_get_latency_histogram (fixture->recorder,
+                                               EMTR_LATENCY_RECORD_CALL);
+  g_assert_cmpuint (emtr_latency_histogram_get_count (histogram), ==, 3);
+  g_assert_cmpint (emtr_latency_histogram_get_p50 (histogram), <=,
+                   emtr_latency_histogram_get_p99 (histogram));
+  g_assert_cmpint (emtr_latency_histogram_get_p99 (histogram), <=,
+                   emtr_latency_histogram_get_p999 (histogram));
+  g_assert_cmpint (emtr_latency_histogram_get_p999 (histogram), ==,
+                   emtr_latency_histogram_get_max (histogram));
+  g_assert_cmpint (emtr_latency_histogram_get_max (histogram), >, 0);
+
+  emtr_event_recorder_reset_latency_histograms (fixture->recorder);
+
+  reset_histogram =
+    emtr_event_recorder_get_latency_histogram (fixture->recorder,
+                                               EMTR_LATENCY_RECORD_CALL);
+  g_assert_cmpuint (emtr_latency_histogram_get_count (reset_histogram), ==, 0);
+  g_assert_cmpint (emtr_latency_histogram_get_p50 (reset_histogram), ==, 0);
+  /* Snapshots are not affected by resetting. */
+  g_assert_cmpuint (emtr_latency_histogram_get_count (histogram), ==, 3);
+}
+
+/* Returns @variant, which must be floating, with an extra reference held by
+   the test, so that whether the recorder released the floating reference can
+   be checked afterwards. */
+static GVariant *
+track_floating_variant (GVariant  *variant,
+                        GPtrArray *tracked)
+{
+  g_assert_true (g_variant_is_floating (variant));
+  g_ptr_array_add (tracked, g_variant_ref (variant));
+  return variant;
+}
+
+/* The recording functions consume floating arguments even while recording is
+   disabled and they return straight away. Had they leaked them, the variants
+   would still be floating here, and would never be freed. */
+static void
+test_event_recorder_disabled_consumes_floating_variants (void)
+{
+  g_autoptr(GPtrArray) tracked = g_ptr_array_new ();
+
+  write_testing_machine_id ();
+  g_setenv ("EOS_DISABLE_METRICS", "1", TRUE);
+  EmtrEventRecorder *recorder = emtr_event_recorder_new ();
+  g_unsetenv ("EOS_DISABLE_METRICS");
+
+  g_autoptr(EmtrEventHandle) handle =
+    emtr_event_recorder_register_event (recorder, MEANINGLESS_EVENT);
+
+  emtr_event_recorder_record_event (recorder, MEANINGLESS_EVENT,
+                                    track_floating_variant (g_variant_new ("u", 1u), tracked));
+  emtr_event_recorder_record_event_sync (recorder, MEANINGLESS_EVENT,
+                                         track_floating_variant (g_variant_new ("u", 2u), tracked));
+  emtr_event_recorder_record_events (recorder, MEANINGLESS_EVENT, 3,
+                                     track_floating_variant (g_variant_new ("u", 3u), tracked));
+  emtr_event_recorder_record_events_sync (recorder, MEANINGLESS_EVENT, 4,
+                                          track_floating_variant (g_variant_new ("u", 4u), tracked));
+  emtr_event_recorder_record_event_with_handle (recorder, handle,
+                                                track_floating_variant (g_variant_new ("u", 5u), tracked));
+  emtr_event_recorder_record_events_with_handle_sync (recorder, handle, 6,
+                                                      track_floating_variant (g_variant_new ("u", 6u), tracked));
+  emtr_event_recorder_record_start (recorder, MEANINGLESS_EVENT,
+                                    track_floating_variant (g_variant_new ("i", 7), tracked),
+                                    track_floating_variant (g_variant_new ("s", "start"), tracked));
+  emtr_event_recorder_record_progress (recorder, MEANINGLESS_EVENT,
+                                       track_floating_variant (g_variant_new ("i", 7), tracked),
+                                       track_floating_variant (g_variant_new ("s", "progress"), tracked));
+  emtr_event_recorder_record_stop (recorder, MEANINGLESS_EVENT,
+                                   track_floating_variant (g_variant_new ("i", 7), tracked),
+                                   track_floating_variant (g_variant_new ("s", "stop"), tracked));
+  emtr_event_recorder_record_stop_sync (recorder, MEANINGLESS_EVENT,
+                                        track_floating_variant (g_variant_new ("i", 8), tracked),
+                                        track_floating_variant (g_variant_new ("s", "stop-sync"), tracked));
+
+  for (guint i = 0; i < tracked->len; i++)
+    {
+      GVariant *variant = g_ptr_array_index (tracked, i);
+
+      g_assert_false (g_variant_is_floating (variant));
+      g_variant_unref (variant);
+    }
+
+  g_object_unref (recorder);
+}
+
 gint
 main (gint                argc,
       const gchar * const argv[])
 {
   g_test_init (&argc, (gchar ***) &argv, NULL);
 
+  /* Keep events spooled by the tests, and those left by others, out of the
+     counts. */
+  g_autofree gchar *cache_dir = g_dir_make_tmp ("eosmetrics-test-XXXXXX", NULL);
+  g_assert_nonnull (cache_dir);
+  g_setenv ("XDG_CACHE_HOME", cache_dir, TRUE);
+
 #define ADD_RECORDER_TEST_FUNC(path, func) \
   g_test_add ((path), struct RecorderFixture, NULL, setup, (func), teardown)
 
@@ -498,11 +990,34 @@ main (gint                argc,
                           test_event_recorder_record_multiple_metric_sequences);
   ADD_RECORDER_TEST_FUNC ("/event-recorder/record-auxiliary-payload-with-maybe-throws-critical",
                           test_event_recorder_record_auxiliary_payload_with_maybe_throws_critical);
+  ADD_RECORDER_TEST_FUNC ("/event-recorder/flush-sync",
+                          test_event_recorder_flush_sync);
+  ADD_RECORDER_TEST_FUNC ("/event-recorder/record-event-fills-batch",
+                          test_event_recorder_record_event_fills_batch);
+  ADD_RECORDER_TEST_FUNC ("/event-recorder/record-events-in-aggregation-window",
+                          test_event_recorder_record_events_in_aggregation_window);
+  ADD_RECORDER_TEST_FUNC ("/event-recorder/record-many-keyed-sequences",
+                          test_event_recorder_record_many_keyed_sequences);
+  ADD_RECORDER_TEST_FUNC ("/event-recorder/record-stop-with-key-of-other-type",
+                          test_event_recorder_record_stop_with_key_of_other_type);
+  ADD_RECORDER_TEST_FUNC ("/event-recorder/record-event-with-handle",
+                          test_event_recorder_record_event_with_handle);
+  ADD_RECORDER_TEST_FUNC ("/event-recorder/register-invalid-event",
+                          test_event_recorder_register_invalid_event);
+  ADD_RECORDER_TEST_FUNC ("/event-recorder/record-event-with-id",
+                          test_event_recorder_record_event_with_id);
+  ADD_RECORDER_TEST_FUNC ("/event-recorder/record-event-from-threads",
+                          test_event_recorder_record_event_from_threads);
   ADD_RECORDER_TEST_FUNC ("/event-recorder/aggregate/start-stop-sync",
                           test_event_recorder_aggregate_start_stop_sync);
   ADD_RECORDER_TEST_FUNC ("/event-recorder/aggregate/start-stop-sync-with-payload",
                           test_event_recorder_aggregate_start_stop_sync_with_payload);
 
+  ADD_RECORDER_TEST_FUNC ("/event-recorder/latency-histogram",
+                          test_event_recorder_latency_histogram);
+  g_test_add_func ("/event-recorder/disabled-consumes-floating-variants",
+                   test_event_recorder_disabled_consumes_floating_variants);
+
 #undef ADD_RECORDER_TEST_FUNC
 
   return g_test_run ();
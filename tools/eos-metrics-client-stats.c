@@ -0,0 +1,637 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC. */
+
+/* This file is part of eos-metrics.
+ *
+ * eos-metrics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * eos-metrics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with eos-metrics.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Lists the processes that export the statistics of their default event
+ * recorder under the com.endlessm.Metrics.ClientStats interface, which they
+ * do when started with EOS_METRICS_CLIENT_STATS=1, noisiest first. Processes
+ * belonging to other users can usually only be queried as root.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gio/gio.h>
+#include <glib.h>
+
+#define CLIENT_STATS_OBJECT_PATH "/com/endlessm/Metrics/ClientStats"
+#define CLIENT_STATS_INTERFACE "com.endlessm.Metrics.ClientStats"
+
+/* Processes that don't answer in time are left out */
+#define CALL_TIMEOUT_MS 1000
+
+typedef struct
+{
+  gchar *name; /* (owned): unique name on the bus */
+  guint32 pid;
+  gchar *command; /* (owned) */
+  GVariant *stats; /* (owned): a{sv} */
+
+  /* Events per second since the previous sample, in --watch mode */
+  gdouble recorded_rate;
+  gdouble dropped_rate;
+
+  /* Whether --profile turned profiling on, and should turn it off again */
+  gboolean started_profiling;
+} Client;
+
+static gboolean opt_dump = FALSE;
+static gboolean opt_events = FALSE;
+static gint opt_pid = 0;
+static gint opt_watch = 0;
+static gint opt_profile = 0;
+
+static GOptionEntry entries[] = {
+  { "dump", 'd', 0, G_OPTION_ARG_NONE, &opt_dump,
+    "Print all statistics of each process", NULL },
+  { "events", 'e', 0, G_OPTION_ARG_NONE, &opt_events,
+    "Print the last events recorded by each process", NULL },
+  { "pid", 'p', 0, G_OPTION_ARG_INT, &opt_pid,
+    "Only show the process with this ID", "PID" },
+  { "watch", 'w', 0, G_OPTION_ARG_INT, &opt_watch,
+    "Show event rates, refreshed every SECONDS", "SECONDS" },
+  { "profile", 0, 0, G_OPTION_ARG_INT, &opt_profile,
+    "Time the steps of recording events for SECONDS", "SECONDS" },
+  { NULL }
+};
+
+static void
+client_free (Client *client)
+{
+  g_free (client->name);
+  g_free (client->command);
+  g_variant_unref (client->stats);
+  g_free (client);
+}
+
+static guint64
+lookup_uint (GVariant    *stats,
+             const gchar *key)
+{
+  GVariant *value = g_variant_lookup_value (stats, key, NULL);
+  guint64 result = 0;
+
+  if (value == NULL)
+    return 0;
+
+  if (g_variant_is_of_type (value, G_VARIANT_TYPE_UINT64))
+    result = g_variant_get_uint64 (value);
+  else if (g_variant_is_of_type (value, G_VARIANT_TYPE_UINT32))
+    result = g_variant_get_uint32 (value);
+
+  g_variant_unref (value);
+  return result;
+}
+
+/* Returns the 99th percentile of the latencies of @kind, in nanoseconds */
+static guint64
+lookup_p99 (GVariant    *stats,
+            const gchar *kind)
+{
+  GVariant *latencies =
+    g_variant_lookup_value (stats, "latencies", G_VARIANT_TYPE ("a{s(ttttt)}"));
+  guint64 count = 0, p50 = 0, p99 = 0, p999 = 0, max = 0;
+
+  if (latencies == NULL)
+    return 0;
+
+  g_variant_lookup (latencies, kind, "(ttttt)", &count, &p50, &p99, &p999,
+                    &max);
+  g_variant_unref (latencies);
+  return p99;
+}
+
+static gchar *
+get_command (guint32 pid)
+{
+  gchar *path = g_strdup_printf ("/proc/%u/comm", pid);
+  gchar *command = NULL;
+
+  if (g_file_get_contents (path, &command, NULL, NULL))
+    g_strchomp (command);
+  else
+    command = g_strdup ("?");
+
+  g_free (path);
+  return command;
+}
+
+static GVariant *
+call_bus (GDBusConnection    *connection,
+          const gchar        *method,
+          GVariant           *parameters,
+          const GVariantType *reply_type,
+          GError            **error)
+{
+  return g_dbus_connection_call_sync (connection, "org.freedesktop.DBus",
+                                      "/org/freedesktop/DBus",
+                                      "org.freedesktop.DBus", method,
+                                      parameters, reply_type,
+                                      G_DBUS_CALL_FLAGS_NONE, -1, NULL, error);
+}
+
+/* Returns the client exporting statistics as @name, or NULL */
+static Client *
+query_client (GDBusConnection *connection,
+              const gchar     *name)
+{
+  GVariant *reply = call_bus (connection, "GetConnectionUnixProcessID",
+                              g_variant_new ("(s)", name),
+                              G_VARIANT_TYPE ("(u)"), NULL);
+  guint32 pid;
+
+  if (reply == NULL)
+    return NULL;
+
+  g_variant_get (reply, "(u)", &pid);
+  g_variant_unref (reply);
+
+  if (opt_pid > 0 && pid != (guint32) opt_pid)
+    return NULL;
+
+  reply = g_dbus_connection_call_sync (connection, name,
+                                       CLIENT_STATS_OBJECT_PATH,
+                                       CLIENT_STATS_INTERFACE, "GetStats",
+                                       NULL, G_VARIANT_TYPE ("(a{sv})"),
+                                       G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                       CALL_TIMEOUT_MS, NULL, NULL);
+  if (reply == NULL)
+    return NULL;
+
+  Client *client = g_new0 (Client, 1);
+  client->name = g_strdup (name);
+  client->pid = pid;
+  g_variant_get (reply, "(@a{sv})", &client->stats);
+  g_variant_unref (reply);
+
+  gchar *program_name = NULL;
+  if (g_variant_lookup (client->stats, "program-name", "s", &program_name))
+    client->command = program_name;
+  else
+    client->command = get_command (pid);
+
+  return client;
+}
+
+static GPtrArray *
+list_clients (GDBusConnection *connection,
+              GError         **error)
+{
+  GVariant *reply = call_bus (connection, "ListNames", NULL,
+                              G_VARIANT_TYPE ("(as)"), error);
+  if (reply == NULL)
+    return NULL;
+
+  const gchar *own_name = g_dbus_connection_get_unique_name (connection);
+  GPtrArray *clients = g_ptr_array_new_with_free_func ((GDestroyNotify) client_free);
+  GVariantIter *names;
+  const gchar *name;
+
+  g_variant_get (reply, "(as)", &names);
+  while (g_variant_iter_next (names, "&s", &name))
+    {
+      if (name[0] != ':' || g_strcmp0 (name, own_name) == 0)
+        continue;
+
+      Client *client = query_client (connection, name);
+      if (client != NULL)
+        g_ptr_array_add (clients, client);
+    }
+
+  g_variant_iter_free (names);
+  g_variant_unref (reply);
+  return clients;
+}
+
+static gint
+compare_clients (gconstpointer a,
+                 gconstpointer b)
+{
+  const Client *client_a = *(const Client **) a;
+  const Client *client_b = *(const Client **) b;
+
+  if (opt_watch > 0 && client_a->recorded_rate != client_b->recorded_rate)
+    return client_a->recorded_rate < client_b->recorded_rate ? 1 : -1;
+
+  guint64 recorded_a = lookup_uint (client_a->stats, "events-recorded");
+  guint64 recorded_b = lookup_uint (client_b->stats, "events-recorded");
+
+  if (recorded_a != recorded_b)
+    return recorded_a < recorded_b ? 1 : -1;
+
+  return (client_a->pid > client_b->pid) - (client_a->pid < client_b->pid);
+}
+
+/* Fills in the rates of @clients from @previous, sampled @elapsed_us ago */
+static void
+compute_rates (GPtrArray  *clients,
+               GHashTable *previous,
+               gint64      elapsed_us)
+{
+  for (guint i = 0; i < clients->len; i++)
+    {
+      Client *client = g_ptr_array_index (clients, i);
+      Client *before = g_hash_table_lookup (previous, client->name);
+
+      if (before == NULL || elapsed_us <= 0)
+        continue;
+
+      gdouble seconds = elapsed_us / (gdouble) G_USEC_PER_SEC;
+      client->recorded_rate =
+        (lookup_uint (client->stats, "events-recorded") -
+         lookup_uint (before->stats, "events-recorded")) / seconds;
+      client->dropped_rate =
+        (lookup_uint (client->stats, "events-dropped") -
+         lookup_uint (before->stats, "events-dropped")) / seconds;
+    }
+}
+
+static void
+print_table (GPtrArray *clients)
+{
+  if (opt_watch > 0)
+    g_print ("%7s %-16s %10s %10s %8s %9s %12s\n", "PID", "COMMAND",
+             "RECORDED/s", "DROPPED/s", "QUEUED", "IN-FLIGHT", "CALL-P99-us");
+  else
+    g_print ("%7s %-16s %10s %10s %10s %8s %8s %9s %12s\n", "PID", "COMMAND",
+             "RECORDED", "SENT", "DROPPED", "FAILED", "QUEUED", "IN-FLIGHT",
+             "CALL-P99-us");
+
+  for (guint i = 0; i < clients->len; i++)
+    {
+      Client *client = g_ptr_array_index (clients, i);
+      GVariant *stats = client->stats;
+      guint64 queued = lookup_uint (stats, "records-pending") +
+        lookup_uint (stats, "records-in-rings") +
+        lookup_uint (stats, "records-queued");
+      guint64 call_p99_us = lookup_p99 (stats, "record-call") / 1000;
+
+      if (opt_watch > 0)
+        g_print ("%7u %-16.16s %10.1f %10.1f %8" G_GUINT64_FORMAT " %9"
+                 G_GUINT64_FORMAT " %12" G_GUINT64_FORMAT "\n",
+                 client->pid, client->command, client->recorded_rate,
+                 client->dropped_rate, queued,
+                 lookup_uint (stats, "calls-in-flight"), call_p99_us);
+      else
+        g_print ("%7u %-16.16s %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT
+                 " %10" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT " %8"
+                 G_GUINT64_FORMAT " %9" G_GUINT64_FORMAT " %12"
+                 G_GUINT64_FORMAT "\n",
+                 client->pid, client->command,
+                 lookup_uint (stats, "events-recorded"),
+                 lookup_uint (stats, "events-sent"),
+                 lookup_uint (stats, "events-dropped"),
+                 lookup_uint (stats, "events-failed"), queued,
+                 lookup_uint (stats, "calls-in-flight"), call_p99_us);
+    }
+}
+
+static void
+print_dump (GPtrArray *clients)
+{
+  for (guint i = 0; i < clients->len; i++)
+    {
+      Client *client = g_ptr_array_index (clients, i);
+      GVariantIter iter;
+      const gchar *key;
+      GVariant *value;
+
+      g_print ("%s%s (pid %u, %s)\n", i > 0 ? "\n" : "", client->command,
+               client->pid, client->name);
+
+      g_variant_iter_init (&iter, client->stats);
+      while (g_variant_iter_next (&iter, "{&sv}", &key, &value))
+        {
+          gchar *printed = g_variant_print (value, FALSE);
+          g_print ("  %s: %s\n", key, printed);
+          g_free (printed);
+          g_variant_unref (value);
+        }
+    }
+}
+
+static void
+print_events (GDBusConnection *connection,
+              GPtrArray       *clients)
+{
+  for (guint i = 0; i < clients->len; i++)
+    {
+      Client *client = g_ptr_array_index (clients, i);
+      GError *error = NULL;
+
+      g_print ("%s%s (pid %u, %s)\n", i > 0 ? "\n" : "", client->command,
+               client->pid, client->name);
+
+      GVariant *reply =
+        g_dbus_connection_call_sync (connection, client->name,
+                                     CLIENT_STATS_OBJECT_PATH,
+                                     CLIENT_STATS_INTERFACE, "GetRecentEvents",
+                                     NULL, G_VARIANT_TYPE ("(a(sxssuu))"),
+                                     G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                     CALL_TIMEOUT_MS, NULL, &error);
+      if (reply == NULL)
+        {
+          g_print ("  %s\n", error->message);
+          g_error_free (error);
+          continue;
+        }
+
+      GVariantIter *events;
+      const gchar *event_id, *kind, *outcome;
+      gint64 relative_time;
+      guint32 payload_size, payload_hash;
+
+      g_variant_get (reply, "(a(sxssuu))", &events);
+      while (g_variant_iter_next (events, "(&sx&s&suu)", &event_id,
+                                  &relative_time, &kind, &outcome,
+                                  &payload_size, &payload_hash))
+        g_print ("  %" G_GINT64_FORMAT " %s %-9s %-8s %6u bytes %08x\n",
+                 relative_time, event_id, kind, outcome, payload_size,
+                 payload_hash);
+
+      g_variant_iter_free (events);
+      g_variant_unref (reply);
+    }
+}
+
+static gboolean
+set_profiling (GDBusConnection *connection,
+               Client          *client,
+               gboolean         enabled)
+{
+  GError *error = NULL;
+  GVariant *reply =
+    g_dbus_connection_call_sync (connection, client->name,
+                                 CLIENT_STATS_OBJECT_PATH,
+                                 CLIENT_STATS_INTERFACE, "SetProfiling",
+                                 g_variant_new ("(b)", enabled), NULL,
+                                 G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                 CALL_TIMEOUT_MS, NULL, &error);
+  if (reply == NULL)
+    {
+      g_printerr ("Unable to set profiling of %s (pid %u): %s\n",
+                  client->command, client->pid, error->message);
+      g_error_free (error);
+      return FALSE;
+    }
+
+  g_variant_unref (reply);
+  return TRUE;
+}
+
+/* Prints the time spent in each phase between @before and @after, both of
+   type a{s(tt)} */
+static void
+print_phase_times (GVariant    *before,
+                   GVariant    *after,
+                   const gchar *indent)
+{
+  GVariantIter iter;
+  const gchar *phase;
+  guint64 calls, ns;
+
+  g_variant_iter_init (&iter, after);
+  while (g_variant_iter_next (&iter, "{&s(tt)}", &phase, &calls, &ns))
+    {
+      guint64 calls_before = 0, ns_before = 0;
+
+      if (before != NULL)
+        g_variant_lookup (before, phase, "(tt)", &calls_before, &ns_before);
+
+      calls -= calls_before;
+      ns -= ns_before;
+      if (calls == 0)
+        continue;
+
+      g_print ("%s%-16s %10" G_GUINT64_FORMAT " calls %12.3f ms "
+               "%10.1f ns/call\n", indent, phase, calls, ns / 1e6,
+               ns / (gdouble) calls);
+    }
+}
+
+/* Prints what each of @clients spent its time on since @before was sampled */
+static void
+print_profiles (GPtrArray *clients,
+                GPtrArray *before)
+{
+  for (guint i = 0; i < clients->len; i++)
+    {
+      Client *client = g_ptr_array_index (clients, i);
+      Client *client_before = NULL;
+
+      for (guint j = 0; j < before->len && client_before == NULL; j++)
+        {
+          Client *candidate = g_ptr_array_index (before, j);
+          if (g_strcmp0 (candidate->name, client->name) == 0)
+            client_before = candidate;
+        }
+
+      if (client_before == NULL)
+        continue;
+
+      GVariant *phases = g_variant_lookup_value (client->stats, "phases",
+                                                 G_VARIANT_TYPE ("a{s(tt)}"));
+      GVariant *phases_before =
+        g_variant_lookup_value (client_before->stats, "phases",
+                                G_VARIANT_TYPE ("a{s(tt)}"));
+      GVariant *by_event =
+        g_variant_lookup_value (client->stats, "phases-by-event",
+                                G_VARIANT_TYPE ("a{sa{s(tt)}}"));
+      GVariant *by_event_before =
+        g_variant_lookup_value (client_before->stats, "phases-by-event",
+                                G_VARIANT_TYPE ("a{sa{s(tt)}}"));
+
+      g_print ("%s%s (pid %u, %s)\n", i > 0 ? "\n" : "", client->command,
+               client->pid, client->name);
+
+      if (phases != NULL)
+        print_phase_times (phases_before, phases, "  ");
+      else
+        g_print ("  Profiling is not supported.\n");
+
+      if (by_event != NULL)
+        {
+          GVariantIter iter;
+          const gchar *event_id;
+          GVariant *event_phases;
+
+          g_variant_iter_init (&iter, by_event);
+          while (g_variant_iter_next (&iter, "{&s@a{s(tt)}}", &event_id,
+                                      &event_phases))
+            {
+              GVariant *event_phases_before = NULL;
+
+              if (by_event_before != NULL)
+                event_phases_before =
+                  g_variant_lookup_value (by_event_before, event_id,
+                                          G_VARIANT_TYPE ("a{s(tt)}"));
+
+              g_print ("  %s\n", event_id);
+              print_phase_times (event_phases_before, event_phases, "    ");
+
+              g_clear_pointer (&event_phases_before, g_variant_unref);
+              g_variant_unref (event_phases);
+            }
+        }
+
+      g_clear_pointer (&phases, g_variant_unref);
+      g_clear_pointer (&phases_before, g_variant_unref);
+      g_clear_pointer (&by_event, g_variant_unref);
+      g_clear_pointer (&by_event_before, g_variant_unref);
+    }
+}
+
+/*
+ * Turns profiling on in @clients for --profile seconds, unless it already was,
+ * and prints what they spent their time on meanwhile.
+ */
+static gboolean
+profile_clients (GDBusConnection *connection,
+                 GPtrArray       *clients,
+                 GError         **error)
+{
+  for (guint i = 0; i < clients->len; i++)
+    {
+      Client *client = g_ptr_array_index (clients, i);
+      gboolean profiling = FALSE;
+
+      g_variant_lookup (client->stats, "profiling", "b", &profiling);
+      if (!profiling)
+        client->started_profiling = set_profiling (connection, client, TRUE);
+    }
+
+  g_usleep (opt_profile * G_USEC_PER_SEC);
+
+  GPtrArray *after = list_clients (connection, error);
+
+  for (guint i = 0; i < clients->len; i++)
+    {
+      Client *client = g_ptr_array_index (clients, i);
+
+      if (client->started_profiling)
+        set_profiling (connection, client, FALSE);
+    }
+
+  if (after == NULL)
+    return FALSE;
+
+  g_ptr_array_sort (after, compare_clients);
+  print_profiles (after, clients);
+  g_ptr_array_unref (after);
+  return TRUE;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  GOptionContext *context =
+    g_option_context_new ("- list the processes recording the most metrics");
+  GError *error = NULL;
+
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+  g_option_context_free (context);
+
+  GDBusConnection *connection = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL,
+                                                &error);
+  if (connection == NULL)
+    {
+      g_printerr ("Unable to connect to the system bus: %s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  if (opt_profile > 0)
+    {
+      GPtrArray *clients = list_clients (connection, &error);
+
+      if (clients == NULL || !profile_clients (connection, clients, &error))
+        {
+          g_printerr ("Unable to list the processes on the system bus: %s\n",
+                      error->message);
+          return EXIT_FAILURE;
+        }
+
+      g_ptr_array_unref (clients);
+      g_object_unref (connection);
+      return EXIT_SUCCESS;
+    }
+
+  GHashTable *previous = NULL;
+  GPtrArray *previous_clients = NULL;
+  gint64 previous_time = 0;
+
+  do
+    {
+      GPtrArray *clients = list_clients (connection, &error);
+      gint64 now = g_get_monotonic_time ();
+
+      if (clients == NULL)
+        {
+          g_printerr ("Unable to list the processes on the system bus: %s\n",
+                      error->message);
+          return EXIT_FAILURE;
+        }
+
+      if (previous != NULL)
+        {
+          compute_rates (clients, previous, now - previous_time);
+          g_hash_table_unref (previous);
+          g_ptr_array_unref (previous_clients);
+        }
+
+      g_ptr_array_sort (clients, compare_clients);
+
+      if (opt_events)
+        print_events (connection, clients);
+      else if (opt_dump)
+        print_dump (clients);
+      else
+        print_table (clients);
+
+      if (opt_watch <= 0)
+        {
+          g_ptr_array_unref (clients);
+          break;
+        }
+
+      previous = g_hash_table_new (g_str_hash, g_str_equal);
+      for (guint i = 0; i < clients->len; i++)
+        {
+          Client *client = g_ptr_array_index (clients, i);
+          g_hash_table_insert (previous, client->name, client);
+        }
+      previous_clients = clients;
+      previous_time = now;
+
+      g_usleep (opt_watch * G_USEC_PER_SEC);
+      g_print ("\n");
+    }
+  while (TRUE);
+
+  g_object_unref (connection);
+  return EXIT_SUCCESS;
+}